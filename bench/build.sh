@@ -0,0 +1,69 @@
+#!/bin/bash
+#
+# Builds nginx with ngx_php into build/ for run.sh, and writes
+# build/micro.mk with what the micro benchmarks link with: the objects
+# of that build, nginx.o with its main() renamed, and its flags.
+#
+#   NGINX_VERSION=1.24.0 PHP_CONFIG=/usr/bin/php-config ./build.sh
+
+set -e
+
+NGINX_VERSION=${NGINX_VERSION:-1.24.0}
+DIR=$(cd "$(dirname "$0")" && pwd)
+ROOT=$(dirname "$DIR")
+BUILD=$DIR/build
+SRC=$BUILD/nginx-$NGINX_VERSION
+
+export PHP_CONFIG=${PHP_CONFIG:-$(which php-config)}
+export PHP_LIB=${PHP_LIB:-$($PHP_CONFIG --prefix)/lib}
+
+mkdir -p "$BUILD"
+
+if [ ! -d "$SRC" ]; then
+    curl -sL "https://nginx.org/download/nginx-$NGINX_VERSION.tar.gz" | tar -xz -C "$BUILD"
+fi
+
+cd "$SRC"
+
+if [ ! -f objs/Makefile ] || [ "$ROOT/config" -nt objs/Makefile ]; then
+    ./configure --with-ld-opt="-Wl,-rpath,$PHP_LIB" \
+                --add-module="$ROOT/third_party/ngx_devel_kit" \
+                --add-module="$ROOT"
+fi
+
+make -j"$(nproc)"
+
+objcopy --redefine-sym main=ngx_bench_nginx_main objs/src/core/nginx.o \
+        "$BUILD/nginx_nomain.o"
+
+# relative paths of objs/Makefile are from the nginx source directory
+
+{
+    echo "NGX_SRC = $SRC"
+
+    echo "NGX_CFLAGS = $(sed -n 's/^CFLAGS = //p' objs/Makefile)"
+
+    echo "NGX_INCS = $(awk -v src="$SRC" '
+        /^ALL_INCS = / { on = 1; sub(/^ALL_INCS = /, "") }
+        on {
+            c = sub(/\\$/, "")
+            for (i = 1; i <= NF; i++)
+                printf "%s ", ($i ~ /^[-\/]/) ? $i : src "/" $i
+            if (!c) exit
+        }' objs/Makefile)"
+
+    echo "NGX_OBJS = $(find objs -name '*.o' ! -path objs/src/core/nginx.o \
+                       | sed "s|^|$SRC/|" | tr '\n' ' ')"
+
+    echo "NGX_LIBS = $(awk '
+        /\$\(LINK\) -o objs\/nginx/ { on = 1; next }
+        on {
+            if ($0 ~ /^[ \t]*$/) exit
+            sub(/\\$/, "")
+            for (i = 1; i <= NF; i++)
+                if ($i !~ /^objs\//) printf "%s ", $i
+        }' objs/Makefile)"
+
+} > "$BUILD/micro.mk"
+
+echo "nginx: $SRC/objs/nginx"
@@ -0,0 +1,44 @@
+#!/bin/bash
+#
+# Compares a run.sh result with the saved baseline, and fails when a
+# scenario lost more than THRESHOLD percent of its req/s or its p99 grew
+# by more than that.
+#
+#   THRESHOLD=5 ./compare.sh [baseline.tsv] [results/latest.tsv]
+
+DIR=$(cd "$(dirname "$0")" && pwd)
+BASELINE=${1:-$DIR/baseline.tsv}
+RESULT=${2:-$DIR/results/latest.tsv}
+THRESHOLD=${THRESHOLD:-5}
+
+if [ ! -f "$BASELINE" ]; then
+    echo "no baseline, save one with make baseline" >&2
+    exit 1
+fi
+
+awk -F '\t' -v t="$THRESHOLD" '
+    /^#/ { next }
+
+    NR == FNR { rps[$1] = $2; p99[$1] = $4; next }
+
+    function delta(old, new) {
+        return (old + 0 > 0 && new != "-") ? (new - old) * 100 / old : 0
+    }
+
+    BEGIN {
+        printf "%-12s %12s %12s %8s %10s %10s %8s\n", 
+               "scenario", "base req/s", "req/s", "", "base p99", "p99", ""
+    }
+
+    $1 in rps {
+        dr = delta(rps[$1], $2)
+        dp = delta(p99[$1], $4)
+        bad = (dr < -t || dp > t)
+        fail = fail || bad
+
+        printf "%-12s %12s %12s %+7.1f%% %10s %10s %+7.1f%%%s\n", 
+               $1, rps[$1], $2, dr, p99[$1], $4, dp, bad ? "  regression" : ""
+    }
+
+    END { exit fail }
+' "$BASELINE" "$RESULT"
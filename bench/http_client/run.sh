@@ -0,0 +1,28 @@
+#!/bin/bash
+#
+# Compare ngx_http_request() with the hand written socket version and
+# proxy_pass against a local backend.
+#
+#   NGINX=/path/to/nginx ./run.sh [duration]
+#
+# nginx must be built with ngx_php, wrk must be in PATH.
+
+NGINX=${NGINX:-nginx}
+DURATION=${1:-10s}
+DIR=$(cd "$(dirname "$0")" && pwd)
+PREFIX=$(mktemp -d)
+
+mkdir -p "$PREFIX/logs" "$PREFIX/html" "$PREFIX/conf"
+cp "$DIR/nginx.conf" "$PREFIX/conf/nginx.conf"
+head -c 1048576 /dev/urandom > "$PREFIX/html/large.bin"
+
+"$NGINX" -p "$PREFIX" -c conf/nginx.conf &
+PID=$!
+trap 'kill $PID; rm -rf "$PREFIX"' EXIT
+sleep 1
+
+for uri in /proxy /socket /http_request /http_request_large; do
+    echo "== $uri"
+    wrk -t2 -c64 -d"$DURATION" --latency "http://127.0.0.1:8080$uri" \
+        | grep -E "Requests/sec|50%|99%|Non-2xx|errors"
+done
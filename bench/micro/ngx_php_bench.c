@@ -0,0 +1,274 @@
+/*
+==============================================================================
+Copyright (c) 2016-2020, rryqszq4 <rryqszq@gmail.com>
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+
+* Redistributions of source code must retain the above copyright notice, this
+  list of conditions and the following disclaimer.
+
+* Redistributions in binary form must reproduce the above copyright notice,
+  this list of conditions and the following disclaimer in the documentation
+  and/or other materials provided with the distribution.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+==============================================================================
+*/
+
+/*
+ * Micro benchmarks of ngx_php's hot paths without an nginx running,
+ * linked with the objects of the nginx build of build.sh:
+ *
+ *   build/ngx_php_bench [iterations] [name]
+ */
+
+#include "ngx_http_php_module.h"
+#include "ngx_http_php_zend_uthread.h"
+#include "php/impl/php_ngx.h"
+
+typedef struct {
+    char            *name;
+    void           (*run)(ngx_uint_t n);
+} ngx_php_bench_t;
+
+static void ngx_php_bench_ub_write(ngx_uint_t n);
+static void ngx_php_bench_query(ngx_uint_t n);
+static void ngx_php_bench_resume(ngx_uint_t n);
+static ngx_http_request_t *ngx_php_bench_request(ngx_pool_t *pool);
+static uint64_t ngx_php_bench_now(void);
+
+static ngx_log_t        ngx_php_bench_log;
+static ngx_open_file_t  ngx_php_bench_log_file;
+
+static ngx_php_bench_t  ngx_php_benches[] = {
+    { "ub_write", ngx_php_bench_ub_write },
+    { "query_args", ngx_php_bench_query },
+    { "generator_resume", ngx_php_bench_resume },
+    { NULL, NULL }
+};
+
+int
+main(int argc, char *const *argv)
+{
+    ngx_php_bench_t     *b;
+    ngx_int_t           n;
+    uint64_t            start, ns;
+
+    n = 1000000;
+
+    if (argc > 1) {
+        n = ngx_atoi((u_char *) argv[1], ngx_strlen(argv[1]));
+        if (n <= 0) {
+            fprintf(stderr, "invalid iterations \"%s\"\n", argv[1]);
+            return 1;
+        }
+    }
+
+    ngx_php_bench_log_file.fd = ngx_stderr;
+    ngx_php_bench_log.file = &ngx_php_bench_log_file;
+    ngx_php_bench_log.log_level = NGX_LOG_NOTICE;
+
+    ngx_pagesize = getpagesize();
+    ngx_cacheline_size = NGX_CPU_CACHE_LINE;
+
+    ngx_time_init();
+
+    /* no configuration was read */
+    ngx_http_php_module.ctx_index = 0;
+
+    if (php_ngx_module_init() == FAILURE || php_ngx_request_init() == FAILURE) {
+        fprintf(stderr, "php startup failed\n");
+        return 1;
+    }
+
+    for (b = ngx_php_benches; b->name; b++) {
+
+        if (argc > 2 && ngx_strcmp(argv[2], b->name) != 0) {
+            continue;
+        }
+
+        start = ngx_php_bench_now();
+
+        b->run((ngx_uint_t) n);
+
+        ns = ngx_php_bench_now() - start;
+
+        printf("%-20s %12ld ops %10.1f ns/op\n", b->name, (long) n, 
+               (double) ns / n);
+    }
+
+    php_ngx_request_shutdown();
+    php_ngx_module_shutdown();
+
+    return 0;
+}
+
+/* echo of 12 bytes, in requests of 1024 of them */
+static void
+ngx_php_bench_ub_write(ngx_uint_t n)
+{
+    ngx_pool_t  *pool;
+    ngx_uint_t  i;
+
+    pool = NULL;
+
+    for (i = 0; i < n; i++) {
+
+        if (i % 1024 == 0) {
+            if (pool) {
+                ngx_destroy_pool(pool);
+            }
+
+            pool = ngx_create_pool(NGX_DEFAULT_POOL_SIZE, &ngx_php_bench_log);
+            if (pool == NULL) {
+                exit(1);
+            }
+
+            ngx_php_request = ngx_php_bench_request(pool);
+        }
+
+        (void) ngx_http_php_code_ub_write("hello world\n", 
+                                          sizeof("hello world\n") - 1);
+    }
+
+    if (pool) {
+        ngx_destroy_pool(pool);
+    }
+
+    ngx_php_request = NULL;
+}
+
+/* ngx_query_args() with the 20 arguments of run.sh, 1024 per request */
+static void
+ngx_php_bench_query(ngx_uint_t n)
+{
+    static u_char  query[] = "a1=1&a2=2&a3=3&a4=4&a5=5&a6=6&a7=7&a8=8&a9=9&a10=10"
+                             "&a11=11&a12=12&a13=13&a14=14&a15=15&a16=16&a17=17"
+                             "&a18=18&a19=19&a20=20";
+    ngx_pool_t     *pool;
+    zval           func, retval;
+    ngx_uint_t     i;
+
+    pool = NULL;
+
+    ZVAL_STRING(&func, "ngx_query_args");
+
+    for (i = 0; i < n; i++) {
+
+        if (i % 1024 == 0) {
+            if (pool) {
+                ngx_destroy_pool(pool);
+            }
+
+            pool = ngx_create_pool(NGX_DEFAULT_POOL_SIZE, &ngx_php_bench_log);
+            if (pool == NULL) {
+                exit(1);
+            }
+
+            ngx_php_request = ngx_php_bench_request(pool);
+
+            ngx_php_request->args.data = query;
+            ngx_php_request->args.len = sizeof(query) - 1;
+        }
+
+        call_user_function(EG(function_table), NULL, &func, &retval, 0, NULL);
+        zval_ptr_dtor(&retval);
+    }
+
+    zval_ptr_dtor(&func);
+
+    if (pool) {
+        ngx_destroy_pool(pool);
+    }
+
+    ngx_php_request = NULL;
+}
+
+/* next() and valid(), as ngx_http_php_zend_uthread_resume() */
+static void
+ngx_php_bench_resume(ngx_uint_t n)
+{
+    zval        generator, func_next, func_valid, retval;
+    ngx_uint_t  i;
+
+    zend_eval_string("function ngx_php_bench_generator() { while (true) { yield 1; } }", 
+                     NULL, "ngx_php bench");
+
+    ZVAL_UNDEF(&generator);
+    zend_eval_string("ngx_php_bench_generator()", &generator, "ngx_php bench");
+
+    if (Z_TYPE(generator) != IS_OBJECT) {
+        fprintf(stderr, "no generator\n");
+        exit(1);
+    }
+
+    ZVAL_STRING(&func_next, "next");
+    ZVAL_STRING(&func_valid, "valid");
+
+    for (i = 0; i < n; i++) {
+        ngx_http_php_call_user_function(NULL, &generator, &func_next, &retval, 0, NULL);
+        zval_ptr_dtor(&retval);
+
+        ngx_http_php_call_user_function(NULL, &generator, &func_valid, &retval, 0, NULL);
+        zval_ptr_dtor(&retval);
+    }
+
+    zval_ptr_dtor(&func_next);
+    zval_ptr_dtor(&func_valid);
+    zval_ptr_dtor(&generator);
+}
+
+/* what ub_write and ngx_query_args() use of a request */
+static ngx_http_request_t *
+ngx_php_bench_request(ngx_pool_t *pool)
+{
+    ngx_http_request_t  *r;
+    ngx_connection_t    *c;
+    ngx_http_php_ctx_t  *ctx;
+
+    r = ngx_pcalloc(pool, sizeof(ngx_http_request_t));
+    c = ngx_pcalloc(pool, sizeof(ngx_connection_t));
+    ctx = ngx_pcalloc(pool, sizeof(ngx_http_php_ctx_t));
+
+    if (r == NULL || c == NULL || ctx == NULL) {
+        exit(1);
+    }
+
+    r->ctx = ngx_pcalloc(pool, sizeof(void *));
+    if (r->ctx == NULL) {
+        exit(1);
+    }
+
+    c->log = &ngx_php_bench_log;
+
+    r->main = r;
+    r->pool = pool;
+    r->connection = c;
+    r->headers_out.content_length_n = -1;
+
+    ctx->output_type = OUTPUT_CONTENT;
+    ngx_http_set_ctx(r, ctx, ngx_http_php_module);
+
+    return r;
+}
+
+static uint64_t
+ngx_php_bench_now(void)
+{
+    struct timespec  ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    return (uint64_t) ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
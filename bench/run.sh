@@ -0,0 +1,100 @@
+#!/bin/bash
+#
+# Runs the scenarios of nginx.conf, the socket ones against stub/stub.py,
+# and writes a line per scenario to results/<time>.tsv and
+# results/latest.tsv: req/s, p50 and p99 in ms, and the growth of the
+# worker's RSS in KB per 1M requests.
+#
+#   ./run.sh [duration]
+#
+#   NGINX        the nginx of build.sh by default
+#   CLIENT       wrk (default) or h2load, which has no percentiles
+#   CONNECTIONS  64
+#   SCENARIOS    hello echo_large json args sleep redis mysql
+
+DIR=$(cd "$(dirname "$0")" && pwd)
+DURATION=${1:-30s}
+NGINX=${NGINX:-$(ls "$DIR"/build/nginx-*/objs/nginx 2>/dev/null | tail -1)}
+CLIENT=${CLIENT:-wrk}
+CONNECTIONS=${CONNECTIONS:-64}
+SCENARIOS=${SCENARIOS:-hello echo_large json args sleep redis mysql}
+PREFIX=$(mktemp -d)
+ARGS="a1=1&a2=2&a3=3&a4=4&a5=5&a6=6&a7=7&a8=8&a9=9&a10=10&a11=11&a12=12&a13=13&a14=14&a15=15&a16=16&a17=17&a18=18&a19=19&a20=20"
+
+if [ ! -x "$NGINX" ]; then
+    echo "no nginx, run build.sh or set NGINX" >&2
+    exit 1
+fi
+
+mkdir -p "$PREFIX/logs" "$PREFIX/conf" "$DIR/results"
+cp "$DIR/nginx.conf" "$PREFIX/conf/nginx.conf"
+
+python3 "$DIR/stub/stub.py" 6380 3307 &
+STUB=$!
+
+"$NGINX" -p "$PREFIX" -c conf/nginx.conf &
+PID=$!
+
+trap 'kill $PID $STUB; rm -rf "$PREFIX"' EXIT
+sleep 1
+
+WORKER=$(pgrep -P $PID | head -1)
+
+rss() {
+    awk '/^VmRSS/ { print $2 }' "/proc/$WORKER/status"
+}
+
+# wrk prints 812.00us, 1.20ms or 1.02s
+ms() {
+    awk '{ v = $1 + 0
+           if ($1 ~ /us$/) v /= 1000; else if ($1 ~ /[0-9]s$/ && $1 !~ /ms$/) v *= 1000
+           printf "%.3f", v }' <<< "$1"
+}
+
+load() {
+    if [ "$CLIENT" = h2load ]; then
+        h2load --h1 -t2 -c"$CONNECTIONS" -D"${2%s}" "$1"
+    else
+        wrk -t2 -c"$CONNECTIONS" -d"$2" --latency "$1"
+    fi
+}
+
+OUT=$DIR/results/$(date +%Y%m%d-%H%M%S).tsv
+
+printf "# scenario\treq_s\tp50_ms\tp99_ms\trss_kb_per_1m\n" > "$OUT"
+
+for s in $SCENARIOS; do
+    url="http://127.0.0.1:8080/$s"
+
+    if [ "$s" = args ]; then
+        url="$url?$ARGS"
+    fi
+
+    load "$url" 2s > /dev/null
+
+    rss0=$(rss)
+    out=$(load "$url" "$DURATION")
+    rss1=$(rss)
+
+    if [ "$CLIENT" = h2load ]; then
+        rps=$(awk '/^finished in/ { print $4 }' <<< "$out")
+        total=$(awk '/^requests:/ { print $2 }' <<< "$out")
+        p50=-
+        p99=-
+    else
+        rps=$(awk '/^Requests\/sec/ { print $2 }' <<< "$out")
+        total=$(awk '/requests in/ { print $1 }' <<< "$out")
+        p50=$(ms "$(awk '$1 == "50%" { print $2 }' <<< "$out")")
+        p99=$(ms "$(awk '$1 == "99%" { print $2 }' <<< "$out")")
+    fi
+
+    growth=$(( (rss1 - rss0) * 1000000 / (total > 0 ? total : 1) ))
+
+    if grep -qE "Non-2xx|errors: [0-9]* *[1-9]" <<< "$out"; then
+        echo "$s: errors, see $PREFIX/logs/error.log" >&2
+    fi
+
+    printf "%s\t%s\t%s\t%s\t%s\n" "$s" "$rps" "$p50" "$p99" "$growth" | tee -a "$OUT"
+done
+
+cp "$OUT" "$DIR/results/latest.tsv"
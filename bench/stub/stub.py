@@ -0,0 +1,129 @@
+#!/usr/bin/env python3
+#
+# Stub redis and mysql servers for the socket scenarios of run.sh: they
+# answer at once, so the numbers are those of ngx_php's side of the round
+# trip.
+#
+#   ./stub.py [redis_port] [mysql_port]
+#
+# redis: GET returns "hello", PING +PONG, anything else +OK.
+# mysql: any user and password, every query returns one row, v = "1".
+
+import asyncio
+import struct
+import sys
+
+
+async def redis_client(reader, writer):
+    try:
+        while True:
+            line = await reader.readline()
+            if not line:
+                break
+
+            if line.startswith(b"*"):
+                args = []
+                for _ in range(int(line[1:])):
+                    size = int((await reader.readline())[1:])
+                    args.append((await reader.readexactly(size + 2))[:-2])
+            else:
+                args = line.split()
+
+            cmd = args[0].upper() if args else b""
+
+            if cmd == b"GET":
+                writer.write(b"$5\r\nhello\r\n")
+            elif cmd == b"PING":
+                writer.write(b"+PONG\r\n")
+            else:
+                writer.write(b"+OK\r\n")
+
+            await writer.drain()
+
+    except (asyncio.IncompleteReadError, ConnectionError, ValueError):
+        pass
+
+    writer.close()
+
+
+CAPS = (0x00000001 | 0x00000004 | 0x00000008 | 0x00000200 | 0x00002000 
+        | 0x00008000 | 0x00020000 | 0x00080000)
+
+OK = b"\x00\x00\x00\x02\x00\x00\x00"
+EOF_PACKET = b"\xfe\x00\x00\x02\x00"
+
+
+def lenenc(s):
+    return bytes([len(s)]) + s
+
+
+def packet(seq, payload):
+    return struct.pack("<I", len(payload))[:3] + bytes([seq & 0xff]) + payload
+
+
+def greeting():
+    scramble = b"12345678abcdefghijkl"
+
+    return (b"\x0a" + b"5.7.0-stub\x00" + struct.pack("<I", 1) 
+            + scramble[:8] + b"\x00" 
+            + struct.pack("<H", CAPS & 0xffff) + b"\x21" + struct.pack("<H", 2) 
+            + struct.pack("<H", CAPS >> 16) + bytes([len(scramble) + 1]) + b"\x00" * 10 
+            + scramble[8:] + b"\x00" + b"mysql_native_password\x00")
+
+
+def resultset():
+    column = (lenenc(b"def") + lenenc(b"") + lenenc(b"") + lenenc(b"") 
+              + lenenc(b"v") + lenenc(b"") + b"\x0c" + struct.pack("<H", 0x21) 
+              + struct.pack("<I", 1) + b"\xfd" + struct.pack("<H", 0) + b"\x00\x00\x00")
+
+    return (packet(1, b"\x01") + packet(2, column) + packet(3, EOF_PACKET) 
+            + packet(4, lenenc(b"1")) + packet(5, EOF_PACKET))
+
+
+RESULTSET = resultset()
+
+
+async def mysql_client(reader, writer):
+    try:
+        writer.write(packet(0, greeting()))
+        await writer.drain()
+
+        header = await reader.readexactly(4)
+        await reader.readexactly(struct.unpack("<I", header[:3] + b"\x00")[0])
+
+        writer.write(packet(header[3] + 1, OK))
+        await writer.drain()
+
+        while True:
+            header = await reader.readexactly(4)
+            payload = await reader.readexactly(struct.unpack("<I", header[:3] + b"\x00")[0])
+
+            if payload[:1] == b"\x01":
+                break
+
+            if payload[:1] == b"\x03":
+                writer.write(RESULTSET)
+            else:
+                writer.write(packet(1, OK))
+
+            await writer.drain()
+
+    except (asyncio.IncompleteReadError, ConnectionError):
+        pass
+
+    writer.close()
+
+
+async def main():
+    redis_port = int(sys.argv[1]) if len(sys.argv) > 1 else 6380
+    mysql_port = int(sys.argv[2]) if len(sys.argv) > 2 else 3307
+
+    redis = await asyncio.start_server(redis_client, "127.0.0.1", redis_port)
+    mysql = await asyncio.start_server(mysql_client, "127.0.0.1", mysql_port)
+
+    async with redis, mysql:
+        await asyncio.gather(redis.serve_forever(), mysql.serve_forever())
+
+
+if __name__ == "__main__":
+    asyncio.run(main())
@@ -0,0 +1,434 @@
+/*
+==============================================================================
+Copyright (c) 2016-2020, rryqszq4 <rryqszq@gmail.com>
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+
+* Redistributions of source code must retain the above copyright notice, this
+  list of conditions and the following disclaimer.
+
+* Redistributions in binary form must reproduce the above copyright notice,
+  this list of conditions and the following disclaimer in the documentation
+  and/or other materials provided with the distribution.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+==============================================================================
+*/
+
+#include "ngx_http_php_module.h"
+#include "ngx_http_php_cache.h"
+#include "ngx_http_php_shdict.h"
+
+/*
+ * An entry is stored as a string in the php_shared_dict zone:
+ *
+ *     status, content type, header count, (key, value) * count, body
+ *
+ * with every length as a 4-byte integer in host order.
+ */
+
+static void ngx_http_php_cache_cleanup(void *data);
+static void ngx_http_php_cache_wait_handler(ngx_event_t *ev);
+static ngx_int_t ngx_http_php_cache_send(ngx_http_request_t *r, 
+    ngx_str_t *entry);
+static u_char *ngx_http_php_cache_write(u_char *p, ngx_str_t *s);
+static u_char *ngx_http_php_cache_read(u_char *p, u_char *last, ngx_str_t *s);
+
+ngx_int_t
+ngx_http_php_cache_handler(ngx_http_request_t *r, ngx_http_php_ctx_t *ctx)
+{
+    ngx_http_php_loc_conf_t     *plcf;
+    ngx_http_php_cache_t        *cache;
+    ngx_pool_cleanup_t          *cln;
+    ngx_str_t                   entry, one;
+    ngx_int_t                   rc;
+
+    cache = ctx->cache;
+
+    if (cache == NULL) {
+
+        if (!(r->method & (NGX_HTTP_GET|NGX_HTTP_HEAD))) {
+            return NGX_DECLINED;
+        }
+
+        plcf = ngx_http_get_module_loc_conf(r, ngx_http_php_module);
+
+        cache = ngx_pcalloc(r->pool, sizeof(ngx_http_php_cache_t));
+        if (cache == NULL) {
+            return NGX_ERROR;
+        }
+
+        if (ngx_http_complex_value(r, plcf->cache_key, &cache->key) != NGX_OK) {
+            return NGX_ERROR;
+        }
+
+        cache->request = r;
+        cache->zone = plcf->cache_zone;
+        cache->ttl = plcf->cache_ttl;
+
+        ctx->cache = cache;
+
+        if (cache->key.len == 0 
+            || cache->key.len > NGX_HTTP_PHP_SHDICT_MAX_KEY - sizeof("lock:") + 1)
+        {
+            cache->bypass = 1;
+            return NGX_DECLINED;
+        }
+
+        cache->lock.len = sizeof("lock:") - 1 + cache->key.len;
+        cache->lock.data = ngx_pnalloc(r->pool, cache->lock.len);
+        if (cache->lock.data == NULL) {
+            return NGX_ERROR;
+        }
+
+        ngx_memcpy(ngx_cpymem(cache->lock.data, "lock:", sizeof("lock:") - 1),
+                   cache->key.data, cache->key.len);
+
+        cln = ngx_pool_cleanup_add(r->pool, 0);
+        if (cln == NULL) {
+            return NGX_ERROR;
+        }
+
+        cln->handler = ngx_http_php_cache_cleanup;
+        cln->data = cache;
+    }
+
+    if (cache->leader || cache->bypass) {
+        return NGX_DECLINED;
+    }
+
+    rc = ngx_http_php_shdict_get_string(cache->zone, &cache->key, r->pool, &entry);
+
+    if (rc == NGX_ERROR) {
+        return NGX_ERROR;
+    }
+
+    if (rc == NGX_OK) {
+        ngx_log_debug1(NGX_LOG_DEBUG_HTTP, r->connection->log, 0,
+                       "php cache hit \"%V\"", &cache->key);
+
+        return ngx_http_php_cache_send(r, &entry);
+    }
+
+    /* single flight, only the request holding the lock runs the php code */
+
+    ngx_str_set(&one, "1");
+
+    rc = ngx_http_php_shdict_set_string(cache->zone, &cache->lock, &one, 
+                                        NGX_HTTP_PHP_CACHE_LOCK_TIMEOUT,
+                                        NGX_HTTP_PHP_SHDICT_ADD);
+
+    if (rc == NGX_OK) {
+        ngx_log_debug1(NGX_LOG_DEBUG_HTTP, r->connection->log, 0,
+                       "php cache miss \"%V\"", &cache->key);
+
+        cache->leader = 1;
+        return NGX_DECLINED;
+    }
+
+    if (rc == NGX_ERROR || cache->waited >= NGX_HTTP_PHP_CACHE_LOCK_TIMEOUT) {
+        cache->bypass = 1;
+        return NGX_DECLINED;
+    }
+
+    cache->wait.handler = ngx_http_php_cache_wait_handler;
+    cache->wait.log = r->connection->log;
+    cache->wait.data = r;
+
+    ngx_add_timer(&cache->wait, NGX_HTTP_PHP_CACHE_WAIT);
+
+    cache->waited += NGX_HTTP_PHP_CACHE_WAIT;
+
+    r->write_event_handler = ngx_http_request_empty_handler;
+    r->main->count++;
+
+    return NGX_DONE;
+}
+
+void
+ngx_http_php_cache_store(ngx_http_request_t *r, ngx_http_php_ctx_t *ctx, 
+    ngx_chain_t *out)
+{
+    ngx_http_php_cache_t    *cache;
+    ngx_list_part_t         *part;
+    ngx_table_elt_t         *h;
+    ngx_chain_t             *cl;
+    ngx_str_t               entry;
+    ngx_uint_t              i, n;
+    uint32_t                v;
+    size_t                  size;
+    u_char                  *p;
+
+    cache = ctx->cache;
+
+    if (cache == NULL || !cache->leader) {
+        return;
+    }
+
+    cache->leader = 0;
+
+    if (r->headers_out.status != NGX_HTTP_OK) {
+        goto unlock;
+    }
+
+    size = 3 * sizeof(uint32_t) + r->headers_out.content_type.len;
+    n = 0;
+
+    part = &r->headers_out.headers.part;
+    h = part->elts;
+
+    for (i = 0; /* void */; i++) {
+
+        if (i >= part->nelts) {
+            if (part->next == NULL) {
+                break;
+            }
+
+            part = part->next;
+            h = part->elts;
+            i = 0;
+        }
+
+        if (h[i].hash == 0) {
+            continue;
+        }
+
+        /* a response for one client only */
+        if (h[i].key.len == sizeof("Set-Cookie") - 1
+            && ngx_strncasecmp(h[i].key.data, (u_char *) "Set-Cookie", 
+                               sizeof("Set-Cookie") - 1) == 0)
+        {
+            goto unlock;
+        }
+
+        size += 2 * sizeof(uint32_t) + h[i].key.len + h[i].value.len;
+        n++;
+    }
+
+    for (cl = out; cl; cl = cl->next) {
+
+        /* ngx_send_file() output stays out of the cache */
+        if (!ngx_buf_in_memory(cl->buf)) {
+            goto unlock;
+        }
+
+        size += cl->buf->last - cl->buf->pos;
+    }
+
+    p = ngx_pnalloc(r->pool, size);
+    if (p == NULL) {
+        goto unlock;
+    }
+
+    entry.data = p;
+    entry.len = size;
+
+    v = (uint32_t) r->headers_out.status;
+    p = ngx_cpymem(p, &v, sizeof(uint32_t));
+
+    p = ngx_http_php_cache_write(p, &r->headers_out.content_type);
+
+    v = (uint32_t) n;
+    p = ngx_cpymem(p, &v, sizeof(uint32_t));
+
+    part = &r->headers_out.headers.part;
+    h = part->elts;
+
+    for (i = 0; /* void */; i++) {
+
+        if (i >= part->nelts) {
+            if (part->next == NULL) {
+                break;
+            }
+
+            part = part->next;
+            h = part->elts;
+            i = 0;
+        }
+
+        if (h[i].hash == 0) {
+            continue;
+        }
+
+        p = ngx_http_php_cache_write(p, &h[i].key);
+        p = ngx_http_php_cache_write(p, &h[i].value);
+    }
+
+    for (cl = out; cl; cl = cl->next) {
+        p = ngx_cpymem(p, cl->buf->pos, cl->buf->last - cl->buf->pos);
+    }
+
+    ngx_log_debug2(NGX_LOG_DEBUG_HTTP, r->connection->log, 0,
+                   "php cache store \"%V\" %uz bytes", &cache->key, entry.len);
+
+    (void) ngx_http_php_shdict_set_string(cache->zone, &cache->key, &entry, 
+                                          cache->ttl, NGX_HTTP_PHP_SHDICT_SET);
+
+unlock:
+
+    (void) ngx_http_php_shdict_set_string(cache->zone, &cache->lock, NULL, 0,
+                                          NGX_HTTP_PHP_SHDICT_SET);
+}
+
+static void
+ngx_http_php_cache_cleanup(void *data)
+{
+    ngx_http_php_cache_t    *cache = data;
+
+    if (cache->wait.timer_set) {
+        ngx_del_timer(&cache->wait);
+    }
+
+    /* the php code failed or was redirected, let a waiting request go on */
+
+    if (cache->leader) {
+        cache->leader = 0;
+
+        (void) ngx_http_php_shdict_set_string(cache->zone, &cache->lock, NULL, 
+                                              0, NGX_HTTP_PHP_SHDICT_SET);
+    }
+}
+
+static void
+ngx_http_php_cache_wait_handler(ngx_event_t *ev)
+{
+    ngx_http_request_t  *r;
+    ngx_connection_t    *c;
+
+    r = ev->data;
+    c = r->connection;
+
+    r->write_event_handler = ngx_http_core_run_phases;
+
+    ngx_http_core_run_phases(r);
+
+    ngx_http_run_posted_requests(c);
+}
+
+static ngx_int_t
+ngx_http_php_cache_send(ngx_http_request_t *r, ngx_str_t *entry)
+{
+    u_char              *p, *last;
+    uint32_t            v, n;
+    ngx_str_t           type, key, value;
+    ngx_table_elt_t     *h;
+    ngx_buf_t           *b;
+    ngx_chain_t         out;
+    ngx_int_t           rc;
+
+    p = entry->data;
+    last = p + entry->len;
+
+    if ((size_t) (last - p) < 3 * sizeof(uint32_t)) {
+        return NGX_ERROR;
+    }
+
+    ngx_memcpy(&v, p, sizeof(uint32_t));
+    p += sizeof(uint32_t);
+
+    p = ngx_http_php_cache_read(p, last, &type);
+    if (p == NULL || (size_t) (last - p) < sizeof(uint32_t)) {
+        return NGX_ERROR;
+    }
+
+    ngx_memcpy(&n, p, sizeof(uint32_t));
+    p += sizeof(uint32_t);
+
+    r->headers_out.status = v;
+
+    if (type.len) {
+        r->headers_out.content_type = type;
+        r->headers_out.content_type_len = type.len;
+        r->headers_out.content_type_lowcase = NULL;
+    }
+
+    while (n--) {
+        p = ngx_http_php_cache_read(p, last, &key);
+        if (p == NULL) {
+            return NGX_ERROR;
+        }
+
+        p = ngx_http_php_cache_read(p, last, &value);
+        if (p == NULL) {
+            return NGX_ERROR;
+        }
+
+        h = ngx_list_push(&r->headers_out.headers);
+        if (h == NULL) {
+            return NGX_ERROR;
+        }
+
+        h->hash = 1;
+        h->key = key;
+        h->value = value;
+    }
+
+    r->headers_out.content_length_n = last - p;
+
+    rc = ngx_http_send_header(r);
+
+    if (rc == NGX_ERROR || rc > NGX_OK || r->header_only) {
+        return rc;
+    }
+
+    b = ngx_calloc_buf(r->pool);
+    if (b == NULL) {
+        return NGX_ERROR;
+    }
+
+    b->pos = p;
+    b->last = last;
+    b->memory = (p != last);
+    b->last_buf = (r == r->main) ? 1 : 0;
+    b->last_in_chain = 1;
+
+    out.buf = b;
+    out.next = NULL;
+
+    return ngx_http_output_filter(r, &out);
+}
+
+static u_char *
+ngx_http_php_cache_write(u_char *p, ngx_str_t *s)
+{
+    uint32_t    len;
+
+    len = (uint32_t) s->len;
+
+    p = ngx_cpymem(p, &len, sizeof(uint32_t));
+
+    return ngx_cpymem(p, s->data, s->len);
+}
+
+static u_char *
+ngx_http_php_cache_read(u_char *p, u_char *last, ngx_str_t *s)
+{
+    uint32_t    len;
+
+    if ((size_t) (last - p) < sizeof(uint32_t)) {
+        return NULL;
+    }
+
+    ngx_memcpy(&len, p, sizeof(uint32_t));
+    p += sizeof(uint32_t);
+
+    if ((size_t) (last - p) < len) {
+        return NULL;
+    }
+
+    s->data = p;
+    s->len = len;
+
+    return p + len;
+}
@@ -0,0 +1,62 @@
+/*
+==============================================================================
+Copyright (c) 2016-2020, rryqszq4 <rryqszq@gmail.com>
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+
+* Redistributions of source code must retain the above copyright notice, this
+  list of conditions and the following disclaimer.
+
+* Redistributions in binary form must reproduce the above copyright notice,
+  this list of conditions and the following disclaimer in the documentation
+  and/or other materials provided with the distribution.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+==============================================================================
+*/
+
+#ifndef __NGX_HTTP_PHP_CACHE_H__
+#define __NGX_HTTP_PHP_CACHE_H__
+
+#include "ngx_http_php_module.h"
+
+/* how long the request filling an entry keeps the others waiting */
+#define NGX_HTTP_PHP_CACHE_LOCK_TIMEOUT     5000
+
+/* how often a waiting request looks for the entry */
+#define NGX_HTTP_PHP_CACHE_WAIT             10
+
+typedef struct {
+    ngx_http_request_t      *request;
+    ngx_shm_zone_t          *zone;
+    ngx_str_t               key;
+    ngx_str_t               lock;
+    ngx_msec_t              ttl;
+
+    ngx_event_t             wait;
+    ngx_msec_t              waited;
+
+    /* this request runs the php code and stores the response */
+    unsigned                leader:1;
+    /* this request runs the php code and stores nothing */
+    unsigned                bypass:1;
+} ngx_http_php_cache_t;
+
+ngx_int_t ngx_http_php_cache_handler(ngx_http_request_t *r, 
+    ngx_http_php_ctx_t *ctx);
+
+void ngx_http_php_cache_store(ngx_http_request_t *r, ngx_http_php_ctx_t *ctx, 
+    ngx_chain_t *out);
+
+#endif
@@ -111,6 +111,39 @@ ngx_http_php_code_from_string(ngx_pool_t *pool, ngx_str_t *code_str)
     return code;
 }
 
+static void
+ngx_http_php_ctx_cleanup(void *data)
+{
+    ngx_http_php_ctx_t *ctx = data;
+
+    /* a result stored for a resume that never came, e.g. client abort */
+
+    zval_ptr_dtor(&ctx->yield_retval);
+    ZVAL_UNDEF(&ctx->yield_retval);
+}
+
+ngx_http_php_ctx_t *
+ngx_http_php_ctx_create(ngx_http_request_t *r)
+{
+    ngx_http_php_ctx_t *ctx;
+    ngx_pool_cleanup_t *cln;
+
+    ctx = ngx_pcalloc(r->pool, sizeof(*ctx));
+    if (ctx == NULL) {
+        return NULL;
+    }
+
+    cln = ngx_pool_cleanup_add(r->pool, 0);
+    if (cln == NULL) {
+        return NULL;
+    }
+
+    cln->handler = ngx_http_php_ctx_cleanup;
+    cln->data = ctx;
+
+    return ctx;
+}
+
 
 #if PHP_MAJOR_VERSION >= 8
 #if PHP_MINOR_VERSION > 0
@@ -333,6 +366,8 @@ ngx_php_error_cb(int type,
             r->headers_out.content_length_n += ns.len;
         }
 
+        ngx_http_php_output_not_file(r);
+
         if (!r->headers_out.status) {
             r->headers_out.status = NGX_HTTP_INTERNAL_SERVER_ERROR;
         }
@@ -408,10 +443,26 @@ size_t ngx_http_php_code_ub_write(const char *str, size_t str_length)
             r->headers_out.content_length_n += ns.len;
         }
 
+        ngx_http_php_output_not_file(r);
+
     }
     return r->headers_out.content_length_n;
 }
 
+/* 
+ * Called by everything that appends to ctx->rputs_chain, the response 
+ * is no longer a file sent alone by ngx_send_file().
+ */
+void
+ngx_http_php_output_not_file(ngx_http_request_t *r)
+{
+    if (r->allow_ranges) {
+        r->allow_ranges = 0;
+        r->headers_out.last_modified_time = -1;
+        ngx_http_clear_etag(r);
+    }
+}
+
 void 
 ngx_http_php_code_flush(void *server_context)
 {
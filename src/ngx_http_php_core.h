@@ -86,6 +86,14 @@ typedef struct ngx_http_php_capture_node_s {
     ngx_str_t capture_uri;
     ngx_buf_t *capture_buf;
     ngx_str_t capture_str;
+
+    ngx_str_t capture_args;
+    ngx_uint_t method;
+    ngx_str_t method_name;
+    ngx_str_t *body;
+
+    ngx_http_request_t *request;
+    ngx_int_t status;
 } ngx_http_php_capture_node_t;
 
 typedef struct ngx_http_php_ctx_s {
@@ -108,6 +116,10 @@ typedef struct ngx_http_php_ctx_s {
     ngx_array_t *capture_multi;
     ngx_uint_t capture_multi_complete_total;
 
+    /* set by ngx_exec(), redirected to once the php code ends */
+    ngx_str_t exec_uri;
+    ngx_str_t exec_args;
+
     //pthread_mutex_t mutex;
     //pthread_cond_t cond;
     //pthread_t pthread_id;
@@ -126,6 +138,8 @@ typedef struct ngx_http_php_ctx_s {
     ngx_int_t phase_status;
 
     zval *generator_closure;
+    /* passed to the generator with send() on the next resume */
+    zval yield_retval;
 
     ngx_int_t delay_time;
     ngx_event_t sleep;
@@ -135,9 +149,19 @@ typedef struct ngx_http_php_ctx_s {
     ngx_http_php_socket_upstream_t  *upstream;
     ngx_str_t   host;
     in_port_t   port;
+    ngx_str_t   pool_name;
     zval *recv_buf;
     zval *recv_code;
 
+    /* state of ngx_http_request(), kept for a streamed body */
+    void *http_client;
+
+    /* php_cache lookup and single flight lock of the request */
+    void *cache;
+
+    /* ngx_http_php_run_t of the request, see ngx_http_php_run_request() */
+    void *run;
+
     unsigned end_of_request : 1;
 
 } ngx_http_php_ctx_t;
@@ -146,6 +170,8 @@ typedef struct ngx_http_php_ctx_s {
 ngx_http_php_code_t *ngx_http_php_code_from_file(ngx_pool_t *pool, ngx_str_t *code_file_path);
 ngx_http_php_code_t *ngx_http_php_code_from_string(ngx_pool_t *pool, ngx_str_t *code_str);
 
+ngx_http_php_ctx_t *ngx_http_php_ctx_create(ngx_http_request_t *r);
+
 #define NGX_HTTP_PHP_NGX_INIT ngx_http_php_request_init(r);   \
         php_ngx_request_init();                                 \
         zend_first_try {
@@ -167,6 +193,7 @@ ngx_int_t ngx_php_set_request_status(ngx_int_t rc);
 
 // php_ngx sapi call_back
 size_t ngx_http_php_code_ub_write(const char *str, size_t str_length );
+void ngx_http_php_output_not_file(ngx_http_request_t *r);
 void ngx_http_php_code_flush(void *server_context);
 void ngx_http_php_code_log_message(char *message);
 void ngx_http_php_code_register_server_variables(zval *track_vars_array );
@@ -0,0 +1,322 @@
+/*
+==============================================================================
+Copyright (c) 2016-2020, rryqszq4 <rryqszq@gmail.com>
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+
+* Redistributions of source code must retain the above copyright notice, this
+  list of conditions and the following disclaimer.
+
+* Redistributions in binary form must reproduce the above copyright notice,
+  this list of conditions and the following disclaimer in the documentation
+  and/or other materials provided with the distribution.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+==============================================================================
+*/
+
+#include "ngx_http_php_module.h"
+#include "ngx_http_php_counter.h"
+
+/* a limit unused for this long is as good as a new one */
+#define NGX_HTTP_PHP_LIMIT_IDLE     1000000
+
+static ngx_http_php_counter_shctx_t *ngx_http_php_counter_shctx(void);
+static uint64_t ngx_http_php_counter_now(ngx_http_php_counter_shctx_t *sh);
+static ngx_http_php_counter_slot_t *ngx_http_php_counter_slot(
+    ngx_http_php_counter_shctx_t *sh, ngx_str_t *key, ngx_uint_t type, 
+    ngx_uint_t create);
+static void ngx_http_php_counter_fill(ngx_http_php_counter_slot_t *slot, 
+    uint32_t hash, ngx_str_t *key, ngx_uint_t type);
+
+ngx_int_t
+ngx_http_php_counter_init_zone(ngx_shm_zone_t *shm_zone, void *data)
+{
+    ngx_http_php_counter_shctx_t    *osh = data;
+    ngx_http_php_counter_shctx_t    *sh;
+    ngx_slab_pool_t                 *shpool;
+    ngx_uint_t                      n;
+
+    if (osh) {
+        shm_zone->data = osh;
+        return NGX_OK;
+    }
+
+    shpool = (ngx_slab_pool_t *) shm_zone->shm.addr;
+
+    if (shm_zone->shm.exists) {
+        shm_zone->data = shpool->data;
+        return NGX_OK;
+    }
+
+    sh = ngx_slab_alloc(shpool, sizeof(ngx_http_php_counter_shctx_t));
+    if (sh == NULL) {
+        return NGX_ERROR;
+    }
+
+    /* 
+     * as many slots as the slab pool can hand out in one piece, 
+     * page aligned so that no two slots share a cache line
+     */
+
+    n = shm_zone->shm.size / NGX_HTTP_PHP_COUNTER_SLOT_SIZE;
+
+    while (n) {
+        sh->slots = ngx_slab_alloc(shpool, n * NGX_HTTP_PHP_COUNTER_SLOT_SIZE);
+        if (sh->slots) {
+            break;
+        }
+
+        n -= n / 16 + 1;
+    }
+
+    if (n == 0) {
+        return NGX_ERROR;
+    }
+
+    ngx_memzero(sh->slots, n * NGX_HTTP_PHP_COUNTER_SLOT_SIZE);
+
+    sh->nslots = n;
+    sh->epoch = ngx_time();
+
+    shpool->data = sh;
+    shm_zone->data = sh;
+
+    return NGX_OK;
+}
+
+ngx_int_t
+ngx_http_php_counter_incr(ngx_str_t *key, ngx_atomic_int_t delta, 
+    ngx_atomic_int_t *value)
+{
+    ngx_http_php_counter_shctx_t    *sh;
+    ngx_http_php_counter_slot_t     *slot;
+
+    sh = ngx_http_php_counter_shctx();
+    if (sh == NULL) {
+        return NGX_ERROR;
+    }
+
+    slot = ngx_http_php_counter_slot(sh, key, NGX_HTTP_PHP_COUNTER, 1);
+    if (slot == NULL) {
+        return NGX_ERROR;
+    }
+
+    *value = (ngx_atomic_int_t) ngx_atomic_fetch_add(&slot->s.value, delta) + delta;
+
+    return NGX_OK;
+}
+
+ngx_int_t
+ngx_http_php_counter_get(ngx_str_t *key, ngx_atomic_int_t *value)
+{
+    ngx_http_php_counter_shctx_t    *sh;
+    ngx_http_php_counter_slot_t     *slot;
+
+    sh = ngx_http_php_counter_shctx();
+    if (sh == NULL) {
+        return NGX_ERROR;
+    }
+
+    slot = ngx_http_php_counter_slot(sh, key, NGX_HTTP_PHP_COUNTER, 0);
+
+    *value = slot ? (ngx_atomic_int_t) slot->s.value : 0;
+
+    return NGX_OK;
+}
+
+/*
+ * A token bucket run as GCRA: the slot holds the time at which the bucket 
+ * would be full again, and a request is let through if moving it one 
+ * interval later does not go beyond burst intervals from now. 
+ * NGX_BUSY sets the usecs to wait before the next request would pass.
+ */
+ngx_int_t
+ngx_http_php_limit(ngx_str_t *key, double rate, ngx_uint_t burst, 
+    uint64_t *delay)
+{
+#if (NGX_PTR_SIZE >= 8)
+    ngx_http_php_counter_shctx_t    *sh;
+    ngx_http_php_counter_slot_t     *slot;
+    ngx_atomic_uint_t               tat, base, now, interval, tolerance;
+
+    sh = ngx_http_php_counter_shctx();
+    if (sh == NULL || rate <= 0) {
+        return NGX_ERROR;
+    }
+
+    slot = ngx_http_php_counter_slot(sh, key, NGX_HTTP_PHP_LIMIT, 1);
+    if (slot == NULL) {
+        return NGX_ERROR;
+    }
+
+    interval = (ngx_atomic_uint_t) (1000000 / rate);
+    if (interval == 0) {
+        interval = 1;
+    }
+
+    tolerance = burst * interval;
+    now = ngx_http_php_counter_now(sh);
+
+    for ( ;; ) {
+        tat = slot->s.value;
+        base = tat > now ? tat : now;
+
+        if (base - now > tolerance) {
+            *delay = base - now - tolerance;
+            return NGX_BUSY;
+        }
+
+        if (ngx_atomic_cmp_set(&slot->s.value, tat, base + interval)) {
+            *delay = 0;
+            return NGX_OK;
+        }
+
+        ngx_cpu_pause();
+    }
+#else
+
+    /* usecs do not fit in a 32-bit ngx_atomic_t */
+    return NGX_ERROR;
+#endif
+}
+
+static ngx_http_php_counter_shctx_t *
+ngx_http_php_counter_shctx(void)
+{
+    ngx_http_php_main_conf_t    *pmcf;
+
+    pmcf = ngx_http_cycle_get_module_main_conf(ngx_cycle, ngx_http_php_module);
+
+    if (pmcf == NULL || pmcf->counter_zone == NULL) {
+        return NULL;
+    }
+
+    return pmcf->counter_zone->data;
+}
+
+static uint64_t
+ngx_http_php_counter_now(ngx_http_php_counter_shctx_t *sh)
+{
+    ngx_time_t  *tp;
+
+    tp = ngx_timeofday();
+
+    return (uint64_t) (tp->sec - sh->epoch) * 1000000 + tp->msec * 1000;
+}
+
+/*
+ * Open addressing without removal, so a lookup is a handful of reads and 
+ * slots are claimed with a compare and swap, never under a lock. 
+ * Idle limits are taken over in place by new keys.
+ */
+static ngx_http_php_counter_slot_t *
+ngx_http_php_counter_slot(ngx_http_php_counter_shctx_t *sh, ngx_str_t *key, 
+    ngx_uint_t type, ngx_uint_t create)
+{
+    uint32_t                        hash;
+    ngx_uint_t                      i, n;
+    ngx_atomic_uint_t               state;
+    uint64_t                        now;
+    ngx_http_php_counter_slot_t     *slot, *idle;
+
+    if (key->len == 0 || key->len > NGX_HTTP_PHP_COUNTER_KEY_LEN) {
+        return NULL;
+    }
+
+    hash = ngx_crc32_short(key->data, key->len);
+    now = (type == NGX_HTTP_PHP_LIMIT) ? ngx_http_php_counter_now(sh) : 0;
+    idle = NULL;
+
+    i = hash % sh->nslots;
+
+    for (n = 0; n < NGX_HTTP_PHP_COUNTER_PROBES; n++) {
+
+        slot = &sh->slots[i];
+
+    again:
+
+        state = slot->s.state;
+
+        if (state == NGX_HTTP_PHP_COUNTER_BUSY) {
+            ngx_cpu_pause();
+            goto again;
+        }
+
+        if (state == NGX_HTTP_PHP_COUNTER_EMPTY) {
+
+            if (!create) {
+                return NULL;
+            }
+
+            if (!ngx_atomic_cmp_set(&slot->s.state, NGX_HTTP_PHP_COUNTER_EMPTY,
+                                    NGX_HTTP_PHP_COUNTER_BUSY))
+            {
+                goto again;
+            }
+
+            ngx_http_php_counter_fill(slot, hash, key, type);
+
+            return slot;
+        }
+
+        if (slot->s.hash == hash 
+            && slot->s.type == type
+            && slot->s.len == key->len
+            && ngx_memcmp(slot->s.key, key->data, key->len) == 0)
+        {
+            return slot;
+        }
+
+        if (idle == NULL 
+            && type == NGX_HTTP_PHP_LIMIT
+            && slot->s.type == NGX_HTTP_PHP_LIMIT
+            && slot->s.value + NGX_HTTP_PHP_LIMIT_IDLE < now)
+        {
+            idle = slot;
+        }
+
+        i = (i + 1) % sh->nslots;
+    }
+
+    if (idle == NULL || !create) {
+        return NULL;
+    }
+
+    if (!ngx_atomic_cmp_set(&idle->s.state, NGX_HTTP_PHP_COUNTER_READY,
+                            NGX_HTTP_PHP_COUNTER_BUSY))
+    {
+        return NULL;
+    }
+
+    ngx_http_php_counter_fill(idle, hash, key, type);
+
+    return idle;
+}
+
+static void
+ngx_http_php_counter_fill(ngx_http_php_counter_slot_t *slot, uint32_t hash, 
+    ngx_str_t *key, ngx_uint_t type)
+{
+    slot->s.value = 0;
+    slot->s.hash = hash;
+    slot->s.type = (u_char) type;
+    slot->s.len = (u_char) key->len;
+
+    ngx_memcpy(slot->s.key, key->data, key->len);
+
+    ngx_memory_barrier();
+
+    slot->s.state = NGX_HTTP_PHP_COUNTER_READY;
+}
@@ -0,0 +1,85 @@
+/*
+==============================================================================
+Copyright (c) 2016-2020, rryqszq4 <rryqszq@gmail.com>
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+
+* Redistributions of source code must retain the above copyright notice, this
+  list of conditions and the following disclaimer.
+
+* Redistributions in binary form must reproduce the above copyright notice,
+  this list of conditions and the following disclaimer in the documentation
+  and/or other materials provided with the distribution.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+==============================================================================
+*/
+
+#ifndef __NGX_HTTP_PHP_COUNTER_H__
+#define __NGX_HTTP_PHP_COUNTER_H__
+
+#include "ngx_http_php_module.h"
+
+#define NGX_HTTP_PHP_COUNTER_ZONE       "php_counters"
+
+/* every slot starts on its own cache line */
+#define NGX_HTTP_PHP_COUNTER_SLOT_SIZE  128
+
+#define NGX_HTTP_PHP_COUNTER_KEY_LEN                                          \
+    (NGX_HTTP_PHP_COUNTER_SLOT_SIZE - 2 * sizeof(ngx_atomic_t)                \
+     - sizeof(uint32_t) - 2)
+
+/* linear probing gives up after this many slots */
+#define NGX_HTTP_PHP_COUNTER_PROBES     64
+
+#define NGX_HTTP_PHP_COUNTER_EMPTY      0
+#define NGX_HTTP_PHP_COUNTER_BUSY       1
+#define NGX_HTTP_PHP_COUNTER_READY      2
+
+#define NGX_HTTP_PHP_COUNTER            1
+#define NGX_HTTP_PHP_LIMIT              2
+
+typedef union {
+    struct {
+        ngx_atomic_t    state;
+
+        /* the count, or the theoretical arrival time in usec of a limit */
+        ngx_atomic_t    value;
+
+        uint32_t        hash;
+        u_char          type;
+        u_char          len;
+        u_char          key[NGX_HTTP_PHP_COUNTER_KEY_LEN];
+    } s;
+
+    u_char              pad[NGX_HTTP_PHP_COUNTER_SLOT_SIZE];
+} ngx_http_php_counter_slot_t;
+
+typedef struct {
+    ngx_http_php_counter_slot_t     *slots;
+    ngx_uint_t                      nslots;
+
+    /* limits count time from here, so usecs fit in ngx_atomic_t */
+    time_t                          epoch;
+} ngx_http_php_counter_shctx_t;
+
+ngx_int_t ngx_http_php_counter_init_zone(ngx_shm_zone_t *shm_zone, void *data);
+
+ngx_int_t ngx_http_php_counter_incr(ngx_str_t *key, ngx_atomic_int_t delta, 
+    ngx_atomic_int_t *value);
+ngx_int_t ngx_http_php_counter_get(ngx_str_t *key, ngx_atomic_int_t *value);
+ngx_int_t ngx_http_php_limit(ngx_str_t *key, double rate, ngx_uint_t burst, 
+    uint64_t *delay);
+
+#endif
@@ -32,6 +32,12 @@ OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 #include "ngx_http_php_directive.h"
 #include "ngx_http_php_variable.h"
 #include "ngx_http_php_handler.h"
+#include "ngx_http_php_shdict.h"
+#include "ngx_http_php_counter.h"
+#include "ngx_http_php_queue.h"
+#include "ngx_http_php_stat.h"
+#include "ngx_http_php_profile.h"
+#include "ngx_http_php_trace.h"
 
 static char *ngx_http_php_init_worker_block_phase_handler(ngx_conf_t *cf, ngx_command_t *cmd, void *conf);
 
@@ -1217,42 +1223,638 @@ ngx_http_php_body_filter_inline_phase(ngx_conf_t *cf, ngx_command_t *cmd, void *
 char *
 ngx_http_php_conf_keepalive(ngx_conf_t *cf, ngx_command_t *cmd, void *conf)
 {
-    ngx_str_t *value = cf->args->elts;
     ngx_http_php_srv_conf_t *pscf = conf;
-    ngx_int_t keepalive_size;
+    ngx_http_php_keepalive_conf_t *kc;
+    ngx_str_t *value, s;
+    ngx_int_t n;
+    ngx_msec_t timeout;
+    ngx_uint_t i;
 
-    keepalive_size = ngx_atoi(value[1].data, value[1].len);
-    if (keepalive_size == NGX_ERROR) {
+    kc = pscf->keepalive_conf;
+
+    /* php_keepalive and php_socket_keepalive configure the same pool */
+    if (kc->max_cached) {
         return "is duplicated";
     }
-    
-    if (pscf->keepalive_conf) {
-        pscf->keepalive_conf->max_cached = (ngx_uint_t)keepalive_size;
+
+    value = cf->args->elts;
+
+    n = ngx_atoi(value[1].data, value[1].len);
+    if (n == NGX_ERROR || n == 0) {
+        ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+                           "invalid value \"%V\" in \"%V\" directive",
+                           &value[1], &cmd->name);
+        return NGX_CONF_ERROR;
     }
 
-    ngx_http_php_keepalive_init(cf->pool, pscf->keepalive_conf);
+    kc->max_cached = (ngx_uint_t) n;
+
+    for (i = 2; i < cf->args->nelts; i++) {
+
+        if (ngx_strncmp(value[i].data, "timeout=", 8) == 0) {
+
+            s.len = value[i].len - 8;
+            s.data = value[i].data + 8;
+
+            timeout = ngx_parse_time(&s, 0);
+            if (timeout == (ngx_msec_t) NGX_ERROR) {
+                goto invalid;
+            }
+
+            kc->timeout = timeout;
+
+            continue;
+        }
+
+        if (ngx_strncmp(value[i].data, "requests=", 9) == 0) {
+
+            n = ngx_atoi(value[i].data + 9, value[i].len - 9);
+            if (n == NGX_ERROR) {
+                goto invalid;
+            }
+
+            kc->requests = (ngx_uint_t) n;
+
+            continue;
+        }
+
+        goto invalid;
+    }
 
     return NGX_CONF_OK;
+
+invalid:
+
+    ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+                       "invalid parameter \"%V\"", &value[i]);
+
+    return NGX_CONF_ERROR;
 }
 
 char *
-ngx_http_php_conf_socket_keepalive(ngx_conf_t *cf, ngx_command_t *cmd, void *conf)
+ngx_http_php_conf_thread_pool(ngx_conf_t *cf, ngx_command_t *cmd, void *conf)
 {
-    ngx_str_t *value = cf->args->elts;
-    ngx_http_php_srv_conf_t *pscf = conf;
-    ngx_int_t keepalive_size;
+#if (NGX_THREADS)
+    ngx_http_php_loc_conf_t *plcf = conf;
+    ngx_str_t *value;
 
-    keepalive_size = ngx_atoi(value[1].data, value[1].len);
-    if (keepalive_size == NGX_ERROR) {
-        return "is duplicated";
+    if (plcf->thread_pool != NGX_CONF_UNSET_PTR) {
+        return "is duplicate";
     }
-    
-    if (pscf->keepalive_conf) {
-        pscf->keepalive_conf->max_cached = (ngx_uint_t)keepalive_size;
+
+    value = cf->args->elts;
+
+    /* the "default" pool is created on demand, others need thread_pool */
+    plcf->thread_pool = ngx_thread_pool_add(cf, cf->args->nelts > 1 ? &value[1] : NULL);
+    if (plcf->thread_pool == NULL) {
+        return NGX_CONF_ERROR;
+    }
+
+    return NGX_CONF_OK;
+#else
+    ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+                       "\"%V\" requires nginx built --with-threads", &cmd->name);
+
+    return NGX_CONF_ERROR;
+#endif
+}
+
+char *
+ngx_http_php_conf_shared_dict(ngx_conf_t *cf, ngx_command_t *cmd, void *conf)
+{
+    ngx_http_php_main_conf_t *pmcf = conf;
+    ngx_http_php_shdict_ctx_t *ctx;
+    ngx_shm_zone_t *zone, **zp;
+    ngx_str_t *value, name;
+    ssize_t size;
+
+    value = cf->args->elts;
+
+    name = value[1];
+    if (name.len == 0) {
+        ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+                           "invalid php_shared_dict name \"%V\"", &name);
+        return NGX_CONF_ERROR;
+    }
+
+    size = ngx_parse_size(&value[2]);
+    if (size == NGX_ERROR || size < (ssize_t) (8 * ngx_pagesize)) {
+        ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+                           "invalid php_shared_dict size \"%V\"", &value[2]);
+        return NGX_CONF_ERROR;
+    }
+
+    ctx = ngx_pcalloc(cf->pool, sizeof(ngx_http_php_shdict_ctx_t));
+    if (ctx == NULL) {
+        return NGX_CONF_ERROR;
+    }
+
+    ctx->name = name;
+    ctx->log = &cf->cycle->new_log;
+
+    zone = ngx_shared_memory_add(cf, &name, (size_t) size, &ngx_http_php_module);
+    if (zone == NULL) {
+        return NGX_CONF_ERROR;
+    }
+
+    if (zone->data) {
+        ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+                           "php_shared_dict \"%V\" is already defined", &name);
+        return NGX_CONF_ERROR;
+    }
+
+    zone->init = ngx_http_php_shdict_init_zone;
+    zone->data = ctx;
+
+    if (pmcf->shdict_zones == NULL) {
+        pmcf->shdict_zones = ngx_array_create(cf->pool, 2, sizeof(ngx_shm_zone_t *));
+        if (pmcf->shdict_zones == NULL) {
+            return NGX_CONF_ERROR;
+        }
+    }
+
+    zp = ngx_array_push(pmcf->shdict_zones);
+    if (zp == NULL) {
+        return NGX_CONF_ERROR;
     }
 
-    ngx_http_php_keepalive_init(cf->pool, pscf->keepalive_conf);
+    *zp = zone;
 
     return NGX_CONF_OK;
 }
 
+char *
+ngx_http_php_conf_cache(ngx_conf_t *cf, ngx_command_t *cmd, void *conf)
+{
+    ngx_http_php_loc_conf_t *plcf = conf;
+    ngx_http_php_main_conf_t *pmcf;
+    ngx_http_compile_complex_value_t ccv;
+    ngx_shm_zone_t **zp;
+    ngx_str_t *value;
+
+    if (plcf->cache_zone != NGX_CONF_UNSET_PTR) {
+        return "is duplicate";
+    }
+
+    value = cf->args->elts;
+
+    if (cf->args->nelts == 2) {
+        if (ngx_strcmp(value[1].data, "off") == 0) {
+            plcf->cache_zone = NULL;
+            return NGX_CONF_OK;
+        }
+
+        return "takes \"off\" or a zone, a key and a ttl";
+    }
+
+    if (cf->args->nelts != 4) {
+        return "takes \"off\" or a zone, a key and a ttl";
+    }
+
+    /* 
+     * declared by php_shared_dict, possibly further down, 
+     * ngx_http_php_init() checks it once every zone is known 
+     */
+    plcf->cache_zone = ngx_shared_memory_add(cf, &value[1], 0, &ngx_http_php_module);
+    if (plcf->cache_zone == NULL) {
+        return NGX_CONF_ERROR;
+    }
+
+    pmcf = ngx_http_conf_get_module_main_conf(cf, ngx_http_php_module);
+
+    if (pmcf->cache_zones == NULL) {
+        pmcf->cache_zones = ngx_array_create(cf->pool, 2, sizeof(ngx_shm_zone_t *));
+        if (pmcf->cache_zones == NULL) {
+            return NGX_CONF_ERROR;
+        }
+    }
+
+    zp = ngx_array_push(pmcf->cache_zones);
+    if (zp == NULL) {
+        return NGX_CONF_ERROR;
+    }
+
+    *zp = plcf->cache_zone;
+
+    plcf->cache_key = ngx_palloc(cf->pool, sizeof(ngx_http_complex_value_t));
+    if (plcf->cache_key == NULL) {
+        return NGX_CONF_ERROR;
+    }
+
+    ngx_memzero(&ccv, sizeof(ngx_http_compile_complex_value_t));
+
+    ccv.cf = cf;
+    ccv.value = &value[2];
+    ccv.complex_value = plcf->cache_key;
+
+    if (ngx_http_compile_complex_value(&ccv) != NGX_OK) {
+        return NGX_CONF_ERROR;
+    }
+
+    plcf->cache_ttl = ngx_parse_time(&value[3], 0);
+    if (plcf->cache_ttl == (ngx_msec_t) NGX_ERROR || plcf->cache_ttl == 0) {
+        ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+                           "invalid php_cache ttl \"%V\"", &value[3]);
+        return NGX_CONF_ERROR;
+    }
+
+    return NGX_CONF_OK;
+}
+
+char *
+ngx_http_php_conf_counter_zone(ngx_conf_t *cf, ngx_command_t *cmd, void *conf)
+{
+    ngx_http_php_main_conf_t *pmcf = conf;
+    ngx_str_t *value, name;
+    ssize_t size;
+
+    if (pmcf->counter_zone) {
+        return "is duplicate";
+    }
+
+    value = cf->args->elts;
+
+    size = ngx_parse_size(&value[1]);
+    if (size == NGX_ERROR || size < (ssize_t) (8 * ngx_pagesize)) {
+        ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+                           "invalid php_counter_zone size \"%V\"", &value[1]);
+        return NGX_CONF_ERROR;
+    }
+
+    ngx_str_set(&name, NGX_HTTP_PHP_COUNTER_ZONE);
+
+    pmcf->counter_zone = ngx_shared_memory_add(cf, &name, (size_t) size, 
+                                               &ngx_http_php_module);
+    if (pmcf->counter_zone == NULL) {
+        return NGX_CONF_ERROR;
+    }
+
+    pmcf->counter_zone->init = ngx_http_php_counter_init_zone;
+
+    return NGX_CONF_OK;
+}
+
+char *
+ngx_http_php_conf_shared_queue(ngx_conf_t *cf, ngx_command_t *cmd, void *conf)
+{
+    ngx_http_php_main_conf_t *pmcf = conf;
+    ngx_http_php_queue_ctx_t *ctx;
+    ngx_shm_zone_t *zone, **zp;
+    ngx_str_t *value, name;
+    ssize_t size;
+
+    value = cf->args->elts;
+
+    name = value[1];
+    if (name.len == 0) {
+        ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+                           "invalid php_shared_queue name \"%V\"", &name);
+        return NGX_CONF_ERROR;
+    }
+
+    size = ngx_parse_size(&value[2]);
+    if (size == NGX_ERROR || size < (ssize_t) (8 * ngx_pagesize)) {
+        ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+                           "invalid php_shared_queue size \"%V\"", &value[2]);
+        return NGX_CONF_ERROR;
+    }
+
+    ctx = ngx_pcalloc(cf->pool, sizeof(ngx_http_php_queue_ctx_t));
+    if (ctx == NULL) {
+        return NGX_CONF_ERROR;
+    }
+
+    ctx->name = name;
+    ctx->cycle = cf->cycle;
+
+    zone = ngx_shared_memory_add(cf, &name, (size_t) size, &ngx_http_php_module);
+    if (zone == NULL) {
+        return NGX_CONF_ERROR;
+    }
+
+    if (zone->data) {
+        ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+                           "php_shared_queue \"%V\" is already defined", &name);
+        return NGX_CONF_ERROR;
+    }
+
+    zone->init = ngx_http_php_queue_init_zone;
+    zone->data = ctx;
+
+    if (pmcf->queue_zones == NULL) {
+        pmcf->queue_zones = ngx_array_create(cf->pool, 2, sizeof(ngx_shm_zone_t *));
+        if (pmcf->queue_zones == NULL) {
+            return NGX_CONF_ERROR;
+        }
+    }
+
+    zp = ngx_array_push(pmcf->queue_zones);
+    if (zp == NULL) {
+        return NGX_CONF_ERROR;
+    }
+
+    *zp = zone;
+
+    return NGX_CONF_OK;
+}
+
+char *
+ngx_http_php_conf_status(ngx_conf_t *cf, ngx_command_t *cmd, void *conf)
+{
+    ngx_http_php_main_conf_t *pmcf;
+    ngx_http_core_loc_conf_t *clcf;
+
+    pmcf = ngx_http_conf_get_module_main_conf(cf, ngx_http_php_module);
+    clcf = ngx_http_conf_get_module_loc_conf(cf, ngx_http_core_module);
+
+    if (clcf->handler != NULL) {
+        return "is duplicate";
+    }
+
+    clcf->handler = ngx_http_php_stat_handler;
+
+    pmcf->enabled_status = 1;
+
+    return NGX_CONF_OK;
+}
+
+char *
+ngx_http_php_conf_profile_path(ngx_conf_t *cf, ngx_command_t *cmd, void *conf)
+{
+#if (NGX_HTTP_PHP_HAVE_PROFILE)
+    ngx_http_php_main_conf_t *pmcf = conf;
+    ngx_str_t *value, name;
+
+    if (pmcf->profile_zone) {
+        return "is duplicate";
+    }
+
+    value = cf->args->elts;
+
+    pmcf->profile_path = value[1];
+
+    while (pmcf->profile_path.len > 1 
+           && pmcf->profile_path.data[pmcf->profile_path.len - 1] == '/') 
+    {
+        pmcf->profile_path.len--;
+    }
+
+    if (ngx_conf_full_name(cf->cycle, &pmcf->profile_path, 0) != NGX_OK) {
+        return NGX_CONF_ERROR;
+    }
+
+    ngx_str_set(&name, NGX_HTTP_PHP_PROFILE_ZONE);
+
+    pmcf->profile_zone = ngx_shared_memory_add(cf, &name, 8 * ngx_pagesize, 
+                                               &ngx_http_php_module);
+    if (pmcf->profile_zone == NULL) {
+        return NGX_CONF_ERROR;
+    }
+
+    pmcf->profile_zone->init = ngx_http_php_profile_init_zone;
+
+    return NGX_CONF_OK;
+#else
+    return "needs php 7.1 or later and posix timers";
+#endif
+}
+
+char *
+ngx_http_php_conf_profile(ngx_conf_t *cf, ngx_command_t *cmd, void *conf)
+{
+    ngx_http_core_loc_conf_t *clcf;
+
+    clcf = ngx_http_conf_get_module_loc_conf(cf, ngx_http_core_module);
+
+    if (clcf->handler != NULL) {
+        return "is duplicate";
+    }
+
+    clcf->handler = ngx_http_php_profile_handler;
+
+    return NGX_CONF_OK;
+}
+
+char *
+ngx_http_php_conf_slowlog(ngx_conf_t *cf, ngx_command_t *cmd, void *conf)
+{
+    ngx_http_php_loc_conf_t *plcf = conf;
+    ngx_http_php_main_conf_t *pmcf;
+    ngx_str_t *value;
+
+    if (plcf->slowlog != NGX_CONF_UNSET_PTR) {
+        return "is duplicate";
+    }
+
+    value = cf->args->elts;
+
+    if (ngx_strcmp(value[1].data, "off") == 0) {
+        plcf->slowlog = NULL;
+        return NGX_CONF_OK;
+    }
+
+    /* reopened with the other logs on USR1 */
+    plcf->slowlog = ngx_conf_open_file(cf->cycle, &value[1]);
+    if (plcf->slowlog == NULL) {
+        return NGX_CONF_ERROR;
+    }
+
+    pmcf = ngx_http_conf_get_module_main_conf(cf, ngx_http_php_module);
+    pmcf->enabled_slowlog = 1;
+
+    return NGX_CONF_OK;
+}
+
+char *
+ngx_http_php_conf_trace(ngx_conf_t *cf, ngx_command_t *cmd, void *conf)
+{
+    ngx_http_php_loc_conf_t *plcf = conf;
+    ngx_http_php_main_conf_t *pmcf;
+    ngx_str_t *value;
+
+    if (plcf->trace_format != NGX_CONF_UNSET_UINT) {
+        return "is duplicate";
+    }
+
+    value = cf->args->elts;
+
+    plcf->trace_format = NGX_HTTP_PHP_TRACE_JSON;
+
+    if (ngx_strcmp(value[1].data, "off") == 0) {
+        if (cf->args->nelts > 2) {
+            return "takes no format with \"off\"";
+        }
+
+        ngx_str_null(&plcf->trace_path);
+        return NGX_CONF_OK;
+    }
+
+    if (cf->args->nelts > 2) {
+        if (ngx_strcmp(value[2].data, "pprof") == 0) {
+            plcf->trace_format = NGX_HTTP_PHP_TRACE_PPROF;
+
+        } else if (ngx_strcmp(value[2].data, "json") != 0) {
+            ngx_conf_log_error(NGX_LOG_EMERG, cf, 0, 
+                               "invalid trace format \"%V\"", &value[2]);
+            return NGX_CONF_ERROR;
+        }
+    }
+
+    plcf->trace_path = value[1];
+
+    while (plcf->trace_path.len > 1 
+           && plcf->trace_path.data[plcf->trace_path.len - 1] == '/') 
+    {
+        plcf->trace_path.len--;
+    }
+
+    if (ngx_conf_full_name(cf->cycle, &plcf->trace_path, 0) != NGX_OK) {
+        return NGX_CONF_ERROR;
+    }
+
+    pmcf = ngx_http_conf_get_module_main_conf(cf, ngx_http_php_module);
+    pmcf->enabled_trace = 1;
+
+    return NGX_CONF_OK;
+}
+
+char *
+ngx_http_php_conf_memcheck(ngx_conf_t *cf, ngx_command_t *cmd, void *conf)
+{
+    ngx_http_php_main_conf_t *pmcf;
+    ngx_http_php_loc_conf_t *plcf = conf;
+    ngx_str_t *value;
+    ngx_int_t window;
+
+    if (plcf->memcheck != NGX_CONF_UNSET_PTR) {
+        return "is duplicate";
+    }
+
+    value = cf->args->elts;
+
+    if (ngx_strcmp(value[1].data, "off") == 0) {
+        if (cf->args->nelts > 2) {
+            return "takes no window with \"off\"";
+        }
+
+        plcf->memcheck = NULL;
+        return NGX_CONF_OK;
+    }
+
+    if (cf->args->nelts > 2) {
+        if (ngx_strncmp(value[2].data, "window=", 7) != 0) {
+            ngx_conf_log_error(NGX_LOG_EMERG, cf, 0, 
+                               "invalid parameter \"%V\"", &value[2]);
+            return NGX_CONF_ERROR;
+        }
+
+        window = ngx_atoi(value[2].data + 7, value[2].len - 7);
+        if (window == NGX_ERROR || window == 0) {
+            ngx_conf_log_error(NGX_LOG_EMERG, cf, 0, 
+                               "invalid window \"%V\"", &value[2]);
+            return NGX_CONF_ERROR;
+        }
+
+        plcf->memcheck_window = (ngx_uint_t) window;
+    }
+
+    plcf->memcheck = ngx_conf_open_file(cf->cycle, &value[1]);
+    if (plcf->memcheck == NULL) {
+        return NGX_CONF_ERROR;
+    }
+
+    pmcf = ngx_http_conf_get_module_main_conf(cf, ngx_http_php_module);
+    pmcf->enabled_memcheck = 1;
+
+    return NGX_CONF_OK;
+}
+
+char *
+ngx_http_php_conf_preload(ngx_conf_t *cf, ngx_command_t *cmd, void *conf)
+{
+    ngx_http_php_main_conf_t *pmcf = conf;
+    ngx_str_t *value;
+
+    if (pmcf->preload != NGX_CONF_UNSET) {
+        return "is duplicate";
+    }
+
+    value = cf->args->elts;
+
+    if (ngx_strcmp(value[1].data, "off") == 0) {
+        pmcf->preload = 0;
+        return NGX_CONF_OK;
+    }
+
+    pmcf->preload = 1;
+
+    if (ngx_strcmp(value[1].data, "on") == 0) {
+        return NGX_CONF_OK;
+    }
+
+    pmcf->preload_code = ngx_http_php_code_from_file(cf->pool, &value[1]);
+    if (pmcf->preload_code == NGX_CONF_UNSET_PTR) {
+        return NGX_CONF_ERROR;
+    }
+
+    return NGX_CONF_OK;
+}
+
+char *
+ngx_http_php_conf_file_watch(ngx_conf_t *cf, ngx_command_t *cmd, void *conf)
+{
+    ngx_http_php_main_conf_t *pmcf = conf;
+    ngx_str_t *value, *path, name;
+    ngx_uint_t i;
+
+    if (pmcf->file_watch != NGX_CONF_UNSET) {
+        return "is duplicate";
+    }
+
+    value = cf->args->elts;
+
+    if (cf->args->nelts == 2 && ngx_strcmp(value[1].data, "off") == 0) {
+        pmcf->file_watch = 0;
+        return NGX_CONF_OK;
+    }
+
+    pmcf->file_watch = 1;
+
+    if (cf->args->nelts == 2 && ngx_strcmp(value[1].data, "on") == 0) {
+        return NGX_CONF_OK;
+    }
+
+    pmcf->file_watch_paths = ngx_array_create(cf->pool, 4, sizeof(ngx_str_t));
+    if (pmcf->file_watch_paths == NULL) {
+        return NGX_CONF_ERROR;
+    }
+
+    for (i = 1; i < cf->args->nelts; i++) {
+        name = value[i];
+
+        while (name.len > 1 && name.data[name.len - 1] == '/') {
+            name.len--;
+        }
+
+        if (ngx_conf_full_name(cf->cycle, &name, 1) != NGX_OK) {
+            return NGX_CONF_ERROR;
+        }
+
+        path = ngx_array_push(pmcf->file_watch_paths);
+        if (path == NULL) {
+            return NGX_CONF_ERROR;
+        }
+
+        /* inotify_add_watch() takes a null-terminated path */
+
+        path->data = ngx_pnalloc(cf->pool, name.len + 1);
+        if (path->data == NULL) {
+            return NGX_CONF_ERROR;
+        }
+
+        ngx_cpystrn(path->data, name.data, name.len + 1);
+        path->len = name.len;
+    }
+
+    return NGX_CONF_OK;
+}
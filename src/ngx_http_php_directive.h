@@ -78,6 +78,18 @@ char *ngx_http_php_body_filter_inline_phase(ngx_conf_t *cf, ngx_command_t *cmd,
 char *ngx_http_php_body_filter_block_phase(ngx_conf_t *cf, ngx_command_t *cmd, void *conf);
 
 char *ngx_http_php_conf_keepalive(ngx_conf_t *cf, ngx_command_t *cmd, void *conf);
-char *ngx_http_php_conf_socket_keepalive(ngx_conf_t *cf, ngx_command_t *cmd, void *conf);
+char *ngx_http_php_conf_thread_pool(ngx_conf_t *cf, ngx_command_t *cmd, void *conf);
+char *ngx_http_php_conf_shared_dict(ngx_conf_t *cf, ngx_command_t *cmd, void *conf);
+char *ngx_http_php_conf_cache(ngx_conf_t *cf, ngx_command_t *cmd, void *conf);
+char *ngx_http_php_conf_counter_zone(ngx_conf_t *cf, ngx_command_t *cmd, void *conf);
+char *ngx_http_php_conf_shared_queue(ngx_conf_t *cf, ngx_command_t *cmd, void *conf);
+char *ngx_http_php_conf_status(ngx_conf_t *cf, ngx_command_t *cmd, void *conf);
+char *ngx_http_php_conf_profile_path(ngx_conf_t *cf, ngx_command_t *cmd, void *conf);
+char *ngx_http_php_conf_profile(ngx_conf_t *cf, ngx_command_t *cmd, void *conf);
+char *ngx_http_php_conf_slowlog(ngx_conf_t *cf, ngx_command_t *cmd, void *conf);
+char *ngx_http_php_conf_trace(ngx_conf_t *cf, ngx_command_t *cmd, void *conf);
+char *ngx_http_php_conf_memcheck(ngx_conf_t *cf, ngx_command_t *cmd, void *conf);
+char *ngx_http_php_conf_preload(ngx_conf_t *cf, ngx_command_t *cmd, void *conf);
+char *ngx_http_php_conf_file_watch(ngx_conf_t *cf, ngx_command_t *cmd, void *conf);
 
 #endif
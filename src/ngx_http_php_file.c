@@ -0,0 +1,297 @@
+/*
+==============================================================================
+Copyright (c) 2016-2020, rryqszq4 <rryqszq@gmail.com>
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+
+* Redistributions of source code must retain the above copyright notice, this
+  list of conditions and the following disclaimer.
+
+* Redistributions in binary form must reproduce the above copyright notice,
+  this list of conditions and the following disclaimer in the documentation
+  and/or other materials provided with the distribution.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+==============================================================================
+*/
+
+#include "ngx_http_php_module.h"
+#include "ngx_http_php_file.h"
+#include "ngx_http_php_sleep.h"
+#include "ngx_http_php_zend_uthread.h"
+
+static void ngx_http_php_file_run(ngx_http_php_file_task_t *ft);
+static void ngx_http_php_file_result(ngx_http_php_file_task_t *ft, zval *retval);
+
+#if (NGX_THREADS)
+static void ngx_http_php_file_thread_handler(void *data, ngx_log_t *log);
+static void ngx_http_php_file_event_handler(ngx_event_t *ev);
+#endif
+
+ngx_http_php_file_task_t *
+ngx_http_php_file_task(ngx_http_request_t *r)
+{
+    ngx_http_php_file_task_t    *ft;
+#if (NGX_THREADS)
+    ngx_thread_task_t           *task;
+
+    task = ngx_thread_task_alloc(r->pool, sizeof(ngx_http_php_file_task_t));
+    if (task == NULL) {
+        return NULL;
+    }
+
+    ft = task->ctx;
+    ngx_memzero(ft, sizeof(ngx_http_php_file_task_t));
+    ft->task = task;
+#else
+
+    ft = ngx_pcalloc(r->pool, sizeof(ngx_http_php_file_task_t));
+    if (ft == NULL) {
+        return NULL;
+    }
+#endif
+
+    ft->request = r;
+
+    return ft;
+}
+
+ngx_int_t 
+ngx_http_php_file_post(ngx_http_request_t *r, ngx_http_php_file_task_t *ft)
+{
+    ngx_http_php_ctx_t          *ctx;
+#if (NGX_THREADS)
+    ngx_thread_task_t           *task;
+    ngx_http_php_loc_conf_t     *plcf;
+
+    plcf = ngx_http_get_module_loc_conf(r, ngx_http_php_module);
+
+    if (plcf->thread_pool) {
+        task = ft->task;
+
+        task->handler = ngx_http_php_file_thread_handler;
+        task->event.handler = ngx_http_php_file_event_handler;
+        task->event.data = ft;
+
+        if (ngx_thread_task_post(plcf->thread_pool, task) != NGX_OK) {
+            return NGX_ERROR;
+        }
+
+        /* keeps the request, and ft with it, until the task is back */
+        r->main->blocked++;
+
+        return NGX_OK;
+    }
+#endif
+
+    /* no php_thread_pool, done here, blocking */
+
+    ctx = ngx_http_get_module_ctx(r, ngx_http_php_module);
+
+    ngx_http_php_file_run(ft);
+    ngx_http_php_file_result(ft, &ctx->yield_retval);
+
+    ctx->delay_time = 0;
+    ngx_http_php_sleep(r);
+
+    return NGX_OK;
+}
+
+static void 
+ngx_http_php_file_run(ngx_http_php_file_task_t *ft)
+{
+    ngx_fd_t        fd;
+    ssize_t         n;
+    size_t          size;
+
+    fd = NGX_INVALID_FILE;
+
+    switch (ft->op) {
+
+    case NGX_HTTP_PHP_FILE_STAT:
+        if (ngx_file_info(ft->path.data, &ft->fi) == NGX_FILE_ERROR) {
+            ft->err = ngx_errno;
+        }
+
+        return;
+
+    case NGX_HTTP_PHP_FILE_READ:
+        fd = ngx_open_file(ft->path.data, NGX_FILE_RDONLY, NGX_FILE_OPEN, 0);
+        if (fd == NGX_INVALID_FILE) {
+            ft->err = ngx_errno;
+            return;
+        }
+
+        if (ngx_fd_info(fd, &ft->fi) == NGX_FILE_ERROR) {
+            ft->err = ngx_errno;
+            break;
+        }
+
+        size = (size_t) ngx_file_size(&ft->fi);
+
+        ft->buf = malloc(size ? size : 1);
+        if (ft->buf == NULL) {
+            ft->err = NGX_ENOMEM;
+            break;
+        }
+
+        while (ft->n < size) {
+            n = read(fd, ft->buf + ft->n, size - ft->n);
+
+            if (n == -1) {
+                if (ngx_errno == NGX_EINTR) {
+                    continue;
+                }
+
+                ft->err = ngx_errno;
+                break;
+            }
+
+            if (n == 0) {
+                /* truncated meanwhile */
+                break;
+            }
+
+            ft->n += n;
+        }
+
+        break;
+
+    default: /* NGX_HTTP_PHP_FILE_WRITE, NGX_HTTP_PHP_FILE_APPEND */
+        if (ft->op == NGX_HTTP_PHP_FILE_APPEND) {
+            fd = ngx_open_file(ft->path.data, NGX_FILE_APPEND, NGX_FILE_CREATE_OR_OPEN, 
+                               NGX_FILE_DEFAULT_ACCESS);
+
+        } else {
+            fd = ngx_open_file(ft->path.data, NGX_FILE_WRONLY, NGX_FILE_TRUNCATE, 
+                               NGX_FILE_DEFAULT_ACCESS);
+        }
+
+        if (fd == NGX_INVALID_FILE) {
+            ft->err = ngx_errno;
+            return;
+        }
+
+        while (ft->n < ft->data.len) {
+            n = write(fd, ft->data.data + ft->n, ft->data.len - ft->n);
+
+            if (n == -1) {
+                if (ngx_errno == NGX_EINTR) {
+                    continue;
+                }
+
+                ft->err = ngx_errno;
+                break;
+            }
+
+            ft->n += n;
+        }
+
+        break;
+    }
+
+    if (ngx_close_file(fd) == NGX_FILE_ERROR && ft->err == 0) {
+        ft->err = ngx_errno;
+    }
+}
+
+static void 
+ngx_http_php_file_result(ngx_http_php_file_task_t *ft, zval *retval)
+{
+    ngx_http_request_t      *r = ft->request;
+
+    if (ft->err) {
+        ngx_log_error(NGX_LOG_ERR, r->connection->log, ft->err, 
+                      "ngx_php file operation on \"%V\" failed", &ft->path);
+
+        if (ft->buf) {
+            free(ft->buf);
+            ft->buf = NULL;
+        }
+
+        ZVAL_FALSE(retval);
+        return;
+    }
+
+    switch (ft->op) {
+
+    case NGX_HTTP_PHP_FILE_READ:
+        ZVAL_STRINGL(retval, (char *) ft->buf, ft->n);
+        free(ft->buf);
+        ft->buf = NULL;
+        break;
+
+    case NGX_HTTP_PHP_FILE_STAT:
+        array_init_size(retval, 5);
+        add_assoc_long(retval, "size", (zend_long) ngx_file_size(&ft->fi));
+        add_assoc_long(retval, "mtime", (zend_long) ngx_file_mtime(&ft->fi));
+        add_assoc_long(retval, "mode", (zend_long) ngx_file_access(&ft->fi));
+        add_assoc_bool(retval, "is_file", ngx_is_file(&ft->fi));
+        add_assoc_bool(retval, "is_dir", ngx_is_dir(&ft->fi));
+        break;
+
+    default:
+        ZVAL_LONG(retval, (zend_long) ft->n);
+        break;
+    }
+}
+
+#if (NGX_THREADS)
+
+static void 
+ngx_http_php_file_thread_handler(void *data, ngx_log_t *log)
+{
+    ngx_http_php_file_task_t    *ft = data;
+
+    ngx_http_php_file_run(ft);
+}
+
+static void 
+ngx_http_php_file_event_handler(ngx_event_t *ev)
+{
+    ngx_connection_t            *c;
+    ngx_http_request_t          *r;
+    ngx_http_php_ctx_t          *ctx;
+    ngx_http_php_file_task_t    *ft;
+
+    ft = ev->data;
+    r = ft->request;
+    c = r->connection;
+
+    r->main->blocked--;
+
+    ctx = ngx_http_get_module_ctx(r, ngx_http_php_module);
+
+    if (c->error || ctx == NULL) {
+
+        /* the request was terminated while the task ran */
+
+        if (ft->buf) {
+            free(ft->buf);
+            ft->buf = NULL;
+        }
+
+        r->write_event_handler(r);
+        ngx_http_run_posted_requests(c);
+        return;
+    }
+
+    ngx_http_php_file_result(ft, &ctx->yield_retval);
+
+    ngx_http_php_zend_uthread_resume(r);
+
+    ngx_http_run_posted_requests(c);
+}
+
+#endif
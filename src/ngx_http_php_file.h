@@ -0,0 +1,59 @@
+/*
+==============================================================================
+Copyright (c) 2016-2020, rryqszq4 <rryqszq@gmail.com>
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+
+* Redistributions of source code must retain the above copyright notice, this
+  list of conditions and the following disclaimer.
+
+* Redistributions in binary form must reproduce the above copyright notice,
+  this list of conditions and the following disclaimer in the documentation
+  and/or other materials provided with the distribution.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+==============================================================================
+*/
+
+#ifndef __NGX_HTTP_PHP_FILE_H__
+#define __NGX_HTTP_PHP_FILE_H__
+
+#include "ngx_http_php_module.h"
+
+#define NGX_HTTP_PHP_FILE_READ      1
+#define NGX_HTTP_PHP_FILE_WRITE     2
+#define NGX_HTTP_PHP_FILE_APPEND    3
+#define NGX_HTTP_PHP_FILE_STAT      4
+
+typedef struct {
+    ngx_http_request_t      *request;
+    void                    *task;
+
+    ngx_uint_t              op;
+    ngx_str_t               path;
+    ngx_str_t               data;
+
+    /* filled in by the thread, nothing there may touch the pool or php */
+    ngx_err_t               err;
+    size_t                  n;
+    u_char                  *buf;
+    ngx_file_info_t         fi;
+} ngx_http_php_file_task_t;
+
+ngx_http_php_file_task_t *ngx_http_php_file_task(ngx_http_request_t *r);
+
+ngx_int_t ngx_http_php_file_post(ngx_http_request_t *r, 
+    ngx_http_php_file_task_t *ft);
+
+#endif
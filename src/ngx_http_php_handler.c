@@ -32,6 +32,9 @@ OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 #include "ngx_http_php_handler.h"
 #include "ngx_http_php_request.h"
 #include "ngx_http_php_zend_uthread.h"
+#include "ngx_http_php_cache.h"
+#include "ngx_http_php_stat.h"
+#include "ngx_http_php_run.h"
 //#include "ngx_http_php_subrequest.h"
 
 //#include "php/php_ngx_location.h"
@@ -50,9 +53,50 @@ static void ngx_http_php_content_file_uthread_routine(void *data);
 
 static void ngx_http_php_read_request_body_callback(ngx_http_request_t *r);
 
+static ngx_int_t ngx_http_php_exec(ngx_http_request_t *r, ngx_http_php_ctx_t *ctx, 
+    ngx_uint_t finalize);
+
 static ngx_http_output_header_filter_pt ngx_http_next_header_filter;
 static ngx_http_output_body_filter_pt ngx_http_next_body_filter;
 
+static ngx_int_t 
+ngx_http_php_exec(ngx_http_request_t *r, ngx_http_php_ctx_t *ctx, ngx_uint_t finalize)
+{
+    ngx_str_t   uri, args;
+
+    uri = ctx->exec_uri;
+    args = ctx->exec_args;
+
+    ngx_str_null(&ctx->exec_uri);
+    ngx_str_null(&ctx->exec_args);
+
+    ngx_php_debug("exec: %*s", (int) uri.len, uri.data);
+
+    /* the module ctx is cleared by the redirect, the output is dropped */
+
+    if (uri.data[0] == '@') {
+        if (args.len) {
+            r->args = args;
+        }
+
+        (void) ngx_http_named_location(r, &uri);
+
+    } else {
+        (void) ngx_http_internal_redirect(r, &uri, &args);
+    }
+
+    /* 
+     * the redirect holds a reference of its own, the content phase 
+     * releases ours on NGX_DONE, rewrite and access phases do not
+     */
+
+    if (finalize) {
+        ngx_http_finalize_request(r, NGX_DONE);
+    }
+
+    return NGX_DONE;
+}
+
 ngx_int_t
 ngx_http_php_post_read_handler(ngx_http_request_t *r)
 {
@@ -61,7 +105,7 @@ ngx_http_php_post_read_handler(ngx_http_request_t *r)
     ngx_php_request = r;
     ctx = ngx_http_get_module_ctx(r, ngx_http_php_module);
     if (ctx == NULL) {
-        ctx = ngx_pcalloc(r->pool, sizeof(*ctx));
+        ctx = ngx_http_php_ctx_create(r);
         if (ctx == NULL) {
             return NGX_ERROR;
         }
@@ -104,11 +148,16 @@ ngx_http_php_rewrite_file_uthread_routine(void *data)
     ngx_php_request = r;
 
     ngx_php_set_request_status(NGX_DECLINED);
+
+    ngx_http_php_run_enter(r, NGX_HTTP_PHP_STAT_REWRITE);
+
     zend_first_try {
 
         ngx_php_eval_file(r, pmcf->state, plcf->rewrite_code);
         
     }zend_end_try();
+
+    ngx_http_php_run_leave(r);
 }
 
 /*
@@ -160,7 +209,7 @@ ngx_http_php_rewrite_file_handler(ngx_http_request_t *r)
     ctx = ngx_http_get_module_ctx(r, ngx_http_php_module);
 
     if ( ctx == NULL ) {
-        ctx = ngx_pcalloc(r->pool, sizeof(*ctx));
+        ctx = ngx_http_php_ctx_create(r);
         if ( ctx == NULL ) {
             return NGX_ERROR;
         }
@@ -209,6 +258,10 @@ set_output:
 
     ctx->phase_status = NGX_DECLINED;
 
+    if (ctx->exec_uri.len) {
+        return ngx_http_php_exec(r, ctx, 1);
+    }
+
     if ( rc == NGX_OK || rc == NGX_HTTP_OK ) {
 
         chain = ctx->rputs_chain;
@@ -265,7 +318,7 @@ ngx_http_php_rewrite_inline_handler(ngx_http_request_t *r)
     ctx = ngx_http_get_module_ctx(r, ngx_http_php_module);
 
     if ( ctx == NULL ) {
-        ctx = ngx_pcalloc(r->pool, sizeof(*ctx));
+        ctx = ngx_http_php_ctx_create(r);
         if ( ctx == NULL ) {
             return NGX_ERROR;
         }
@@ -350,6 +403,10 @@ set_output:
 
     ctx->phase_status = NGX_DECLINED;
 
+    if (ctx->exec_uri.len) {
+        return ngx_http_php_exec(r, ctx, 1);
+    }
+
     if ( rc == NGX_OK || rc == NGX_HTTP_OK ) {
         chain = ctx->rputs_chain;
 
@@ -413,11 +470,16 @@ ngx_http_php_access_file_uthread_routine(void *data)
     ngx_php_request = r;
 
     ngx_php_set_request_status(NGX_DECLINED);
+
+    ngx_http_php_run_enter(r, NGX_HTTP_PHP_STAT_ACCESS);
+
     zend_first_try {
 
         ngx_php_eval_file(r, pmcf->state, plcf->access_code);
 
     }zend_end_try();
+
+    ngx_http_php_run_leave(r);
 }
 
 /*
@@ -468,7 +530,7 @@ ngx_http_php_access_file_handler(ngx_http_request_t *r)
     ctx = ngx_http_get_module_ctx(r, ngx_http_php_module);
 
     if (ctx == NULL) {
-        ctx = ngx_pcalloc(r->pool, sizeof(*ctx));
+        ctx = ngx_http_php_ctx_create(r);
         if (ctx == NULL) {
             return NGX_ERROR;
         }
@@ -519,6 +581,10 @@ set_output:
 
     ctx->phase_status = NGX_DECLINED;
 
+    if (ctx->exec_uri.len) {
+        return ngx_http_php_exec(r, ctx, 1);
+    }
+
     if (rc == NGX_OK || rc == NGX_HTTP_OK) {
 
         chain = ctx->rputs_chain;
@@ -577,7 +643,7 @@ ngx_http_php_access_inline_handler(ngx_http_request_t *r)
     ctx = ngx_http_get_module_ctx(r, ngx_http_php_module);
 
     if (ctx == NULL) {
-        ctx = ngx_pcalloc(r->pool, sizeof(*ctx));
+        ctx = ngx_http_php_ctx_create(r);
         if (ctx == NULL) {
             return NGX_ERROR;
         }
@@ -664,6 +730,10 @@ set_output:
 
     ctx->phase_status = NGX_DECLINED;
 
+    if (ctx->exec_uri.len) {
+        return ngx_http_php_exec(r, ctx, 1);
+    }
+
     if (rc == NGX_OK || rc == NGX_HTTP_OK) {
 
         chain = ctx->rputs_chain;
@@ -728,11 +798,16 @@ ngx_http_php_content_file_uthread_routine(void *data)
     ngx_php_request = r;
 
     ngx_php_set_request_status(NGX_OK);
+
+    ngx_http_php_run_enter(r, NGX_HTTP_PHP_STAT_CONTENT);
+
     zend_first_try {
 
         ngx_php_eval_file(r, pmcf->state, plcf->content_code);
 
     }zend_end_try();
+
+    ngx_http_php_run_leave(r);
 }
 
 /*
@@ -855,11 +930,12 @@ ngx_http_php_content_file_handler(ngx_http_request_t *r)
     ngx_int_t rc;
     ngx_http_php_rputs_chain_list_t *chain;
     ngx_http_php_ctx_t *ctx;
+    ngx_http_php_loc_conf_t *plcf;
 
     ctx = ngx_http_get_module_ctx(r, ngx_http_php_module);
 
     if (ctx == NULL) {
-        ctx = ngx_pcalloc(r->pool, sizeof(*ctx));
+        ctx = ngx_http_php_ctx_create(r);
         if (ctx == NULL) {
             return NGX_ERROR;
         }
@@ -874,6 +950,15 @@ ngx_http_php_content_file_handler(ngx_http_request_t *r)
 
     ngx_php_set_request_status(NGX_OK);
 
+    plcf = ngx_http_get_module_loc_conf(r, ngx_http_php_module);
+
+    if (plcf->cache_zone && ctx->phase_status == NGX_DECLINED) {
+        rc = ngx_http_php_cache_handler(r, ctx);
+        if (rc != NGX_DECLINED) {
+            return rc;
+        }
+    }
+
     /*if (r->method == NGX_HTTP_POST) {
         return ngx_http_php_content_post_handler(r);
     }*/
@@ -942,6 +1027,10 @@ set_output:
 
     ctx->phase_status = NGX_DECLINED;
 
+    if (ctx->exec_uri.len) {
+        return ngx_http_php_exec(r, ctx, 0);
+    }
+
     if (rc == NGX_OK || rc == NGX_DECLINED) {
 
         chain = ctx->rputs_chain;
@@ -990,6 +1079,8 @@ set_output:
             (*chain->last)->buf->last_buf = 1;
         }
 
+        ngx_http_php_cache_store(r, ctx, chain->out);
+
         rc = ngx_http_send_header(r);
         if (rc != NGX_OK){
             return rc;
@@ -1020,11 +1111,12 @@ ngx_http_php_content_inline_handler(ngx_http_request_t *r)
     ngx_int_t rc;
     ngx_http_php_rputs_chain_list_t *chain;
     ngx_http_php_ctx_t *ctx;
+    ngx_http_php_loc_conf_t *plcf;
 
     ctx = ngx_http_get_module_ctx(r, ngx_http_php_module);
 
     if (ctx == NULL) {
-        ctx = ngx_pcalloc(r->pool, sizeof(*ctx));
+        ctx = ngx_http_php_ctx_create(r);
         if (ctx == NULL) {
             return NGX_ERROR;
         }
@@ -1038,6 +1130,15 @@ ngx_http_php_content_inline_handler(ngx_http_request_t *r)
 
     ngx_php_set_request_status(NGX_OK);
 
+    plcf = ngx_http_get_module_loc_conf(r, ngx_http_php_module);
+
+    if (plcf->cache_zone && ctx->phase_status == NGX_DECLINED) {
+        rc = ngx_http_php_cache_handler(r, ctx);
+        if (rc != NGX_DECLINED) {
+            return rc;
+        }
+    }
+
     /*if (r->method == NGX_HTTP_POST) {
         return ngx_http_php_content_post_handler(r);
     }*/
@@ -1123,6 +1224,10 @@ set_output:
     }
 
     ctx->phase_status = NGX_DECLINED;
+
+    if (ctx->exec_uri.len) {
+        return ngx_http_php_exec(r, ctx, 0);
+    }
     
     if (rc == NGX_ERROR 
             || rc == NGX_HTTP_MOVED_TEMPORARILY 
@@ -1182,6 +1287,8 @@ set_output:
             (*chain->last)->buf->last_buf = 1;
         }
 
+        ngx_http_php_cache_store(r, ctx, chain->out);
+
         rc = ngx_http_send_header(r);
         if (rc != NGX_OK){
             return rc;
@@ -1223,7 +1330,7 @@ ngx_http_php_opcode_inline_handler(ngx_http_request_t *r)
     ctx = ngx_http_get_module_ctx(r, ngx_http_php_module);
 
     if (ctx == NULL){
-        ctx = ngx_pcalloc(r->pool, sizeof(*ctx));
+        ctx = ngx_http_php_ctx_create(r);
         if (ctx == NULL){
             return NGX_ERROR;
         }
@@ -1331,7 +1438,7 @@ ngx_http_php_stack_inline_handler(ngx_http_request_t *r)
     ctx = ngx_http_get_module_ctx(r, ngx_http_php_module);
 
     if (ctx == NULL){
-        ctx = ngx_pcalloc(r->pool, sizeof(*ctx));
+        ctx = ngx_http_php_ctx_create(r);
         if (ctx == NULL){
             return NGX_ERROR;
         }
@@ -29,112 +29,266 @@ OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 #include "ngx_http_php_module.h"
 #include "ngx_http_php_keepalive.h"
 
-ngx_int_t 
-ngx_http_php_keepalive_init(ngx_pool_t *pool, ngx_http_php_keepalive_conf_t *kc)
+static ngx_http_php_keepalive_pool_t *ngx_http_php_keepalive_pool = NULL;
+
+static ngx_str_t *ngx_http_php_keepalive_key(ngx_peer_connection_t *pc, 
+    ngx_http_php_keepalive_opt_t *opt, ngx_str_t *key, u_char *text);
+static void ngx_http_php_keepalive_drop(ngx_http_php_keepalive_cache_t *item);
+
+static ngx_str_t *
+ngx_http_php_keepalive_key(ngx_peer_connection_t *pc, 
+    ngx_http_php_keepalive_opt_t *opt, ngx_str_t *key, u_char *text)
 {
-    ngx_http_php_keepalive_cache_t  *cached;
-    ngx_uint_t                      i;
+    if (opt->name.len) {
+        *key = opt->name;
+        return key;
+    }
 
-    cached = ngx_pcalloc(pool, sizeof(ngx_http_php_keepalive_cache_t) * kc->max_cached);
+    key->data = text;
+    key->len = ngx_sock_ntop(pc->sockaddr, pc->socklen, text, 
+                             NGX_SOCKADDR_STRLEN, 1);
+    if (key->len == 0) {
+        return NULL;
+    }
 
-    if ( cached == NULL ) {
-        return NGX_ERROR;
+    return key;
+}
+
+ngx_http_php_keepalive_peer_t *
+ngx_http_php_keepalive_lookup(ngx_peer_connection_t *pc, 
+    ngx_http_php_keepalive_opt_t *opt, ngx_uint_t create)
+{
+    ngx_http_php_keepalive_pool_t   *kp;
+    ngx_http_php_keepalive_peer_t   *kpeer;
+    ngx_str_node_t                  *sn;
+    ngx_str_t                       key;
+    uint32_t                        hash;
+    u_char                          text[NGX_SOCKADDR_STRLEN];
+
+    kp = ngx_http_php_keepalive_pool;
+
+    if (kp == NULL) {
+        if (!create) {
+            return NULL;
+        }
+
+        /* lives as long as the worker, connections are recycled in place */
+
+        kp = ngx_pcalloc(ngx_cycle->pool, sizeof(ngx_http_php_keepalive_pool_t));
+        if (kp == NULL) {
+            return NULL;
+        }
+
+        kp->pool = ngx_cycle->pool;
+        ngx_rbtree_init(&kp->rbtree, &kp->sentinel, ngx_str_rbtree_insert_value);
+
+        /* idle backend connections must leave room for the clients */
+
+        ngx_queue_init(&kp->cache);
+        kp->max_cached = ngx_max(ngx_cycle->connection_n / 2, 1);
+
+        ngx_http_php_keepalive_pool = kp;
+    }
+
+    if (ngx_http_php_keepalive_key(pc, opt, &key, text) == NULL) {
+        return NULL;
     }
 
-    ngx_queue_init(&kc->cache);
-    ngx_queue_init(&kc->free);
+    hash = ngx_crc32_short(key.data, key.len);
 
-    for (i = 0; i < kc->max_cached; i++) {
-        ngx_queue_insert_head(&kc->free, &cached[i].queue);
-        cached[i].keepalilve_conf = kc;
+    sn = ngx_str_rbtree_lookup(&kp->rbtree, &key, hash);
+    if (sn != NULL) {
+        return (ngx_http_php_keepalive_peer_t *) sn;
     }
 
-    return NGX_OK;
+    if (!create) {
+        return NULL;
+    }
+
+    kpeer = ngx_pcalloc(kp->pool, sizeof(ngx_http_php_keepalive_peer_t));
+    if (kpeer == NULL) {
+        return NULL;
+    }
+
+    kpeer->sn.str.data = ngx_pstrdup(kp->pool, &key);
+    if (kpeer->sn.str.data == NULL) {
+        return NULL;
+    }
+
+    kpeer->sn.str.len = key.len;
+    kpeer->sn.node.key = hash;
+
+    ngx_queue_init(&kpeer->cache);
+    ngx_queue_init(&kpeer->free);
+
+    ngx_rbtree_insert(&kp->rbtree, &kpeer->sn.node);
+
+    ngx_log_debug1(NGX_LOG_DEBUG_HTTP, pc->log, 0,
+                   "php keepalive new pool \"%V\"", &kpeer->sn.str);
+
+    return kpeer;
 }
 
 ngx_int_t 
-ngx_http_php_keepalive_get_peer(ngx_peer_connection_t *pc, void *data)
+ngx_http_php_keepalive_get_peer(ngx_peer_connection_t *pc, 
+    ngx_http_php_keepalive_opt_t *opt)
 {
     ngx_http_php_keepalive_cache_t  *item;
-    ngx_http_php_keepalive_conf_t   *kc = data;
-    ngx_queue_t                     *q, *cache;
+    ngx_http_php_keepalive_peer_t   *kpeer;
+    ngx_queue_t                     *q;
     ngx_connection_t                *c;
 
-    cache = &kc->cache;
-
     ngx_php_debug("get_peer");
 
-    for (q = ngx_queue_head(cache); 
-         q != ngx_queue_sentinel(cache);
-         q = ngx_queue_next(q)) 
-    {
-        item = ngx_queue_data(q, ngx_http_php_keepalive_cache_t, queue);
-        c = item->connection;
+    opt->reused = 0;
+
+    kpeer = ngx_http_php_keepalive_lookup(pc, opt, 0);
+    if (kpeer == NULL || ngx_queue_empty(&kpeer->cache)) {
+        return NGX_OK;
+    }
 
-        if (ngx_memn2cmp((u_char *) &item->sockaddr, (u_char *) pc->sockaddr, item->socklen, pc->socklen) == 0)
-        {
-            ngx_php_debug("get_cache_peer");
-            ngx_queue_remove(q);
-            ngx_queue_insert_head(&kc->free, q);
+    /* LIFO, the most recently released connection is the warmest one */
 
-            c->idle = 0;
-            c->log = pc->log;
+    q = ngx_queue_head(&kpeer->cache);
+    ngx_queue_remove(q);
+    ngx_queue_insert_head(&kpeer->free, q);
+    kpeer->cached--;
+
+    item = ngx_queue_data(q, ngx_http_php_keepalive_cache_t, queue);
+
+    ngx_queue_remove(&item->pool_queue);
+    ngx_http_php_keepalive_pool->cached--;
+    c = item->connection;
+
+    ngx_php_debug("get_cache_peer");
+
+    ngx_log_debug2(NGX_LOG_DEBUG_HTTP, pc->log, 0,
+                   "php keepalive get cached connection %p from \"%V\"", 
+                   c, &kpeer->sn.str);
+
+    if (c->read->timer_set) {
+        ngx_del_timer(c->read);
+    }
+
+    c->idle = 0;
+    c->log = pc->log;
 #if defined(nginx_version) && (nginx_version >= 1001004)
-            c->pool->log = pc->log;
+    c->pool->log = pc->log;
 #endif
-            c->read->log = pc->log;
-            c->write->log = pc->log;
+    c->read->log = pc->log;
+    c->write->log = pc->log;
 
-            pc->connection = c;
-            pc->cached = 1;
+    pc->connection = c;
+    pc->cached = 1;
 
-            if (ngx_add_event(c->read, NGX_READ_EVENT, NGX_CLEAR_EVENT) == NGX_ERROR){
-                return NGX_ERROR;
-            }
+    opt->reused = item->requests;
+    opt->data = item->data;
 
-            return NGX_DONE;
-        }
+    if (ngx_add_event(c->read, NGX_READ_EVENT, NGX_CLEAR_EVENT) == NGX_ERROR){
+        return NGX_ERROR;
     }
 
-    return NGX_OK;
+    return NGX_DONE;
 }
 
-void 
-ngx_http_php_keepalive_free_peer(ngx_peer_connection_t *pc, void *data, ngx_uint_t state)
+ngx_int_t 
+ngx_http_php_keepalive_free_peer(ngx_peer_connection_t *pc, 
+    ngx_http_php_keepalive_opt_t *opt, ngx_uint_t state)
 {
     ngx_http_php_keepalive_cache_t  *item;
-    ngx_http_php_keepalive_conf_t   *kc = data;
+    ngx_http_php_keepalive_peer_t   *kpeer;
+    ngx_http_php_keepalive_pool_t   *kp;
     ngx_queue_t                     *q;
     ngx_connection_t                *c;
+    ngx_uint_t                      requests;
 
-    if (state & NGX_PEER_FAILED) {
+    c = pc->connection;
 
+    if (c == NULL || opt->max_cached == 0) {
+        return NGX_DECLINED;
     }
 
-    c = pc->connection;
+    if (state & NGX_PEER_FAILED
+        || c->read->eof
+        || c->read->error
+        || c->read->timedout
+        || c->write->error
+        || c->write->timedout)
+    {
+        return NGX_DECLINED;
+    }
+
+    requests = opt->reused + 1;
+
+    if (opt->requests && requests >= opt->requests) {
+        ngx_log_debug1(NGX_LOG_DEBUG_HTTP, pc->log, 0,
+                       "php keepalive connection used %ui times, closing", 
+                       requests);
+        return NGX_DECLINED;
+    }
 
     if (ngx_handle_read_event(c->read, 0) != NGX_OK) {
-        return ;
+        return NGX_DECLINED;
+    }
+
+    kpeer = ngx_http_php_keepalive_lookup(pc, opt, 1);
+    if (kpeer == NULL) {
+        return NGX_DECLINED;
     }
 
+    kpeer->max_cached = opt->max_cached;
+    kpeer->timeout = opt->timeout;
+    kpeer->requests = opt->requests;
+
     ngx_php_debug("free_peer");
 
-    if (ngx_queue_empty(&kc->free)) {
-        q = ngx_queue_last(&kc->cache);
-        ngx_queue_remove(q);
+    kp = ngx_http_php_keepalive_pool;
+
+    /* 
+     * the pool of the key is full (its size may just have been lowered), 
+     * or all keys together hold as many idle connections as the worker 
+     * allows: drop the least recently used ones
+     */
 
+    while (kpeer->cached && kpeer->cached >= kpeer->max_cached) {
+        q = ngx_queue_last(&kpeer->cache);
         item = ngx_queue_data(q, ngx_http_php_keepalive_cache_t, queue);
 
-        ngx_http_php_keepalive_close(item->connection);
-    }else {
-        q = ngx_queue_head(&kc->free);
+        ngx_http_php_keepalive_drop(item);
+    }
+
+    while (kp->cached && kp->cached >= kp->max_cached) {
+        q = ngx_queue_last(&kp->cache);
+        item = ngx_queue_data(q, ngx_http_php_keepalive_cache_t, pool_queue);
+
+        ngx_http_php_keepalive_drop(item);
+    }
+
+    if (ngx_queue_empty(&kpeer->free)) {
+
+        item = ngx_palloc(kp->pool, sizeof(ngx_http_php_keepalive_cache_t));
+        if (item == NULL) {
+            return NGX_DECLINED;
+        }
+
+        item->peer = kpeer;
+
+    } else {
+        q = ngx_queue_head(&kpeer->free);
         ngx_queue_remove(q);
 
         item = ngx_queue_data(q, ngx_http_php_keepalive_cache_t, queue);
     }
 
-    ngx_queue_insert_head(&kc->cache, q);
+    ngx_queue_insert_head(&kpeer->cache, &item->queue);
+    kpeer->cached++;
+
+    ngx_queue_insert_head(&kp->cache, &item->pool_queue);
+    kp->cached++;
+
     item->connection = c;
+    item->requests = requests;
+    item->data = opt->data;
 
     pc->connection = NULL;
 
@@ -145,6 +299,10 @@ ngx_http_php_keepalive_free_peer(ngx_peer_connection_t *pc, void *data, ngx_uint
         ngx_del_timer(c->write);
     }
 
+    if (kpeer->timeout) {
+        ngx_add_timer(c->read, kpeer->timeout);
+    }
+
     c->write->handler = ngx_http_php_keepalive_dummy_handler;
     c->read->handler = ngx_http_php_keepalive_close_handler;
 
@@ -158,6 +316,11 @@ ngx_http_php_keepalive_free_peer(ngx_peer_connection_t *pc, void *data, ngx_uint
     item->socklen = pc->socklen;
     ngx_memcpy(&item->sockaddr, pc->sockaddr, pc->socklen);
 
+    if (c->read->ready) {
+        ngx_http_php_keepalive_close_handler(c->read);
+    }
+
+    return NGX_OK;
 }
 
 void 
@@ -172,7 +335,7 @@ void
 ngx_http_php_keepalive_close_handler(ngx_event_t *ev)
 {
     ngx_http_php_keepalive_cache_t  *item;
-    ngx_http_php_keepalive_conf_t   *kc;
+    ngx_http_php_keepalive_peer_t   *kpeer;
 
     int                 n;
     char                buf[1];
@@ -180,7 +343,7 @@ ngx_http_php_keepalive_close_handler(ngx_event_t *ev)
 
     c = ev->data;
 
-    if (c->close) {
+    if (c->close || ev->timedout) {
         goto close;
     }
 
@@ -198,22 +361,40 @@ ngx_http_php_keepalive_close_handler(ngx_event_t *ev)
 
 close:
     item = c->data;
-    kc = item->keepalilve_conf;
+    kpeer = item->peer;
+
+    ngx_log_debug2(NGX_LOG_DEBUG_HTTP, ev->log, 0,
+                   "php keepalive close cached connection %p from \"%V\"", 
+                   c, &kpeer->sn.str);
+
+    ngx_http_php_keepalive_drop(item);
+}
+
+/* closes a cached connection, its item is kept on the free list of the key */
+static void
+ngx_http_php_keepalive_drop(ngx_http_php_keepalive_cache_t *item)
+{
+    ngx_http_php_keepalive_peer_t   *kpeer;
 
-    ngx_http_php_keepalive_close(c);
+    kpeer = item->peer;
+
+    ngx_http_php_keepalive_close(item->connection);
 
     ngx_queue_remove(&item->queue);
-    ngx_queue_insert_head(&kc->free, &item->queue);
+    ngx_queue_insert_head(&kpeer->free, &item->queue);
+    kpeer->cached--;
+
+    ngx_queue_remove(&item->pool_queue);
+    ngx_http_php_keepalive_pool->cached--;
 }
 
 void 
 ngx_http_php_keepalive_close(ngx_connection_t *c)
 {
+    if (c->read->timer_set) {
+        ngx_del_timer(c->read);
+    }
+
     ngx_destroy_pool(c->pool);
     ngx_close_connection(c);
 }
-
-
-
-
-
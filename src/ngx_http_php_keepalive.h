@@ -32,30 +32,92 @@ OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 #include <ngx_core.h>
 #include <ngx_http.h>
 
+#define NGX_HTTP_PHP_KEEPALIVE_DEFAULT_SIZE     30
+#define NGX_HTTP_PHP_KEEPALIVE_DEFAULT_TIMEOUT  60000
+
+/*
+ * Server level defaults, set by php_keepalive / php_socket_keepalive.
+ * The connections themselves are cached in a per worker pool, keyed by
+ * peer address (or by an explicit pool name), see below.
+ */
 typedef struct {
 
-    ngx_pool_t      *pool;
     ngx_uint_t      max_cached;
-    ngx_queue_t     cache;
-    ngx_queue_t     free;
+    ngx_msec_t      timeout;
+    ngx_uint_t      requests;
 
 } ngx_http_php_keepalive_conf_t;
 
 typedef struct {
 
-    ngx_http_php_keepalive_conf_t   *keepalilve_conf;
+    ngx_rbtree_t        rbtree;
+    ngx_rbtree_node_t   sentinel;
+    ngx_pool_t          *pool;
+
+    /* idle connections of every key, most recently released first */
+    ngx_queue_t         cache;
+    ngx_uint_t          cached;
+
+    /* half of worker_connections, whatever the number of keys */
+    ngx_uint_t          max_cached;
+
+} ngx_http_php_keepalive_pool_t;
+
+/* one node per key, holding a LIFO queue of idle connections */
+typedef struct {
+
+    ngx_str_node_t      sn;
+
+    ngx_uint_t          max_cached;
+    ngx_uint_t          cached;
+    ngx_msec_t          timeout;
+    ngx_uint_t          requests;
+
+    ngx_queue_t         cache;
+    ngx_queue_t         free;
+
+} ngx_http_php_keepalive_peer_t;
+
+typedef struct {
+
+    ngx_http_php_keepalive_peer_t   *peer;
     ngx_queue_t                     queue;
+    ngx_queue_t                     pool_queue;
     ngx_connection_t                *connection;
+    ngx_uint_t                      requests;
+    void                            *data;
     struct sockaddr_storage         sockaddr;
     socklen_t                       socklen;
 
 } ngx_http_php_keepalive_cache_t;
 
-ngx_int_t ngx_http_php_keepalive_init(ngx_pool_t *pool, ngx_http_php_keepalive_conf_t *kc);
+/* per connection pool parameters, filled by the socket layer */
+typedef struct {
+
+    ngx_str_t       name;
+    ngx_uint_t      max_cached;
+    ngx_msec_t      timeout;
+    ngx_uint_t      requests;
 
-ngx_int_t ngx_http_php_keepalive_get_peer(ngx_peer_connection_t *pc, void *data);
+    /* times the current connection has been handed out by the pool */
+    ngx_uint_t      reused;
 
-void ngx_http_php_keepalive_free_peer(ngx_peer_connection_t *pc, void *data, ngx_uint_t state);
+    /* 
+     * protocol state bound to the connection (e.g. prepared statements), 
+     * allocated from c->pool and kept while the connection is cached 
+     */
+    void            *data;
+
+} ngx_http_php_keepalive_opt_t;
+
+ngx_http_php_keepalive_peer_t *ngx_http_php_keepalive_lookup(ngx_peer_connection_t *pc,
+    ngx_http_php_keepalive_opt_t *opt, ngx_uint_t create);
+
+ngx_int_t ngx_http_php_keepalive_get_peer(ngx_peer_connection_t *pc, 
+    ngx_http_php_keepalive_opt_t *opt);
+
+ngx_int_t ngx_http_php_keepalive_free_peer(ngx_peer_connection_t *pc, 
+    ngx_http_php_keepalive_opt_t *opt, ngx_uint_t state);
 
 void ngx_http_php_keepalive_dummy_handler(ngx_event_t *ev);
 
@@ -64,4 +126,3 @@ void ngx_http_php_keepalive_close_handler(ngx_event_t *ev);
 void ngx_http_php_keepalive_close(ngx_connection_t *c);
 
 #endif
-
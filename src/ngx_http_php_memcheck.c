@@ -0,0 +1,242 @@
+/*
+==============================================================================
+Copyright (c) 2016-2020, rryqszq4 <rryqszq@gmail.com>
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+
+* Redistributions of source code must retain the above copyright notice, this
+  list of conditions and the following disclaimer.
+
+* Redistributions in binary form must reproduce the above copyright notice,
+  this list of conditions and the following disclaimer in the documentation
+  and/or other materials provided with the distribution.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+==============================================================================
+*/
+
+#include "ngx_http_php_module.h"
+#include "ngx_http_php_run.h"
+#include "ngx_http_php_memcheck.h"
+
+struct ngx_http_php_memcheck_req_s {
+    ngx_http_request_t          *request;
+
+    /* at the first php code of the request */
+    size_t                      heap;
+    size_t                      pool;
+};
+
+typedef struct {
+    ngx_uint_t                  requests;
+
+    /* the least heap seen at the end of a request, with none in flight */
+    size_t                      rest;
+    size_t                      busy;
+
+    size_t                      pool;
+    ngx_uint_t                  large;
+} ngx_http_php_memcheck_window_t;
+
+static void ngx_http_php_memcheck_report(ngx_http_php_memcheck_req_t *mc);
+static size_t ngx_http_php_memcheck_pool(ngx_pool_t *pool, ngx_uint_t *large);
+
+/* the php heap is the worker's, so are the windows */
+static ngx_http_php_memcheck_window_t ngx_http_php_memcheck_window;
+
+static ngx_uint_t ngx_http_php_memcheck_in_flight;
+static ngx_uint_t ngx_http_php_memcheck_windows;
+static ngx_uint_t ngx_http_php_memcheck_streak;
+static size_t ngx_http_php_memcheck_last;
+static size_t ngx_http_php_memcheck_first;
+
+/* The php code of a phase starts: the first one of a request counts. */
+void
+ngx_http_php_memcheck_enter(ngx_http_php_run_t *run)
+{
+    ngx_http_php_loc_conf_t     *plcf;
+    ngx_http_php_memcheck_req_t *mc;
+    ngx_http_request_t          *r;
+
+    r = run->request;
+
+    plcf = ngx_http_get_module_loc_conf(r, ngx_http_php_module);
+
+    if (plcf->memcheck == NULL || run->memcheck) {
+        return;
+    }
+
+    mc = ngx_palloc(r->pool, sizeof(ngx_http_php_memcheck_req_t));
+    if (mc == NULL) {
+        return;
+    }
+
+    mc->request = r;
+    mc->heap = zend_memory_usage(0);
+    mc->pool = ngx_http_php_memcheck_pool(r->pool, NULL);
+
+    run->memcheck = mc;
+
+    ngx_http_php_memcheck_in_flight++;
+}
+
+/* 
+ * The end of a request: whatever its php code left on the heap stays 
+ * there, the worker runs a single php request for its lifetime.
+ */
+void
+ngx_http_php_memcheck_done(ngx_http_php_memcheck_req_t *mc)
+{
+    ngx_http_php_memcheck_window_t  *w;
+    ngx_http_php_loc_conf_t         *plcf;
+    ngx_http_request_t              *r;
+    ngx_uint_t                      large;
+    size_t                          heap, pool;
+
+    r = mc->request;
+    w = &ngx_http_php_memcheck_window;
+
+    ngx_http_php_memcheck_in_flight--;
+
+    heap = zend_memory_usage(0);
+    pool = ngx_http_php_memcheck_pool(r->pool, &large);
+
+    ngx_log_debug6(NGX_LOG_DEBUG_HTTP, r->connection->log, 0, 
+                   "php memcheck: heap %uz -> %uz, pool %uz -> %uz, "
+                   "%ui large, %ui in flight", 
+                   mc->heap, heap, mc->pool, pool, large, 
+                   ngx_http_php_memcheck_in_flight);
+
+    if (ngx_http_php_memcheck_in_flight == 0) {
+        if (w->rest == 0 || heap < w->rest) {
+            w->rest = heap;
+        }
+
+    } else {
+        if (w->busy == 0 || heap < w->busy) {
+            w->busy = heap;
+        }
+    }
+
+    w->pool = ngx_max(w->pool, pool);
+    w->large = ngx_max(w->large, large);
+
+    plcf = ngx_http_get_module_loc_conf(r, ngx_http_php_module);
+
+    if (++w->requests >= plcf->memcheck_window) {
+        ngx_http_php_memcheck_report(mc);
+    }
+}
+
+/* 
+ * [time] pid N, 1000 requests, heap 1843200 bytes at rest (+0), 
+ * request pool up to 4096 bytes and 0 large
+ */
+static void
+ngx_http_php_memcheck_report(ngx_http_php_memcheck_req_t *mc)
+{
+    ngx_http_php_memcheck_window_t  *w;
+    ngx_http_php_loc_conf_t         *plcf;
+    ngx_http_request_t              *r;
+    size_t                          heap;
+    double                          rate;
+    u_char                          buf[1024];
+    u_char                          *p, *last;
+
+    r = mc->request;
+    w = &ngx_http_php_memcheck_window;
+
+    plcf = ngx_http_get_module_loc_conf(r, ngx_http_php_module);
+
+    heap = w->rest ? w->rest : w->busy;
+
+    if (ngx_http_php_memcheck_windows && heap > ngx_http_php_memcheck_last) {
+
+        if (ngx_http_php_memcheck_streak++ == 0) {
+            ngx_http_php_memcheck_first = ngx_http_php_memcheck_last;
+        }
+
+    } else {
+        ngx_http_php_memcheck_streak = 0;
+    }
+
+    p = buf;
+    last = buf + sizeof(buf) - 1;
+
+    p = ngx_slprintf(p, last, "[%V] pid %P, %ui requests, heap %uz bytes %s (%s%O), "
+                     "request pool up to %uz bytes and %ui large", 
+                     &ngx_cached_err_log_time, ngx_pid, w->requests, heap, 
+                     w->rest ? "at rest" : "busy", 
+                     heap >= ngx_http_php_memcheck_last ? "+" : "", 
+                     ngx_http_php_memcheck_windows 
+                         ? (off_t) heap - (off_t) ngx_http_php_memcheck_last : 0, 
+                     w->pool, w->large);
+
+    if (ngx_http_php_memcheck_streak 
+        && ngx_http_php_memcheck_streak % NGX_HTTP_PHP_MEMCHECK_STREAK == 0) 
+    {
+        rate = (double) (heap - ngx_http_php_memcheck_first) 
+               / (ngx_http_php_memcheck_streak * w->requests);
+
+        p = ngx_slprintf(p, last, ", growing for %ui windows: %.1f bytes per request, "
+                         "last %V %V", ngx_http_php_memcheck_streak, rate, 
+                         &r->method_name, &r->uri);
+
+        ngx_log_error(NGX_LOG_WARN, ngx_cycle->log, 0, 
+                      "php heap grew for %ui windows of %ui requests in a row, "
+                      "%.1f bytes per request", 
+                      ngx_http_php_memcheck_streak, w->requests, rate);
+    }
+
+    *p++ = '\n';
+
+    if (plcf->memcheck) {
+        (void) ngx_write_fd(plcf->memcheck->fd, buf, p - buf);
+    }
+
+    ngx_http_php_memcheck_last = heap;
+    ngx_http_php_memcheck_windows++;
+
+    ngx_memzero(w, sizeof(ngx_http_php_memcheck_window_t));
+}
+
+/* the bytes used of the blocks, the large allocations have no size */
+static size_t
+ngx_http_php_memcheck_pool(ngx_pool_t *pool, ngx_uint_t *large)
+{
+    ngx_pool_t          *p;
+    ngx_pool_large_t    *l;
+    size_t              size;
+    ngx_uint_t          n;
+
+    size = 0;
+
+    for (p = pool; p; p = p->d.next) {
+        size += p->d.last - (u_char *) p;
+    }
+
+    if (large) {
+        n = 0;
+
+        for (l = pool->large; l; l = l->next) {
+            if (l->alloc) {
+                n++;
+            }
+        }
+
+        *large = n;
+    }
+
+    return size;
+}
@@ -34,6 +34,10 @@ OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 #include "php/impl/php_ngx_var.h"
 #include "php/impl/php_ngx_sockets.h"
 #include "php/impl/php_ngx_header.h"
+#include "php/impl/php_ngx_redis.h"
+#include "php/impl/php_ngx_mysql.h"
+#include "php/impl/php_ngx_memcached.h"
+#include "php/impl/php_ngx_shared.h"
 
 #include <ngx_core.h>
 #include <ngx_http.h>
@@ -43,6 +47,15 @@ OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 #include "ngx_http_php_module.h"
 #include "ngx_http_php_directive.h"
 #include "ngx_http_php_handler.h"
+#include "ngx_http_php_shdict.h"
+#include "ngx_http_php_queue.h"
+#include "ngx_http_php_stat.h"
+#include "ngx_http_php_profile.h"
+#include "ngx_http_php_slowlog.h"
+#include "ngx_http_php_trace.h"
+#include "ngx_http_php_memcheck.h"
+#include "ngx_http_php_preload.h"
+#include "ngx_http_php_watch.h"
 
 // http init
 static ngx_int_t ngx_http_php_init(ngx_conf_t *cf);
@@ -60,6 +73,14 @@ static char *ngx_http_php_merge_loc_conf(ngx_conf_t *cf, void *parent, void *chi
 static ngx_int_t ngx_http_php_init_worker(ngx_cycle_t *cycle);
 static void ngx_http_php_exit_worker(ngx_cycle_t *cycle);
 
+static ngx_int_t ngx_http_php_engine_init(ngx_http_php_main_conf_t *pmcf);
+static void ngx_http_php_engine_shutdown(void);
+static ngx_int_t ngx_http_php_preload_engine(ngx_conf_t *cf, 
+    ngx_http_php_main_conf_t *pmcf);
+
+/* the cycle whose configuration the master preloaded the engine with */
+static ngx_cycle_t *ngx_http_php_engine_cycle;
+
 static ngx_command_t ngx_http_php_commands[] = {
 
     {ngx_string("php_ini_path"),
@@ -69,6 +90,22 @@ static ngx_command_t ngx_http_php_commands[] = {
      0,
      NULL
     },
+
+    {ngx_string("php_preload"),
+     NGX_HTTP_MAIN_CONF|NGX_CONF_TAKE1,
+     ngx_http_php_conf_preload,
+     NGX_HTTP_MAIN_CONF_OFFSET,
+     0,
+     NULL
+    },
+
+    {ngx_string("php_file_watch"),
+     NGX_HTTP_MAIN_CONF|NGX_CONF_1MORE,
+     ngx_http_php_conf_file_watch,
+     NGX_HTTP_MAIN_CONF_OFFSET,
+     0,
+     NULL
+    },
 /*
     {ngx_string("init_by_php"),
      NGX_HTTP_MAIN_CONF|NGX_CONF_TAKE1,
@@ -312,7 +349,7 @@ static ngx_command_t ngx_http_php_commands[] = {
     },
 
     {ngx_string("php_keepalive"),
-     NGX_HTTP_SRV_CONF|NGX_CONF_TAKE1,
+     NGX_HTTP_SRV_CONF|NGX_CONF_TAKE123,
      ngx_http_php_conf_keepalive,
      NGX_HTTP_SRV_CONF_OFFSET,
      0,
@@ -320,8 +357,8 @@ static ngx_command_t ngx_http_php_commands[] = {
     },
 
     {ngx_string("php_socket_keepalive"),
-     NGX_HTTP_SRV_CONF|NGX_CONF_TAKE1,
-     ngx_http_php_conf_socket_keepalive,
+     NGX_HTTP_SRV_CONF|NGX_CONF_TAKE123,
+     ngx_http_php_conf_keepalive,
      NGX_HTTP_SRV_CONF_OFFSET,
      0,
      NULL
@@ -336,6 +373,104 @@ static ngx_command_t ngx_http_php_commands[] = {
      NULL
     },
 
+    {ngx_string("php_thread_pool"),
+     NGX_HTTP_MAIN_CONF|NGX_HTTP_SRV_CONF|NGX_HTTP_LOC_CONF
+          |NGX_CONF_NOARGS|NGX_CONF_TAKE1,
+     ngx_http_php_conf_thread_pool,
+     NGX_HTTP_LOC_CONF_OFFSET,
+     0,
+     NULL
+    },
+
+    {ngx_string("php_shared_dict"),
+     NGX_HTTP_MAIN_CONF|NGX_CONF_TAKE2,
+     ngx_http_php_conf_shared_dict,
+     NGX_HTTP_MAIN_CONF_OFFSET,
+     0,
+     NULL
+    },
+
+    {ngx_string("php_counter_zone"),
+     NGX_HTTP_MAIN_CONF|NGX_CONF_TAKE1,
+     ngx_http_php_conf_counter_zone,
+     NGX_HTTP_MAIN_CONF_OFFSET,
+     0,
+     NULL
+    },
+
+    {ngx_string("php_shared_queue"),
+     NGX_HTTP_MAIN_CONF|NGX_CONF_TAKE2,
+     ngx_http_php_conf_shared_queue,
+     NGX_HTTP_MAIN_CONF_OFFSET,
+     0,
+     NULL
+    },
+
+    {ngx_string("php_cache"),
+     NGX_HTTP_MAIN_CONF|NGX_HTTP_SRV_CONF|NGX_HTTP_LOC_CONF
+          |NGX_CONF_TAKE13,
+     ngx_http_php_conf_cache,
+     NGX_HTTP_LOC_CONF_OFFSET,
+     0,
+     NULL
+    },
+
+    {ngx_string("php_status"),
+     NGX_HTTP_LOC_CONF|NGX_CONF_NOARGS,
+     ngx_http_php_conf_status,
+     NGX_HTTP_LOC_CONF_OFFSET,
+     0,
+     NULL
+    },
+
+    {ngx_string("php_profile_path"),
+     NGX_HTTP_MAIN_CONF|NGX_CONF_TAKE1,
+     ngx_http_php_conf_profile_path,
+     NGX_HTTP_MAIN_CONF_OFFSET,
+     0,
+     NULL
+    },
+
+    {ngx_string("php_profile"),
+     NGX_HTTP_LOC_CONF|NGX_CONF_NOARGS,
+     ngx_http_php_conf_profile,
+     NGX_HTTP_LOC_CONF_OFFSET,
+     0,
+     NULL
+    },
+
+    {ngx_string("php_slowlog"),
+     NGX_HTTP_MAIN_CONF|NGX_HTTP_SRV_CONF|NGX_HTTP_LOC_CONF|NGX_CONF_TAKE1,
+     ngx_http_php_conf_slowlog,
+     NGX_HTTP_LOC_CONF_OFFSET,
+     0,
+     NULL
+    },
+
+    {ngx_string("php_slowlog_timeout"),
+     NGX_HTTP_MAIN_CONF|NGX_HTTP_SRV_CONF|NGX_HTTP_LOC_CONF|NGX_CONF_TAKE1,
+     ngx_conf_set_msec_slot,
+     NGX_HTTP_LOC_CONF_OFFSET,
+     offsetof(ngx_http_php_loc_conf_t, slowlog_timeout),
+     NULL
+    },
+
+    {ngx_string("php_trace"),
+     NGX_HTTP_MAIN_CONF|NGX_HTTP_SRV_CONF|NGX_HTTP_LOC_CONF|NGX_CONF_TAKE12,
+     ngx_http_php_conf_trace,
+     NGX_HTTP_LOC_CONF_OFFSET,
+     0,
+     NULL
+    },
+
+    {ngx_string("php_memcheck"),
+     NGX_HTTP_MAIN_CONF|NGX_HTTP_SRV_CONF|NGX_HTTP_LOC_CONF|NGX_CONF_TAKE12,
+     ngx_http_php_conf_memcheck,
+     NGX_HTTP_LOC_CONF_OFFSET,
+     0,
+     NULL
+    },
+
     {ngx_string("php_set"),
      NGX_HTTP_MAIN_CONF|NGX_HTTP_SRV_CONF|NGX_HTTP_LOC_CONF|NGX_HTTP_LIF_CONF
         |NGX_CONF_2MORE,
@@ -389,7 +524,7 @@ static ngx_command_t ngx_http_php_commands[] = {
 };
 
 static ngx_http_module_t ngx_http_php_module_ctx = {
-    NULL,                          /* preconfiguration */
+    ngx_http_php_stat_add_variables, /* preconfiguration */
     ngx_http_php_init,             /* postconfiguration */
 
     ngx_http_php_create_main_conf, /* create main configuration */
@@ -436,12 +571,27 @@ ngx_http_php_init(ngx_conf_t *cf)
 {
     ngx_http_core_main_conf_t *cmcf;
     ngx_http_php_main_conf_t *pmcf;
+    ngx_shm_zone_t **zone;
+    ngx_uint_t i;
+    ngx_str_t mem_peak = ngx_string("php_mem_peak");
 
     cmcf = ngx_http_conf_get_module_main_conf(cf, ngx_http_core_module);
     pmcf = ngx_http_conf_get_module_main_conf(cf, ngx_http_php_module);
 
     ngx_php_request = NULL;
 
+    if (pmcf->cache_zones) {
+        zone = pmcf->cache_zones->elts;
+        for (i = 0; i < pmcf->cache_zones->nelts; i++) {
+            if (zone[i]->init != ngx_http_php_shdict_init_zone) {
+                ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+                                   "\"%V\" is not a php_shared_dict zone",
+                                   &zone[i]->shm.name);
+                return NGX_ERROR;
+            }
+        }
+    }
+
     if (ngx_http_php_handler_init(cmcf, pmcf) != NGX_OK){
         return NGX_ERROR;
     }
@@ -454,6 +604,26 @@ ngx_http_php_init(ngx_conf_t *cf)
         ngx_http_php_body_filter_init();
     }
 
+    if (pmcf->enabled_status) {
+        if (ngx_http_php_stat_add_zone(cf, pmcf) != NGX_OK) {
+            return NGX_ERROR;
+        }
+    }
+
+    if (pmcf->enabled_status || ngx_http_php_stat_variables_used(cf)) {
+        pmcf->enabled_timing = 1;
+    }
+
+    if (ngx_http_php_stat_variable_used(cf, &mem_peak)) {
+        pmcf->enabled_mem_peak = 1;
+    }
+
+    if (pmcf->preload) {
+        if (ngx_http_php_preload_engine(cf, pmcf) != NGX_OK) {
+            return NGX_ERROR;
+        }
+    }
+
     return NGX_OK;
 }
 
@@ -532,6 +702,13 @@ ngx_http_php_handler_init(ngx_http_core_main_conf_t *cmcf, ngx_http_php_main_con
                     }
                     *h = ngx_http_php_log_handler;
                 }
+                if (pmcf->enabled_status) {
+                    h = ngx_array_push(&cmcf->phases[phase].handlers);
+                    if (h == NULL) {
+                        return NGX_ERROR;
+                    }
+                    *h = ngx_http_php_stat_log_handler;
+                }
                 break;
             default:
                 break;
@@ -564,12 +741,24 @@ ngx_http_php_create_main_conf(ngx_conf_t *cf)
     pmcf->init_inline_code = NGX_CONF_UNSET_PTR;
     pmcf->init_worker_inline_code = NGX_CONF_UNSET_PTR;
 
+    pmcf->preload = NGX_CONF_UNSET;
+    pmcf->preload_code = NULL;
+    pmcf->preload_locations = NULL;
+
+    pmcf->file_watch = NGX_CONF_UNSET;
+    pmcf->file_watch_paths = NULL;
+
     return pmcf;
 }
 
 static char *
 ngx_http_php_init_main_conf(ngx_conf_t *cf, void *conf)
 {
+    ngx_http_php_main_conf_t *pmcf = conf;
+
+    ngx_conf_init_value(pmcf->preload, 0);
+    ngx_conf_init_value(pmcf->file_watch, 0);
+
     return NGX_CONF_OK;
 }
 
@@ -589,6 +778,8 @@ ngx_http_php_create_srv_conf(ngx_conf_t *cf)
     }
 
     pscf->keepalive_conf->max_cached = 0;
+    pscf->keepalive_conf->timeout = NGX_HTTP_PHP_KEEPALIVE_DEFAULT_TIMEOUT;
+    pscf->keepalive_conf->requests = 0;
 
     return pscf;
 }
@@ -636,6 +827,21 @@ ngx_http_php_create_loc_conf(ngx_conf_t *cf)
     plcf->send_lowat = NGX_CONF_UNSET_SIZE;
     plcf->buffer_size = NGX_CONF_UNSET_SIZE;
 
+#if (NGX_THREADS)
+    plcf->thread_pool = NGX_CONF_UNSET_PTR;
+#endif
+
+    plcf->cache_zone = NGX_CONF_UNSET_PTR;
+    plcf->cache_ttl = NGX_CONF_UNSET_MSEC;
+
+    plcf->slowlog_timeout = NGX_CONF_UNSET_MSEC;
+    plcf->slowlog = NGX_CONF_UNSET_PTR;
+
+    plcf->trace_format = NGX_CONF_UNSET_UINT;
+
+    plcf->memcheck = NGX_CONF_UNSET_PTR;
+    plcf->memcheck_window = NGX_CONF_UNSET_UINT;
+
     return plcf;
 }
 
@@ -720,6 +926,47 @@ ngx_http_php_merge_loc_conf(ngx_conf_t *cf, void *parent, void *child)
                               prev->buffer_size,
                               (size_t) ngx_pagesize);
 
+#if (NGX_THREADS)
+    ngx_conf_merge_ptr_value(conf->thread_pool, prev->thread_pool, NULL);
+#endif
+
+    if (conf->cache_zone == NGX_CONF_UNSET_PTR) {
+        conf->cache_key = prev->cache_key;
+        conf->cache_ttl = prev->cache_ttl;
+    }
+
+    ngx_conf_merge_ptr_value(conf->cache_zone, prev->cache_zone, NULL);
+
+    ngx_conf_merge_msec_value(conf->slowlog_timeout, prev->slowlog_timeout, 0);
+    ngx_conf_merge_ptr_value(conf->slowlog, prev->slowlog, NULL);
+
+    if (conf->trace_format == NGX_CONF_UNSET_UINT) {
+        conf->trace_path = prev->trace_path;
+    }
+
+    ngx_conf_merge_uint_value(conf->trace_format, prev->trace_format, 
+                              NGX_HTTP_PHP_TRACE_JSON);
+
+    if (conf->memcheck == NGX_CONF_UNSET_PTR) {
+        conf->memcheck_window = prev->memcheck_window;
+    }
+
+    ngx_conf_merge_ptr_value(conf->memcheck, prev->memcheck, NULL);
+    ngx_conf_merge_uint_value(conf->memcheck_window, prev->memcheck_window, 
+                              NGX_HTTP_PHP_MEMCHECK_WINDOW);
+
+    if (ngx_http_php_stat_add_location(cf, prev, conf) != NGX_OK) {
+        return NGX_CONF_ERROR;
+    }
+
+    if (ngx_http_php_preload_add_location(cf, conf) != NGX_OK) {
+        return NGX_CONF_ERROR;
+    }
+
+    if (ngx_http_php_watch_add_location(cf, conf) != NGX_OK) {
+        return NGX_CONF_ERROR;
+    }
+
     return NGX_CONF_OK;
 }
 
@@ -730,28 +977,25 @@ ngx_http_php_init_worker(ngx_cycle_t *cycle)
 
     pmcf = ngx_http_cycle_get_module_main_conf(cycle, ngx_http_php_module);
 
-    php_ngx_module.ub_write = ngx_http_php_code_ub_write;
-    //php_ngx_module.flush = ngx_http_php_code_flush;
-    //php_ngx_module.log_message = ngx_http_php_code_log_message;
-    //php_ngx_module.register_server_variables = ngx_http_php_code_register_server_variables;
-    //php_ngx_module.read_post = ngx_http_php_code_read_post;
-    //php_ngx_module.read_cookies = ngx_http_php_code_read_cookies;
-    //php_ngx_module.header_handler = ngx_http_php_code_header_handler;
+    if (!pmcf->preload || ngx_http_php_engine_cycle != cycle) {
 
-    if (pmcf->ini_path.len != 0){
-        php_ngx_module.php_ini_path_override = (char *)pmcf->ini_path.data;
-    }
-    
-    php_ngx_module_init();
+        if (ngx_http_php_engine_cycle) {
+            /* 
+             * the master preloaded a configuration that failed to load 
+             * or this one has php_preload off, its engine is not ours
+             */
+            ngx_http_php_engine_shutdown();
+            ngx_http_php_engine_cycle = NULL;
+        }
 
-#if PHP_MAJOR_VERSION == 7 && PHP_MINOR_VERSION < 2
-    zend_startup_module(&php_ngx_module_entry);
-#else
-    EG(current_module) = &php_ngx_module_entry;
-    EG(current_module)->type = MODULE_PERSISTENT;
-#endif
+        ngx_http_php_preload_reset(pmcf);
 
-    php_ngx_request_init();
+        if (ngx_http_php_engine_init(pmcf) != NGX_OK) {
+            ngx_log_error(NGX_LOG_EMERG, cycle->log, 0, 
+                          "failed to start the php engine");
+            return NGX_ERROR;
+        }
+    }
 
     if (pmcf->enabled_init_worker_handler) {
         zend_first_try {
@@ -779,7 +1023,67 @@ ngx_http_php_init_worker(ngx_cycle_t *cycle)
     //zend_execute_ex = ngx_execute_ex;
 
     //zend_execute_internal = ngx_execute_internal;
+
+    ngx_http_php_queue_init_worker(cycle);
+
+    ngx_http_php_stat_init_worker(cycle);
+
+    ngx_http_php_profile_init_worker(cycle);
+
+    ngx_http_php_slowlog_init_worker(cycle);
+
+    ngx_http_php_trace_init_worker(cycle);
+
+    ngx_http_php_watch_init_worker(cycle);
+
+    return NGX_OK;
+}
+
+static void 
+ngx_http_php_exit_worker(ngx_cycle_t *cycle)
+{
+    ngx_http_php_profile_exit_worker(cycle);
+
+    ngx_http_php_watch_exit_worker(cycle);
+
+    php_ngx_request_shutdown();
+    php_ngx_module_shutdown();
+}
+
+/* 
+ * Starts php in a worker, or in the master at configuration time with 
+ * php_preload, and registers the ngx classes.
+ */
+static ngx_int_t
+ngx_http_php_engine_init(ngx_http_php_main_conf_t *pmcf)
+{
+    php_ngx_module.ub_write = ngx_http_php_code_ub_write;
+    //php_ngx_module.flush = ngx_http_php_code_flush;
+    //php_ngx_module.log_message = ngx_http_php_code_log_message;
+    //php_ngx_module.register_server_variables = ngx_http_php_code_register_server_variables;
+    //php_ngx_module.read_post = ngx_http_php_code_read_post;
+    //php_ngx_module.read_cookies = ngx_http_php_code_read_cookies;
+    //php_ngx_module.header_handler = ngx_http_php_code_header_handler;
+
+    if (pmcf->ini_path.len != 0){
+        php_ngx_module.php_ini_path_override = (char *)pmcf->ini_path.data;
+    }
     
+    if (php_ngx_module_init() == FAILURE) {
+        return NGX_ERROR;
+    }
+
+#if PHP_MAJOR_VERSION == 7 && PHP_MINOR_VERSION < 2
+    zend_startup_module(&php_ngx_module_entry);
+#else
+    EG(current_module) = &php_ngx_module_entry;
+    EG(current_module)->type = MODULE_PERSISTENT;
+#endif
+
+    if (php_ngx_request_init() == FAILURE) {
+        return NGX_ERROR;
+    }
+
     php_impl_ngx_core_init(0 );
     php_impl_ngx_log_init(0 );
     php_impl_ngx_request_init(0 );
@@ -787,14 +1091,50 @@ ngx_http_php_init_worker(ngx_cycle_t *cycle)
     php_impl_ngx_var_init(0 );
     php_impl_ngx_sockets_init(0 );
     php_impl_ngx_header_init(0 );
+    php_impl_ngx_redis_init(0 );
+    php_impl_ngx_mysql_init(0 );
+    php_impl_ngx_memcached_init(0 );
+    php_impl_ngx_shared_init(0 );
 
     return NGX_OK;
 }
 
-static void 
-ngx_http_php_exit_worker(ngx_cycle_t *cycle)
+static void
+ngx_http_php_engine_shutdown(void)
 {
+    if (zend_error_cb == ngx_php_error_cb) {
+        zend_error_cb = old_zend_error_cb;
+    }
+
     php_ngx_request_shutdown();
     php_ngx_module_shutdown();
 }
 
+/* 
+ * The configuration is read in the master: php starts there and the 
+ * workers fork with its classes, functions and opcache copy-on-write. A 
+ * reload restarts it, the workers of the old cycle keep their own copy.
+ */
+static ngx_int_t
+ngx_http_php_preload_engine(ngx_conf_t *cf, ngx_http_php_main_conf_t *pmcf)
+{
+    if (ngx_http_php_engine_cycle) {
+        ngx_http_php_engine_shutdown();
+        ngx_http_php_engine_cycle = NULL;
+    }
+
+    if (ngx_http_php_engine_init(pmcf) != NGX_OK) {
+        ngx_conf_log_error(NGX_LOG_EMERG, cf, 0, 
+                           "php_preload failed to start the php engine");
+        return NGX_ERROR;
+    }
+
+    ngx_http_php_engine_cycle = cf->cycle;
+
+    if (pmcf->enabled_trace) {
+        ngx_http_php_trace_hook();
+    }
+
+    return ngx_http_php_preload(cf, pmcf);
+}
+
@@ -73,8 +73,44 @@ typedef struct ngx_http_php_main_conf_s {
     unsigned enabled_header_filter:1;
     unsigned enabled_body_filter:1;
 
+    unsigned enabled_status:1;
+    unsigned enabled_timing:1;
+    unsigned enabled_mem_peak:1;
+    unsigned enabled_slowlog:1;
+    unsigned enabled_trace:1;
+    unsigned enabled_memcheck:1;
+
     ngx_http_php_state_t *state;
 
+    /* ngx_shm_zone_t * of every php_shared_dict */
+    ngx_array_t *shdict_zones;
+
+    /* ngx_shm_zone_t * of every php_cache, each must be a php_shared_dict */
+    ngx_array_t *cache_zones;
+
+    ngx_shm_zone_t *counter_zone;
+
+    /* ngx_shm_zone_t * of every php_shared_queue */
+    ngx_array_t *queue_zones;
+
+    /* ngx_http_php_stat_name_t of every location php_status records */
+    ngx_array_t *status_locations;
+    ngx_shm_zone_t *status_zone;
+
+    ngx_str_t profile_path;
+    ngx_shm_zone_t *profile_zone;
+
+    ngx_flag_t preload;
+    ngx_http_php_code_t *preload_code;
+
+    /* ngx_http_php_loc_conf_t * of every location with inline code */
+    ngx_array_t *preload_locations;
+
+    ngx_flag_t file_watch;
+
+    /* ngx_str_t of the directories php_file_watch watches */
+    ngx_array_t *file_watch_paths;
+
 } ngx_http_php_main_conf_t;
 
 typedef struct ngx_http_php_srv_conf_s {
@@ -128,6 +164,27 @@ typedef struct ngx_http_php_loc_conf_s {
     size_t send_lowat;
     size_t buffer_size;
 
+#if (NGX_THREADS)
+    ngx_thread_pool_t *thread_pool;
+#endif
+
+    ngx_shm_zone_t *cache_zone;
+    ngx_http_complex_value_t *cache_key;
+    ngx_msec_t cache_ttl;
+
+    /* 1-based index into status_locations, 0 if not recorded */
+    ngx_uint_t status_slot;
+
+    ngx_msec_t slowlog_timeout;
+    ngx_open_file_t *slowlog;
+
+    /* empty with php_trace off */
+    ngx_str_t trace_path;
+    ngx_uint_t trace_format;
+
+    ngx_open_file_t *memcheck;
+    ngx_uint_t memcheck_window;
+
 } ngx_http_php_loc_conf_t;
 
 #endif
@@ -0,0 +1,318 @@
+/*
+==============================================================================
+Copyright (c) 2016-2020, rryqszq4 <rryqszq@gmail.com>
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+
+* Redistributions of source code must retain the above copyright notice, this
+  list of conditions and the following disclaimer.
+
+* Redistributions in binary form must reproduce the above copyright notice,
+  this list of conditions and the following disclaimer in the documentation
+  and/or other materials provided with the distribution.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+==============================================================================
+*/
+
+#include "ngx_http_php_module.h"
+#include "ngx_http_php_core.h"
+#include "ngx_http_php_zend_uthread.h"
+#include "ngx_http_php_preload.h"
+
+static ngx_int_t ngx_http_php_preload_function(ngx_conf_t *cf, 
+    const char *prefix, ngx_http_php_code_t *code);
+static ngx_int_t ngx_http_php_preload_owner(ngx_conf_t *cf, char *file);
+static size_t ngx_http_php_preload_ub_write(const char *str, size_t str_length);
+
+static ngx_log_t *ngx_http_php_preload_log;
+
+/* The locations with inline code, compiled in the master with php_preload. */
+ngx_int_t
+ngx_http_php_preload_add_location(ngx_conf_t *cf, ngx_http_php_loc_conf_t *plcf)
+{
+    ngx_http_php_main_conf_t    *pmcf;
+    ngx_http_php_loc_conf_t     **loc;
+
+    pmcf = ngx_http_conf_get_module_main_conf(cf, ngx_http_php_module);
+
+    if (!pmcf->preload) {
+        return NGX_OK;
+    }
+
+    if (plcf->rewrite_inline_code == NGX_CONF_UNSET_PTR 
+        && plcf->access_inline_code == NGX_CONF_UNSET_PTR 
+        && plcf->content_inline_code == NGX_CONF_UNSET_PTR 
+        && plcf->log_inline_code == NGX_CONF_UNSET_PTR 
+        && plcf->header_filter_inline_code == NGX_CONF_UNSET_PTR 
+        && plcf->body_filter_inline_code == NGX_CONF_UNSET_PTR)
+    {
+        return NGX_OK;
+    }
+
+    if (pmcf->preload_locations == NULL) {
+        pmcf->preload_locations = ngx_array_create(cf->pool, 16, 
+                                      sizeof(ngx_http_php_loc_conf_t *));
+        if (pmcf->preload_locations == NULL) {
+            return NGX_ERROR;
+        }
+    }
+
+    loc = ngx_array_push(pmcf->preload_locations);
+    if (loc == NULL) {
+        return NGX_ERROR;
+    }
+
+    *loc = plcf;
+
+    return NGX_OK;
+}
+
+/* 
+ * The engine is up in the master: runs the preload file and defines the 
+ * functions of the inline code, the workers fork with them compiled.
+ */
+ngx_int_t
+ngx_http_php_preload(ngx_conf_t *cf, ngx_http_php_main_conf_t *pmcf)
+{
+    ngx_http_php_loc_conf_t     **loc, *plcf;
+    ngx_uint_t                  i;
+    ngx_int_t                   rc;
+    size_t                      (*ub_write)(const char *str, size_t str_length);
+
+    /* no request to write to, the output of the master goes to the log */
+
+    ub_write = sapi_module.ub_write;
+    sapi_module.ub_write = ngx_http_php_preload_ub_write;
+    ngx_http_php_preload_log = cf->log;
+
+    rc = NGX_OK;
+
+    if (pmcf->preload_code 
+        && ngx_http_php_preload_owner(cf, pmcf->preload_code->code.file) != NGX_OK)
+    {
+        rc = NGX_ERROR;
+
+    } else if (pmcf->preload_code) {
+        EG(exit_status) = 0;
+
+        zend_first_try {
+            ngx_php_eval_file(NULL, pmcf->state, pmcf->preload_code);
+        } zend_catch {
+            EG(exit_status) = 255;
+        } zend_end_try();
+
+        if (EG(exception)) {
+            zend_clear_exception();
+            EG(exit_status) = 255;
+        }
+
+        if (EG(exit_status) == 255) {
+            ngx_conf_log_error(NGX_LOG_EMERG, cf, 0, 
+                               "php_preload failed in \"%s\"", 
+                               pmcf->preload_code->code.file);
+            rc = NGX_ERROR;
+        }
+    }
+
+    if (pmcf->preload_locations && rc == NGX_OK) {
+        loc = pmcf->preload_locations->elts;
+
+        for (i = 0; i < pmcf->preload_locations->nelts; i++) {
+            plcf = loc[i];
+
+            if (plcf->rewrite_inline_code != NGX_CONF_UNSET_PTR) {
+                if (ngx_http_php_preload_function(cf, "ngx_rewrite_", 
+                        plcf->rewrite_inline_code) != NGX_OK) 
+                {
+                    rc = NGX_ERROR;
+                    break;
+                }
+                plcf->enabled_rewrite_inline_compile = 1;
+            }
+
+            if (plcf->access_inline_code != NGX_CONF_UNSET_PTR) {
+                if (ngx_http_php_preload_function(cf, "ngx_access_", 
+                        plcf->access_inline_code) != NGX_OK) 
+                {
+                    rc = NGX_ERROR;
+                    break;
+                }
+                plcf->enabled_access_inline_compile = 1;
+            }
+
+            if (plcf->content_inline_code != NGX_CONF_UNSET_PTR) {
+                if (ngx_http_php_preload_function(cf, "ngx_content_", 
+                        plcf->content_inline_code) != NGX_OK) 
+                {
+                    rc = NGX_ERROR;
+                    break;
+                }
+                plcf->enabled_content_inline_compile = 1;
+            }
+
+            if (plcf->log_inline_code != NGX_CONF_UNSET_PTR) {
+                if (ngx_http_php_preload_function(cf, "ngx_log_", 
+                        plcf->log_inline_code) != NGX_OK) 
+                {
+                    rc = NGX_ERROR;
+                    break;
+                }
+                plcf->enabled_log_inline_compile = 1;
+            }
+
+            if (plcf->header_filter_inline_code != NGX_CONF_UNSET_PTR) {
+                if (ngx_http_php_preload_function(cf, "ngx_header_filter_", 
+                        plcf->header_filter_inline_code) != NGX_OK) 
+                {
+                    rc = NGX_ERROR;
+                    break;
+                }
+                plcf->enabled_header_filter_inline_compile = 1;
+            }
+
+            if (plcf->body_filter_inline_code != NGX_CONF_UNSET_PTR) {
+                if (ngx_http_php_preload_function(cf, "ngx_body_filter_", 
+                        plcf->body_filter_inline_code) != NGX_OK) 
+                {
+                    rc = NGX_ERROR;
+                    break;
+                }
+                plcf->enabled_body_filter_inline_compile = 1;
+            }
+        }
+    }
+
+    sapi_module.ub_write = ub_write;
+    ngx_http_php_preload_log = NULL;
+
+    return rc;
+}
+
+/* The engine of the master is not this configuration's, compile on use. */
+void
+ngx_http_php_preload_reset(ngx_http_php_main_conf_t *pmcf)
+{
+    ngx_http_php_loc_conf_t     **loc;
+    ngx_uint_t                  i;
+
+    if (pmcf->preload_locations == NULL) {
+        return;
+    }
+
+    loc = pmcf->preload_locations->elts;
+
+    for (i = 0; i < pmcf->preload_locations->nelts; i++) {
+        loc[i]->enabled_rewrite_inline_compile = 0;
+        loc[i]->enabled_access_inline_compile = 0;
+        loc[i]->enabled_content_inline_compile = 0;
+        loc[i]->enabled_log_inline_compile = 0;
+        loc[i]->enabled_header_filter_inline_compile = 0;
+        loc[i]->enabled_body_filter_inline_compile = 0;
+    }
+}
+
+/* the same wrapper as the uthread routines, an inherited code once */
+static ngx_int_t
+ngx_http_php_preload_function(ngx_conf_t *cf, const char *prefix, 
+    ngx_http_php_code_t *code)
+{
+    ngx_str_t   name, inline_code;
+    size_t      len;
+    volatile int rc;
+
+    len = ngx_strlen(code->code.string);
+
+    inline_code.data = ngx_pnalloc(cf->temp_pool, sizeof("function (){  }") - 1 
+                                   + ngx_strlen(prefix) + code->code_id.len + len);
+    if (inline_code.data == NULL) {
+        return NGX_ERROR;
+    }
+
+    inline_code.len = ngx_sprintf(inline_code.data, "function %s%V(){ %*s }", 
+                                  prefix, &code->code_id, len, code->code.string) 
+                      - inline_code.data;
+
+    name.data = inline_code.data + sizeof("function ") - 1;
+    name.len = ngx_strlen(prefix) + code->code_id.len;
+
+    if (zend_hash_str_exists(EG(function_table), (char *) name.data, name.len)) {
+        return NGX_OK;
+    }
+
+    rc = FAILURE;
+
+    zend_first_try {
+        rc = ngx_http_php_zend_eval_stringl_ex(
+            (char *) inline_code.data, 
+            inline_code.len, 
+            NULL, 
+            "ngx_php eval code", 
+            0
+        );
+    } zend_end_try();
+
+    if (EG(exception)) {
+        zend_clear_exception();
+        rc = FAILURE;
+    }
+
+    if (rc != SUCCESS) {
+        ngx_conf_log_error(NGX_LOG_EMERG, cf, 0, 
+                           "php_preload failed to compile the inline code %V", 
+                           &name);
+        return NGX_ERROR;
+    }
+
+    return NGX_OK;
+}
+
+/* 
+ * The master usually runs as root, so does the preload file: as sudo 
+ * does, it must not be a file another user can change.
+ */
+static ngx_int_t
+ngx_http_php_preload_owner(ngx_conf_t *cf, char *file)
+{
+    ngx_file_info_t     fi;
+
+    if (geteuid() != 0) {
+        return NGX_OK;
+    }
+
+    if (ngx_file_info(file, &fi) == NGX_FILE_ERROR) {
+        ngx_conf_log_error(NGX_LOG_EMERG, cf, ngx_errno, 
+                           ngx_file_info_n " \"%s\" failed", file);
+        return NGX_ERROR;
+    }
+
+    if (fi.st_uid != 0 || (fi.st_mode & (S_IWGRP|S_IWOTH))) {
+        ngx_conf_log_error(NGX_LOG_EMERG, cf, 0, 
+                           "php_preload \"%s\" runs as root in the master, "
+                           "it must be owned by root and writable by no one else", 
+                           file);
+        return NGX_ERROR;
+    }
+
+    return NGX_OK;
+}
+
+static size_t
+ngx_http_php_preload_ub_write(const char *str, size_t str_length)
+{
+    ngx_log_error(NGX_LOG_NOTICE, ngx_http_php_preload_log, 0, 
+                  "php_preload: %*s", str_length, str);
+
+    return str_length;
+}
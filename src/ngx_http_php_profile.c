@@ -0,0 +1,674 @@
+/*
+==============================================================================
+Copyright (c) 2016-2020, rryqszq4 <rryqszq@gmail.com>
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+
+* Redistributions of source code must retain the above copyright notice, this
+  list of conditions and the following disclaimer.
+
+* Redistributions in binary form must reproduce the above copyright notice,
+  this list of conditions and the following disclaimer in the documentation
+  and/or other materials provided with the distribution.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+==============================================================================
+*/
+
+#include "ngx_http_php_module.h"
+#include "ngx_http_php_profile.h"
+
+#if (NGX_HTTP_PHP_HAVE_PROFILE)
+
+typedef struct ngx_http_php_profile_stack_s ngx_http_php_profile_stack_t;
+
+struct ngx_http_php_profile_stack_s {
+    ngx_http_php_profile_stack_t    *next;
+    uint32_t                        hash;
+    ngx_uint_t                      count;
+    size_t                          len;
+    u_char                          data[1];
+};
+
+typedef struct {
+    ngx_shm_zone_t                  *zone;
+    ngx_str_t                       path;
+
+    /* the generation this worker follows, the one its run started at */
+    ngx_atomic_uint_t               generation;
+
+    unsigned                        running:1;
+
+    ngx_pool_t                      *pool;
+    ngx_http_php_profile_stack_t    **buckets;
+    ngx_uint_t                      nstacks;
+    ngx_uint_t                      dropped;
+
+    timer_t                         timer;
+    ngx_event_t                     event;
+} ngx_http_php_profile_t;
+
+static void ngx_http_php_profile_poll(ngx_event_t *ev);
+static void ngx_http_php_profile_sync(ngx_cycle_t *cycle);
+static ngx_int_t ngx_http_php_profile_start(ngx_cycle_t *cycle, ngx_msec_t interval);
+static void ngx_http_php_profile_stop(ngx_cycle_t *cycle);
+static void ngx_http_php_profile_dump(ngx_cycle_t *cycle);
+static void ngx_http_php_profile_signal_handler(int signo);
+static void ngx_http_php_profile_interrupt(zend_execute_data *execute_data);
+static void ngx_http_php_profile_sample(zend_execute_data *execute_data, 
+    ngx_uint_t ticks);
+static u_char *ngx_http_php_profile_frame(u_char *p, u_char *last, 
+    zend_execute_data *ex);
+
+static ngx_http_php_profile_t ngx_http_php_profile;
+
+/* ticks of the timer signal in and out of php code */
+static volatile sig_atomic_t ngx_http_php_profile_pending;
+static volatile sig_atomic_t ngx_http_php_profile_outside;
+
+static void (*ngx_http_php_profile_orig_interrupt)(zend_execute_data *execute_data);
+
+#endif
+
+ngx_int_t
+ngx_http_php_profile_init_zone(ngx_shm_zone_t *shm_zone, void *data)
+{
+    ngx_http_php_profile_shctx_t    *osh = data;
+    ngx_http_php_profile_shctx_t    *sh;
+    ngx_slab_pool_t                 *shpool;
+
+    /* a profile keeps running over a reload, the new workers join it */
+
+    if (osh) {
+        shm_zone->data = osh;
+        return NGX_OK;
+    }
+
+    shpool = (ngx_slab_pool_t *) shm_zone->shm.addr;
+
+    if (shm_zone->shm.exists) {
+        shm_zone->data = shpool->data;
+        return NGX_OK;
+    }
+
+    sh = ngx_slab_calloc(shpool, sizeof(ngx_http_php_profile_shctx_t));
+    if (sh == NULL) {
+        return NGX_ERROR;
+    }
+
+    sh->interval = NGX_HTTP_PHP_PROFILE_INTERVAL;
+
+    shpool->data = sh;
+    shm_zone->data = sh;
+
+    return NGX_OK;
+}
+
+void
+ngx_http_php_profile_init_worker(ngx_cycle_t *cycle)
+{
+#if (NGX_HTTP_PHP_HAVE_PROFILE)
+    ngx_http_php_main_conf_t    *pmcf;
+    ngx_http_php_profile_t      *pf;
+
+    pmcf = ngx_http_cycle_get_module_main_conf(cycle, ngx_http_php_module);
+
+    if (pmcf == NULL || pmcf->profile_zone == NULL) {
+        return;
+    }
+
+    if (ngx_process != NGX_PROCESS_WORKER && ngx_process != NGX_PROCESS_SINGLE) {
+        return;
+    }
+
+    pf = &ngx_http_php_profile;
+
+    pf->zone = pmcf->profile_zone;
+    pf->path = pmcf->profile_path;
+
+    /* only called when the signal handler raised the vm interrupt */
+
+    ngx_http_php_profile_orig_interrupt = zend_interrupt_function;
+    zend_interrupt_function = ngx_http_php_profile_interrupt;
+
+    pf->event.handler = ngx_http_php_profile_poll;
+    pf->event.data = pf;
+    pf->event.log = cycle->log;
+    pf->event.cancelable = 1;
+
+    ngx_http_php_profile_sync(cycle);
+
+    ngx_add_timer(&pf->event, NGX_HTTP_PHP_PROFILE_POLL);
+#endif
+}
+
+void
+ngx_http_php_profile_exit_worker(ngx_cycle_t *cycle)
+{
+#if (NGX_HTTP_PHP_HAVE_PROFILE)
+    if (ngx_http_php_profile.running) {
+        ngx_http_php_profile_stop(cycle);
+    }
+#endif
+}
+
+/* 
+ * php_profile, the status, or with ?action=start[&interval=<time>] 
+ * or ?action=stop for all the workers.
+ */
+ngx_int_t
+ngx_http_php_profile_handler(ngx_http_request_t *r)
+{
+#if (NGX_HTTP_PHP_HAVE_PROFILE)
+    ngx_http_php_main_conf_t        *pmcf;
+    ngx_http_php_profile_shctx_t    *sh;
+    ngx_slab_pool_t                 *shpool;
+    ngx_str_t                       action, value;
+    ngx_buf_t                       *b;
+    ngx_chain_t                     out;
+    ngx_msec_t                      interval;
+    ngx_int_t                       rc;
+
+    if (!(r->method & (NGX_HTTP_GET|NGX_HTTP_HEAD))) {
+        return NGX_HTTP_NOT_ALLOWED;
+    }
+
+    rc = ngx_http_discard_request_body(r);
+    if (rc != NGX_OK) {
+        return rc;
+    }
+
+    pmcf = ngx_http_get_module_main_conf(r, ngx_http_php_module);
+
+    if (pmcf->profile_zone == NULL) {
+        ngx_log_error(NGX_LOG_ERR, r->connection->log, 0, 
+                      "php_profile needs php_profile_path");
+        return NGX_HTTP_INTERNAL_SERVER_ERROR;
+    }
+
+    shpool = (ngx_slab_pool_t *) pmcf->profile_zone->shm.addr;
+    sh = pmcf->profile_zone->data;
+
+    if (ngx_http_arg(r, (u_char *) "action", 6, &action) == NGX_OK) {
+
+        if (action.len == 5 && ngx_strncmp(action.data, "start", 5) == 0) {
+
+            interval = NGX_HTTP_PHP_PROFILE_INTERVAL;
+
+            if (ngx_http_arg(r, (u_char *) "interval", 8, &value) == NGX_OK) {
+                interval = ngx_parse_time(&value, 0);
+
+                if (interval == (ngx_msec_t) NGX_ERROR || interval == 0 
+                    || interval > 1000) 
+                {
+                    return NGX_HTTP_BAD_REQUEST;
+                }
+            }
+
+            ngx_shmtx_lock(&shpool->mutex);
+
+            sh->generation++;
+            sh->running = 1;
+            sh->interval = interval;
+            sh->started = ngx_time();
+
+            ngx_shmtx_unlock(&shpool->mutex);
+
+        } else if (action.len == 4 && ngx_strncmp(action.data, "stop", 4) == 0) {
+
+            ngx_shmtx_lock(&shpool->mutex);
+
+            if (sh->running) {
+                sh->generation++;
+                sh->running = 0;
+            }
+
+            ngx_shmtx_unlock(&shpool->mutex);
+
+        } else {
+            return NGX_HTTP_BAD_REQUEST;
+        }
+
+        /* this worker at once, the others at their next poll */
+        ngx_http_php_profile_sync((ngx_cycle_t *) ngx_cycle);
+    }
+
+    b = ngx_create_temp_buf(r->pool, 256 + pmcf->profile_path.len);
+    if (b == NULL) {
+        return NGX_HTTP_INTERNAL_SERVER_ERROR;
+    }
+
+    b->last = ngx_sprintf(b->last, "running: %uA\n"
+                                   "generation: %uA\n"
+                                   "interval: %uAms\n"
+                                   "started: %T\n"
+                                   "path: %V\n", 
+                          sh->running, sh->generation, sh->interval, 
+                          sh->started, &pmcf->profile_path);
+
+    b->last_buf = (r == r->main) ? 1 : 0;
+    b->last_in_chain = 1;
+
+    out.buf = b;
+    out.next = NULL;
+
+    ngx_str_set(&r->headers_out.content_type, "text/plain");
+    r->headers_out.content_type_len = r->headers_out.content_type.len;
+
+    r->headers_out.status = NGX_HTTP_OK;
+    r->headers_out.content_length_n = b->last - b->pos;
+
+    rc = ngx_http_send_header(r);
+
+    if (rc == NGX_ERROR || rc > NGX_OK || r->header_only) {
+        return rc;
+    }
+
+    return ngx_http_output_filter(r, &out);
+#else
+    return NGX_HTTP_NOT_IMPLEMENTED;
+#endif
+}
+
+#if (NGX_HTTP_PHP_HAVE_PROFILE)
+
+static void
+ngx_http_php_profile_poll(ngx_event_t *ev)
+{
+    if (ngx_exiting || ngx_quit || ngx_terminate) {
+        return;
+    }
+
+    ngx_http_php_profile_sync((ngx_cycle_t *) ngx_cycle);
+
+    ngx_add_timer(ev, NGX_HTTP_PHP_PROFILE_POLL);
+}
+
+static void
+ngx_http_php_profile_sync(ngx_cycle_t *cycle)
+{
+    ngx_http_php_profile_t          *pf;
+    ngx_http_php_profile_shctx_t    *sh;
+    ngx_atomic_uint_t               generation;
+
+    pf = &ngx_http_php_profile;
+
+    if (pf->zone == NULL) {
+        return;
+    }
+
+    sh = pf->zone->data;
+    generation = sh->generation;
+
+    if (generation == pf->generation) {
+        return;
+    }
+
+    if (pf->running) {
+        ngx_http_php_profile_stop(cycle);
+    }
+
+    pf->generation = generation;
+
+    if (sh->running) {
+        (void) ngx_http_php_profile_start(cycle, sh->interval);
+    }
+}
+
+static ngx_int_t
+ngx_http_php_profile_start(ngx_cycle_t *cycle, ngx_msec_t interval)
+{
+    ngx_http_php_profile_t  *pf;
+    struct sigaction        sa;
+    struct sigevent         sev;
+    struct itimerspec       its;
+
+    pf = &ngx_http_php_profile;
+
+    pf->pool = ngx_create_pool(16384, cycle->log);
+    if (pf->pool == NULL) {
+        return NGX_ERROR;
+    }
+
+    pf->buckets = ngx_pcalloc(pf->pool, NGX_HTTP_PHP_PROFILE_BUCKETS 
+                                        * sizeof(ngx_http_php_profile_stack_t *));
+    if (pf->buckets == NULL) {
+        ngx_destroy_pool(pf->pool);
+        pf->pool = NULL;
+        return NGX_ERROR;
+    }
+
+    pf->nstacks = 0;
+    pf->dropped = 0;
+
+    ngx_http_php_profile_pending = 0;
+    ngx_http_php_profile_outside = 0;
+
+    ngx_memzero(&sa, sizeof(struct sigaction));
+    sa.sa_handler = ngx_http_php_profile_signal_handler;
+    sa.sa_flags = SA_RESTART;
+    sigemptyset(&sa.sa_mask);
+
+    if (sigaction(NGX_HTTP_PHP_PROFILE_SIGNAL, &sa, NULL) == -1) {
+        ngx_log_error(NGX_LOG_ALERT, cycle->log, ngx_errno, 
+                      "php profile sigaction() failed");
+        ngx_destroy_pool(pf->pool);
+        pf->pool = NULL;
+        return NGX_ERROR;
+    }
+
+    /* cpu time of the worker, an idle worker takes no samples */
+
+    ngx_memzero(&sev, sizeof(struct sigevent));
+    sev.sigev_notify = SIGEV_SIGNAL;
+    sev.sigev_signo = NGX_HTTP_PHP_PROFILE_SIGNAL;
+
+    if (timer_create(CLOCK_PROCESS_CPUTIME_ID, &sev, &pf->timer) == -1) {
+        ngx_log_error(NGX_LOG_ALERT, cycle->log, ngx_errno, 
+                      "php profile timer_create() failed");
+        ngx_destroy_pool(pf->pool);
+        pf->pool = NULL;
+        return NGX_ERROR;
+    }
+
+    its.it_interval.tv_sec = interval / 1000;
+    its.it_interval.tv_nsec = (interval % 1000) * 1000000;
+    its.it_value = its.it_interval;
+
+    if (timer_settime(pf->timer, 0, &its, NULL) == -1) {
+        ngx_log_error(NGX_LOG_ALERT, cycle->log, ngx_errno, 
+                      "php profile timer_settime() failed");
+        (void) timer_delete(pf->timer);
+        ngx_destroy_pool(pf->pool);
+        pf->pool = NULL;
+        return NGX_ERROR;
+    }
+
+    pf->running = 1;
+
+    ngx_log_error(NGX_LOG_NOTICE, cycle->log, 0, 
+                  "php profile %uA started, every %Mms", pf->generation, interval);
+
+    return NGX_OK;
+}
+
+static void
+ngx_http_php_profile_stop(ngx_cycle_t *cycle)
+{
+    ngx_http_php_profile_t  *pf;
+
+    pf = &ngx_http_php_profile;
+
+    /* 
+     * the handler stays: the default action of a real-time signal ends 
+     * the process, a tick still queued only finds the profile stopped
+     */
+
+    (void) timer_delete(pf->timer);
+
+    pf->running = 0;
+
+    ngx_http_php_profile_dump(cycle);
+
+    ngx_destroy_pool(pf->pool);
+    pf->pool = NULL;
+    pf->buckets = NULL;
+}
+
+/* <path>/php-<pid>-<generation>.folded, one "frame;frame;... count" per line */
+static void
+ngx_http_php_profile_dump(ngx_cycle_t *cycle)
+{
+    ngx_http_php_profile_t          *pf;
+    ngx_http_php_profile_stack_t    *st;
+    ngx_fd_t                        fd;
+    ngx_uint_t                      i, samples;
+    u_char                          *name, *buf, *p, *last;
+    size_t                          size;
+
+    pf = &ngx_http_php_profile;
+
+    name = ngx_pnalloc(pf->pool, pf->path.len + sizeof("/php--.folded") 
+                                 + 2 * NGX_INT64_LEN);
+    if (name == NULL) {
+        return;
+    }
+
+    ngx_sprintf(name, "%V/php-%P-%uA.folded%Z", &pf->path, ngx_pid, pf->generation);
+
+    fd = ngx_open_file(name, NGX_FILE_WRONLY, NGX_FILE_TRUNCATE, 
+                       NGX_FILE_DEFAULT_ACCESS);
+    if (fd == NGX_INVALID_FILE) {
+        ngx_log_error(NGX_LOG_ERR, cycle->log, ngx_errno, 
+                      ngx_open_file_n " \"%s\" failed", name);
+        return;
+    }
+
+    size = 65536;
+
+    buf = ngx_pnalloc(pf->pool, size);
+    if (buf == NULL) {
+        (void) ngx_close_file(fd);
+        return;
+    }
+
+    p = buf;
+    last = buf + size;
+    samples = 0;
+
+    for (i = 0; i < NGX_HTTP_PHP_PROFILE_BUCKETS; i++) {
+        for (st = pf->buckets[i]; st; st = st->next) {
+
+            if ((size_t) (last - p) < st->len + NGX_INT_T_LEN + 2) {
+                (void) ngx_write_fd(fd, buf, p - buf);
+                p = buf;
+            }
+
+            if (st->len + NGX_INT_T_LEN + 2 > size) {
+                continue;
+            }
+
+            p = ngx_cpymem(p, st->data, st->len);
+            p = ngx_sprintf(p, " %ui\n", st->count);
+
+            samples += st->count;
+        }
+    }
+
+    if ((size_t) (last - p) < 2 * (sizeof("[dropped] \n") + NGX_INT_T_LEN)) {
+        (void) ngx_write_fd(fd, buf, p - buf);
+        p = buf;
+    }
+
+    /* the time in nginx itself, or past the stack limit */
+
+    if (ngx_http_php_profile_outside) {
+        p = ngx_sprintf(p, "[nginx] %ui\n", (ngx_uint_t) ngx_http_php_profile_outside);
+    }
+
+    if (pf->dropped) {
+        p = ngx_sprintf(p, "[dropped] %ui\n", pf->dropped);
+    }
+
+    if (p != buf) {
+        (void) ngx_write_fd(fd, buf, p - buf);
+    }
+
+    if (ngx_close_file(fd) == NGX_FILE_ERROR) {
+        ngx_log_error(NGX_LOG_ALERT, cycle->log, ngx_errno, 
+                      ngx_close_file_n " \"%s\" failed", name);
+    }
+
+    ngx_log_error(NGX_LOG_NOTICE, cycle->log, 0, 
+                  "php profile %uA stopped, %ui samples in %ui stacks to \"%s\"", 
+                  pf->generation, samples, pf->nstacks, name);
+}
+
+/* 
+ * The stack is not safe to walk in a signal handler, the interrupt 
+ * takes the sample at the next opcode that checks it.
+ */
+static void
+ngx_http_php_profile_signal_handler(int signo)
+{
+    if (EG(current_execute_data) == NULL) {
+        ngx_http_php_profile_outside++;
+        return;
+    }
+
+    ngx_http_php_profile_pending++;
+
+#if PHP_MAJOR_VERSION >= 8 && PHP_MINOR_VERSION > 1
+    zend_atomic_bool_store_ex(&EG(vm_interrupt), 1);
+#else
+    EG(vm_interrupt) = 1;
+#endif
+}
+
+static void
+ngx_http_php_profile_interrupt(zend_execute_data *execute_data)
+{
+    ngx_uint_t  ticks;
+
+    ticks = ngx_http_php_profile_pending;
+
+    if (ticks) {
+        ngx_http_php_profile_pending = 0;
+
+        if (ngx_http_php_profile.running) {
+            ngx_http_php_profile_sample(execute_data, ticks);
+        }
+    }
+
+    if (ngx_http_php_profile_orig_interrupt) {
+        ngx_http_php_profile_orig_interrupt(execute_data);
+    }
+}
+
+static void
+ngx_http_php_profile_sample(zend_execute_data *execute_data, ngx_uint_t ticks)
+{
+    static u_char                   buf[NGX_HTTP_PHP_PROFILE_DEPTH * 64];
+
+    ngx_http_php_profile_t          *pf;
+    ngx_http_php_profile_stack_t    *st, **bucket;
+    zend_execute_data               *frames[NGX_HTTP_PHP_PROFILE_DEPTH];
+    zend_execute_data               *ex;
+    ngx_uint_t                      n;
+    uint32_t                        hash;
+    size_t                          len;
+    u_char                          *p;
+
+    pf = &ngx_http_php_profile;
+
+    n = 0;
+
+    for (ex = execute_data; ex && n < NGX_HTTP_PHP_PROFILE_DEPTH; 
+         ex = ex->prev_execute_data) 
+    {
+        if (ex->func) {
+            frames[n++] = ex;
+        }
+    }
+
+    if (n == 0) {
+        return;
+    }
+
+    /* the root first, as flamegraph.pl reads it */
+
+    p = buf;
+
+    while (n--) {
+        if (p != buf && p < buf + sizeof(buf)) {
+            *p++ = ';';
+        }
+
+        p = ngx_http_php_profile_frame(p, buf + sizeof(buf), frames[n]);
+    }
+
+    len = p - buf;
+    hash = ngx_crc32_short(buf, len);
+
+    bucket = &pf->buckets[hash % NGX_HTTP_PHP_PROFILE_BUCKETS];
+
+    for (st = *bucket; st; st = st->next) {
+        if (st->hash == hash && st->len == len 
+            && ngx_memcmp(st->data, buf, len) == 0) 
+        {
+            st->count += ticks;
+            return;
+        }
+    }
+
+    if (pf->nstacks >= NGX_HTTP_PHP_PROFILE_STACKS) {
+        pf->dropped += ticks;
+        return;
+    }
+
+    st = ngx_palloc(pf->pool, offsetof(ngx_http_php_profile_stack_t, data) + len);
+    if (st == NULL) {
+        pf->dropped += ticks;
+        return;
+    }
+
+    st->hash = hash;
+    st->count = ticks;
+    st->len = len;
+    ngx_memcpy(st->data, buf, len);
+
+    st->next = *bucket;
+    *bucket = st;
+
+    pf->nstacks++;
+}
+
+/* Class::function:line, function for internals, file:line for the top level */
+static u_char *
+ngx_http_php_profile_frame(u_char *p, u_char *last, zend_execute_data *ex)
+{
+    zend_function   *func;
+    uint32_t        lineno;
+
+    func = ex->func;
+    lineno = 0;
+
+    if (ZEND_USER_CODE(func->type)) {
+        lineno = ex->opline ? ex->opline->lineno : func->op_array.line_start;
+    }
+
+    if (func->common.function_name == NULL) {
+
+        if (ZEND_USER_CODE(func->type) && func->op_array.filename) {
+            return ngx_slprintf(p, last, "%s:%uD", 
+                                ZSTR_VAL(func->op_array.filename), lineno);
+        }
+
+        return ngx_slprintf(p, last, "{main}");
+    }
+
+    if (func->common.scope) {
+        p = ngx_slprintf(p, last, "%s::", ZSTR_VAL(func->common.scope->name));
+    }
+
+    p = ngx_slprintf(p, last, "%s", ZSTR_VAL(func->common.function_name));
+
+    if (ZEND_USER_CODE(func->type)) {
+        p = ngx_slprintf(p, last, ":%uD", lineno);
+    }
+
+    return p;
+}
+
+#endif
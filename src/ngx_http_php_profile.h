@@ -0,0 +1,78 @@
+/*
+==============================================================================
+Copyright (c) 2016-2020, rryqszq4 <rryqszq@gmail.com>
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+
+* Redistributions of source code must retain the above copyright notice, this
+  list of conditions and the following disclaimer.
+
+* Redistributions in binary form must reproduce the above copyright notice,
+  this list of conditions and the following disclaimer in the documentation
+  and/or other materials provided with the distribution.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+==============================================================================
+*/
+
+#ifndef __NGX_HTTP_PHP_PROFILE_H__
+#define __NGX_HTTP_PHP_PROFILE_H__
+
+#include "ngx_http_php_module.h"
+
+/* 
+ * samples are taken at the vm interrupt, which php has since 7.1, on the 
+ * ticks of a posix cpu time timer
+ */
+#if (PHP_MAJOR_VERSION > 7 || PHP_MINOR_VERSION > 0)                         \
+    && defined(SIGEV_SIGNAL) && defined(SIGRTMIN)
+#define NGX_HTTP_PHP_HAVE_PROFILE       1
+
+/* 
+ * SIGPROF is max_execution_time's, SIGVTALRM the slowlog's and SIGRTMIN 
+ * the one of the php timers with ZTS
+ */
+#define NGX_HTTP_PHP_PROFILE_SIGNAL     (SIGRTMIN + 1)
+#endif
+
+#define NGX_HTTP_PHP_PROFILE_ZONE       "php_profile"
+
+/* msecs of cpu time between samples, 100 Hz */
+#define NGX_HTTP_PHP_PROFILE_INTERVAL   10
+
+/* how often the workers look for a start or stop, msecs */
+#define NGX_HTTP_PHP_PROFILE_POLL       1000
+
+/* frames kept from the top of a stack */
+#define NGX_HTTP_PHP_PROFILE_DEPTH      128
+
+/* distinct stacks per worker and run, more samples count as dropped */
+#define NGX_HTTP_PHP_PROFILE_STACKS     65536
+#define NGX_HTTP_PHP_PROFILE_BUCKETS    4096
+
+typedef struct {
+    /* bumped by every start and stop */
+    ngx_atomic_t                generation;
+    ngx_atomic_t                running;
+    ngx_atomic_t                interval;
+    time_t                      started;
+} ngx_http_php_profile_shctx_t;
+
+ngx_int_t ngx_http_php_profile_init_zone(ngx_shm_zone_t *shm_zone, void *data);
+void ngx_http_php_profile_init_worker(ngx_cycle_t *cycle);
+void ngx_http_php_profile_exit_worker(ngx_cycle_t *cycle);
+
+ngx_int_t ngx_http_php_profile_handler(ngx_http_request_t *r);
+
+#endif
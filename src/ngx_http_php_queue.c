@@ -0,0 +1,717 @@
+/*
+==============================================================================
+Copyright (c) 2016-2020, rryqszq4 <rryqszq@gmail.com>
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+
+* Redistributions of source code must retain the above copyright notice, this
+  list of conditions and the following disclaimer.
+
+* Redistributions in binary form must reproduce the above copyright notice,
+  this list of conditions and the following disclaimer in the documentation
+  and/or other materials provided with the distribution.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+==============================================================================
+*/
+
+#include "ngx_http_php_module.h"
+#include "ngx_http_php_queue.h"
+#include "ngx_http_php_zend_uthread.h"
+
+#if (NGX_HAVE_EVENTFD)
+#include <sys/eventfd.h>
+#endif
+
+typedef struct {
+    ngx_queue_t                 queue;
+    ngx_http_request_t          *request;
+    ngx_http_php_queue_ctx_t    *ctx;
+    ngx_event_t                 timeout;
+    uint64_t                    after;
+    unsigned                    pop:1;
+    unsigned                    waiting:1;
+} ngx_http_php_queue_waiter_t;
+
+/* records copied out of the zone, to be turned into zvals unlocked */
+typedef struct {
+    u_char                      *data;
+    size_t                      len;
+    uint64_t                    seq;
+} ngx_http_php_queue_copy_t;
+
+static ngx_int_t ngx_http_php_queue_notify_init(ngx_http_php_queue_ctx_t *ctx);
+static void ngx_http_php_queue_notify_cleanup(void *data);
+static void ngx_http_php_queue_notify(ngx_http_php_queue_ctx_t *ctx);
+static void ngx_http_php_queue_notify_handler(ngx_event_t *rev);
+static void ngx_http_php_queue_timeout_handler(ngx_event_t *ev);
+static void ngx_http_php_queue_cleanup(void *data);
+static void ngx_http_php_queue_done(ngx_http_php_queue_waiter_t *w);
+static ngx_int_t ngx_http_php_queue_take(ngx_http_php_queue_shctx_t *sh, 
+    ngx_pool_t *pool, ngx_uint_t pop, uint64_t after, 
+    ngx_http_php_queue_copy_t *cp);
+static void ngx_http_php_queue_result(ngx_uint_t pop, 
+    ngx_http_php_queue_copy_t *cp, zval *rv);
+static void ngx_http_php_queue_empty(ngx_uint_t pop, zval *rv);
+static void ngx_http_php_queue_read(ngx_http_php_queue_shctx_t *sh, size_t off, 
+    u_char *dst, size_t len);
+static void ngx_http_php_queue_write(ngx_http_php_queue_shctx_t *sh, size_t off, 
+    u_char *src, size_t len);
+
+ngx_int_t
+ngx_http_php_queue_init_zone(ngx_shm_zone_t *shm_zone, void *data)
+{
+    ngx_http_php_queue_ctx_t    *octx = data;
+    ngx_http_php_queue_ctx_t    *ctx;
+    ngx_slab_pool_t             *shpool;
+    ngx_http_php_queue_shctx_t  *sh;
+    size_t                      len;
+
+    ctx = shm_zone->data;
+
+    /* the notification fds belong to a generation of workers */
+    if (ngx_http_php_queue_notify_init(ctx) != NGX_OK) {
+        return NGX_ERROR;
+    }
+
+    if (octx) {
+        ctx->sh = octx->sh;
+        ctx->shpool = octx->shpool;
+
+        return NGX_OK;
+    }
+
+    shpool = (ngx_slab_pool_t *) shm_zone->shm.addr;
+    ctx->shpool = shpool;
+
+    if (shm_zone->shm.exists) {
+        ctx->sh = shpool->data;
+
+        return NGX_OK;
+    }
+
+    sh = ngx_slab_alloc(shpool, sizeof(ngx_http_php_queue_shctx_t));
+    if (sh == NULL) {
+        return NGX_ERROR;
+    }
+
+    ngx_memzero(sh, sizeof(ngx_http_php_queue_shctx_t));
+
+    len = shm_zone->shm.size;
+
+    while (len > ngx_pagesize) {
+        sh->data = ngx_slab_alloc(shpool, len);
+        if (sh->data) {
+            break;
+        }
+
+        len -= ngx_pagesize;
+    }
+
+    if (sh->data == NULL) {
+        return NGX_ERROR;
+    }
+
+    sh->size = len;
+    sh->first = 1;
+    sh->next = 1;
+    sh->pop = 1;
+
+    shpool->data = sh;
+    ctx->sh = sh;
+
+    len = sizeof(" in php_shared_queue zone \"\"") + shm_zone->shm.name.len;
+
+    shpool->log_ctx = ngx_slab_alloc(shpool, len);
+    if (shpool->log_ctx == NULL) {
+        return NGX_ERROR;
+    }
+
+    ngx_sprintf(shpool->log_ctx, " in php_shared_queue zone \"%V\"%Z",
+                &shm_zone->shm.name);
+
+    return NGX_OK;
+}
+
+void
+ngx_http_php_queue_init_worker(ngx_cycle_t *cycle)
+{
+    ngx_http_php_main_conf_t    *pmcf;
+    ngx_http_php_queue_ctx_t    *ctx;
+    ngx_shm_zone_t              **zone;
+    ngx_connection_t            *c;
+    ngx_uint_t                  i;
+
+    pmcf = ngx_http_cycle_get_module_main_conf(cycle, ngx_http_php_module);
+
+    if (pmcf == NULL || pmcf->queue_zones == NULL) {
+        return;
+    }
+
+    if (ngx_process != NGX_PROCESS_WORKER && ngx_process != NGX_PROCESS_SINGLE) {
+        return;
+    }
+
+    zone = pmcf->queue_zones->elts;
+
+    for (i = 0; i < pmcf->queue_zones->nelts; i++) {
+        ctx = zone[i]->data;
+
+        ngx_queue_init(&ctx->waiting);
+
+        if (ngx_worker >= ctx->nworkers) {
+            continue;
+        }
+
+        c = ngx_get_connection(ctx->fds[2 * ngx_worker], cycle->log);
+        if (c == NULL) {
+            continue;
+        }
+
+        c->data = ctx;
+        c->read->handler = ngx_http_php_queue_notify_handler;
+        c->read->log = cycle->log;
+
+        if (ngx_handle_read_event(c->read, 0) != NGX_OK) {
+            ngx_free_connection(c);
+            continue;
+        }
+
+        ctx->notify = c;
+    }
+}
+
+ngx_shm_zone_t *
+ngx_http_php_queue_zone(ngx_str_t *name)
+{
+    ngx_http_php_main_conf_t    *pmcf;
+    ngx_shm_zone_t              **zone;
+    ngx_uint_t                  i;
+
+    pmcf = ngx_http_cycle_get_module_main_conf(ngx_cycle, ngx_http_php_module);
+    if (pmcf == NULL || pmcf->queue_zones == NULL) {
+        return NULL;
+    }
+
+    zone = pmcf->queue_zones->elts;
+
+    for (i = 0; i < pmcf->queue_zones->nelts; i++) {
+        if (name->len == zone[i]->shm.name.len
+            && ngx_strncmp(name->data, zone[i]->shm.name.data, name->len) == 0)
+        {
+            return zone[i];
+        }
+    }
+
+    return NULL;
+}
+
+/* the oldest messages make room, popped or not */
+ngx_int_t
+ngx_http_php_queue_push(ngx_shm_zone_t *zone, ngx_str_t *msg, uint64_t *seq)
+{
+    ngx_http_php_queue_ctx_t    *ctx;
+    ngx_http_php_queue_shctx_t  *sh;
+    uint32_t                    len;
+    size_t                      off;
+
+    ctx = zone->data;
+    sh = ctx->sh;
+
+    if (msg->len + sizeof(uint32_t) > sh->size) {
+        return NGX_DECLINED;
+    }
+
+    ngx_shmtx_lock(&ctx->shpool->mutex);
+
+    while (sh->size - sh->used < msg->len + sizeof(uint32_t)) {
+        ngx_http_php_queue_read(sh, sh->head, (u_char *) &len, sizeof(uint32_t));
+
+        sh->head = (sh->head + sizeof(uint32_t) + len) % sh->size;
+        sh->used -= sizeof(uint32_t) + len;
+        sh->first++;
+    }
+
+    if (sh->pop < sh->first) {
+        sh->dropped += sh->first - sh->pop;
+        sh->pop = sh->first;
+        sh->pop_off = sh->head;
+    }
+
+    off = (sh->head + sh->used) % sh->size;
+
+    if (sh->pop == sh->next) {
+        sh->pop_off = off;
+    }
+
+    len = (uint32_t) msg->len;
+
+    ngx_http_php_queue_write(sh, off, (u_char *) &len, sizeof(uint32_t));
+    ngx_http_php_queue_write(sh, (off + sizeof(uint32_t)) % sh->size, 
+                             msg->data, msg->len);
+
+    sh->used += sizeof(uint32_t) + msg->len;
+    *seq = sh->next++;
+
+    ngx_shmtx_unlock(&ctx->shpool->mutex);
+
+    ngx_http_php_queue_notify(ctx);
+
+    return NGX_OK;
+}
+
+/*
+ * NGX_OK with rv set right away, NGX_AGAIN when the request waits for a 
+ * push, up to timeout, and is resumed with rv in ctx->yield_retval.
+ * after < 0 fetches from the next message pushed.
+ */
+ngx_int_t
+ngx_http_php_queue_wait(ngx_http_request_t *r, ngx_shm_zone_t *zone, 
+    ngx_uint_t pop, int64_t after, ngx_msec_t timeout, zval *rv)
+{
+    ngx_http_php_queue_ctx_t    *ctx;
+    ngx_http_php_queue_shctx_t  *sh;
+    ngx_http_php_queue_waiter_t *w;
+    ngx_http_cleanup_t          *cln;
+    ngx_http_php_queue_copy_t   cp;
+    ngx_int_t                   rc;
+    uint64_t                    a;
+
+    ctx = zone->data;
+    sh = ctx->sh;
+
+    w = NULL;
+    cln = NULL;
+
+    if (timeout && ctx->notify) {
+        w = ngx_pcalloc(r->pool, sizeof(ngx_http_php_queue_waiter_t));
+        if (w == NULL) {
+            return NGX_ERROR;
+        }
+
+        cln = ngx_http_cleanup_add(r, 0);
+        if (cln == NULL) {
+            return NGX_ERROR;
+        }
+    }
+
+    ngx_shmtx_lock(&ctx->shpool->mutex);
+
+    a = (after < 0) ? sh->next - 1 : (uint64_t) after;
+
+    rc = ngx_http_php_queue_take(sh, r->pool, pop, a, &cp);
+
+    if (rc != NGX_DECLINED) {
+        ngx_shmtx_unlock(&ctx->shpool->mutex);
+
+        if (rc == NGX_ERROR) {
+            return NGX_ERROR;
+        }
+
+        ngx_http_php_queue_result(pop, &cp, rv);
+        ngx_pfree(r->pool, cp.data);
+
+        return NGX_OK;
+    }
+
+    if (w == NULL) {
+        ngx_shmtx_unlock(&ctx->shpool->mutex);
+
+        ngx_http_php_queue_empty(pop, rv);
+        return NGX_OK;
+    }
+
+    /* counted under the lock, so that no push after the check is missed */
+    (void) ngx_atomic_fetch_add(&sh->waiters[ngx_worker], 1);
+
+    ngx_shmtx_unlock(&ctx->shpool->mutex);
+
+    w->request = r;
+    w->ctx = ctx;
+    w->after = a;
+    w->pop = pop;
+    w->waiting = 1;
+
+    ngx_queue_insert_tail(&ctx->waiting, &w->queue);
+
+    w->timeout.handler = ngx_http_php_queue_timeout_handler;
+    w->timeout.data = w;
+    w->timeout.log = r->connection->log;
+
+    ngx_add_timer(&w->timeout, timeout);
+
+    cln->handler = ngx_http_php_queue_cleanup;
+    cln->data = w;
+
+    return NGX_AGAIN;
+}
+
+static ngx_int_t
+ngx_http_php_queue_notify_init(ngx_http_php_queue_ctx_t *ctx)
+{
+    ngx_core_conf_t     *ccf;
+    ngx_pool_cleanup_t  *cln;
+    ngx_uint_t          i, n;
+#if !(NGX_HAVE_EVENTFD)
+    ngx_socket_t        s[2];
+#endif
+
+    ccf = (ngx_core_conf_t *) ngx_get_conf(ctx->cycle->conf_ctx, ngx_core_module);
+
+    n = ccf->master ? (ngx_uint_t) ccf->worker_processes : 1;
+    n = ngx_min(n, NGX_MAX_PROCESSES);
+
+    ctx->fds = ngx_palloc(ctx->cycle->pool, 2 * n * sizeof(ngx_socket_t));
+    if (ctx->fds == NULL) {
+        return NGX_ERROR;
+    }
+
+    for (i = 0; i < 2 * n; i++) {
+        ctx->fds[i] = (ngx_socket_t) -1;
+    }
+
+    ctx->nworkers = n;
+
+    cln = ngx_pool_cleanup_add(ctx->cycle->pool, 0);
+    if (cln == NULL) {
+        return NGX_ERROR;
+    }
+
+    cln->handler = ngx_http_php_queue_notify_cleanup;
+    cln->data = ctx;
+
+    for (i = 0; i < n; i++) {
+
+#if (NGX_HAVE_EVENTFD)
+        ctx->fds[2 * i] = eventfd(0, 0);
+
+        if (ctx->fds[2 * i] == -1) {
+            ngx_log_error(NGX_LOG_EMERG, ctx->cycle->log, ngx_errno,
+                          "eventfd() failed for php_shared_queue \"%V\"", 
+                          &ctx->name);
+            return NGX_ERROR;
+        }
+
+        ctx->fds[2 * i + 1] = ctx->fds[2 * i];
+#else
+        if (socketpair(AF_UNIX, SOCK_STREAM, 0, s) == -1) {
+            ngx_log_error(NGX_LOG_EMERG, ctx->cycle->log, ngx_socket_errno,
+                          "socketpair() failed for php_shared_queue \"%V\"", 
+                          &ctx->name);
+            return NGX_ERROR;
+        }
+
+        ctx->fds[2 * i] = s[0];
+        ctx->fds[2 * i + 1] = s[1];
+#endif
+
+        if (ngx_nonblocking(ctx->fds[2 * i]) == -1
+            || ngx_nonblocking(ctx->fds[2 * i + 1]) == -1)
+        {
+            ngx_log_error(NGX_LOG_EMERG, ctx->cycle->log, ngx_socket_errno,
+                          ngx_nonblocking_n " failed for php_shared_queue \"%V\"",
+                          &ctx->name);
+            return NGX_ERROR;
+        }
+    }
+
+    return NGX_OK;
+}
+
+static void
+ngx_http_php_queue_notify_cleanup(void *data)
+{
+    ngx_http_php_queue_ctx_t    *ctx = data;
+    ngx_uint_t                  i;
+
+    for (i = 0; i < 2 * ctx->nworkers; i++) {
+
+        if (ctx->fds[i] == (ngx_socket_t) -1) {
+            continue;
+        }
+
+#if (NGX_HAVE_EVENTFD)
+        if (i % 2) {
+            continue;
+        }
+#endif
+
+        (void) ngx_close_socket(ctx->fds[i]);
+    }
+}
+
+static void
+ngx_http_php_queue_notify(ngx_http_php_queue_ctx_t *ctx)
+{
+    ngx_uint_t  i;
+#if (NGX_HAVE_EVENTFD)
+    uint64_t    v = 1;
+#else
+    u_char      v = 1;
+#endif
+
+    for (i = 0; i < ctx->nworkers; i++) {
+
+        if (ctx->sh->waiters[i] == 0) {
+            continue;
+        }
+
+        /* EAGAIN means a notification is pending already */
+        (void) write(ctx->fds[2 * i + 1], &v, sizeof(v));
+    }
+}
+
+static void
+ngx_http_php_queue_notify_handler(ngx_event_t *rev)
+{
+    ngx_connection_t            *c;
+    ngx_http_php_queue_ctx_t    *ctx;
+    ngx_queue_t                 pending, *q;
+    ngx_http_php_queue_waiter_t *w;
+    ngx_http_request_t          *r;
+    ngx_http_php_ctx_t          *rctx;
+    ngx_http_php_queue_copy_t   cp;
+    ngx_int_t                   rc;
+    u_char                      buf[64];
+
+    c = rev->data;
+    ctx = c->data;
+
+    while (read(c->fd, buf, sizeof(buf)) > 0) {
+        /* void */
+    }
+
+    if (ngx_queue_empty(&ctx->waiting)) {
+        return;
+    }
+
+    /* resumed code may wait again, it goes after the current waiters */
+
+    ngx_queue_init(&pending);
+    ngx_queue_add(&pending, &ctx->waiting);
+    ngx_queue_init(&ctx->waiting);
+
+    while (!ngx_queue_empty(&pending)) {
+
+        q = ngx_queue_head(&pending);
+        w = ngx_queue_data(q, ngx_http_php_queue_waiter_t, queue);
+        r = w->request;
+
+        ngx_queue_remove(q);
+        ngx_queue_insert_tail(&ctx->waiting, q);
+
+        rctx = ngx_http_get_module_ctx(r, ngx_http_php_module);
+        if (rctx == NULL) {
+            continue;
+        }
+
+        ngx_shmtx_lock(&ctx->shpool->mutex);
+        rc = ngx_http_php_queue_take(ctx->sh, r->pool, w->pop, w->after, &cp);
+        ngx_shmtx_unlock(&ctx->shpool->mutex);
+
+        if (rc != NGX_OK) {
+            continue;
+        }
+
+        ngx_http_php_queue_done(w);
+
+        zval_ptr_dtor(&rctx->yield_retval);
+        ngx_http_php_queue_result(w->pop, &cp, &rctx->yield_retval);
+        ngx_pfree(r->pool, cp.data);
+
+        c = r->connection;
+
+        ngx_http_php_zend_uthread_resume(r);
+
+        ngx_http_run_posted_requests(c);
+    }
+}
+
+static void
+ngx_http_php_queue_timeout_handler(ngx_event_t *ev)
+{
+    ngx_http_php_queue_waiter_t *w;
+    ngx_http_request_t          *r;
+    ngx_http_php_ctx_t          *rctx;
+    ngx_connection_t            *c;
+
+    w = ev->data;
+    r = w->request;
+    c = r->connection;
+
+    ngx_http_php_queue_done(w);
+
+    rctx = ngx_http_get_module_ctx(r, ngx_http_php_module);
+    if (rctx == NULL) {
+        return;
+    }
+
+    zval_ptr_dtor(&rctx->yield_retval);
+    ngx_http_php_queue_empty(w->pop, &rctx->yield_retval);
+
+    ngx_http_php_zend_uthread_resume(r);
+
+    ngx_http_run_posted_requests(c);
+}
+
+static void
+ngx_http_php_queue_cleanup(void *data)
+{
+    ngx_http_php_queue_waiter_t *w = data;
+
+    if (w->waiting) {
+        ngx_http_php_queue_done(w);
+    }
+}
+
+static void
+ngx_http_php_queue_done(ngx_http_php_queue_waiter_t *w)
+{
+    ngx_queue_remove(&w->queue);
+    w->waiting = 0;
+
+    if (w->timeout.timer_set) {
+        ngx_del_timer(&w->timeout);
+    }
+
+    (void) ngx_atomic_fetch_add(&w->ctx->sh->waiters[ngx_worker], -1);
+}
+
+/* 
+ * Called with the zone locked, so it only copies: a php allocation failing 
+ * there would bail out with the mutex held.
+ */
+static ngx_int_t
+ngx_http_php_queue_take(ngx_http_php_queue_shctx_t *sh, ngx_pool_t *pool, 
+    ngx_uint_t pop, uint64_t after, ngx_http_php_queue_copy_t *cp)
+{
+    uint32_t        len;
+    uint64_t        seq;
+    size_t          off, skipped;
+
+    if (pop) {
+        if (sh->pop == sh->next) {
+            return NGX_DECLINED;
+        }
+
+        ngx_http_php_queue_read(sh, sh->pop_off, (u_char *) &len, sizeof(uint32_t));
+
+        cp->len = sizeof(uint32_t) + len;
+        cp->seq = sh->pop;
+
+        cp->data = ngx_pnalloc(pool, cp->len);
+        if (cp->data == NULL) {
+            return NGX_ERROR;
+        }
+
+        ngx_http_php_queue_read(sh, sh->pop_off, cp->data, cp->len);
+
+        sh->pop_off = (sh->pop_off + cp->len) % sh->size;
+        sh->pop++;
+
+        return NGX_OK;
+    }
+
+    if (after + 1 >= sh->next) {
+        return NGX_DECLINED;
+    }
+
+    /* the records after "after" are the tail of the ring */
+
+    off = sh->head;
+    skipped = 0;
+
+    for (seq = sh->first; seq <= after; seq++) {
+        ngx_http_php_queue_read(sh, off, (u_char *) &len, sizeof(uint32_t));
+
+        off = (off + sizeof(uint32_t) + len) % sh->size;
+        skipped += sizeof(uint32_t) + len;
+    }
+
+    cp->len = sh->used - skipped;
+    cp->seq = seq;
+
+    cp->data = ngx_pnalloc(pool, cp->len);
+    if (cp->data == NULL) {
+        return NGX_ERROR;
+    }
+
+    ngx_http_php_queue_read(sh, off, cp->data, cp->len);
+
+    return NGX_OK;
+}
+
+static void
+ngx_http_php_queue_result(ngx_uint_t pop, ngx_http_php_queue_copy_t *cp, 
+    zval *rv)
+{
+    uint32_t        len;
+    uint64_t        seq;
+    u_char          *p, *last;
+
+    if (!pop) {
+        array_init(rv);
+    }
+
+    p = cp->data;
+    last = cp->data + cp->len;
+
+    for (seq = cp->seq; p < last; seq++) {
+        ngx_memcpy(&len, p, sizeof(uint32_t));
+        p += sizeof(uint32_t);
+
+        if (pop) {
+            ZVAL_STRINGL(rv, (char *) p, len);
+            return;
+        }
+
+        add_index_stringl(rv, (zend_ulong) seq, (char *) p, len);
+
+        p += len;
+    }
+}
+
+static void
+ngx_http_php_queue_empty(ngx_uint_t pop, zval *rv)
+{
+    if (pop) {
+        ZVAL_NULL(rv);
+    } else {
+        array_init(rv);
+    }
+}
+
+static void
+ngx_http_php_queue_read(ngx_http_php_queue_shctx_t *sh, size_t off, 
+    u_char *dst, size_t len)
+{
+    size_t  n;
+
+    n = ngx_min(len, sh->size - off);
+
+    ngx_memcpy(dst, sh->data + off, n);
+    ngx_memcpy(dst + n, sh->data, len - n);
+}
+
+static void
+ngx_http_php_queue_write(ngx_http_php_queue_shctx_t *sh, size_t off, 
+    u_char *src, size_t len)
+{
+    size_t  n;
+
+    n = ngx_min(len, sh->size - off);
+
+    ngx_memcpy(sh->data + off, src, n);
+    ngx_memcpy(sh->data, src + n, len - n);
+}
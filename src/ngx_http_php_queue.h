@@ -0,0 +1,80 @@
+/*
+==============================================================================
+Copyright (c) 2016-2020, rryqszq4 <rryqszq@gmail.com>
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+
+* Redistributions of source code must retain the above copyright notice, this
+  list of conditions and the following disclaimer.
+
+* Redistributions in binary form must reproduce the above copyright notice,
+  this list of conditions and the following disclaimer in the documentation
+  and/or other materials provided with the distribution.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+==============================================================================
+*/
+
+#ifndef __NGX_HTTP_PHP_QUEUE_H__
+#define __NGX_HTTP_PHP_QUEUE_H__
+
+#include "ngx_http_php_module.h"
+
+typedef struct {
+    /* a byte ring of (4-byte length, message) records */
+    u_char                  *data;
+    size_t                  size;
+    size_t                  head;
+    size_t                  used;
+
+    /* sequence numbers of the oldest record and of the next push */
+    uint64_t                first;
+    uint64_t                next;
+
+    /* next record for ngx_queue_pop(), at pop_off if pop < next */
+    uint64_t                pop;
+    size_t                  pop_off;
+
+    ngx_uint_t              dropped;
+
+    /* requests waiting in each worker, only those get notified */
+    ngx_atomic_t            waiters[NGX_MAX_PROCESSES];
+} ngx_http_php_queue_shctx_t;
+
+typedef struct {
+    ngx_http_php_queue_shctx_t  *sh;
+    ngx_slab_pool_t             *shpool;
+    ngx_str_t                   name;
+    ngx_cycle_t                 *cycle;
+
+    /* one eventfd or socketpair per worker, created before the fork */
+    ngx_uint_t                  nworkers;
+    ngx_socket_t                *fds;
+    ngx_connection_t            *notify;
+
+    /* waiters of this worker */
+    ngx_queue_t                 waiting;
+} ngx_http_php_queue_ctx_t;
+
+ngx_int_t ngx_http_php_queue_init_zone(ngx_shm_zone_t *shm_zone, void *data);
+void ngx_http_php_queue_init_worker(ngx_cycle_t *cycle);
+
+ngx_shm_zone_t *ngx_http_php_queue_zone(ngx_str_t *name);
+
+ngx_int_t ngx_http_php_queue_push(ngx_shm_zone_t *zone, ngx_str_t *msg, 
+    uint64_t *seq);
+ngx_int_t ngx_http_php_queue_wait(ngx_http_request_t *r, ngx_shm_zone_t *zone, 
+    ngx_uint_t pop, int64_t after, ngx_msec_t timeout, zval *rv);
+
+#endif
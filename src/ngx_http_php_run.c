@@ -0,0 +1,171 @@
+/*
+==============================================================================
+Copyright (c) 2016-2020, rryqszq4 <rryqszq@gmail.com>
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+
+* Redistributions of source code must retain the above copyright notice, this
+  list of conditions and the following disclaimer.
+
+* Redistributions in binary form must reproduce the above copyright notice,
+  this list of conditions and the following disclaimer in the documentation
+  and/or other materials provided with the distribution.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+==============================================================================
+*/
+
+#include "ngx_http_php_module.h"
+#include "ngx_http_php_run.h"
+#include "ngx_http_php_stat.h"
+#include "ngx_http_php_slowlog.h"
+#include "ngx_http_php_trace.h"
+#include "ngx_http_php_memcheck.h"
+
+static ngx_uint_t ngx_http_php_run_enabled(ngx_http_request_t *r);
+static void ngx_http_php_run_cleanup(void *data);
+
+/* 
+ * One pool cleanup per request, subrequests share the pool of the main 
+ * request. A redirect resets the module ctx, which only caches it.
+ */
+ngx_http_php_run_t *
+ngx_http_php_run_request(ngx_http_request_t *r, ngx_uint_t create)
+{
+    ngx_http_php_ctx_t          *ctx;
+    ngx_pool_cleanup_t          *cln;
+    ngx_http_php_run_t          *run;
+
+    ctx = ngx_http_get_module_ctx(r, ngx_http_php_module);
+
+    if (ctx && ctx->run) {
+        return ctx->run;
+    }
+
+    run = NULL;
+
+    for (cln = r->pool->cleanup; cln; cln = cln->next) {
+        if (cln->handler == ngx_http_php_run_cleanup 
+            && ((ngx_http_php_run_t *) cln->data)->request == r)
+        {
+            run = cln->data;
+            break;
+        }
+    }
+
+    if (run == NULL) {
+        if (!create) {
+            return NULL;
+        }
+
+        cln = ngx_pool_cleanup_add(r->pool, sizeof(ngx_http_php_run_t));
+        if (cln == NULL) {
+            return NULL;
+        }
+
+        run = cln->data;
+        ngx_memzero(run, sizeof(ngx_http_php_run_t));
+
+        run->request = r;
+
+        cln->handler = ngx_http_php_run_cleanup;
+    }
+
+    if (ctx) {
+        ctx->run = run;
+    }
+
+    return run;
+}
+
+/* 
+ * The php code of a phase starts, or with NGX_HTTP_PHP_STAT_IDLE, 
+ * a coroutine is resumed.
+ */
+void
+ngx_http_php_run_enter(ngx_http_request_t *r, ngx_uint_t phase)
+{
+    ngx_http_php_run_t          *run;
+
+    if (!ngx_http_php_run_enabled(r)) {
+        return;
+    }
+
+    run = ngx_http_php_run_request(r, 1);
+    if (run == NULL) {
+        return;
+    }
+
+    ngx_http_php_stat_enter(run, phase);
+    ngx_http_php_slowlog_enter(run, phase);
+
+    if (phase != NGX_HTTP_PHP_STAT_IDLE) {
+        ngx_http_php_memcheck_enter(run);
+    }
+
+    ngx_http_php_trace_enter(run);
+}
+
+/* After a run of php code, suspended if the coroutine yielded. */
+void
+ngx_http_php_run_leave(ngx_http_request_t *r)
+{
+    ngx_http_php_run_t          *run;
+
+    if (!ngx_http_php_run_enabled(r)) {
+        return;
+    }
+
+    run = ngx_http_php_run_request(r, 0);
+    if (run == NULL) {
+        return;
+    }
+
+    ngx_http_php_stat_leave(run);
+    ngx_http_php_slowlog_leave(run);
+    ngx_http_php_trace_leave(run);
+}
+
+static ngx_uint_t
+ngx_http_php_run_enabled(ngx_http_request_t *r)
+{
+    ngx_http_php_main_conf_t    *pmcf;
+
+    pmcf = ngx_http_get_module_main_conf(r, ngx_http_php_module);
+
+    return pmcf->enabled_timing || pmcf->enabled_slowlog 
+           || pmcf->enabled_trace || pmcf->enabled_memcheck;
+}
+
+static void
+ngx_http_php_run_cleanup(void *data)
+{
+    ngx_http_php_run_t          *run = data;
+
+    if (run->trace) {
+        ngx_http_php_trace_done(run->trace);
+    }
+
+    if (run->memcheck) {
+        ngx_http_php_memcheck_done(run->memcheck);
+    }
+
+    if (run->slowlog) {
+        ngx_http_php_slowlog_done(run->slowlog);
+    }
+
+    if (run->stat) {
+        ngx_http_php_stat_done(run->stat);
+    }
+}
@@ -0,0 +1,58 @@
+/*
+==============================================================================
+Copyright (c) 2016-2020, rryqszq4 <rryqszq@gmail.com>
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+
+* Redistributions of source code must retain the above copyright notice, this
+  list of conditions and the following disclaimer.
+
+* Redistributions in binary form must reproduce the above copyright notice,
+  this list of conditions and the following disclaimer in the documentation
+  and/or other materials provided with the distribution.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+==============================================================================
+*/
+
+#ifndef __NGX_HTTP_PHP_RUN_H__
+#define __NGX_HTTP_PHP_RUN_H__
+
+#include "ngx_http_php_module.h"
+
+typedef struct ngx_http_php_stat_req_s ngx_http_php_stat_req_t;
+typedef struct ngx_http_php_slowlog_req_s ngx_http_php_slowlog_req_t;
+typedef struct ngx_http_php_trace_s ngx_http_php_trace_t;
+typedef struct ngx_http_php_memcheck_req_s ngx_http_php_memcheck_req_t;
+
+/* 
+ * What the stats, the slowlog, the trace and the memcheck keep of a 
+ * request, each part set once it is used.
+ */
+typedef struct {
+    ngx_http_request_t              *request;
+
+    ngx_http_php_stat_req_t         *stat;
+    ngx_http_php_slowlog_req_t      *slowlog;
+    ngx_http_php_trace_t            *trace;
+    ngx_http_php_memcheck_req_t     *memcheck;
+} ngx_http_php_run_t;
+
+ngx_http_php_run_t *ngx_http_php_run_request(ngx_http_request_t *r, 
+    ngx_uint_t create);
+
+void ngx_http_php_run_enter(ngx_http_request_t *r, ngx_uint_t phase);
+void ngx_http_php_run_leave(ngx_http_request_t *r);
+
+#endif
@@ -0,0 +1,673 @@
+/*
+==============================================================================
+Copyright (c) 2016-2020, rryqszq4 <rryqszq@gmail.com>
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+
+* Redistributions of source code must retain the above copyright notice, this
+  list of conditions and the following disclaimer.
+
+* Redistributions in binary form must reproduce the above copyright notice,
+  this list of conditions and the following disclaimer in the documentation
+  and/or other materials provided with the distribution.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+==============================================================================
+*/
+
+#include "ngx_http_php_module.h"
+#include "ngx_http_php_shdict.h"
+
+#define ngx_http_php_shdict_node(sd)                                          \
+    ((ngx_rbtree_node_t *) ((u_char *) (sd) - offsetof(ngx_rbtree_node_t, color)))
+
+static void ngx_http_php_shdict_rbtree_insert_value(ngx_rbtree_node_t *temp,
+    ngx_rbtree_node_t *node, ngx_rbtree_node_t *sentinel);
+static uint64_t ngx_http_php_shdict_now(void);
+static ngx_int_t ngx_http_php_shdict_lookup(ngx_http_php_shdict_ctx_t *ctx, 
+    ngx_uint_t hash, ngx_str_t *key, ngx_http_php_shdict_node_t **sdp);
+static void ngx_http_php_shdict_remove(ngx_http_php_shdict_ctx_t *ctx, 
+    ngx_http_php_shdict_node_t *sd);
+static ngx_uint_t ngx_http_php_shdict_expire(ngx_http_php_shdict_ctx_t *ctx, 
+    ngx_uint_t n);
+static ngx_int_t ngx_http_php_shdict_store(ngx_http_php_shdict_ctx_t *ctx, 
+    ngx_uint_t hash, ngx_str_t *key, ngx_uint_t type, u_char *data, 
+    size_t len, uint64_t expires, ngx_uint_t op);
+static void ngx_http_php_shdict_value(ngx_http_php_shdict_node_t *sd, zval *rv);
+
+ngx_int_t
+ngx_http_php_shdict_init_zone(ngx_shm_zone_t *shm_zone, void *data)
+{
+    ngx_http_php_shdict_ctx_t   *octx = data;
+    ngx_http_php_shdict_ctx_t   *ctx;
+    size_t                      len;
+
+    ctx = shm_zone->data;
+
+    if (octx) {
+        /* reload keeps the zone and everything stored in it */
+        ctx->sh = octx->sh;
+        ctx->shpool = octx->shpool;
+
+        return NGX_OK;
+    }
+
+    ctx->shpool = (ngx_slab_pool_t *) shm_zone->shm.addr;
+
+    if (shm_zone->shm.exists) {
+        ctx->sh = ctx->shpool->data;
+
+        return NGX_OK;
+    }
+
+    ctx->sh = ngx_slab_alloc(ctx->shpool, sizeof(ngx_http_php_shdict_shctx_t));
+    if (ctx->sh == NULL) {
+        return NGX_ERROR;
+    }
+
+    ctx->shpool->data = ctx->sh;
+
+    ngx_rbtree_init(&ctx->sh->rbtree, &ctx->sh->sentinel,
+                    ngx_http_php_shdict_rbtree_insert_value);
+
+    ngx_queue_init(&ctx->sh->lru_queue);
+
+    len = sizeof(" in php_shared_dict zone \"\"") + shm_zone->shm.name.len;
+
+    ctx->shpool->log_ctx = ngx_slab_alloc(ctx->shpool, len);
+    if (ctx->shpool->log_ctx == NULL) {
+        return NGX_ERROR;
+    }
+
+    ngx_sprintf(ctx->shpool->log_ctx, " in php_shared_dict zone \"%V\"%Z",
+                &shm_zone->shm.name);
+
+    /* running out of memory is expected, the lru makes room */
+    ctx->shpool->log_nomem = 0;
+
+    return NGX_OK;
+}
+
+ngx_shm_zone_t *
+ngx_http_php_shdict_zone(ngx_str_t *name)
+{
+    ngx_http_php_main_conf_t    *pmcf;
+    ngx_shm_zone_t              **zone;
+    ngx_uint_t                  i;
+
+    pmcf = ngx_http_cycle_get_module_main_conf(ngx_cycle, ngx_http_php_module);
+    if (pmcf == NULL || pmcf->shdict_zones == NULL) {
+        return NULL;
+    }
+
+    zone = pmcf->shdict_zones->elts;
+
+    for (i = 0; i < pmcf->shdict_zones->nelts; i++) {
+        if (name->len == zone[i]->shm.name.len
+            && ngx_strncmp(name->data, zone[i]->shm.name.data, name->len) == 0)
+        {
+            return zone[i];
+        }
+    }
+
+    return NULL;
+}
+
+ngx_int_t
+ngx_http_php_shdict_get(ngx_shm_zone_t *zone, ngx_str_t *key, zval *rv)
+{
+    ngx_http_php_shdict_ctx_t   *ctx;
+    ngx_http_php_shdict_node_t  *sd;
+    ngx_uint_t                  hash;
+    ngx_int_t                   rc;
+
+    ctx = zone->data;
+    hash = ngx_crc32_short(key->data, key->len);
+
+    ngx_shmtx_lock(&ctx->shpool->mutex);
+
+    rc = ngx_http_php_shdict_lookup(ctx, hash, key, &sd);
+
+    if (rc == NGX_OK) {
+        /* copied out under the lock, another worker may free the node */
+        ngx_http_php_shdict_value(sd, rv);
+    }
+
+    ngx_shmtx_unlock(&ctx->shpool->mutex);
+
+    return rc == NGX_OK ? NGX_OK : NGX_DECLINED;
+}
+
+ngx_int_t
+ngx_http_php_shdict_set(ngx_shm_zone_t *zone, ngx_str_t *key, zval *value, 
+    ngx_msec_t exptime, ngx_uint_t op)
+{
+    ngx_http_php_shdict_ctx_t   *ctx;
+    ngx_uint_t                  hash, type;
+    u_char                      *data, b;
+    size_t                      len;
+    int64_t                     l;
+    double                      d;
+    uint64_t                    expires;
+    ngx_int_t                   rc;
+
+    switch (Z_TYPE_P(value)) {
+
+    case IS_NULL:
+        type = 0;
+        data = NULL;
+        len = 0;
+        break;
+
+    case IS_STRING:
+        type = NGX_HTTP_PHP_SHDICT_STRING;
+        data = (u_char *) Z_STRVAL_P(value);
+        len = Z_STRLEN_P(value);
+        break;
+
+    case IS_LONG:
+        type = NGX_HTTP_PHP_SHDICT_LONG;
+        l = (int64_t) Z_LVAL_P(value);
+        data = (u_char *) &l;
+        len = sizeof(int64_t);
+        break;
+
+    case IS_DOUBLE:
+        type = NGX_HTTP_PHP_SHDICT_DOUBLE;
+        d = Z_DVAL_P(value);
+        data = (u_char *) &d;
+        len = sizeof(double);
+        break;
+
+    case IS_TRUE:
+    case IS_FALSE:
+        type = NGX_HTTP_PHP_SHDICT_BOOL;
+        b = Z_TYPE_P(value) == IS_TRUE;
+        data = &b;
+        len = 1;
+        break;
+
+    default:
+        return NGX_ABORT;
+    }
+
+    ctx = zone->data;
+    hash = ngx_crc32_short(key->data, key->len);
+    expires = exptime ? ngx_http_php_shdict_now() + exptime : 0;
+
+    ngx_shmtx_lock(&ctx->shpool->mutex);
+
+    rc = ngx_http_php_shdict_store(ctx, hash, key, type, data, len, expires, op);
+
+    ngx_shmtx_unlock(&ctx->shpool->mutex);
+
+    return rc;
+}
+
+ngx_int_t
+ngx_http_php_shdict_incr(ngx_shm_zone_t *zone, ngx_str_t *key, zval *delta, 
+    zval *init, zval *rv)
+{
+    ngx_http_php_shdict_ctx_t   *ctx;
+    ngx_http_php_shdict_node_t  *sd;
+    ngx_uint_t                  hash, type;
+    ngx_int_t                   rc;
+    int64_t                     l, dl;
+    double                      d;
+    zval                        base;
+
+    ctx = zone->data;
+    hash = ngx_crc32_short(key->data, key->len);
+
+    ngx_shmtx_lock(&ctx->shpool->mutex);
+
+    rc = ngx_http_php_shdict_lookup(ctx, hash, key, &sd);
+
+    if (rc == NGX_OK) {
+        if (sd->value_type != NGX_HTTP_PHP_SHDICT_LONG
+            && sd->value_type != NGX_HTTP_PHP_SHDICT_DOUBLE)
+        {
+            ngx_shmtx_unlock(&ctx->shpool->mutex);
+            return NGX_ABORT;
+        }
+
+        ngx_http_php_shdict_value(sd, &base);
+
+    } else if (init == NULL) {
+        ngx_shmtx_unlock(&ctx->shpool->mutex);
+        return NGX_DECLINED;
+
+    } else {
+        ZVAL_COPY_VALUE(&base, init);
+        sd = NULL;
+    }
+
+    if (Z_TYPE(base) == IS_LONG && Z_TYPE_P(delta) == IS_LONG) {
+        l = (int64_t) Z_LVAL(base);
+        dl = (int64_t) Z_LVAL_P(delta);
+
+        /* php promotes an overflowing integer to a float, so do we */
+        if ((dl > 0 && l > ZEND_LONG_MAX - dl)
+            || (dl < 0 && l < ZEND_LONG_MIN - dl))
+        {
+            d = (double) l + (double) dl;
+            type = NGX_HTTP_PHP_SHDICT_DOUBLE;
+            ZVAL_DOUBLE(rv, d);
+
+        } else {
+            l += dl;
+            type = NGX_HTTP_PHP_SHDICT_LONG;
+            ZVAL_LONG(rv, (zend_long) l);
+        }
+
+    } else {
+        d = zval_get_double(&base) + zval_get_double(delta);
+        type = NGX_HTTP_PHP_SHDICT_DOUBLE;
+        ZVAL_DOUBLE(rv, d);
+    }
+
+    if (sd) {
+        /* both number types take 8 bytes, the node is updated in place */
+        sd->value_type = (u_char) type;
+
+        if (type == NGX_HTTP_PHP_SHDICT_LONG) {
+            ngx_memcpy(sd->data + sd->key_len, &l, sizeof(int64_t));
+        } else {
+            ngx_memcpy(sd->data + sd->key_len, &d, sizeof(double));
+        }
+
+        rc = NGX_OK;
+
+    } else {
+        rc = ngx_http_php_shdict_store(ctx, hash, key, type,
+                                       type == NGX_HTTP_PHP_SHDICT_LONG 
+                                           ? (u_char *) &l : (u_char *) &d,
+                                       sizeof(int64_t), 0, 
+                                       NGX_HTTP_PHP_SHDICT_SET);
+    }
+
+    ngx_shmtx_unlock(&ctx->shpool->mutex);
+
+    return rc;
+}
+
+/* the value is copied into the pool, only string values are returned */
+ngx_int_t
+ngx_http_php_shdict_get_string(ngx_shm_zone_t *zone, ngx_str_t *key, 
+    ngx_pool_t *pool, ngx_str_t *value)
+{
+    ngx_http_php_shdict_ctx_t   *ctx;
+    ngx_http_php_shdict_node_t  *sd;
+    ngx_uint_t                  hash;
+    ngx_int_t                   rc;
+
+    ctx = zone->data;
+    hash = ngx_crc32_short(key->data, key->len);
+
+    ngx_shmtx_lock(&ctx->shpool->mutex);
+
+    rc = ngx_http_php_shdict_lookup(ctx, hash, key, &sd);
+
+    if (rc != NGX_OK || sd->value_type != NGX_HTTP_PHP_SHDICT_STRING) {
+        ngx_shmtx_unlock(&ctx->shpool->mutex);
+        return NGX_DECLINED;
+    }
+
+    value->len = sd->value_len;
+    value->data = ngx_pnalloc(pool, value->len);
+
+    if (value->data == NULL) {
+        ngx_shmtx_unlock(&ctx->shpool->mutex);
+        return NGX_ERROR;
+    }
+
+    ngx_memcpy(value->data, sd->data + sd->key_len, value->len);
+
+    ngx_shmtx_unlock(&ctx->shpool->mutex);
+
+    return NGX_OK;
+}
+
+/* a NULL value removes the key */
+ngx_int_t
+ngx_http_php_shdict_set_string(ngx_shm_zone_t *zone, ngx_str_t *key, 
+    ngx_str_t *value, ngx_msec_t exptime, ngx_uint_t op)
+{
+    ngx_http_php_shdict_ctx_t   *ctx;
+    ngx_uint_t                  hash;
+    uint64_t                    expires;
+    ngx_int_t                   rc;
+
+    ctx = zone->data;
+    hash = ngx_crc32_short(key->data, key->len);
+    expires = exptime ? ngx_http_php_shdict_now() + exptime : 0;
+
+    ngx_shmtx_lock(&ctx->shpool->mutex);
+
+    if (value) {
+        rc = ngx_http_php_shdict_store(ctx, hash, key, 
+                                       NGX_HTTP_PHP_SHDICT_STRING, 
+                                       value->data, value->len, expires, op);
+    } else {
+        rc = ngx_http_php_shdict_store(ctx, hash, key, 0, NULL, 0, 0, op);
+    }
+
+    ngx_shmtx_unlock(&ctx->shpool->mutex);
+
+    return rc;
+}
+
+ngx_uint_t
+ngx_http_php_shdict_flush_expired(ngx_shm_zone_t *zone, ngx_uint_t max)
+{
+    ngx_http_php_shdict_ctx_t   *ctx;
+    ngx_http_php_shdict_node_t  *sd;
+    ngx_queue_t                 *q, *prev;
+    ngx_uint_t                  freed;
+    uint64_t                    now;
+
+    ctx = zone->data;
+    now = ngx_http_php_shdict_now();
+    freed = 0;
+
+    ngx_shmtx_lock(&ctx->shpool->mutex);
+
+    q = ngx_queue_last(&ctx->sh->lru_queue);
+
+    while (q != ngx_queue_sentinel(&ctx->sh->lru_queue)) {
+        prev = ngx_queue_prev(q);
+        sd = ngx_queue_data(q, ngx_http_php_shdict_node_t, queue);
+
+        if (sd->expires && sd->expires <= now) {
+            ngx_http_php_shdict_remove(ctx, sd);
+
+            if (++freed == max) {
+                break;
+            }
+        }
+
+        q = prev;
+    }
+
+    ngx_shmtx_unlock(&ctx->shpool->mutex);
+
+    return freed;
+}
+
+static void
+ngx_http_php_shdict_rbtree_insert_value(ngx_rbtree_node_t *temp,
+    ngx_rbtree_node_t *node, ngx_rbtree_node_t *sentinel)
+{
+    ngx_rbtree_node_t           **p;
+    ngx_http_php_shdict_node_t  *sdn, *sdt;
+
+    for ( ;; ) {
+
+        if (node->key < temp->key) {
+            p = &temp->left;
+
+        } else if (node->key > temp->key) {
+            p = &temp->right;
+
+        } else {
+            sdn = (ngx_http_php_shdict_node_t *) &node->color;
+            sdt = (ngx_http_php_shdict_node_t *) &temp->color;
+
+            p = ngx_memn2cmp(sdn->data, sdt->data, sdn->key_len,
+                             sdt->key_len) < 0 ? &temp->left : &temp->right;
+        }
+
+        if (*p == sentinel) {
+            break;
+        }
+
+        temp = *p;
+    }
+
+    *p = node;
+    node->parent = temp;
+    node->left = sentinel;
+    node->right = sentinel;
+    ngx_rbt_red(node);
+}
+
+static uint64_t
+ngx_http_php_shdict_now(void)
+{
+    ngx_time_t  *tp;
+
+    tp = ngx_timeofday();
+
+    return (uint64_t) tp->sec * 1000 + tp->msec;
+}
+
+/*
+ * NGX_OK for a live entry, which becomes the most recently used one, 
+ * NGX_DONE for an expired entry still in the tree, NGX_DECLINED otherwise.
+ */
+static ngx_int_t
+ngx_http_php_shdict_lookup(ngx_http_php_shdict_ctx_t *ctx, ngx_uint_t hash, 
+    ngx_str_t *key, ngx_http_php_shdict_node_t **sdp)
+{
+    ngx_int_t                   rc;
+    ngx_rbtree_node_t           *node, *sentinel;
+    ngx_http_php_shdict_node_t  *sd;
+
+    node = ctx->sh->rbtree.root;
+    sentinel = ctx->sh->rbtree.sentinel;
+
+    while (node != sentinel) {
+
+        if (hash < node->key) {
+            node = node->left;
+            continue;
+        }
+
+        if (hash > node->key) {
+            node = node->right;
+            continue;
+        }
+
+        sd = (ngx_http_php_shdict_node_t *) &node->color;
+
+        rc = ngx_memn2cmp(key->data, sd->data, key->len, (size_t) sd->key_len);
+
+        if (rc == 0) {
+            ngx_queue_remove(&sd->queue);
+            ngx_queue_insert_head(&ctx->sh->lru_queue, &sd->queue);
+
+            *sdp = sd;
+
+            if (sd->expires && sd->expires <= ngx_http_php_shdict_now()) {
+                return NGX_DONE;
+            }
+
+            return NGX_OK;
+        }
+
+        node = (rc < 0) ? node->left : node->right;
+    }
+
+    *sdp = NULL;
+
+    return NGX_DECLINED;
+}
+
+static void
+ngx_http_php_shdict_remove(ngx_http_php_shdict_ctx_t *ctx, 
+    ngx_http_php_shdict_node_t *sd)
+{
+    ngx_rbtree_node_t   *node;
+
+    node = ngx_http_php_shdict_node(sd);
+
+    ngx_queue_remove(&sd->queue);
+    ngx_rbtree_delete(&ctx->sh->rbtree, node);
+    ngx_slab_free_locked(ctx->shpool, node);
+}
+
+/*
+ * n == 0 evicts the least recently used entry no matter what, then up to 
+ * two more entries are freed from the tail as long as they have expired.
+ */
+static ngx_uint_t
+ngx_http_php_shdict_expire(ngx_http_php_shdict_ctx_t *ctx, ngx_uint_t n)
+{
+    ngx_queue_t                 *q;
+    ngx_http_php_shdict_node_t  *sd;
+    ngx_uint_t                  freed;
+    uint64_t                    now;
+
+    now = ngx_http_php_shdict_now();
+    freed = 0;
+
+    while (n < 3) {
+
+        if (ngx_queue_empty(&ctx->sh->lru_queue)) {
+            return freed;
+        }
+
+        q = ngx_queue_last(&ctx->sh->lru_queue);
+        sd = ngx_queue_data(q, ngx_http_php_shdict_node_t, queue);
+
+        if (n++ != 0) {
+            if (sd->expires == 0 || sd->expires > now) {
+                return freed;
+            }
+        }
+
+        ngx_http_php_shdict_remove(ctx, sd);
+        freed++;
+    }
+
+    return freed;
+}
+
+/* type 0 removes the key, called with the zone locked */
+static ngx_int_t
+ngx_http_php_shdict_store(ngx_http_php_shdict_ctx_t *ctx, ngx_uint_t hash, 
+    ngx_str_t *key, ngx_uint_t type, u_char *data, size_t len, 
+    uint64_t expires, ngx_uint_t op)
+{
+    ngx_int_t                   rc;
+    ngx_uint_t                  i;
+    size_t                      size;
+    ngx_rbtree_node_t           *node;
+    ngx_http_php_shdict_node_t  *sd;
+
+    ngx_http_php_shdict_expire(ctx, 1);
+
+    rc = ngx_http_php_shdict_lookup(ctx, hash, key, &sd);
+
+    if (op == NGX_HTTP_PHP_SHDICT_ADD && rc == NGX_OK) {
+        return NGX_DECLINED;
+    }
+
+    if (op == NGX_HTTP_PHP_SHDICT_REPLACE && rc != NGX_OK) {
+        return NGX_DECLINED;
+    }
+
+    if (sd) {
+        if (type && sd->value_len == len) {
+            sd->value_type = (u_char) type;
+            sd->expires = expires;
+            ngx_memcpy(sd->data + sd->key_len, data, len);
+
+            return NGX_OK;
+        }
+
+        ngx_http_php_shdict_remove(ctx, sd);
+    }
+
+    if (type == 0) {
+        return NGX_OK;
+    }
+
+    size = offsetof(ngx_rbtree_node_t, color)
+           + offsetof(ngx_http_php_shdict_node_t, data)
+           + key->len
+           + len;
+
+    node = ngx_slab_alloc_locked(ctx->shpool, size);
+
+    if (node == NULL) {
+
+        /* make room by evicting the least recently used entries */
+
+        for (i = 0; i < 30; i++) {
+            if (ngx_http_php_shdict_expire(ctx, 0) == 0) {
+                break;
+            }
+
+            node = ngx_slab_alloc_locked(ctx->shpool, size);
+            if (node != NULL) {
+                break;
+            }
+        }
+
+        if (node == NULL) {
+            ngx_log_error(NGX_LOG_ERR, ngx_cycle->log, 0,
+                          "php_shared_dict \"%V\": no memory for %uz bytes",
+                          &ctx->name, size);
+            return NGX_ERROR;
+        }
+    }
+
+    sd = (ngx_http_php_shdict_node_t *) &node->color;
+
+    node->key = hash;
+    sd->key_len = (u_short) key->len;
+    sd->value_len = (uint32_t) len;
+    sd->value_type = (u_char) type;
+    sd->expires = expires;
+
+    ngx_memcpy(sd->data, key->data, key->len);
+    ngx_memcpy(sd->data + key->len, data, len);
+
+    ngx_rbtree_insert(&ctx->sh->rbtree, node);
+    ngx_queue_insert_head(&ctx->sh->lru_queue, &sd->queue);
+
+    return NGX_OK;
+}
+
+static void
+ngx_http_php_shdict_value(ngx_http_php_shdict_node_t *sd, zval *rv)
+{
+    u_char      *p;
+    int64_t     l;
+    double      d;
+
+    p = sd->data + sd->key_len;
+
+    switch (sd->value_type) {
+
+    case NGX_HTTP_PHP_SHDICT_LONG:
+        ngx_memcpy(&l, p, sizeof(int64_t));
+        ZVAL_LONG(rv, (zend_long) l);
+        break;
+
+    case NGX_HTTP_PHP_SHDICT_DOUBLE:
+        ngx_memcpy(&d, p, sizeof(double));
+        ZVAL_DOUBLE(rv, d);
+        break;
+
+    case NGX_HTTP_PHP_SHDICT_BOOL:
+        ZVAL_BOOL(rv, *p);
+        break;
+
+    default:
+        ZVAL_STRINGL(rv, (char *) p, sd->value_len);
+        break;
+    }
+}
@@ -0,0 +1,90 @@
+/*
+==============================================================================
+Copyright (c) 2016-2020, rryqszq4 <rryqszq@gmail.com>
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+
+* Redistributions of source code must retain the above copyright notice, this
+  list of conditions and the following disclaimer.
+
+* Redistributions in binary form must reproduce the above copyright notice,
+  this list of conditions and the following disclaimer in the documentation
+  and/or other materials provided with the distribution.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+==============================================================================
+*/
+
+#ifndef __NGX_HTTP_PHP_SHDICT_H__
+#define __NGX_HTTP_PHP_SHDICT_H__
+
+#include "ngx_http_php_module.h"
+
+#define NGX_HTTP_PHP_SHDICT_STRING      1
+#define NGX_HTTP_PHP_SHDICT_LONG        2
+#define NGX_HTTP_PHP_SHDICT_DOUBLE      3
+#define NGX_HTTP_PHP_SHDICT_BOOL        4
+
+#define NGX_HTTP_PHP_SHDICT_SET         0
+#define NGX_HTTP_PHP_SHDICT_ADD         1
+#define NGX_HTTP_PHP_SHDICT_REPLACE     2
+
+#define NGX_HTTP_PHP_SHDICT_MAX_KEY     65535
+
+typedef struct {
+    u_char                  color;
+    u_char                  value_type;
+    u_short                 key_len;
+    uint32_t                value_len;
+
+    /* absolute time in milliseconds, 0 never expires */
+    uint64_t                expires;
+
+    ngx_queue_t             queue;
+    u_char                  data[1];
+} ngx_http_php_shdict_node_t;
+
+typedef struct {
+    ngx_rbtree_t            rbtree;
+    ngx_rbtree_node_t       sentinel;
+
+    /* most recently used at the head */
+    ngx_queue_t             lru_queue;
+} ngx_http_php_shdict_shctx_t;
+
+typedef struct {
+    ngx_http_php_shdict_shctx_t     *sh;
+    ngx_slab_pool_t                 *shpool;
+    ngx_str_t                       name;
+    ngx_log_t                       *log;
+} ngx_http_php_shdict_ctx_t;
+
+ngx_int_t ngx_http_php_shdict_init_zone(ngx_shm_zone_t *shm_zone, void *data);
+
+ngx_shm_zone_t *ngx_http_php_shdict_zone(ngx_str_t *name);
+
+ngx_int_t ngx_http_php_shdict_get(ngx_shm_zone_t *zone, ngx_str_t *key, 
+    zval *rv);
+ngx_int_t ngx_http_php_shdict_set(ngx_shm_zone_t *zone, ngx_str_t *key, 
+    zval *value, ngx_msec_t exptime, ngx_uint_t op);
+ngx_int_t ngx_http_php_shdict_incr(ngx_shm_zone_t *zone, ngx_str_t *key, 
+    zval *delta, zval *init, zval *rv);
+ngx_int_t ngx_http_php_shdict_get_string(ngx_shm_zone_t *zone, ngx_str_t *key, 
+    ngx_pool_t *pool, ngx_str_t *value);
+ngx_int_t ngx_http_php_shdict_set_string(ngx_shm_zone_t *zone, ngx_str_t *key, 
+    ngx_str_t *value, ngx_msec_t exptime, ngx_uint_t op);
+ngx_uint_t ngx_http_php_shdict_flush_expired(ngx_shm_zone_t *zone, 
+    ngx_uint_t max);
+
+#endif
@@ -0,0 +1,433 @@
+/*
+==============================================================================
+Copyright (c) 2016-2020, rryqszq4 <rryqszq@gmail.com>
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+
+* Redistributions of source code must retain the above copyright notice, this
+  list of conditions and the following disclaimer.
+
+* Redistributions in binary form must reproduce the above copyright notice,
+  this list of conditions and the following disclaimer in the documentation
+  and/or other materials provided with the distribution.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+==============================================================================
+*/
+
+#include "ngx_http_php_module.h"
+#include "ngx_http_php_run.h"
+#include "ngx_http_php_stat.h"
+#include "ngx_http_php_slowlog.h"
+
+#include <zend_generators.h>
+
+struct ngx_http_php_slowlog_req_s {
+    ngx_http_request_t          *request;
+
+    /* a suspension past the timeout */
+    ngx_event_t                 event;
+
+    ngx_uint_t                  phase;
+    ngx_msec_t                  start;
+
+    /* once per request, as php-fpm */
+    unsigned                    logged:1;
+};
+
+static void ngx_http_php_slowlog_suspended_handler(ngx_event_t *ev);
+static void ngx_http_php_slowlog_write(ngx_http_php_slowlog_req_t *sl, 
+    zend_execute_data *execute_data);
+static u_char *ngx_http_php_slowlog_frame(u_char *p, u_char *last, 
+    zend_execute_data *ex);
+
+#if (NGX_HTTP_PHP_HAVE_SLOWLOG_TIMER)
+
+static void ngx_http_php_slowlog_arm(ngx_msec_t timeout);
+static void ngx_http_php_slowlog_signal_handler(int signo);
+static void ngx_http_php_slowlog_interrupt(zend_execute_data *execute_data);
+
+static timer_t ngx_http_php_slowlog_timer;
+static ngx_uint_t ngx_http_php_slowlog_timer_created;
+
+/* the request running php code, and the one the timer went off for */
+static ngx_http_php_slowlog_req_t *ngx_http_php_slowlog_running;
+static ngx_http_php_slowlog_req_t * volatile ngx_http_php_slowlog_fired;
+
+static void (*ngx_http_php_slowlog_orig_interrupt)(zend_execute_data *execute_data);
+
+#endif
+
+static char *ngx_http_php_slowlog_phases[] = {
+    "", "", "", "", "rewrite", "access", "content", "log"
+};
+
+void
+ngx_http_php_slowlog_init_worker(ngx_cycle_t *cycle)
+{
+#if (NGX_HTTP_PHP_HAVE_SLOWLOG_TIMER)
+    ngx_http_php_main_conf_t    *pmcf;
+    struct sigaction            sa;
+    struct sigevent             sev;
+
+    pmcf = ngx_http_cycle_get_module_main_conf(cycle, ngx_http_php_module);
+
+    if (pmcf == NULL || !pmcf->enabled_slowlog) {
+        return;
+    }
+
+    if (ngx_process != NGX_PROCESS_WORKER && ngx_process != NGX_PROCESS_SINGLE) {
+        return;
+    }
+
+    /* SIGVTALRM is used neither by nginx nor by php */
+
+    ngx_memzero(&sa, sizeof(struct sigaction));
+    sa.sa_handler = ngx_http_php_slowlog_signal_handler;
+    sa.sa_flags = SA_RESTART;
+    sigemptyset(&sa.sa_mask);
+
+    if (sigaction(SIGVTALRM, &sa, NULL) == -1) {
+        ngx_log_error(NGX_LOG_ALERT, cycle->log, ngx_errno, 
+                      "php slowlog sigaction(SIGVTALRM) failed");
+        return;
+    }
+
+    ngx_memzero(&sev, sizeof(struct sigevent));
+    sev.sigev_notify = SIGEV_SIGNAL;
+    sev.sigev_signo = SIGVTALRM;
+
+    if (timer_create(CLOCK_MONOTONIC, &sev, &ngx_http_php_slowlog_timer) == -1) {
+        ngx_log_error(NGX_LOG_ALERT, cycle->log, ngx_errno, 
+                      "php slowlog timer_create() failed");
+        return;
+    }
+
+    ngx_http_php_slowlog_timer_created = 1;
+
+    ngx_http_php_slowlog_orig_interrupt = zend_interrupt_function;
+    zend_interrupt_function = ngx_http_php_slowlog_interrupt;
+#endif
+}
+
+/* 
+ * The php code of a phase starts, or with NGX_HTTP_PHP_STAT_IDLE, 
+ * a coroutine is resumed: the end of a suspension.
+ */
+void
+ngx_http_php_slowlog_enter(ngx_http_php_run_t *run, ngx_uint_t phase)
+{
+    ngx_http_php_loc_conf_t     *plcf;
+    ngx_http_php_slowlog_req_t  *sl;
+    ngx_http_request_t          *r;
+
+    r = run->request;
+
+    plcf = ngx_http_get_module_loc_conf(r, ngx_http_php_module);
+
+    if (plcf->slowlog == NULL || plcf->slowlog_timeout == 0) {
+        return;
+    }
+
+    sl = run->slowlog;
+
+    if (sl == NULL) {
+        sl = ngx_pcalloc(r->pool, sizeof(ngx_http_php_slowlog_req_t));
+        if (sl == NULL) {
+            return;
+        }
+
+        sl->request = r;
+
+        sl->event.handler = ngx_http_php_slowlog_suspended_handler;
+        sl->event.data = sl;
+        sl->event.log = r->connection->log;
+
+        run->slowlog = sl;
+    }
+
+    if (sl->logged) {
+        return;
+    }
+
+    if (sl->event.timer_set) {
+        ngx_del_timer(&sl->event);
+    }
+
+    if (phase == NGX_HTTP_PHP_STAT_IDLE) {
+        phase = sl->phase;
+
+        if (phase == NGX_HTTP_PHP_STAT_IDLE) {
+            return;
+        }
+
+    } else {
+        sl->phase = phase;
+    }
+
+    sl->start = ngx_current_msec;
+
+#if (NGX_HTTP_PHP_HAVE_SLOWLOG_TIMER)
+    if (ngx_http_php_slowlog_timer_created) {
+        ngx_http_php_slowlog_running = sl;
+        ngx_http_php_slowlog_fired = NULL;
+
+        ngx_http_php_slowlog_arm(plcf->slowlog_timeout);
+    }
+#endif
+}
+
+/* After a run of php code, a yield starts a suspension. */
+void
+ngx_http_php_slowlog_leave(ngx_http_php_run_t *run)
+{
+    ngx_http_php_loc_conf_t     *plcf;
+    ngx_http_php_slowlog_req_t  *sl;
+    ngx_http_php_ctx_t          *ctx;
+    ngx_http_request_t          *r;
+
+    sl = run->slowlog;
+    if (sl == NULL) {
+        return;
+    }
+
+    r = run->request;
+
+#if (NGX_HTTP_PHP_HAVE_SLOWLOG_TIMER)
+    if (ngx_http_php_slowlog_running == sl) {
+        ngx_http_php_slowlog_arm(0);
+
+        ngx_http_php_slowlog_running = NULL;
+        ngx_http_php_slowlog_fired = NULL;
+    }
+#endif
+
+    if (sl->logged) {
+        return;
+    }
+
+    ctx = ngx_http_get_module_ctx(r, ngx_http_php_module);
+
+    if (ctx && ctx->phase_status == NGX_AGAIN && ctx->generator_closure) {
+        plcf = ngx_http_get_module_loc_conf(r, ngx_http_php_module);
+
+        sl->start = ngx_current_msec;
+        ngx_add_timer(&sl->event, plcf->slowlog_timeout);
+    }
+}
+
+/* the end of the request */
+void
+ngx_http_php_slowlog_done(ngx_http_php_slowlog_req_t *sl)
+{
+    if (sl->event.timer_set) {
+        ngx_del_timer(&sl->event);
+    }
+
+#if (NGX_HTTP_PHP_HAVE_SLOWLOG_TIMER)
+    if (ngx_http_php_slowlog_running == sl) {
+        ngx_http_php_slowlog_arm(0);
+
+        ngx_http_php_slowlog_running = NULL;
+        ngx_http_php_slowlog_fired = NULL;
+    }
+#endif
+}
+
+static void
+ngx_http_php_slowlog_suspended_handler(ngx_event_t *ev)
+{
+    ngx_http_php_slowlog_req_t  *sl = ev->data;
+
+    ngx_http_php_slowlog_write(sl, NULL);
+
+    sl->logged = 1;
+}
+
+/* 
+ * [time] pid N, GET /uri, content suspended for 612ms, waiting on 10.0.0.1:6379
+ *     ngx_content_1() ngx_php eval code:3
+ */
+static void
+ngx_http_php_slowlog_write(ngx_http_php_slowlog_req_t *sl, 
+    zend_execute_data *execute_data)
+{
+    ngx_http_request_t          *r;
+    ngx_http_php_loc_conf_t     *plcf;
+    ngx_http_php_ctx_t          *ctx;
+    zend_generator              *generator;
+    zend_execute_data           *ex;
+    ngx_uint_t                  n;
+    u_char                      buf[8192];
+    u_char                      *p, *last;
+
+    r = sl->request;
+
+    plcf = ngx_http_get_module_loc_conf(r, ngx_http_php_module);
+    ctx = ngx_http_get_module_ctx(r, ngx_http_php_module);
+
+    if (plcf->slowlog == NULL) {
+        return;
+    }
+
+    p = buf;
+    last = buf + sizeof(buf) - 1;
+
+    p = ngx_slprintf(p, last, "[%V] pid %P, %V %V%s%V%s, %s %s for %Mms", 
+                     &ngx_cached_err_log_time, ngx_pid, 
+                     &r->method_name, &r->uri, r->args.len ? "?" : "", 
+                     &r->args, (r != r->main) ? " (subrequest)" : "", 
+                     ngx_http_php_slowlog_phases[sl->phase], 
+                     execute_data ? "running" : "suspended", 
+                     ngx_current_msec - sl->start);
+
+    ex = execute_data;
+
+    if (ex == NULL && ctx) {
+
+        if (ctx->upstream && ctx->upstream->peer.name) {
+            p = ngx_slprintf(p, last, ", waiting on %V", ctx->upstream->peer.name);
+
+        } else if (ctx->upstream && ctx->host.len) {
+            p = ngx_slprintf(p, last, ", waiting on %V:%d", &ctx->host, (int) ctx->port);
+
+        } else if (ctx->sleep.timer_set) {
+            p = ngx_slprintf(p, last, ", sleeping");
+
+        } else if (ctx->capture_uri.len) {
+            p = ngx_slprintf(p, last, ", waiting on subrequest %V", &ctx->capture_uri);
+        }
+
+        /* the frame the generator yielded in */
+
+        if (ctx->generator_closure && Z_TYPE_P(ctx->generator_closure) == IS_OBJECT) {
+            generator = (zend_generator *) Z_OBJ_P(ctx->generator_closure);
+            ex = generator->execute_data;
+        }
+    }
+
+    p = ngx_slprintf(p, last, "\n");
+
+    for (n = 0; ex && n < NGX_HTTP_PHP_SLOWLOG_DEPTH; ex = ex->prev_execute_data) {
+
+        if (ex->func == NULL) {
+            continue;
+        }
+
+        p = ngx_slprintf(p, last, "    ");
+        p = ngx_http_php_slowlog_frame(p, last, ex);
+        p = ngx_slprintf(p, last, "\n");
+
+        n++;
+
+        /* a suspended generator is not linked to a caller */
+        if (execute_data == NULL) {
+            break;
+        }
+    }
+
+    if (p == last) {
+        *p++ = '\n';
+    }
+
+    (void) ngx_write_fd(plcf->slowlog->fd, buf, p - buf);
+}
+
+/* Class::function() file:line, function() for internals, {main} file:line */
+static u_char *
+ngx_http_php_slowlog_frame(u_char *p, u_char *last, zend_execute_data *ex)
+{
+    zend_function   *func;
+
+    func = ex->func;
+
+    if (func->common.function_name == NULL) {
+        p = ngx_slprintf(p, last, "{main}");
+
+    } else if (func->common.scope) {
+        p = ngx_slprintf(p, last, "%s::%s()", ZSTR_VAL(func->common.scope->name), 
+                         ZSTR_VAL(func->common.function_name));
+
+    } else {
+        p = ngx_slprintf(p, last, "%s()", ZSTR_VAL(func->common.function_name));
+    }
+
+    if (ZEND_USER_CODE(func->type) && func->op_array.filename) {
+        p = ngx_slprintf(p, last, " %s:%uD", ZSTR_VAL(func->op_array.filename), 
+                         ex->opline ? ex->opline->lineno : func->op_array.line_start);
+    }
+
+    return p;
+}
+
+#if (NGX_HTTP_PHP_HAVE_SLOWLOG_TIMER)
+
+/* one shot, 0 disarms */
+static void
+ngx_http_php_slowlog_arm(ngx_msec_t timeout)
+{
+    struct itimerspec   its;
+
+    ngx_memzero(&its, sizeof(struct itimerspec));
+
+    its.it_value.tv_sec = timeout / 1000;
+    its.it_value.tv_nsec = (timeout % 1000) * 1000000;
+
+    (void) timer_settime(ngx_http_php_slowlog_timer, 0, &its, NULL);
+}
+
+/* the stack is taken at the next vm interrupt check, not in the handler */
+static void
+ngx_http_php_slowlog_signal_handler(int signo)
+{
+    if (ngx_http_php_slowlog_running == NULL) {
+        return;
+    }
+
+    ngx_http_php_slowlog_fired = ngx_http_php_slowlog_running;
+
+#if PHP_MAJOR_VERSION >= 8 && PHP_MINOR_VERSION > 1
+    zend_atomic_bool_store_ex(&EG(vm_interrupt), 1);
+#else
+    EG(vm_interrupt) = 1;
+#endif
+}
+
+static void
+ngx_http_php_slowlog_interrupt(zend_execute_data *execute_data)
+{
+    ngx_http_php_slowlog_req_t  *sl;
+
+    sl = ngx_http_php_slowlog_fired;
+
+    if (sl) {
+        ngx_http_php_slowlog_fired = NULL;
+
+        if (sl == ngx_http_php_slowlog_running && !sl->logged) {
+
+            /* the event loop has not run since the php code started */
+            ngx_time_update();
+
+            ngx_http_php_slowlog_write(sl, execute_data);
+
+            sl->logged = 1;
+        }
+    }
+
+    if (ngx_http_php_slowlog_orig_interrupt) {
+        ngx_http_php_slowlog_orig_interrupt(execute_data);
+    }
+}
+
+#endif
@@ -30,6 +30,7 @@ OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 #include "ngx_http_php_sleep.h"
 #include "ngx_http_php_socket.h"
 #include "ngx_http_php_zend_uthread.h"
+#include "ngx_http_php_stat.h"
 
 static void ngx_http_php_socket_handler(ngx_event_t *event);
 
@@ -46,6 +47,11 @@ static ngx_int_t ngx_php_http_socket_test_connect(ngx_connection_t *c);
 static void ngx_http_php_socket_connected_handler(ngx_http_request_t *r, 
     ngx_http_php_socket_upstream_t *u);
 
+static ngx_msec_t ngx_http_php_socket_timeout(ngx_http_php_socket_upstream_t *u, 
+    ngx_msec_t timeout);
+static void ngx_http_php_socket_release(ngx_http_request_t *r, 
+    ngx_http_php_socket_upstream_t *u);
+
 static ngx_int_t ngx_http_php_socket_get_peer(ngx_peer_connection_t *pc, 
     void *data);
 
@@ -55,6 +61,8 @@ static void ngx_http_php_socket_free_peer(ngx_peer_connection_t *pc,
 static void ngx_http_php_socket_finalize(ngx_http_request_t *r, 
     ngx_http_php_socket_upstream_t *u);
 
+static void ngx_http_php_socket_free_bufs(ngx_http_php_socket_upstream_t *u, 
+    ngx_chain_t *upto);
 static ngx_int_t ngx_http_php_socket_upstream_send(ngx_http_request_t *r, 
     ngx_http_php_socket_upstream_t *u);
 
@@ -67,6 +75,21 @@ static ngx_int_t ngx_http_php_socket_upstream_recv(ngx_http_request_t *r,
 static void ngx_http_php_socket_upstream_recv_handler(ngx_http_request_t *r, 
     ngx_http_php_socket_upstream_t *u);
 
+static ngx_int_t ngx_http_php_socket_buffer_reserve(ngx_http_request_t *r, 
+    ngx_http_php_socket_upstream_t *u, size_t size);
+
+static ngx_int_t ngx_http_php_socket_recv_match(ngx_http_request_t *r, 
+    ngx_http_php_socket_upstream_t *u);
+
+static ngx_int_t ngx_http_php_socket_upstream_read(ngx_http_request_t *r, 
+    ngx_http_php_socket_upstream_t *u);
+
+static ngx_int_t ngx_http_php_socket_read_start(ngx_http_request_t *r, 
+    ngx_http_php_socket_upstream_t *u);
+
+static void ngx_http_php_socket_upstream_read_handler(ngx_http_request_t *r, 
+    ngx_http_php_socket_upstream_t *u);
+
 //static void ngx_http_php_socket_upstream_recv_wait_handler(ngx_http_request_t *r, 
 //    ngx_http_php_socket_upstream_t *u);
 
@@ -90,6 +113,14 @@ ngx_http_php_socket_handler(ngx_event_t *ev)
         u->read_event_handler(r, u);
     }
 
+    if (u->suspended) {
+        /* the operation made progress but is not complete yet */
+        return ;
+    }
+
+    /* until the next operation starts, events must not resume again */
+    u->suspended = 1;
+
     ngx_http_php_zend_uthread_resume(r);
 
 }
@@ -107,14 +138,18 @@ static ngx_int_t
 ngx_http_php_socket_get_peer(ngx_peer_connection_t *pc, 
     void *data)
 {
-    ngx_http_php_keepalive_conf_t   *kc = data;
+    ngx_http_php_socket_upstream_t  *u = data;
     ngx_int_t                       rc;
 
-    if (kc->max_cached) {
-        rc = ngx_http_php_keepalive_get_peer(pc, kc);
-        if (rc != NGX_OK) {
-            return NGX_DONE;
-        }
+    /* 
+     * Always consult the worker pool, a connection may have been
+     * parked there by ngx_socket_setkeepalive() even when the server
+     * has no php_keepalive configured.
+     */
+
+    rc = ngx_http_php_keepalive_get_peer(pc, &u->keepalive);
+    if (rc != NGX_OK) {
+        return NGX_DONE;
     }
 
     return NGX_OK;
@@ -123,11 +158,16 @@ ngx_http_php_socket_get_peer(ngx_peer_connection_t *pc,
 static void 
 ngx_http_php_socket_free_peer(ngx_peer_connection_t *pc,void *data, ngx_uint_t state)
 {
-    ngx_http_php_keepalive_conf_t   *kc = data;
+    ngx_http_php_socket_upstream_t  *u = data;
 
-    if (kc->max_cached) {
-        ngx_http_php_keepalive_free_peer(pc, data, state);
+    if (u->recv_mode || u->buffer.pos != u->buffer.last 
+        || u->release == NGX_HTTP_PHP_SOCKET_RELEASE_CLOSE) 
+    {
+        /* a reply was not read completely, the connection is not reusable */
+        state |= NGX_PEER_FAILED;
     }
+
+    (void) ngx_http_php_keepalive_free_peer(pc, &u->keepalive, state);
 }
 
 static void 
@@ -139,7 +179,7 @@ ngx_http_php_socket_resolve_handler(ngx_resolver_ctx_t *ctx)
     ngx_http_php_socket_upstream_t  *u;
     u_char                          *p;
     size_t                          len;
-    //ngx_http_php_ctx_t              *php_ctx;
+    ngx_http_php_ctx_t              *php_ctx;
 
     socklen_t                        socklen;
     struct sockaddr                 *sockaddr;
@@ -157,6 +197,25 @@ ngx_http_php_socket_resolve_handler(ngx_resolver_ctx_t *ctx)
     ngx_php_debug("php socket resolve handler");
 
     if (ctx->state) {
+        ngx_log_error(NGX_LOG_ERR, r->connection->log, 0, 
+                      "php socket could not resolve \"%V\" (%i: %s)", 
+                      &ctx->name, ctx->state, ngx_resolver_strerror(ctx->state));
+
+        ngx_resolve_name_done(ctx);
+        ur->ctx = NULL;
+
+        u->recv_mode = 0;
+        ngx_http_php_socket_free_bufs(u, NULL);
+        ngx_http_php_socket_release_strs(u);
+
+        /* fail the pending "yield" instead of waiting forever */
+
+        php_ctx = ngx_http_get_module_ctx(r, ngx_http_php_module);
+        ZVAL_FALSE(&php_ctx->yield_retval);
+
+        php_ctx->delay_time = 0;
+        ngx_http_php_sleep(r);
+
         return ;
     }
 
@@ -201,6 +260,11 @@ ngx_http_php_socket_resolve_handler(ngx_resolver_ctx_t *ctx)
     case AF_INET6:
         ((struct sockaddr_in6 *) sockaddr)->sin6_port = htons(ur->port);
         break;
+#endif
+#if (NGX_HAVE_UNIX_DOMAIN)
+    case AF_UNIX:
+        /* no port */
+        break;
 #endif
     default: /* AF_INET */
         ((struct sockaddr_in *) sockaddr)->sin_port = htons(ur->port);
@@ -255,7 +319,14 @@ ngx_http_php_socket_resolve_retval_handler(ngx_http_request_t *r,
         return NGX_ERROR;
     }
 
-    peer->data = pscf->keepalive_conf;
+    u->keepalive.name = ctx->pool_name;
+    u->keepalive.max_cached = pscf->keepalive_conf->max_cached;
+    u->keepalive.timeout = pscf->keepalive_conf->timeout;
+    u->keepalive.requests = pscf->keepalive_conf->requests;
+    u->keepalive.reused = 0;
+    u->keepalive.data = NULL;
+
+    peer->data = u;
     peer->get = ngx_http_php_socket_get_peer;
     peer->free = ngx_http_php_socket_free_peer;
 
@@ -328,8 +399,7 @@ ngx_http_php_socket_resolve_retval_handler(ngx_http_request_t *r,
             return NGX_ERROR;
         }
 
-        u->read_event_handler = (ngx_http_php_socket_upstream_handler_pt) ngx_http_php_socket_dummy_handler;
-        u->write_event_handler = (ngx_http_php_socket_upstream_handler_pt) ngx_http_php_socket_dummy_handler;
+        /* the connected handler runs on the first write event */
     
         return NGX_OK;
     }
@@ -342,7 +412,7 @@ ngx_http_php_socket_resolve_retval_handler(ngx_http_request_t *r,
     ngx_php_debug("c->write->active:%d,c->write->timer_set:%d,c->write->ready:%d", c->write->active, c->write->timer_set, c->write->ready);
 
     if (rc == NGX_AGAIN){
-        ngx_add_timer(c->write, u->connect_timeout);
+        ngx_add_timer(c->write, ngx_http_php_socket_timeout(u, u->connect_timeout));
     }
 
     return NGX_AGAIN;
@@ -419,6 +489,9 @@ ngx_http_php_socket_finalize(ngx_http_request_t *r,
         u->resolved->ctx = NULL;
     }
 
+    ngx_http_php_socket_free_bufs(u, NULL);
+    ngx_http_php_socket_release_strs(u);
+
     if (u->peer.free && u->peer.sockaddr) {
         u->peer.free(&u->peer, u->peer.data, 0);
         u->peer.sockaddr = NULL;
@@ -437,6 +510,7 @@ ngx_http_php_socket_finalize(ngx_http_request_t *r,
         }
 
         ngx_close_connection(c);
+        u->peer.connection = NULL;
     }
 
     ngx_php_debug("socket end");
@@ -448,23 +522,79 @@ ngx_http_php_socket_connected_handler(ngx_http_request_t *r,
     ngx_http_php_socket_upstream_t *u)
 {
     ngx_connection_t            *c;
+    ngx_http_php_ctx_t          *ctx;
+    ngx_int_t                   rc;
 
     c = u->peer.connection;
 
     ngx_php_debug("php socket connected handler");
 
+    if (c->write->timedout) {
+        ngx_php_debug("php socket connecte timedout");
+        goto failed;
+    }
+
     if (ngx_php_http_socket_test_connect(c) != NGX_OK) {
-        // TODO connect faild handler
+        goto failed;
     }
 
-    if (c->write->timedout) {
-        ngx_php_debug("php socket connecte timedout");
+    if (c->write->timer_set) {
+        ngx_del_timer(c->write);
+    }
+
+    u->read_event_handler = (ngx_http_php_socket_upstream_handler_pt) ngx_http_php_socket_dummy_handler;
+    u->write_event_handler = (ngx_http_php_socket_upstream_handler_pt) ngx_http_php_socket_dummy_handler;
+
+    if (u->recv_mode == NGX_HTTP_PHP_SOCKET_RECV_FILTER) {
+
+        if (u->request_bufs) {
+
+            /* queued by ngx_http_php_socket_request() while connecting */
+
+            rc = ngx_http_php_socket_upstream_send(r, u);
+
+            if (rc == NGX_ERROR) {
+                goto failed;
+            }
+
+            if (rc == NGX_AGAIN) {
+                /* the send handler goes on with the reply */
+                u->suspended = 1;
+                return ;
+            }
+
+            (void) ngx_http_php_socket_upstream_read(r, u);
+            return ;
+        }
+
+        /* see ngx_http_php_socket_handshake() */
+
+        if (u->peer.cached) {
+            u->recv_mode = 0;
+            return ;
+        }
+
+        (void) ngx_http_php_socket_upstream_read(r, u);
     }
 
+    return ;
+
+failed:
+
     if (c->write->timer_set) {
         ngx_del_timer(c->write);
     }
 
+    /* the result of "yield" for callers that expect one */
+    ctx = ngx_http_get_module_ctx(r, ngx_http_php_module);
+    ZVAL_FALSE(&ctx->yield_retval);
+
+    u->recv_mode = 0;
+    u->suspended = 0;
+
+    ngx_http_php_socket_free_bufs(u, NULL);
+    ngx_http_php_socket_release_strs(u);
+
     u->read_event_handler = (ngx_http_php_socket_upstream_handler_pt) ngx_http_php_socket_dummy_handler;
     u->write_event_handler = (ngx_http_php_socket_upstream_handler_pt) ngx_http_php_socket_dummy_handler;
 }
@@ -473,10 +603,10 @@ static ngx_int_t
 ngx_http_php_socket_upstream_send(ngx_http_request_t *r, 
     ngx_http_php_socket_upstream_t *u)
 {
-    ngx_int_t           n;
     ngx_connection_t    *c;
     ngx_http_php_ctx_t  *ctx;
-    ngx_buf_t           *b;
+    ngx_chain_t         *cl;
+    off_t               sent;
 
     c = u->peer.connection;
 
@@ -489,50 +619,51 @@ ngx_http_php_socket_upstream_send(ngx_http_request_t *r,
         return NGX_ERROR;
     }
 
-    b = u->request_bufs->buf;
+    /* 
+     * All buffers of the chain go out with a single writev(), 
+     * c->send_chain() updates b->pos of what was sent.
+     */
 
-    for (;;) {
-        //ngx_php_debug("%s, %d", b->pos, (int)(b->last - b->pos));
-        n = c->send(c, b->pos, b->last - b->pos);
-    
-        if (n >= 0) {
-            b->pos += n;
+    sent = c->sent;
 
-            if (b->pos == b->last) {
-                ngx_log_debug0(NGX_LOG_DEBUG_HTTP, c->log, 0, 
-                               "php socket send all the data");
-                ngx_php_debug("php socket send all the data");
+    cl = c->send_chain(c, u->request_bufs, 0);
 
-                if (c->write->timer_set) {
-                    ngx_del_timer(c->write);
-                }
+    ngx_http_php_stat_socket_bytes(r, c->sent - sent);
 
-                ngx_chain_update_chains(r->pool, &u->free_bufs, &u->busy_bufs, &u->request_bufs,
-                    (ngx_buf_tag_t) &ngx_http_php_module);
+    if (cl == NGX_CHAIN_ERROR) {
+        ngx_http_php_socket_free_bufs(u, NULL);
+        ngx_http_php_socket_release_strs(u);
+        return NGX_ERROR;
+    }
 
-                u->write_event_handler = (ngx_http_php_socket_upstream_handler_pt) ngx_http_php_socket_dummy_handler;
+    if (cl == NULL) {
+        ngx_log_debug0(NGX_LOG_DEBUG_HTTP, c->log, 0, 
+                       "php socket send all the data");
+        ngx_php_debug("php socket send all the data");
 
-                if (ngx_handle_write_event(c->write, 0) != NGX_OK) {
-                    
-                    return NGX_ERROR;
-                }
+        if (c->write->timer_set) {
+            ngx_del_timer(c->write);
+        }
 
-                //ngx_http_php_socket_handler(c->write);
-                return NGX_OK;
-            }
+        ngx_chain_update_chains(r->pool, &u->free_bufs, &u->busy_bufs, &u->request_bufs,
+            (ngx_buf_tag_t) &ngx_http_php_module);
 
-            /* keep sending more data */
-            continue;
+        ngx_http_php_socket_release_strs(u);
+
+        u->write_event_handler = (ngx_http_php_socket_upstream_handler_pt) ngx_http_php_socket_dummy_handler;
+
+        if (ngx_handle_write_event(c->write, 0) != NGX_OK) {
+            
+            return NGX_ERROR;
         }
 
-        /* NGX_ERROR || NGX_AGAIN */
-        break;
+        //ngx_http_php_socket_handler(c->write);
+        return NGX_OK;
     }
 
-    if (n == NGX_ERROR) {
+    /* the links sent in full go back to free_bufs, the rest is sent later */
 
-        return NGX_ERROR;
-    }
+    ngx_http_php_socket_free_bufs(u, cl);
 
     /* n == NGX_AGAIN */
 
@@ -540,7 +671,7 @@ ngx_http_php_socket_upstream_send(ngx_http_request_t *r,
 
     u->write_event_handler = (ngx_http_php_socket_upstream_handler_pt) ngx_http_php_socket_send_handler;
 
-    ngx_add_timer(c->write, u->write_timeout);
+    ngx_add_timer(c->write, ngx_http_php_socket_timeout(u, u->write_timeout));
 
     if (ngx_handle_write_event(c->write, 0) != NGX_OK) {
         return NGX_ERROR;
@@ -551,12 +682,31 @@ ngx_http_php_socket_upstream_send(ngx_http_request_t *r,
 
 }
 
+static void 
+ngx_http_php_socket_free_bufs(ngx_http_php_socket_upstream_t *u, 
+    ngx_chain_t *upto)
+{
+    ngx_chain_t     *cl;
+
+    while (u->request_bufs && u->request_bufs != upto) {
+        cl = u->request_bufs;
+        u->request_bufs = cl->next;
+
+        cl->next = u->free_bufs;
+        u->free_bufs = cl;
+    }
+
+    u->request_bufs = upto;
+}
+
 static void 
 ngx_http_php_socket_send_handler(ngx_http_request_t *r, 
     ngx_http_php_socket_upstream_t *u)
 {
     ngx_connection_t                    *c;
+    ngx_http_php_ctx_t                  *ctx;
     ngx_http_php_loc_conf_t             *plcf;
+    ngx_int_t                           rc;
 
     c = u->peer.connection;
 
@@ -572,13 +722,46 @@ ngx_http_php_socket_send_handler(ngx_http_request_t *r,
                           "php socket write timed out.");
         }
 
+        goto failed;
+    }
+
+    if (u->request_bufs == NULL) {
         return ;
     }
 
-    if (u->request_bufs) {
-        (void) ngx_http_php_socket_upstream_send(r, u);
+    rc = ngx_http_php_socket_upstream_send(r, u);
+
+    if (rc == NGX_AGAIN) {
+        /* do not resume the coroutine before everything is sent */
+        u->suspended = 1;
+        return ;
+    }
+
+    if (rc == NGX_ERROR) {
+        goto failed;
+    }
+
+    if (u->recv_mode) {
+        /* a request of ngx_http_php_socket_request(), read the reply */
+        (void) ngx_http_php_socket_upstream_read(r, u);
+        return ;
+    }
+
+    u->suspended = 0;
+
+    return ;
+
+failed:
+
+    if (u->recv_mode) {
+        ctx = ngx_http_get_module_ctx(r, ngx_http_php_module);
+        ZVAL_FALSE(&ctx->yield_retval);
+
+        u->recv_mode = 0;
     }
 
+    u->suspended = 0;
+
 }
 
 static ngx_int_t 
@@ -607,25 +790,42 @@ ngx_http_php_socket_upstream_recv(ngx_http_request_t *r,
     b = &u->buffer;
     read = 0;
 
-    if (b->start == NULL) {
-        b->start = ngx_palloc(r->pool, u->buffer_size);
+    if (b->pos != b->last) {
 
-        b->pos = b->start;
-        b->last = b->start;
-        b->end = b->start + u->buffer_size;
-        b->temporary = 1;
+        /* left over by ngx_socket_recv_until() or ngx_socket_recv_exact() */
+
+        size = ngx_min((size_t) (b->last - b->pos), u->buffer_size);
+
+        ZVAL_STRINGL(ctx->recv_buf, (char *)b->pos, size);
+        b->pos += size;
+
+        u->recv_pending = 0;
+
+        return NGX_DONE;
+    }
+
+    /* the buffer is allocated once and reused for every read */
+
+    b->pos = b->start;
+    b->last = b->start;
+
+    if (ngx_http_php_socket_buffer_reserve(r, u, u->buffer_size) != NGX_OK) {
+        return NGX_ERROR;
     }
 
+    u->recv_pending = 1;
+
     for (;;) {
         if (read && !rev->ready) {
             //rc = NGX_AGAIN;
             break;
         }
 
-        size = b->end - b->last;
+        size = ngx_min((size_t) (b->end - b->last), 
+                       u->buffer_size - (size_t) (b->last - b->pos));
 
         if (size == 0) {
-            b->start = NULL;
+            u->recv_pending = 0;
             break;
         }
 
@@ -649,6 +849,10 @@ ngx_http_php_socket_upstream_recv(ngx_http_request_t *r,
         //ngx_log_error(NGX_LOG_ERR, r->connection->log, 0, "%d", n);
         ngx_php_debug("n = c->recv: %d\n", (int)n);
 
+        if (n > 0) {
+            ngx_http_php_stat_socket_bytes(r, n);
+        }
+
 #if 1
         if (u->enabled_receive_page && rev->active && !rev->ready) {
             ngx_php_debug("recv ready: %d", rev->ready);
@@ -659,16 +863,18 @@ ngx_http_php_socket_upstream_recv(ngx_http_request_t *r,
             if (n == NGX_ERROR) {
                 ngx_log_error(NGX_LOG_ERR, r->connection->log, 0, 
                               "php socket recv error");
+                u->recv_pending = 0;
                 n = -1;
                 return NGX_ERROR;
             }
 
             if ( n > 0 ) {
                 b->last += n;
-                b->start = NULL;
 
                 ngx_php_debug("buf write in php var.");
                 ZVAL_STRINGL(ctx->recv_buf, (char *)b->pos, b->last - b->pos);
+                b->pos = b->last;
+                u->recv_pending = 0;
                 break;
             }
 
@@ -677,13 +883,7 @@ ngx_http_php_socket_upstream_recv(ngx_http_request_t *r,
                 break;
             }
 
-            if (n == NGX_OK) {
-                b->start = NULL;
-                break;
-            }
-
-            b->last += n;
-            b->start = NULL;
+            u->recv_pending = 0;
             break;
 
             /*if (u->enabled_receive_page) {
@@ -737,16 +937,18 @@ ngx_http_php_socket_upstream_recv(ngx_http_request_t *r,
         if (n == NGX_ERROR) {
             ngx_log_error(NGX_LOG_ERR, r->connection->log, 0, 
                           "php socket recv error");
+            u->recv_pending = 0;
             n = -1;
             return NGX_ERROR;
         }
 
         if (n > 0) {
             b->last += n;
-            b->start = NULL;
 
             ngx_php_debug("buf write in php var.");
             ZVAL_STRINGL(ctx->recv_buf, (char *)b->pos, b->last - b->pos);
+            b->pos = b->last;
+            u->recv_pending = 0;
             //ngx_log_error(NGX_LOG_ERR, r->connection->log, 0, "===>%d", n);
             return NGX_AGAIN;
         }
@@ -756,13 +958,7 @@ ngx_http_php_socket_upstream_recv(ngx_http_request_t *r,
             break;
         }
 
-        if (n == NGX_OK) {
-            b->start = NULL;
-            break;
-        }
-
-        b->last += n;
-        b->start = NULL;
+        u->recv_pending = 0;
         break;
 
         /*if (n > 0) {
@@ -787,7 +983,7 @@ ngx_http_php_socket_upstream_recv(ngx_http_request_t *r,
 #endif
 
     if (rev->active) {
-        ngx_add_timer(rev, u->read_timeout);
+        ngx_add_timer(rev, ngx_http_php_socket_timeout(u, u->read_timeout));
     }else if (rev->timer_set) {
         ngx_del_timer(rev);
     }
@@ -823,143 +1019,490 @@ ngx_http_php_socket_upstream_recv_handler(ngx_http_request_t *r,
     }
 #endif
 
-    if (u->buffer.start != NULL) {
+    if (u->recv_pending) {
         (void) ngx_http_php_socket_upstream_recv(r, u);
     }
 
 }
 
-ngx_int_t 
-ngx_http_php_socket_connect(ngx_http_request_t *r)
+static ngx_int_t 
+ngx_http_php_socket_buffer_reserve(ngx_http_request_t *r, 
+    ngx_http_php_socket_upstream_t *u, size_t size)
 {
-    ngx_http_php_ctx_t                  *ctx;
-    //ngx_http_php_loc_conf_t             *plcf;
-    //ngx_str_t                           host;
-    //int                                 port;
-    ngx_resolver_ctx_t                  *rctx, temp;
-    ngx_http_core_loc_conf_t            *clcf;
+    ngx_buf_t           *b;
+    u_char              *p;
+    size_t              len, cap;
 
-    ngx_url_t                           url;
+    b = &u->buffer;
 
-    ngx_int_t                           rc;
-    ngx_peer_connection_t               *peer;
+    if (b->start && (size_t) (b->end - b->last) >= size) {
+        return NGX_OK;
+    }
 
-    ngx_http_php_socket_upstream_t      *u;
+    len = b->last - b->pos;
 
-    ngx_connection_t                    *c;
+    if (b->start && (size_t) (b->end - b->start) >= len + size) {
 
-    c = r->connection;
+        /* enough room, move the unread data to the beginning */
 
-    ctx = ngx_http_get_module_ctx(r, ngx_http_php_module);
+        if (len) {
+            ngx_memmove(b->start, b->pos, len);
+        }
 
-    if (ctx->upstream == NULL){
-        ctx->upstream = ngx_pcalloc(r->pool, sizeof(ngx_http_php_socket_upstream_t));
-    }
+        b->pos = b->start;
+        b->last = b->start + len;
 
-    if (c->read->timer_set) {
-        ngx_del_timer(c->read);
+        return NGX_OK;
     }
 
-    //r->keepalive = 0;
+    cap = b->start ? (size_t) (b->end - b->start) * 2 : 0;
+    cap = ngx_max(cap, len + size);
 
-    u = ctx->upstream;
+    ngx_log_debug2(NGX_LOG_DEBUG_HTTP, r->connection->log, 0,
+                   "php socket receive buffer: %uz -> %uz", 
+                   (size_t) (b->end - b->start), cap);
 
-    if (u->connect_timeout <= 0) {
-        u->connect_timeout = 60000;
+    p = ngx_palloc(r->pool, cap);
+    if (p == NULL) {
+        return NGX_ERROR;
     }
 
-    if (u->read_timeout <= 0) {
-        u->read_timeout = 60000;
+    if (len) {
+        ngx_memcpy(p, b->pos, len);
     }
-    
-    if (u->write_timeout <= 0) {
-        u->write_timeout = 60000;
+
+    if (b->start) {
+        ngx_pfree(r->pool, b->start);
     }
 
-    u->enabled_receive = 0;
+    b->start = p;
+    b->pos = p;
+    b->last = p + len;
+    b->end = p + cap;
+    b->temporary = 1;
 
-    u->receive_threshold = 0;
+    return NGX_OK;
+}
 
-    u->enabled_receive_page = 0;
+static ngx_int_t 
+ngx_http_php_socket_recv_match(ngx_http_request_t *r, 
+    ngx_http_php_socket_upstream_t *u)
+{
+    ngx_http_php_ctx_t      *ctx;
+    ngx_buf_t               *b;
+    u_char                  *p, *start;
+    size_t                  len;
+    ngx_int_t               rc;
+    zend_string             *next;
+    ngx_chain_t             **last;
 
-    u->request = r;
+    ctx = ngx_http_get_module_ctx(r, ngx_http_php_module);
 
-    peer = &u->peer;
+    b = &u->buffer;
+    len = b->last - b->pos;
 
-    peer->log = r->connection->log;
-    peer->log_error = NGX_ERROR_ERR;
+    if (u->recv_mode == NGX_HTTP_PHP_SOCKET_RECV_FILTER) {
+        next = NULL;
 
-    ngx_php_debug("php peer connection log: %p %p", peer->log, peer);
+        rc = u->recv_filter(u->recv_filter_data, b, &ctx->yield_retval, &next);
 
-    ngx_memzero(&url, sizeof(ngx_url_t));
+        if (rc == NGX_AGAIN) {
+            return NGX_DECLINED;
+        }
 
-    url.url.len = ctx->host.len;
-    url.url.data = ctx->host.data;
-    url.default_port = (in_port_t) ctx->port;
-    url.no_resolve = 1;
+        if (rc == NGX_DONE) {
+            ngx_http_php_socket_free_bufs(u, NULL);
+            last = &u->request_bufs;
 
-    if (ngx_parse_url(r->pool, &url) != NGX_OK) {
-        if (url.err) {
-            ngx_log_error(NGX_LOG_ERR, r->connection->log, 0,
-                          "%s in upstream \"%V\"", url.err, &url.url);
-        }else {
+            if (ngx_http_php_socket_append_str(r, u, &last, next, ZSTR_LEN(next)) 
+                != NGX_OK)
+            {
+                ngx_http_php_socket_release_strs(u);
+                return NGX_ERROR;
+            }
+
+            return NGX_DONE;
+        }
+
+        if (rc == NGX_ERROR) {
             ngx_log_error(NGX_LOG_ERR, r->connection->log, 0, 
-                          "failed to parse host name \"%s\"", ctx->host.data);
+                          "php socket received an invalid reply");
         }
-        return NGX_ERROR;
-    }
 
-    u->resolved = ngx_pcalloc(r->pool, sizeof(ngx_http_upstream_resolved_t));
-    if (u->resolved == NULL) {
-        ngx_log_error(NGX_LOG_ERR, r->connection->log, 0, "ngx_pcalloc resolved error. %s.", strerror(errno));
-        return NGX_ERROR;
+        return rc;
     }
 
-    if (url.addrs && url.addrs[0].sockaddr) {
-        ngx_log_debug0(NGX_LOG_DEBUG_HTTP, r->connection->log, 0, 
-                       "php socket network address given directly");
+    if (u->recv_mode == NGX_HTTP_PHP_SOCKET_RECV_EXACT) {
+        if (len < u->recv_bytes) {
+            return NGX_DECLINED;
+        }
 
-        u->resolved->sockaddr = url.addrs[0].sockaddr;
-        u->resolved->socklen = url.addrs[0].socklen;
-        u->resolved->naddrs = 1;
-        u->resolved->host = url.addrs[0].name;
-    } else {
-        u->resolved->host = ctx->host;
-        u->resolved->port = (in_port_t) ctx->port;
+        ZVAL_STRINGL(&ctx->yield_retval, (char *) b->pos, u->recv_bytes);
+        b->pos += u->recv_bytes;
+
+        return NGX_OK;
     }
 
-    // Already real ip address, is not url and not resolve.
-    if (u->resolved->sockaddr) {
-        rc = ngx_http_php_socket_resolve_retval_handler(r, u);
-        if (rc == NGX_AGAIN) {
-            return NGX_AGAIN;
-        }
+    /* NGX_HTTP_PHP_SOCKET_RECV_UNTIL */
 
-        return rc;
+    if (len < u->recv_pattern.len) {
+        return NGX_DECLINED;
     }
 
-    clcf = ngx_http_get_module_loc_conf(r, ngx_http_core_module);
+    /* do not scan again what was already scanned by a previous read */
 
-    temp.name = ctx->host;
-    rctx = ngx_resolve_start(clcf->resolver, &temp);
-    if (rctx == NULL) {
-        ngx_log_error(NGX_LOG_ERR, r->connection->log, 0, 
-                      "failed to start the resolver");
-        return NGX_ERROR;
+    start = b->pos;
+    if (u->recv_scanned >= u->recv_pattern.len) {
+        start += u->recv_scanned - u->recv_pattern.len + 1;
     }
 
-    if (rctx == NGX_NO_RESOLVER) {
-        ngx_log_error(NGX_LOG_ERR, r->connection->log, 0, 
-                      "no resolver defined to resolve \"%s\"", ctx->host.data);
-        return NGX_ERROR;
-    }
+    p = ngx_strlstrn(start, b->last, (char *) u->recv_pattern.data, 
+                     u->recv_pattern.len - 1);
 
-    rctx->name = ctx->host;
-    rctx->handler = ngx_http_php_socket_resolve_handler;
-    rctx->data = u;
-    rctx->timeout = clcf->resolver_timeout;
+    if (p == NULL) {
+        u->recv_scanned = len;
 
-    u->resolved->ctx = rctx;
+        if (len > u->recv_max) {
+            ngx_log_error(NGX_LOG_ERR, r->connection->log, 0, 
+                          "php socket line longer than %uz bytes", u->recv_max);
+            return NGX_ERROR;
+        }
+
+        return NGX_DECLINED;
+    }
+
+    ZVAL_STRINGL(&ctx->yield_retval, (char *) b->pos, p - b->pos);
+    b->pos = p + u->recv_pattern.len;
+
+    return NGX_OK;
+}
+
+static ngx_int_t 
+ngx_http_php_socket_upstream_read(ngx_http_request_t *r, 
+    ngx_http_php_socket_upstream_t *u)
+{
+    ngx_http_php_ctx_t          *ctx;
+    ngx_http_php_loc_conf_t     *plcf;
+    ngx_connection_t            *c;
+    ngx_event_t                 *rev;
+    ngx_buf_t                   *b;
+    ngx_int_t                   rc;
+    size_t                      size;
+    ssize_t                     n;
+
+    ctx = ngx_http_get_module_ctx(r, ngx_http_php_module);
+    plcf = ngx_http_get_module_loc_conf(r, ngx_http_php_module);
+
+    c = u->peer.connection;
+    rev = c->read;
+    b = &u->buffer;
+
+    for (;;) {
+
+        rc = ngx_http_php_socket_recv_match(r, u);
+
+        if (rc == NGX_OK) {
+            ngx_log_debug1(NGX_LOG_DEBUG_HTTP, r->connection->log, 0, 
+                           "php socket read done, %uz bytes left in buffer", 
+                           (size_t) (b->last - b->pos));
+            goto done;
+        }
+
+        if (rc == NGX_ERROR) {
+            goto failed;
+        }
+
+        if (rc == NGX_DONE) {
+
+            /* the filter has something to send before reading on */
+
+            rc = ngx_http_php_socket_upstream_send(r, u);
+
+            if (rc == NGX_ERROR) {
+                goto failed;
+            }
+
+            if (rc == NGX_AGAIN) {
+                /* the send handler goes on reading once all is sent */
+                u->suspended = 1;
+                u->read_event_handler = ngx_http_php_socket_dummy_handler;
+                return NGX_AGAIN;
+            }
+
+            continue;
+        }
+
+        size = plcf->buffer_size;
+
+        if (u->recv_mode == NGX_HTTP_PHP_SOCKET_RECV_EXACT
+            && u->recv_bytes - (b->last - b->pos) > size)
+        {
+            size = u->recv_bytes - (b->last - b->pos);
+        }
+
+        if (ngx_http_php_socket_buffer_reserve(r, u, size) != NGX_OK) {
+            goto failed;
+        }
+
+        n = c->recv(c, b->last, b->end - b->last);
+
+        ngx_php_debug("n = c->recv: %d", (int) n);
+
+        if (n > 0) {
+            ngx_http_php_stat_socket_bytes(r, n);
+            b->last += n;
+            continue;
+        }
+
+        if (n == NGX_AGAIN) {
+            break;
+        }
+
+        if (n == 0 && u->recv_mode == NGX_HTTP_PHP_SOCKET_RECV_FILTER 
+            && !b->last_buf) 
+        {
+            /* a reply may end with the connection, let the filter decide */
+            b->last_buf = 1;
+            continue;
+        }
+
+        /* n == 0 || n == NGX_ERROR */
+
+        if (plcf->log_socket_errors) {
+            ngx_log_error(NGX_LOG_ERR, r->connection->log, 0, 
+                          n == 0 ? "php socket closed prematurely" : 
+                                   "php socket recv error");
+        }
+
+        goto failed;
+    }
+
+    u->suspended = 1;
+    u->read_event_handler = ngx_http_php_socket_upstream_read_handler;
+
+    if (ngx_handle_read_event(rev, 0) != NGX_OK) {
+        goto failed;
+    }
+
+    if (!rev->timer_set) {
+        ngx_add_timer(rev, ngx_http_php_socket_timeout(u, u->read_timeout));
+    }
+
+    ctx->phase_status = NGX_AGAIN;
+
+    return NGX_AGAIN;
+
+failed:
+
+    ZVAL_FALSE(&ctx->yield_retval);
+    rc = NGX_ERROR;
+
+done:
+
+    u->recv_mode = 0;
+    u->suspended = 0;
+    u->read_event_handler = ngx_http_php_socket_dummy_handler;
+
+    if (rev->timer_set) {
+        ngx_del_timer(rev);
+    }
+
+    if (u->release) {
+        ngx_http_php_socket_release(r, u);
+    }
+
+    return rc;
+}
+
+static void 
+ngx_http_php_socket_upstream_read_handler(ngx_http_request_t *r, 
+    ngx_http_php_socket_upstream_t *u)
+{
+    ngx_http_php_ctx_t          *ctx;
+    ngx_http_php_loc_conf_t     *plcf;
+    ngx_connection_t            *c;
+
+    c = u->peer.connection;
+
+    ngx_log_debug0(NGX_LOG_DEBUG_HTTP, r->connection->log, 0, 
+                   "php socket read handler.");
+    ngx_php_debug("php socket read handler.");
+
+    if (c->read->timedout) {
+        plcf = ngx_http_get_module_loc_conf(r, ngx_http_php_module);
+
+        if (plcf->log_socket_errors) {
+            ngx_log_error(NGX_LOG_ERR, r->connection->log, 0, 
+                          "php socket read timed out.");
+        }
+
+        ctx = ngx_http_get_module_ctx(r, ngx_http_php_module);
+        ZVAL_FALSE(&ctx->yield_retval);
+
+        u->recv_mode = 0;
+        u->suspended = 0;
+        u->read_event_handler = ngx_http_php_socket_dummy_handler;
+
+        return ;
+    }
+
+    if (u->recv_mode == 0) {
+        return ;
+    }
+
+    (void) ngx_http_php_socket_upstream_read(r, u);
+}
+
+ngx_int_t 
+ngx_http_php_socket_connect(ngx_http_request_t *r)
+{
+    ngx_http_php_ctx_t                  *ctx;
+    //ngx_http_php_loc_conf_t             *plcf;
+    //ngx_str_t                           host;
+    //int                                 port;
+    ngx_resolver_ctx_t                  *rctx, temp;
+    ngx_http_core_loc_conf_t            *clcf;
+
+    ngx_url_t                           url;
+
+    ngx_int_t                           rc;
+    ngx_peer_connection_t               *peer;
+
+    ngx_http_php_socket_upstream_t      *u;
+
+    ngx_connection_t                    *c;
+
+    c = r->connection;
+
+    ctx = ngx_http_get_module_ctx(r, ngx_http_php_module);
+
+    if (ctx->upstream == NULL){
+        ctx->upstream = ngx_pcalloc(r->pool, sizeof(ngx_http_php_socket_upstream_t));
+    }
+
+    if (c->read->timer_set) {
+        ngx_del_timer(c->read);
+    }
+
+    //r->keepalive = 0;
+
+    u = ctx->upstream;
+
+    /* 
+     * The clients share one socket per request, a connection still open
+     * from a previous connect() is closed rather than leaked.
+     */
+
+    if (u->peer.connection) {
+        ngx_http_php_socket_clear(r);
+    }
+
+    if (u->connect_timeout <= 0) {
+        u->connect_timeout = 60000;
+    }
+
+    if (u->read_timeout <= 0) {
+        u->read_timeout = 60000;
+    }
+    
+    if (u->write_timeout <= 0) {
+        u->write_timeout = 60000;
+    }
+
+    u->enabled_receive = 0;
+
+    u->receive_threshold = 0;
+
+    u->enabled_receive_page = 0;
+
+    u->recv_pending = 0;
+    u->suspended = 0;
+    u->recv_mode = 0;
+    u->release = 0;
+    u->deadline = 0;
+
+    /* keep the receive buffer, but not what is left in it */
+    u->buffer.pos = u->buffer.start;
+    u->buffer.last = u->buffer.start;
+
+    u->request = r;
+
+    peer = &u->peer;
+
+    peer->log = r->connection->log;
+    peer->log_error = NGX_ERROR_ERR;
+
+    ngx_php_debug("php peer connection log: %p %p", peer->log, peer);
+
+    ngx_memzero(&url, sizeof(ngx_url_t));
+
+    url.url.len = ctx->host.len;
+    url.url.data = ctx->host.data;
+    url.default_port = (in_port_t) ctx->port;
+    url.no_resolve = 1;
+
+    if (ngx_parse_url(r->pool, &url) != NGX_OK) {
+        if (url.err) {
+            ngx_log_error(NGX_LOG_ERR, r->connection->log, 0,
+                          "%s in upstream \"%V\"", url.err, &url.url);
+        }else {
+            ngx_log_error(NGX_LOG_ERR, r->connection->log, 0, 
+                          "failed to parse host name \"%s\"", ctx->host.data);
+        }
+        return NGX_ERROR;
+    }
+
+    u->resolved = ngx_pcalloc(r->pool, sizeof(ngx_http_upstream_resolved_t));
+    if (u->resolved == NULL) {
+        ngx_log_error(NGX_LOG_ERR, r->connection->log, 0, "ngx_pcalloc resolved error. %s.", strerror(errno));
+        return NGX_ERROR;
+    }
+
+    if (url.addrs && url.addrs[0].sockaddr) {
+        ngx_log_debug0(NGX_LOG_DEBUG_HTTP, r->connection->log, 0, 
+                       "php socket network address given directly");
+
+        u->resolved->sockaddr = url.addrs[0].sockaddr;
+        u->resolved->socklen = url.addrs[0].socklen;
+        u->resolved->naddrs = 1;
+        u->resolved->host = url.addrs[0].name;
+    } else {
+        u->resolved->host = ctx->host;
+        u->resolved->port = (in_port_t) ctx->port;
+    }
+
+    // Already real ip address, is not url and not resolve.
+    if (u->resolved->sockaddr) {
+        rc = ngx_http_php_socket_resolve_retval_handler(r, u);
+        if (rc == NGX_AGAIN) {
+            return NGX_AGAIN;
+        }
+
+        return rc;
+    }
+
+    clcf = ngx_http_get_module_loc_conf(r, ngx_http_core_module);
+
+    temp.name = ctx->host;
+    rctx = ngx_resolve_start(clcf->resolver, &temp);
+    if (rctx == NULL) {
+        ngx_log_error(NGX_LOG_ERR, r->connection->log, 0, 
+                      "failed to start the resolver");
+        return NGX_ERROR;
+    }
+
+    if (rctx == NGX_NO_RESOLVER) {
+        ngx_log_error(NGX_LOG_ERR, r->connection->log, 0, 
+                      "no resolver defined to resolve \"%s\"", ctx->host.data);
+        return NGX_ERROR;
+    }
+
+    rctx->name = ctx->host;
+    rctx->handler = ngx_http_php_socket_resolve_handler;
+    rctx->data = u;
+    rctx->timeout = clcf->resolver_timeout;
+
+    u->resolved->ctx = rctx;
 
     if (ngx_resolve_name(rctx) != NGX_OK) {
         ngx_log_debug0(NGX_LOG_DEBUG_HTTP, r->connection->log, 0,
@@ -1023,6 +1566,7 @@ ngx_http_php_socket_send(ngx_http_request_t *r)
     }
 
     u->enabled_receive = 0;
+    u->suspended = 0;
 
     c = u->peer.connection;
 
@@ -1084,8 +1628,18 @@ ngx_http_php_socket_recv(ngx_http_request_t *r)
     c = u->peer.connection;
     rev = c->read;
 
+    u->suspended = 0;
+
     rc = ngx_http_php_socket_upstream_recv(r, u);
 
+    if (rc == NGX_DONE) {
+        /* served from the buffer, no event will come, resume on a timer */
+        ctx->delay_time = 0;
+        ngx_http_php_sleep(r);
+        u->suspended = 1;
+        return NGX_OK;
+    }
+
     ngx_php_debug("%d", u->enabled_receive);
 
     if (u->enabled_receive == 0) {
@@ -1161,8 +1715,17 @@ ngx_http_php_socket_recv_wait(ngx_http_request_t *r)
     c = u->peer.connection;
     rev = c->read;
 
+    u->suspended = 0;
+
     rc = ngx_http_php_socket_upstream_recv(r, u);
 
+    if (rc == NGX_DONE) {
+        ctx->delay_time = 0;
+        ngx_http_php_sleep(r);
+        u->suspended = 1;
+        return NGX_OK;
+    }
+
     ngx_php_debug("%d", u->enabled_receive);
 
     if (u->enabled_receive == 0) {
@@ -1234,6 +1797,11 @@ ngx_http_php_socket_recv_sync(ngx_http_request_t *r)
 
     rc = ngx_http_php_socket_upstream_recv(r, u);
 
+    if (rc == NGX_DONE) {
+
+        return NGX_OK;
+    }
+
     if (rc == NGX_AGAIN) {
 
         return NGX_AGAIN;
@@ -1285,7 +1853,427 @@ ngx_http_php_socket_clear(ngx_http_request_t *r)
     return ;
 }
 
+ngx_int_t 
+ngx_http_php_socket_setkeepalive(ngx_http_request_t *r, 
+    ngx_msec_t timeout, ngx_uint_t size)
+{
+    ngx_http_php_socket_upstream_t      *u;
+    ngx_http_php_ctx_t                  *ctx;
+    ngx_http_php_srv_conf_t             *pscf;
+
+    ctx = ngx_http_get_module_ctx(r, ngx_http_php_module);
+
+    u = ctx->upstream;
+
+    if (u == NULL || 
+        u->peer.connection == NULL )
+    {
+        return NGX_ERROR;
+    }
+
+    if (u->request != r) {
+        return NGX_ERROR;
+    }
+
+    pscf = ngx_http_get_module_srv_conf(r, ngx_http_php_module);
+
+    if (size == 0) {
+        size = pscf->keepalive_conf->max_cached ? 
+                    pscf->keepalive_conf->max_cached : 
+                    NGX_HTTP_PHP_KEEPALIVE_DEFAULT_SIZE;
+    }
+
+    if (timeout == 0) {
+        timeout = pscf->keepalive_conf->timeout;
+    }
+
+    u->keepalive.max_cached = size;
+    u->keepalive.timeout = timeout;
+
+    u->enabled_receive = 0;
+
+    ngx_log_debug2(NGX_LOG_DEBUG_HTTP, r->connection->log, 0,
+                   "php socket set keepalive, timeout: %M, size: %ui", 
+                   timeout, size);
+
+    ngx_http_php_socket_finalize(r, u);
+
+    return NGX_OK;
+}
+
+static ngx_int_t 
+ngx_http_php_socket_read_start(ngx_http_request_t *r, 
+    ngx_http_php_socket_upstream_t *u)
+{
+    ngx_http_php_ctx_t                  *ctx;
+    ngx_int_t                           rc;
+
+    ctx = ngx_http_get_module_ctx(r, ngx_http_php_module);
+
+    if (u == NULL || u->peer.connection == NULL || u->request != r) {
+        ZVAL_FALSE(&ctx->yield_retval);
+        rc = NGX_ERROR;
+
+    } else {
+        u->recv_scanned = 0;
+        u->enabled_receive = 0;
+
+        rc = ngx_http_php_socket_upstream_read(r, u);
+    }
+
+    if (rc != NGX_AGAIN) {
+        /* the result is already known, resume the coroutine on a timer */
+        ctx->delay_time = 0;
+        ngx_http_php_sleep(r);
+
+        if (u) {
+            /* and not on a stray socket event as well */
+            u->suspended = 1;
+        }
+    }
+
+    return rc;
+}
+
+ngx_int_t 
+ngx_http_php_socket_recv_until(ngx_http_request_t *r, 
+    ngx_str_t *pattern, size_t max)
+{
+    u_char                              *p;
+    ngx_http_php_ctx_t                  *ctx;
+    ngx_http_php_socket_upstream_t      *u;
+
+    ngx_log_debug1(NGX_LOG_DEBUG_HTTP, r->connection->log, 0, 
+                   "php socket receive until \"%V\"", pattern);
+
+    ctx = ngx_http_get_module_ctx(r, ngx_http_php_module);
+
+    u = ctx->upstream;
+
+    if (u) {
+
+        /* 
+         * the delimiter must survive until the read completes, kept in 
+         * a buffer that a loop reading line after line reuses 
+         */
+
+        if (pattern->len > u->recv_pattern_size) {
+            p = ngx_pnalloc(r->pool, pattern->len);
+            if (p == NULL) {
+                ZVAL_FALSE(&ctx->yield_retval);
+                ctx->delay_time = 0;
+                ngx_http_php_sleep(r);
+                return NGX_ERROR;
+            }
+
+            if (u->recv_pattern_size) {
+                ngx_pfree(r->pool, u->recv_pattern.data);
+            }
+
+            u->recv_pattern.data = p;
+            u->recv_pattern_size = pattern->len;
+        }
+
+        ngx_memcpy(u->recv_pattern.data, pattern->data, pattern->len);
+        u->recv_pattern.len = pattern->len;
+
+        u->recv_mode = NGX_HTTP_PHP_SOCKET_RECV_UNTIL;
+        u->recv_max = max ? max : NGX_HTTP_PHP_SOCKET_RECV_UNTIL_MAX;
+    }
+
+    return ngx_http_php_socket_read_start(r, u);
+}
 
+ngx_int_t 
+ngx_http_php_socket_recv_exact(ngx_http_request_t *r, size_t bytes)
+{
+    ngx_http_php_ctx_t                  *ctx;
+    ngx_http_php_socket_upstream_t      *u;
 
+    ngx_log_debug1(NGX_LOG_DEBUG_HTTP, r->connection->log, 0, 
+                   "php socket receive exact %uz bytes", bytes);
 
+    ctx = ngx_http_get_module_ctx(r, ngx_http_php_module);
 
+    u = ctx->upstream;
+
+    if (u) {
+        u->recv_mode = NGX_HTTP_PHP_SOCKET_RECV_EXACT;
+        u->recv_bytes = bytes;
+    }
+
+    return ngx_http_php_socket_read_start(r, u);
+}
+
+ngx_int_t 
+ngx_http_php_socket_request(ngx_http_request_t *r, zend_string *req, 
+    ngx_http_php_socket_recv_filter_pt filter, void *data)
+{
+    ngx_http_php_ctx_t                  *ctx;
+    ngx_http_php_socket_upstream_t      *u;
+    ngx_chain_t                         **last;
+    ngx_int_t                           rc;
+    ngx_uint_t                          connecting;
+
+    ngx_log_debug1(NGX_LOG_DEBUG_HTTP, r->connection->log, 0, 
+                   "php socket request %uz bytes", req ? ZSTR_LEN(req) : 0);
+
+    ctx = ngx_http_get_module_ctx(r, ngx_http_php_module);
+
+    u = ctx->upstream;
+
+    /* 
+     * The request may follow ngx_http_php_socket_connect() right away,
+     * it is then sent by the connected handler.
+     */
+
+    connecting = 0;
+
+    if (u && u->request == r) {
+        if (u->peer.connection) {
+            connecting = u->write_event_handler == 
+                (ngx_http_php_socket_upstream_handler_pt) ngx_http_php_socket_connected_handler;
+
+        } else {
+            connecting = u->resolved && u->resolved->ctx;
+        }
+    }
+
+    if (u == NULL || u->request != r || (u->peer.connection == NULL && !connecting)) {
+        if (req) {
+            zend_string_release(req);
+        }
+
+        goto failed;
+    }
+
+    u->enabled_receive = 0;
+    u->recv_scanned = 0;
+    u->buffer.last_buf = 0;
+
+    /* events before the reply is complete must not resume the coroutine */
+    u->suspended = 1;
+
+    ngx_http_php_socket_free_bufs(u, NULL);
+    last = &u->request_bufs;
+
+    if (req && ngx_http_php_socket_append_str(r, u, &last, req, ZSTR_LEN(req)) 
+        != NGX_OK)
+    {
+        ngx_http_php_socket_release_strs(u);
+        goto failed;
+    }
+
+    u->recv_mode = NGX_HTTP_PHP_SOCKET_RECV_FILTER;
+    u->recv_filter = filter;
+    u->recv_filter_data = data;
+
+    if (connecting) {
+        return NGX_AGAIN;
+    }
+
+    if (u->request_bufs) {
+        rc = ngx_http_php_socket_upstream_send(r, u);
+
+        if (rc == NGX_AGAIN) {
+            /* the send handler goes on with the reply */
+            return NGX_AGAIN;
+        }
+
+        if (rc == NGX_ERROR) {
+            u->recv_mode = 0;
+            goto failed;
+        }
+    }
+
+    rc = ngx_http_php_socket_upstream_read(r, u);
+
+    if (rc == NGX_AGAIN) {
+        return NGX_AGAIN;
+    }
+
+    ctx->delay_time = 0;
+    ngx_http_php_sleep(r);
+    u->suspended = 1;
+
+    return rc;
+
+failed:
+
+    ZVAL_FALSE(&ctx->yield_retval);
+
+    ctx->delay_time = 0;
+    ngx_http_php_sleep(r);
+
+    if (u) {
+        u->suspended = 1;
+    }
+
+    return NGX_ERROR;
+}
+
+/*
+ * Bounds the whole operation, from connect to the end of the reply: the 
+ * timers armed after it are cut to the time left, the pending one too.
+ */
+void 
+ngx_http_php_socket_set_deadline(ngx_http_request_t *r, ngx_msec_t timeout)
+{
+    ngx_http_php_ctx_t                  *ctx;
+    ngx_http_php_socket_upstream_t      *u;
+    ngx_connection_t                    *c;
+
+    ctx = ngx_http_get_module_ctx(r, ngx_http_php_module);
+
+    u = ctx->upstream;
+
+    if (u == NULL || timeout == 0) {
+        return ;
+    }
+
+    /* the whole operation, from connect to the end of the reply */
+
+    u->deadline = ngx_current_msec + timeout;
+
+    c = u->peer.connection;
+
+    if (c && c->write->timer_set) {
+        ngx_add_timer(c->write, ngx_http_php_socket_timeout(u, u->write_timeout));
+    }
+}
+
+static ngx_msec_t 
+ngx_http_php_socket_timeout(ngx_http_php_socket_upstream_t *u, ngx_msec_t timeout)
+{
+    ngx_msec_int_t      left;
+
+    if (u->deadline == 0) {
+        return timeout;
+    }
+
+    left = (ngx_msec_int_t) (u->deadline - ngx_current_msec);
+
+    if (left <= 0) {
+        return 1;
+    }
+
+    return (ngx_msec_t) left < timeout ? (ngx_msec_t) left : timeout;
+}
+
+static void 
+ngx_http_php_socket_release(ngx_http_request_t *r, 
+    ngx_http_php_socket_upstream_t *u)
+{
+    /* requested by a filter that knows the reply ends the exchange */
+
+    if (u->release == NGX_HTTP_PHP_SOCKET_RELEASE_KEEPALIVE) {
+        (void) ngx_http_php_socket_setkeepalive(r, 0, 0);
+
+    } else {
+        ngx_http_php_socket_clear(r);
+    }
+
+    u->release = 0;
+    u->deadline = 0;
+}
+
+/*
+ * Called right after ngx_http_php_socket_connect(): for protocols where the
+ * server speaks first, the greeting is read with the filter before the
+ * coroutine is resumed. Connections from the keepalive pool went through
+ * the handshake already and skip it.
+ */
+ngx_int_t 
+ngx_http_php_socket_handshake(ngx_http_request_t *r, 
+    ngx_http_php_socket_recv_filter_pt filter, void *data)
+{
+    ngx_http_php_ctx_t                  *ctx;
+    ngx_http_php_socket_upstream_t      *u;
+
+    ctx = ngx_http_get_module_ctx(r, ngx_http_php_module);
+
+    u = ctx->upstream;
+
+    if (u == NULL || u->request != r) {
+        return NGX_ERROR;
+    }
+
+    u->recv_scanned = 0;
+    u->recv_mode = NGX_HTTP_PHP_SOCKET_RECV_FILTER;
+    u->recv_filter = filter;
+    u->recv_filter_data = data;
+
+    return NGX_OK;
+}
+
+void 
+ngx_http_php_socket_release_strs(ngx_http_php_socket_upstream_t *u)
+{
+    zend_string     **str;
+    ngx_uint_t      i;
+
+    if (u->request_strs == NULL) {
+        return ;
+    }
+
+    str = u->request_strs->elts;
+
+    for (i = 0; i < u->request_strs->nelts; i++) {
+        zend_string_release(str[i]);
+    }
+
+    u->request_strs->nelts = 0;
+}
+
+ngx_int_t 
+ngx_http_php_socket_append_str(ngx_http_request_t *r, 
+    ngx_http_php_socket_upstream_t *u, ngx_chain_t ***last, zend_string *str, 
+    size_t len)
+{
+    ngx_chain_t     *cl;
+    ngx_buf_t       *b;
+    zend_string     **ps;
+
+    if (len == 0) {
+        zend_string_release(str);
+        return NGX_OK;
+    }
+
+    if (u->request_strs == NULL) {
+        u->request_strs = ngx_array_create(r->pool, 4, sizeof(zend_string *));
+        if (u->request_strs == NULL) {
+            zend_string_release(str);
+            return NGX_ERROR;
+        }
+    }
+
+    ps = ngx_array_push(u->request_strs);
+    if (ps == NULL) {
+        zend_string_release(str);
+        return NGX_ERROR;
+    }
+
+    /* the reference is kept until the data is sent, no copy is made */
+
+    *ps = str;
+
+    cl = ngx_chain_get_free_buf(r->pool, &u->free_bufs);
+    if (cl == NULL) {
+        return NGX_ERROR;
+    }
+
+    b = cl->buf;
+    ngx_memzero(b, sizeof(ngx_buf_t));
+
+    b->start = (u_char *) ZSTR_VAL(str);
+    b->pos = b->start;
+    b->last = b->start + len;
+    b->end = b->last;
+    b->memory = 1;
+    b->tag = (ngx_buf_tag_t) &ngx_http_php_module;
+
+    **last = cl;
+    *last = &cl->next;
+
+    return NGX_OK;
+}
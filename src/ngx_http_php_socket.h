@@ -34,6 +34,18 @@ OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 #include <ngx_event_connect.h>
 #include <ngx_http.h>
 
+#include <php.h>
+
+#include "ngx_http_php_keepalive.h"
+
+#define NGX_HTTP_PHP_SOCKET_RECV_UNTIL      1
+#define NGX_HTTP_PHP_SOCKET_RECV_EXACT      2
+#define NGX_HTTP_PHP_SOCKET_RECV_FILTER     3
+
+#define NGX_HTTP_PHP_SOCKET_RECV_UNTIL_MAX  65536
+
+#define NGX_HTTP_PHP_SOCKET_RELEASE_KEEPALIVE   1
+#define NGX_HTTP_PHP_SOCKET_RELEASE_CLOSE       2
 
 /*typedef struct ngx_http_php_socket_pool_s {
 
@@ -45,6 +57,16 @@ typedef struct ngx_http_php_socket_upstream_s
 typedef void (*ngx_http_php_socket_upstream_handler_pt)(ngx_http_request_t *r, 
     ngx_http_php_socket_upstream_t *u);
 
+/*
+ * Parses a reply from the receive buffer, advancing b->pos over what was
+ * consumed. Returns NGX_OK with retval set once the reply is complete,
+ * NGX_AGAIN if more data is needed or NGX_ERROR. NGX_DONE sends *next
+ * (e.g. an authentication packet) and then goes on reading. b->last_buf
+ * is set once the peer has closed the connection.
+ */
+typedef ngx_int_t (*ngx_http_php_socket_recv_filter_pt)(void *data, 
+    ngx_buf_t *b, zval *retval, zend_string **next);
+
 struct ngx_http_php_socket_upstream_s {
 
     ngx_http_php_socket_upstream_handler_pt     read_event_handler;
@@ -66,8 +88,27 @@ struct ngx_http_php_socket_upstream_s {
     unsigned        enabled_receive:1;
     unsigned        wait_receive:1;
     unsigned        enabled_receive_page:1;
+    unsigned        recv_pending:1;
+    unsigned        suspended:1;
     ngx_int_t       receive_threshold;
 
+    /* ngx_socket_recv_until / ngx_socket_recv_exact state */
+    ngx_uint_t      recv_mode;
+    ngx_str_t       recv_pattern;
+    size_t          recv_pattern_size;
+    size_t          recv_bytes;
+    size_t          recv_scanned;
+    size_t          recv_max;
+
+    ngx_http_php_socket_recv_filter_pt  recv_filter;
+    void                                *recv_filter_data;
+
+    /* what to do with the connection once the filter is done, see above */
+    ngx_uint_t      release;
+
+    /* no timer is armed beyond it, 0 if there is none */
+    ngx_msec_t      deadline;
+
     ngx_chain_t     *bufs_in;
 
     ngx_chain_t     *busy_bufs;
@@ -79,20 +120,42 @@ struct ngx_http_php_socket_upstream_s {
 
     size_t          request_len;
     ngx_chain_t     *request_bufs;
-    
+
+    /* zend_strings referenced by request_bufs, released once sent */
+    ngx_array_t     *request_strs;
+
+    ngx_http_php_keepalive_opt_t    keepalive;
 
 };
 
 ngx_int_t ngx_http_php_socket_connect(ngx_http_request_t *r);
+ngx_int_t ngx_http_php_socket_handshake(ngx_http_request_t *r, 
+    ngx_http_php_socket_recv_filter_pt filter, void *data);
+void ngx_http_php_socket_set_deadline(ngx_http_request_t *r, ngx_msec_t timeout);
 void ngx_http_php_socket_close(ngx_http_request_t *r);
 
 ngx_int_t ngx_http_php_socket_send(ngx_http_request_t *r);
+void ngx_http_php_socket_release_strs(ngx_http_php_socket_upstream_t *u);
+ngx_int_t ngx_http_php_socket_append_str(ngx_http_request_t *r, 
+    ngx_http_php_socket_upstream_t *u, ngx_chain_t ***last, zend_string *str, 
+    size_t len);
+
+ngx_int_t ngx_http_php_socket_request(ngx_http_request_t *r, zend_string *req, 
+    ngx_http_php_socket_recv_filter_pt filter, void *data);
+
 ngx_int_t ngx_http_php_socket_recv(ngx_http_request_t *r);
 
 ngx_int_t ngx_http_php_socket_recv_wait(ngx_http_request_t *r);
 
 ngx_int_t ngx_http_php_socket_recv_sync(ngx_http_request_t *r);
 
+ngx_int_t ngx_http_php_socket_recv_until(ngx_http_request_t *r, 
+    ngx_str_t *pattern, size_t max);
+ngx_int_t ngx_http_php_socket_recv_exact(ngx_http_request_t *r, size_t bytes);
+
 void ngx_http_php_socket_clear(ngx_http_request_t *r);
 
+ngx_int_t ngx_http_php_socket_setkeepalive(ngx_http_request_t *r, 
+    ngx_msec_t timeout, ngx_uint_t size);
+
 #endif
\ No newline at end of file
@@ -0,0 +1,1304 @@
+/*
+==============================================================================
+Copyright (c) 2016-2020, rryqszq4 <rryqszq@gmail.com>
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+
+* Redistributions of source code must retain the above copyright notice, this
+  list of conditions and the following disclaimer.
+
+* Redistributions in binary form must reproduce the above copyright notice,
+  this list of conditions and the following disclaimer in the documentation
+  and/or other materials provided with the distribution.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+==============================================================================
+*/
+
+#include "ngx_http_php_module.h"
+#include "ngx_http_php_run.h"
+#include "ngx_http_php_stat.h"
+
+/* the lowest bucket boundary exported to prometheus, 2^7 usecs */
+#define NGX_HTTP_PHP_STAT_PROM_MIN      7
+
+struct ngx_http_php_stat_req_s {
+    ngx_uint_t                  slot;
+    ngx_uint_t                  state;
+    ngx_uint_t                  phase;
+    ngx_uint_t                  ran;
+
+    /* usecs of the last state change */
+    uint64_t                    last;
+    uint64_t                    last_cpu;
+
+    uint64_t                    time[NGX_HTTP_PHP_STAT_N];
+
+    ngx_uint_t                  yields;
+    off_t                       socket_bytes;
+
+    /* heap kept by the runs so far, its peak, and the heap at the run start */
+    ssize_t                     mem_retained;
+    ssize_t                     mem_peak;
+    size_t                      mem_start;
+};
+
+#define NGX_HTTP_PHP_STAT_VAR_EXEC      0
+#define NGX_HTTP_PHP_STAT_VAR_WAIT      1
+#define NGX_HTTP_PHP_STAT_VAR_YIELDS    2
+#define NGX_HTTP_PHP_STAT_VAR_MEM       3
+#define NGX_HTTP_PHP_STAT_VAR_COMPILE   4
+#define NGX_HTTP_PHP_STAT_VAR_SOCKET    5
+
+static ngx_int_t ngx_http_php_stat_init_zone(ngx_shm_zone_t *shm_zone, void *data);
+static ngx_http_php_stat_req_t *ngx_http_php_stat_request(ngx_http_request_t *r);
+static void ngx_http_php_stat_mark(ngx_http_php_stat_req_t *st, ngx_uint_t state);
+static void ngx_http_php_stat_record(ngx_http_php_stat_histogram_t *h, 
+    uint64_t usec);
+static ngx_uint_t ngx_http_php_stat_bucket(uint64_t usec);
+static uint64_t ngx_http_php_stat_upper(ngx_uint_t bucket);
+static uint64_t ngx_http_php_stat_quantile(ngx_http_php_stat_histogram_t *h, 
+    ngx_atomic_uint_t count, ngx_uint_t permille);
+static uint64_t ngx_http_php_stat_now(void);
+static uint64_t ngx_http_php_stat_cpu(void);
+static void ngx_http_php_stat_memory(ngx_http_php_stat_req_t *st, ngx_uint_t start);
+static ngx_int_t ngx_http_php_stat_variable(ngx_http_request_t *r, 
+    ngx_http_variable_value_t *v, uintptr_t data);
+
+static ngx_chain_t *ngx_http_php_stat_prometheus(ngx_http_request_t *r, 
+    ngx_http_php_stat_loc_t *locs, ngx_str_t *labels, ngx_uint_t n);
+static u_char *ngx_http_php_stat_prometheus_hist(u_char *p, char *metric, 
+    ngx_str_t *labels, char *phase, ngx_http_php_stat_histogram_t *h);
+static ngx_chain_t *ngx_http_php_stat_json(ngx_http_request_t *r, 
+    ngx_http_php_stat_loc_t *locs, ngx_http_php_stat_name_t *names, ngx_uint_t n);
+static u_char *ngx_http_php_stat_json_hist(u_char *p, char *name, 
+    ngx_http_php_stat_histogram_t *h);
+static u_char *ngx_http_php_stat_seconds(u_char *p, uint64_t usec);
+static u_char *ngx_http_php_stat_escape(u_char *p, ngx_str_t *s);
+
+static zend_op_array *ngx_http_php_stat_compile_file(zend_file_handle *file_handle, 
+    int type);
+#if PHP_MAJOR_VERSION >= 8
+#if PHP_MINOR_VERSION > 1
+static zend_op_array *ngx_http_php_stat_compile_string(zend_string *source_string, 
+    const char *filename, zend_compile_position position);
+#else
+static zend_op_array *ngx_http_php_stat_compile_string(zend_string *source_string, 
+    const char *filename);
+#endif
+#else
+static zend_op_array *ngx_http_php_stat_compile_string(zval *source_string, 
+    char *filename);
+#endif
+
+static zend_op_array *(*ngx_http_php_stat_orig_compile_file)(
+    zend_file_handle *file_handle, int type);
+#if PHP_MAJOR_VERSION >= 8
+#if PHP_MINOR_VERSION > 1
+static zend_op_array *(*ngx_http_php_stat_orig_compile_string)(
+    zend_string *source_string, const char *filename, zend_compile_position position);
+#else
+static zend_op_array *(*ngx_http_php_stat_orig_compile_string)(
+    zend_string *source_string, const char *filename);
+#endif
+#else
+static zend_op_array *(*ngx_http_php_stat_orig_compile_string)(
+    zval *source_string, char *filename);
+#endif
+
+/* the request whose php code is running, compile time goes to it */
+static ngx_http_php_stat_req_t *ngx_http_php_stat_running;
+
+/* $php_mem_peak is used, the heap is measured on each run */
+static ngx_uint_t ngx_http_php_stat_mem;
+
+static ngx_http_variable_t ngx_http_php_stat_vars[] = {
+
+    { ngx_string("php_exec_time"), NULL, ngx_http_php_stat_variable,
+      NGX_HTTP_PHP_STAT_VAR_EXEC, NGX_HTTP_VAR_NOCACHEABLE, 0 },
+
+    { ngx_string("php_wait_time"), NULL, ngx_http_php_stat_variable,
+      NGX_HTTP_PHP_STAT_VAR_WAIT, NGX_HTTP_VAR_NOCACHEABLE, 0 },
+
+    { ngx_string("php_yield_count"), NULL, ngx_http_php_stat_variable,
+      NGX_HTTP_PHP_STAT_VAR_YIELDS, NGX_HTTP_VAR_NOCACHEABLE, 0 },
+
+    { ngx_string("php_mem_peak"), NULL, ngx_http_php_stat_variable,
+      NGX_HTTP_PHP_STAT_VAR_MEM, NGX_HTTP_VAR_NOCACHEABLE, 0 },
+
+    { ngx_string("php_compile_time"), NULL, ngx_http_php_stat_variable,
+      NGX_HTTP_PHP_STAT_VAR_COMPILE, NGX_HTTP_VAR_NOCACHEABLE, 0 },
+
+    { ngx_string("php_socket_bytes"), NULL, ngx_http_php_stat_variable,
+      NGX_HTTP_PHP_STAT_VAR_SOCKET, NGX_HTTP_VAR_NOCACHEABLE, 0 },
+
+    ngx_http_null_variable
+};
+
+static char *ngx_http_php_stat_hists[] = {
+    "request", "cpu", "suspended", "compile", 
+    "rewrite", "access", "content", "log"
+};
+
+/* 
+ * Called from merge_loc_conf: every location with a php phase handler 
+ * gets a slot, if blocks share the one of their location.
+ */
+ngx_int_t
+ngx_http_php_stat_add_location(ngx_conf_t *cf, ngx_http_php_loc_conf_t *prev, 
+    ngx_http_php_loc_conf_t *conf)
+{
+    ngx_http_php_main_conf_t    *pmcf;
+    ngx_http_core_loc_conf_t    *clcf;
+    ngx_http_core_srv_conf_t    *cscf;
+    ngx_http_php_stat_name_t    *name;
+
+    pmcf = ngx_http_conf_get_module_main_conf(cf, ngx_http_php_module);
+
+    if (!pmcf->enabled_status || conf->status_slot) {
+        return NGX_OK;
+    }
+
+    if (conf->rewrite_handler == NULL && conf->access_handler == NULL
+        && conf->content_handler == NULL && conf->log_handler == NULL)
+    {
+        return NGX_OK;
+    }
+
+    clcf = ngx_http_conf_get_module_loc_conf(cf, ngx_http_core_module);
+
+    if (clcf->noname) {
+        conf->status_slot = prev->status_slot;
+        return NGX_OK;
+    }
+
+    if (clcf->name.len == 0) {
+        return NGX_OK;
+    }
+
+    cscf = ngx_http_conf_get_module_srv_conf(cf, ngx_http_core_module);
+
+    if (pmcf->status_locations == NULL) {
+        pmcf->status_locations = ngx_array_create(cf->pool, 8, 
+                                                  sizeof(ngx_http_php_stat_name_t));
+        if (pmcf->status_locations == NULL) {
+            return NGX_ERROR;
+        }
+    }
+
+    name = ngx_array_push(pmcf->status_locations);
+    if (name == NULL) {
+        return NGX_ERROR;
+    }
+
+    name->server = cscf->server_name;
+    name->location = clcf->name;
+
+    conf->status_slot = pmcf->status_locations->nelts;
+
+    return NGX_OK;
+}
+
+ngx_int_t
+ngx_http_php_stat_add_variables(ngx_conf_t *cf)
+{
+    ngx_http_variable_t  *var, *v;
+
+    for (v = ngx_http_php_stat_vars; v->name.len; v++) {
+        var = ngx_http_add_variable(cf, &v->name, v->flags);
+        if (var == NULL) {
+            return NGX_ERROR;
+        }
+
+        var->get_handler = v->get_handler;
+        var->data = v->data;
+    }
+
+    return NGX_OK;
+}
+
+/* 
+ * Requests are only timed for php_status or for the variables used 
+ * in the configuration, by log_format mostly.
+ */
+ngx_uint_t
+ngx_http_php_stat_variables_used(ngx_conf_t *cf)
+{
+    ngx_http_variable_t         *v;
+
+    for (v = ngx_http_php_stat_vars; v->name.len; v++) {
+        if (ngx_http_php_stat_variable_used(cf, &v->name)) {
+            return 1;
+        }
+    }
+
+    return 0;
+}
+
+ngx_uint_t
+ngx_http_php_stat_variable_used(ngx_conf_t *cf, ngx_str_t *name)
+{
+    ngx_http_core_main_conf_t   *cmcf;
+    ngx_http_variable_t         *var;
+    ngx_uint_t                  i;
+
+    cmcf = ngx_http_conf_get_module_main_conf(cf, ngx_http_core_module);
+
+    var = cmcf->variables.elts;
+
+    for (i = 0; i < cmcf->variables.nelts; i++) {
+        if (var[i].name.len == name->len
+            && ngx_strncmp(var[i].name.data, name->data, name->len) == 0)
+        {
+            return 1;
+        }
+    }
+
+    return 0;
+}
+
+/* 
+ * The zone is sized for the slots, so another number of locations makes 
+ * a new zone on reload; other names clear it.
+ */
+ngx_int_t
+ngx_http_php_stat_add_zone(ngx_conf_t *cf, ngx_http_php_main_conf_t *pmcf)
+{
+    ngx_shm_zone_t  *zone;
+    ngx_str_t       name;
+    size_t          size;
+
+    if (pmcf->status_locations == NULL) {
+        pmcf->status_locations = ngx_array_create(cf->pool, 1, 
+                                                  sizeof(ngx_http_php_stat_name_t));
+        if (pmcf->status_locations == NULL) {
+            return NGX_ERROR;
+        }
+    }
+
+    size = pmcf->status_locations->nelts * sizeof(ngx_http_php_stat_loc_t);
+    size = 8 * ngx_pagesize + size + size / 64;
+
+    ngx_str_set(&name, NGX_HTTP_PHP_STAT_ZONE);
+
+    zone = ngx_shared_memory_add(cf, &name, size, &ngx_http_php_module);
+    if (zone == NULL) {
+        return NGX_ERROR;
+    }
+
+    if (zone->data) {
+        ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+                           "shared memory zone \"%V\" is reserved for php_status", 
+                           &name);
+        return NGX_ERROR;
+    }
+
+    zone->init = ngx_http_php_stat_init_zone;
+    zone->data = pmcf->status_locations;
+
+    pmcf->status_zone = zone;
+
+    return NGX_OK;
+}
+
+static ngx_int_t
+ngx_http_php_stat_init_zone(ngx_shm_zone_t *shm_zone, void *data)
+{
+    ngx_array_t                 *onames = data;
+    ngx_array_t                 *names;
+    ngx_slab_pool_t             *shpool;
+    ngx_http_php_stat_name_t    *name, *oname;
+    ngx_http_php_stat_loc_t     *locs;
+    ngx_uint_t                  i, n;
+    size_t                      len;
+
+    names = shm_zone->data;
+    shpool = (ngx_slab_pool_t *) shm_zone->shm.addr;
+
+    n = ngx_max(names->nelts, 1);
+
+    if (onames) {
+        locs = shpool->data;
+
+        name = names->elts;
+        oname = onames->elts;
+
+        for (i = 0; i < names->nelts; i++) {
+            if (name[i].server.len != oname[i].server.len
+                || name[i].location.len != oname[i].location.len
+                || ngx_strncmp(name[i].server.data, oname[i].server.data, 
+                               name[i].server.len) != 0
+                || ngx_strncmp(name[i].location.data, oname[i].location.data, 
+                               name[i].location.len) != 0)
+            {
+                ngx_memzero(locs, n * sizeof(ngx_http_php_stat_loc_t));
+                break;
+            }
+        }
+
+        return NGX_OK;
+    }
+
+    if (shm_zone->shm.exists) {
+        return NGX_OK;
+    }
+
+    locs = ngx_slab_calloc(shpool, n * sizeof(ngx_http_php_stat_loc_t));
+    if (locs == NULL) {
+        return NGX_ERROR;
+    }
+
+    shpool->data = locs;
+
+    len = sizeof(" in php_status zone \"\"") + shm_zone->shm.name.len;
+
+    shpool->log_ctx = ngx_slab_alloc(shpool, len);
+    if (shpool->log_ctx == NULL) {
+        return NGX_ERROR;
+    }
+
+    ngx_sprintf(shpool->log_ctx, " in php_status zone \"%V\"%Z",
+                &shm_zone->shm.name);
+
+    return NGX_OK;
+}
+
+void
+ngx_http_php_stat_init_worker(ngx_cycle_t *cycle)
+{
+    ngx_http_php_main_conf_t    *pmcf;
+
+    pmcf = ngx_http_cycle_get_module_main_conf(cycle, ngx_http_php_module);
+
+    if (pmcf == NULL || !pmcf->enabled_timing) {
+        return;
+    }
+
+    ngx_http_php_stat_mem = pmcf->enabled_mem_peak;
+
+    /* on top of opcache, whose hits then count as cheap compiles */
+
+    ngx_http_php_stat_orig_compile_file = zend_compile_file;
+    zend_compile_file = ngx_http_php_stat_compile_file;
+
+    ngx_http_php_stat_orig_compile_string = zend_compile_string;
+    zend_compile_string = ngx_http_php_stat_compile_string;
+}
+
+/* 
+ * The php code of a phase starts, or with NGX_HTTP_PHP_STAT_IDLE, 
+ * a coroutine is resumed.
+ */
+void
+ngx_http_php_stat_enter(ngx_http_php_run_t *run, ngx_uint_t phase)
+{
+    ngx_http_php_main_conf_t    *pmcf;
+    ngx_http_php_loc_conf_t     *plcf;
+    ngx_http_php_stat_req_t     *st;
+    ngx_http_request_t          *r;
+
+    r = run->request;
+
+    /* subrequests run while the main request is suspended */
+    if (r != r->main) {
+        return;
+    }
+
+    st = run->stat;
+
+    if (st == NULL) {
+        pmcf = ngx_http_get_module_main_conf(r, ngx_http_php_module);
+        if (!pmcf->enabled_timing) {
+            return;
+        }
+
+        st = ngx_pcalloc(r->pool, sizeof(ngx_http_php_stat_req_t));
+        if (st == NULL) {
+            return;
+        }
+
+        run->stat = st;
+    }
+
+    if (phase == NGX_HTTP_PHP_STAT_IDLE) {
+        phase = st->phase;
+
+        if (phase == NGX_HTTP_PHP_STAT_IDLE) {
+            return;
+        }
+
+    } else {
+        st->phase = phase;
+
+        plcf = ngx_http_get_module_loc_conf(r, ngx_http_php_module);
+        if (plcf->status_slot) {
+            st->slot = plcf->status_slot;
+        }
+    }
+
+    ngx_http_php_stat_mark(st, phase);
+
+    st->ran |= 1 << phase;
+}
+
+/* 
+ * After a run of php code, suspended if the coroutine yielded. When a 
+ * resume ran the next phase, that phase has left already.
+ */
+void
+ngx_http_php_stat_leave(ngx_http_php_run_t *run)
+{
+    ngx_http_php_stat_req_t     *st;
+    ngx_http_php_ctx_t          *ctx;
+
+    st = run->stat;
+
+    if (st == NULL || st->state < NGX_HTTP_PHP_STAT_REWRITE) {
+        return;
+    }
+
+    ctx = ngx_http_get_module_ctx(run->request, ngx_http_php_module);
+
+    if (ctx && ctx->phase_status == NGX_AGAIN) {
+        ngx_http_php_stat_mark(st, NGX_HTTP_PHP_STAT_SUSPENDED);
+    } else {
+        ngx_http_php_stat_mark(st, NGX_HTTP_PHP_STAT_IDLE);
+    }
+}
+
+ngx_int_t
+ngx_http_php_stat_log_handler(ngx_http_request_t *r)
+{
+    ngx_http_php_main_conf_t    *pmcf;
+    ngx_http_php_loc_conf_t     *plcf;
+    ngx_http_php_stat_req_t     *st;
+    ngx_http_php_stat_loc_t     *loc;
+    ngx_slab_pool_t             *shpool;
+    ngx_time_t                  *tp;
+    ngx_msec_int_t              ms;
+    ngx_uint_t                  slot, i;
+
+    pmcf = ngx_http_get_module_main_conf(r, ngx_http_php_module);
+    plcf = ngx_http_get_module_loc_conf(r, ngx_http_php_module);
+
+    if (pmcf->status_zone == NULL) {
+        return NGX_OK;
+    }
+
+    st = ngx_http_php_stat_request(r);
+
+    /* where the php code ran if the request went elsewhere since */
+
+    slot = plcf->status_slot;
+
+    if (slot == 0 && st) {
+        slot = st->slot;
+    }
+
+    if (slot == 0 || slot > pmcf->status_locations->nelts) {
+        return NGX_OK;
+    }
+
+    shpool = (ngx_slab_pool_t *) pmcf->status_zone->shm.addr;
+    loc = (ngx_http_php_stat_loc_t *) shpool->data + slot - 1;
+
+    (void) ngx_atomic_fetch_add(&loc->requests, 1);
+
+    if (r->headers_out.status >= NGX_HTTP_INTERNAL_SERVER_ERROR) {
+        (void) ngx_atomic_fetch_add(&loc->errors, 1);
+    }
+
+    /* the same as $request_time */
+
+    tp = ngx_timeofday();
+
+    ms = (ngx_msec_int_t)
+             ((tp->sec - r->start_sec) * 1000 + (tp->msec - r->start_msec));
+    ms = ngx_max(ms, 0);
+
+    ngx_http_php_stat_record(&loc->hist[NGX_HTTP_PHP_STAT_TOTAL], (uint64_t) ms * 1000);
+
+    if (st == NULL) {
+        return NGX_OK;
+    }
+
+    ngx_http_php_stat_mark(st, NGX_HTTP_PHP_STAT_IDLE);
+
+    for (i = NGX_HTTP_PHP_STAT_CPU; i < NGX_HTTP_PHP_STAT_N; i++) {
+
+        if (i >= NGX_HTTP_PHP_STAT_REWRITE && !(st->ran & (1 << i))) {
+            continue;
+        }
+
+        ngx_http_php_stat_record(&loc->hist[i], st->time[i]);
+    }
+
+    return NGX_OK;
+}
+
+/* php_status, prometheus text or json with ?format=json */
+ngx_int_t
+ngx_http_php_stat_handler(ngx_http_request_t *r)
+{
+    ngx_http_php_main_conf_t    *pmcf;
+    ngx_http_php_stat_name_t    *names;
+    ngx_http_php_stat_loc_t     *locs;
+    ngx_slab_pool_t             *shpool;
+    ngx_str_t                   format, *labels;
+    ngx_chain_t                 *out, *cl;
+    ngx_uint_t                  i, n, json;
+    ngx_int_t                   rc;
+    off_t                       len;
+    u_char                      *p;
+
+    if (!(r->method & (NGX_HTTP_GET|NGX_HTTP_HEAD))) {
+        return NGX_HTTP_NOT_ALLOWED;
+    }
+
+    rc = ngx_http_discard_request_body(r);
+    if (rc != NGX_OK) {
+        return rc;
+    }
+
+    pmcf = ngx_http_get_module_main_conf(r, ngx_http_php_module);
+
+    if (pmcf->status_zone == NULL) {
+        return NGX_HTTP_INTERNAL_SERVER_ERROR;
+    }
+
+    json = (ngx_http_arg(r, (u_char *) "format", 6, &format) == NGX_OK
+            && format.len == 4 
+            && ngx_strncmp(format.data, "json", 4) == 0);
+
+    n = pmcf->status_locations->nelts;
+    names = pmcf->status_locations->elts;
+
+    /* a snapshot, the counters keep moving while it is printed */
+
+    shpool = (ngx_slab_pool_t *) pmcf->status_zone->shm.addr;
+
+    locs = ngx_palloc(r->pool, ngx_max(n, 1) * sizeof(ngx_http_php_stat_loc_t));
+    if (locs == NULL) {
+        return NGX_HTTP_INTERNAL_SERVER_ERROR;
+    }
+
+    ngx_memcpy(locs, shpool->data, n * sizeof(ngx_http_php_stat_loc_t));
+
+    if (json) {
+        out = ngx_http_php_stat_json(r, locs, names, n);
+        ngx_str_set(&r->headers_out.content_type, "application/json");
+
+    } else {
+
+        /* server="...",location="..." */
+
+        labels = ngx_palloc(r->pool, ngx_max(n, 1) * sizeof(ngx_str_t));
+        if (labels == NULL) {
+            return NGX_HTTP_INTERNAL_SERVER_ERROR;
+        }
+
+        for (i = 0; i < n; i++) {
+            labels[i].data = ngx_pnalloc(r->pool, sizeof("server=\"\",location=\"\"") 
+                                         + 2 * names[i].server.len 
+                                         + 2 * names[i].location.len);
+            if (labels[i].data == NULL) {
+                return NGX_HTTP_INTERNAL_SERVER_ERROR;
+            }
+
+            p = ngx_cpymem(labels[i].data, "server=\"", sizeof("server=\"") - 1);
+            p = ngx_http_php_stat_escape(p, &names[i].server);
+            p = ngx_cpymem(p, "\",location=\"", sizeof("\",location=\"") - 1);
+            p = ngx_http_php_stat_escape(p, &names[i].location);
+            *p++ = '"';
+
+            labels[i].len = p - labels[i].data;
+        }
+
+        out = ngx_http_php_stat_prometheus(r, locs, labels, n);
+        ngx_str_set(&r->headers_out.content_type, "text/plain; version=0.0.4");
+    }
+
+    if (out == NULL) {
+        return NGX_HTTP_INTERNAL_SERVER_ERROR;
+    }
+
+    r->headers_out.content_type_len = r->headers_out.content_type.len;
+
+    len = 0;
+
+    for (cl = out; cl; cl = cl->next) {
+        len += ngx_buf_size(cl->buf);
+
+        if (cl->next == NULL) {
+            cl->buf->last_buf = (r == r->main) ? 1 : 0;
+            cl->buf->last_in_chain = 1;
+        }
+    }
+
+    r->headers_out.status = NGX_HTTP_OK;
+    r->headers_out.content_length_n = len;
+
+    rc = ngx_http_send_header(r);
+
+    if (rc == NGX_ERROR || rc > NGX_OK || r->header_only) {
+        return rc;
+    }
+
+    return ngx_http_output_filter(r, out);
+}
+
+/* the module ctx is reset before the log phase, the record lasts */
+static ngx_http_php_stat_req_t *
+ngx_http_php_stat_request(ngx_http_request_t *r)
+{
+    ngx_http_php_run_t          *run;
+
+    run = ngx_http_php_run_request(r->main, 0);
+
+    return run ? run->stat : NULL;
+}
+
+/* the end of the request */
+void
+ngx_http_php_stat_done(ngx_http_php_stat_req_t *st)
+{
+    if (ngx_http_php_stat_running == st) {
+        ngx_http_php_stat_running = NULL;
+    }
+}
+
+/* accounts the time since the last change to the state left */
+static void
+ngx_http_php_stat_mark(ngx_http_php_stat_req_t *st, ngx_uint_t state)
+{
+    uint64_t    now, cpu;
+
+    now = ngx_http_php_stat_now();
+
+    if (st->state == NGX_HTTP_PHP_STAT_SUSPENDED) {
+        st->time[NGX_HTTP_PHP_STAT_SUSPENDED] += now - st->last;
+
+    } else if (st->state >= NGX_HTTP_PHP_STAT_REWRITE) {
+        st->time[st->state] += now - st->last;
+
+        cpu = ngx_http_php_stat_cpu();
+        st->time[NGX_HTTP_PHP_STAT_CPU] += cpu - st->last_cpu;
+
+        if (ngx_http_php_stat_mem) {
+            ngx_http_php_stat_memory(st, 0);
+        }
+    }
+
+    if (state == NGX_HTTP_PHP_STAT_SUSPENDED) {
+        st->yields++;
+    }
+
+    if (state >= NGX_HTTP_PHP_STAT_REWRITE) {
+        st->last_cpu = ngx_http_php_stat_cpu();
+
+        if (ngx_http_php_stat_mem) {
+            ngx_http_php_stat_memory(st, 1);
+        }
+
+        ngx_http_php_stat_running = st;
+
+    } else if (ngx_http_php_stat_running == st) {
+        ngx_http_php_stat_running = NULL;
+    }
+
+    st->state = state;
+    st->last = now;
+}
+
+/* 
+ * Between two yields the php code of one request runs alone, what the 
+ * heap grows by in a run is its own. The peak of php is reset for that, 
+ * so this only runs when $php_mem_peak is used.
+ */
+static void
+ngx_http_php_stat_memory(ngx_http_php_stat_req_t *st, ngx_uint_t start)
+{
+    size_t      usage, peak;
+
+    usage = zend_memory_usage(0);
+
+    if (start) {
+        st->mem_start = usage;
+
+#if PHP_MAJOR_VERSION >= 8 && PHP_MINOR_VERSION > 1
+        zend_memory_reset_peak_usage();
+#endif
+        return;
+    }
+
+#if PHP_MAJOR_VERSION >= 8 && PHP_MINOR_VERSION > 1
+    peak = zend_memory_peak_usage(0);
+#else
+    peak = usage;
+#endif
+
+    st->mem_peak = ngx_max(st->mem_peak, 
+                           st->mem_retained + (ssize_t) (peak - st->mem_start));
+    st->mem_retained += (ssize_t) (usage - st->mem_start);
+}
+
+void
+ngx_http_php_stat_socket_bytes(ngx_http_request_t *r, off_t bytes)
+{
+    ngx_http_php_stat_req_t     *st;
+
+    st = ngx_http_php_stat_request(r);
+
+    if (st) {
+        st->socket_bytes += bytes;
+    }
+}
+
+static ngx_int_t
+ngx_http_php_stat_variable(ngx_http_request_t *r, ngx_http_variable_value_t *v, 
+    uintptr_t data)
+{
+    ngx_http_php_stat_req_t     *st;
+    uint64_t                    usec;
+    ngx_uint_t                  i;
+    u_char                      *p;
+
+    st = ngx_http_php_stat_request(r);
+
+    /* no php code ran */
+    if (st == NULL) {
+        v->not_found = 1;
+        return NGX_OK;
+    }
+
+    p = ngx_pnalloc(r->pool, NGX_OFF_T_LEN + 8);
+    if (p == NULL) {
+        return NGX_ERROR;
+    }
+
+    v->data = p;
+
+    switch (data) {
+
+    case NGX_HTTP_PHP_STAT_VAR_EXEC:
+        usec = 0;
+
+        for (i = NGX_HTTP_PHP_STAT_REWRITE; i < NGX_HTTP_PHP_STAT_N; i++) {
+            usec += st->time[i];
+        }
+
+        p = ngx_http_php_stat_seconds(p, usec);
+        break;
+
+    case NGX_HTTP_PHP_STAT_VAR_WAIT:
+        p = ngx_http_php_stat_seconds(p, st->time[NGX_HTTP_PHP_STAT_SUSPENDED]);
+        break;
+
+    case NGX_HTTP_PHP_STAT_VAR_YIELDS:
+        p = ngx_sprintf(p, "%ui", st->yields);
+        break;
+
+    case NGX_HTTP_PHP_STAT_VAR_MEM:
+        p = ngx_sprintf(p, "%z", ngx_max(st->mem_peak, 0));
+        break;
+
+    case NGX_HTTP_PHP_STAT_VAR_COMPILE:
+        p = ngx_http_php_stat_seconds(p, st->time[NGX_HTTP_PHP_STAT_COMPILE]);
+        break;
+
+    default: /* NGX_HTTP_PHP_STAT_VAR_SOCKET */
+        p = ngx_sprintf(p, "%O", st->socket_bytes);
+        break;
+    }
+
+    v->len = p - v->data;
+    v->valid = 1;
+    v->no_cacheable = 1;
+    v->not_found = 0;
+
+    return NGX_OK;
+}
+
+static void
+ngx_http_php_stat_record(ngx_http_php_stat_histogram_t *h, uint64_t usec)
+{
+    (void) ngx_atomic_fetch_add(&h->count, 1);
+    (void) ngx_atomic_fetch_add(&h->sum, (ngx_atomic_int_t) usec);
+    (void) ngx_atomic_fetch_add(&h->buckets[ngx_http_php_stat_bucket(usec)], 1);
+}
+
+static ngx_uint_t
+ngx_http_php_stat_bucket(uint64_t usec)
+{
+    ngx_uint_t  e;
+
+    if (usec < (1 << NGX_HTTP_PHP_STAT_SUB_BITS)) {
+        return (ngx_uint_t) usec;
+    }
+
+    if (usec >> NGX_HTTP_PHP_STAT_MAX_BITS) {
+        return NGX_HTTP_PHP_STAT_BUCKETS - 1;
+    }
+
+    for (e = NGX_HTTP_PHP_STAT_SUB_BITS; usec >> (e + 1); e++) {
+        /* void */
+    }
+
+    return ((e - NGX_HTTP_PHP_STAT_SUB_BITS + 1) << NGX_HTTP_PHP_STAT_SUB_BITS)
+           + ((usec >> (e - NGX_HTTP_PHP_STAT_SUB_BITS))
+              & ((1 << NGX_HTTP_PHP_STAT_SUB_BITS) - 1));
+}
+
+/* the first value above the bucket */
+static uint64_t
+ngx_http_php_stat_upper(ngx_uint_t bucket)
+{
+    ngx_uint_t  e, sub;
+
+    if (bucket < (1 << NGX_HTTP_PHP_STAT_SUB_BITS)) {
+        return bucket + 1;
+    }
+
+    e = (bucket >> NGX_HTTP_PHP_STAT_SUB_BITS) + NGX_HTTP_PHP_STAT_SUB_BITS - 1;
+    sub = bucket & ((1 << NGX_HTTP_PHP_STAT_SUB_BITS) - 1);
+
+    return (uint64_t) ((1 << NGX_HTTP_PHP_STAT_SUB_BITS) + sub + 1)
+           << (e - NGX_HTTP_PHP_STAT_SUB_BITS);
+}
+
+static uint64_t
+ngx_http_php_stat_quantile(ngx_http_php_stat_histogram_t *h, 
+    ngx_atomic_uint_t count, ngx_uint_t permille)
+{
+    ngx_atomic_uint_t   rank, cum;
+    ngx_uint_t          i;
+
+    if (count == 0) {
+        return 0;
+    }
+
+    rank = (count * permille + 999) / 1000;
+    cum = 0;
+
+    for (i = 0; i < NGX_HTTP_PHP_STAT_BUCKETS; i++) {
+        cum += h->buckets[i];
+
+        if (cum >= rank) {
+            return ngx_http_php_stat_upper(i);
+        }
+    }
+
+    return ngx_http_php_stat_upper(NGX_HTTP_PHP_STAT_BUCKETS - 1);
+}
+
+static uint64_t
+ngx_http_php_stat_now(void)
+{
+#if (NGX_HAVE_CLOCK_MONOTONIC)
+    struct timespec  ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    return (uint64_t) ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+#else
+    struct timeval   tv;
+
+    ngx_gettimeofday(&tv);
+
+    return (uint64_t) tv.tv_sec * 1000000 + tv.tv_usec;
+#endif
+}
+
+static uint64_t
+ngx_http_php_stat_cpu(void)
+{
+#if defined(CLOCK_THREAD_CPUTIME_ID)
+    struct timespec  ts;
+
+    clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts);
+
+    return (uint64_t) ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+#else
+    struct rusage    ru;
+
+    getrusage(RUSAGE_SELF, &ru);
+
+    return (uint64_t) (ru.ru_utime.tv_sec + ru.ru_stime.tv_sec) * 1000000
+           + ru.ru_utime.tv_usec + ru.ru_stime.tv_usec;
+#endif
+}
+
+/* 
+ * Families are grouped as the exposition format wants. The buckets are 
+ * cumulative at powers of two, which fall on bucket boundaries.
+ */
+static ngx_chain_t *
+ngx_http_php_stat_prometheus(ngx_http_request_t *r, ngx_http_php_stat_loc_t *locs, 
+    ngx_str_t *labels, ngx_uint_t n)
+{
+    static char    *metrics[] = {
+        "ngx_php_request_seconds", "ngx_php_cpu_seconds", 
+        "ngx_php_suspended_seconds", "ngx_php_compile_seconds"
+    };
+
+    static char    *help[] = {
+        "Total request time, as $request_time.",
+        "CPU time running php code.",
+        "Time coroutines waited on sleeps, sockets and subrequests.",
+        "Time compiling php code."
+    };
+
+    ngx_buf_t       *b;
+    ngx_chain_t     *out;
+    ngx_uint_t      i, j;
+    size_t          size, lines;
+    u_char          *p;
+
+    lines = NGX_HTTP_PHP_STAT_MAX_BITS - NGX_HTTP_PHP_STAT_PROM_MIN + 3;
+    size = 4096;
+
+    for (i = 0; i < n; i++) {
+        size += 2 * (64 + labels[i].len)
+                + NGX_HTTP_PHP_STAT_N * lines * (128 + labels[i].len);
+    }
+
+    b = ngx_create_temp_buf(r->pool, size);
+    if (b == NULL) {
+        return NULL;
+    }
+
+    p = b->last;
+
+    p = ngx_sprintf(p, "# HELP ngx_php_requests_total Requests to the location.\n"
+                       "# TYPE ngx_php_requests_total counter\n");
+
+    for (i = 0; i < n; i++) {
+        p = ngx_sprintf(p, "ngx_php_requests_total{%V} %uA\n", 
+                        &labels[i], locs[i].requests);
+    }
+
+    p = ngx_sprintf(p, "# HELP ngx_php_errors_total Responses with a 5xx status.\n"
+                       "# TYPE ngx_php_errors_total counter\n");
+
+    for (i = 0; i < n; i++) {
+        p = ngx_sprintf(p, "ngx_php_errors_total{%V} %uA\n", 
+                        &labels[i], locs[i].errors);
+    }
+
+    for (j = 0; j < NGX_HTTP_PHP_STAT_REWRITE; j++) {
+        p = ngx_sprintf(p, "# HELP %s %s\n# TYPE %s histogram\n", 
+                        metrics[j], help[j], metrics[j]);
+
+        for (i = 0; i < n; i++) {
+            p = ngx_http_php_stat_prometheus_hist(p, metrics[j], &labels[i], 
+                                                  NULL, &locs[i].hist[j]);
+        }
+    }
+
+    p = ngx_sprintf(p, "# HELP ngx_php_phase_seconds Time running php code "
+                       "in a phase.\n"
+                       "# TYPE ngx_php_phase_seconds histogram\n");
+
+    for (i = 0; i < n; i++) {
+        for (j = NGX_HTTP_PHP_STAT_REWRITE; j < NGX_HTTP_PHP_STAT_N; j++) {
+
+            if (locs[i].hist[j].count == 0) {
+                continue;
+            }
+
+            p = ngx_http_php_stat_prometheus_hist(p, "ngx_php_phase_seconds", 
+                    &labels[i], ngx_http_php_stat_hists[j], &locs[i].hist[j]);
+        }
+    }
+
+    b->last = p;
+
+    out = ngx_alloc_chain_link(r->pool);
+    if (out == NULL) {
+        return NULL;
+    }
+
+    out->buf = b;
+    out->next = NULL;
+
+    return out;
+}
+
+static u_char *
+ngx_http_php_stat_prometheus_hist(u_char *p, char *metric, ngx_str_t *labels, 
+    char *phase, ngx_http_php_stat_histogram_t *h)
+{
+    ngx_atomic_uint_t   cum;
+    ngx_uint_t          b, k;
+    u_char              sel[32];
+
+    if (phase) {
+        ngx_sprintf(sel, ",phase=\"%s\"%Z", phase);
+    } else {
+        sel[0] = '\0';
+    }
+
+    cum = 0;
+    b = 0;
+
+    for (k = NGX_HTTP_PHP_STAT_PROM_MIN; k < NGX_HTTP_PHP_STAT_MAX_BITS; k++) {
+
+        /* the buckets below 2^k */
+        for ( ; b < ((k - NGX_HTTP_PHP_STAT_SUB_BITS + 1) << NGX_HTTP_PHP_STAT_SUB_BITS); b++) {
+            cum += h->buckets[b];
+        }
+
+        p = ngx_sprintf(p, "%s_bucket{%V%s,le=\"", metric, labels, sel);
+        p = ngx_http_php_stat_seconds(p, (uint64_t) 1 << k);
+        p = ngx_sprintf(p, "\"} %uA\n", cum);
+    }
+
+    for ( ; b < NGX_HTTP_PHP_STAT_BUCKETS; b++) {
+        cum += h->buckets[b];
+    }
+
+    /* counted from the buckets, +Inf and _count must match */
+
+    p = ngx_sprintf(p, "%s_bucket{%V%s,le=\"+Inf\"} %uA\n", metric, labels, sel, cum);
+
+    p = ngx_sprintf(p, "%s_sum{%V%s} ", metric, labels, sel);
+    p = ngx_http_php_stat_seconds(p, h->sum);
+    *p++ = '\n';
+
+    return ngx_sprintf(p, "%s_count{%V%s} %uA\n", metric, labels, sel, cum);
+}
+
+static ngx_chain_t *
+ngx_http_php_stat_json(ngx_http_request_t *r, ngx_http_php_stat_loc_t *locs, 
+    ngx_http_php_stat_name_t *names, ngx_uint_t n)
+{
+    ngx_buf_t       *b;
+    ngx_chain_t     *out;
+    ngx_uint_t      i, j, k;
+    size_t          size;
+    u_char          *p;
+
+    size = sizeof("{\"locations\":[]}");
+
+    for (i = 0; i < n; i++) {
+        size += 2 * names[i].server.len + 2 * names[i].location.len + 128;
+
+        for (j = 0; j < NGX_HTTP_PHP_STAT_N; j++) {
+            size += 256;
+
+            for (k = 0; k < NGX_HTTP_PHP_STAT_BUCKETS; k++) {
+                if (locs[i].hist[j].buckets[k]) {
+                    size += 48;
+                }
+            }
+        }
+    }
+
+    b = ngx_create_temp_buf(r->pool, size);
+    if (b == NULL) {
+        return NULL;
+    }
+
+    p = ngx_cpymem(b->last, "{\"locations\":[", sizeof("{\"locations\":[") - 1);
+
+    for (i = 0; i < n; i++) {
+
+        if (i) {
+            *p++ = ',';
+        }
+
+        p = ngx_cpymem(p, "{\"server\":\"", sizeof("{\"server\":\"") - 1);
+        p = ngx_http_php_stat_escape(p, &names[i].server);
+        p = ngx_cpymem(p, "\",\"location\":\"", sizeof("\",\"location\":\"") - 1);
+        p = ngx_http_php_stat_escape(p, &names[i].location);
+
+        p = ngx_sprintf(p, "\",\"requests\":%uA,\"errors\":%uA", 
+                        locs[i].requests, locs[i].errors);
+
+        for (j = 0; j < NGX_HTTP_PHP_STAT_REWRITE; j++) {
+            *p++ = ',';
+            p = ngx_http_php_stat_json_hist(p, ngx_http_php_stat_hists[j], 
+                                            &locs[i].hist[j]);
+        }
+
+        p = ngx_cpymem(p, ",\"phases\":{", sizeof(",\"phases\":{") - 1);
+
+        for (j = NGX_HTTP_PHP_STAT_REWRITE; j < NGX_HTTP_PHP_STAT_N; j++) {
+
+            if (j > NGX_HTTP_PHP_STAT_REWRITE) {
+                *p++ = ',';
+            }
+
+            p = ngx_http_php_stat_json_hist(p, ngx_http_php_stat_hists[j], 
+                                            &locs[i].hist[j]);
+        }
+
+        *p++ = '}';
+        *p++ = '}';
+    }
+
+    *p++ = ']';
+    *p++ = '}';
+
+    b->last = p;
+
+    out = ngx_alloc_chain_link(r->pool);
+    if (out == NULL) {
+        return NULL;
+    }
+
+    out->buf = b;
+    out->next = NULL;
+
+    return out;
+}
+
+/* "name":{"count":..,"sum":..,"p50":..,"buckets":[[upper,count],..]} */
+static u_char *
+ngx_http_php_stat_json_hist(u_char *p, char *name, 
+    ngx_http_php_stat_histogram_t *h)
+{
+    static ngx_uint_t   quantiles[] = { 500, 900, 990, 999 };
+    static char        *keys[] = { "p50", "p90", "p99", "p999" };
+
+    ngx_atomic_uint_t   count;
+    ngx_uint_t          i, first;
+
+    count = 0;
+
+    for (i = 0; i < NGX_HTTP_PHP_STAT_BUCKETS; i++) {
+        count += h->buckets[i];
+    }
+
+    p = ngx_sprintf(p, "\"%s\":{\"count\":%uA,\"sum\":", name, count);
+    p = ngx_http_php_stat_seconds(p, h->sum);
+
+    for (i = 0; i < sizeof(quantiles) / sizeof(quantiles[0]); i++) {
+        p = ngx_sprintf(p, ",\"%s\":", keys[i]);
+        p = ngx_http_php_stat_seconds(p, 
+                ngx_http_php_stat_quantile(h, count, quantiles[i]));
+    }
+
+    p = ngx_cpymem(p, ",\"buckets\":[", sizeof(",\"buckets\":[") - 1);
+
+    first = 1;
+
+    for (i = 0; i < NGX_HTTP_PHP_STAT_BUCKETS; i++) {
+
+        if (h->buckets[i] == 0) {
+            continue;
+        }
+
+        if (!first) {
+            *p++ = ',';
+        }
+
+        first = 0;
+
+        *p++ = '[';
+        p = ngx_http_php_stat_seconds(p, ngx_http_php_stat_upper(i));
+        p = ngx_sprintf(p, ",%uA]", h->buckets[i]);
+    }
+
+    *p++ = ']';
+    *p++ = '}';
+
+    return p;
+}
+
+static u_char *
+ngx_http_php_stat_seconds(u_char *p, uint64_t usec)
+{
+    return ngx_sprintf(p, "%uL.%06uL", usec / 1000000, usec % 1000000);
+}
+
+/* good for json strings and prometheus label values alike */
+static u_char *
+ngx_http_php_stat_escape(u_char *p, ngx_str_t *s)
+{
+    ngx_uint_t  i;
+
+    for (i = 0; i < s->len; i++) {
+
+        if (s->data[i] == '"' || s->data[i] == '\\') {
+            *p++ = '\\';
+            *p++ = s->data[i];
+
+        } else if (s->data[i] < 0x20) {
+            *p++ = ' ';
+
+        } else {
+            *p++ = s->data[i];
+        }
+    }
+
+    return p;
+}
+
+static zend_op_array *
+ngx_http_php_stat_compile_file(zend_file_handle *file_handle, int type)
+{
+    ngx_http_php_stat_req_t     *st;
+    zend_op_array               *op_array;
+    uint64_t                    start;
+
+    st = ngx_http_php_stat_running;
+
+    if (st == NULL) {
+        return ngx_http_php_stat_orig_compile_file(file_handle, type);
+    }
+
+    start = ngx_http_php_stat_now();
+
+    op_array = ngx_http_php_stat_orig_compile_file(file_handle, type);
+
+    st->time[NGX_HTTP_PHP_STAT_COMPILE] += ngx_http_php_stat_now() - start;
+
+    return op_array;
+}
+
+#if PHP_MAJOR_VERSION >= 8
+#if PHP_MINOR_VERSION > 1
+static zend_op_array *
+ngx_http_php_stat_compile_string(zend_string *source_string, const char *filename, 
+    zend_compile_position position)
+#else
+static zend_op_array *
+ngx_http_php_stat_compile_string(zend_string *source_string, const char *filename)
+#endif
+#else
+static zend_op_array *
+ngx_http_php_stat_compile_string(zval *source_string, char *filename)
+#endif
+{
+    ngx_http_php_stat_req_t     *st;
+    zend_op_array               *op_array;
+    uint64_t                    start;
+
+    st = ngx_http_php_stat_running;
+
+    start = st ? ngx_http_php_stat_now() : 0;
+
+#if PHP_MAJOR_VERSION >= 8 && PHP_MINOR_VERSION > 1
+    op_array = ngx_http_php_stat_orig_compile_string(source_string, filename, position);
+#else
+    op_array = ngx_http_php_stat_orig_compile_string(source_string, filename);
+#endif
+
+    if (st) {
+        st->time[NGX_HTTP_PHP_STAT_COMPILE] += ngx_http_php_stat_now() - start;
+    }
+
+    return op_array;
+}
@@ -0,0 +1,96 @@
+/*
+==============================================================================
+Copyright (c) 2016-2020, rryqszq4 <rryqszq@gmail.com>
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+
+* Redistributions of source code must retain the above copyright notice, this
+  list of conditions and the following disclaimer.
+
+* Redistributions in binary form must reproduce the above copyright notice,
+  this list of conditions and the following disclaimer in the documentation
+  and/or other materials provided with the distribution.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+==============================================================================
+*/
+
+#ifndef __NGX_HTTP_PHP_STAT_H__
+#define __NGX_HTTP_PHP_STAT_H__
+
+#include "ngx_http_php_module.h"
+#include "ngx_http_php_run.h"
+
+#define NGX_HTTP_PHP_STAT_ZONE          "php_status"
+
+/* the histograms of a location, also the states of a request */
+#define NGX_HTTP_PHP_STAT_TOTAL         0
+#define NGX_HTTP_PHP_STAT_CPU           1
+#define NGX_HTTP_PHP_STAT_SUSPENDED     2
+#define NGX_HTTP_PHP_STAT_COMPILE       3
+#define NGX_HTTP_PHP_STAT_REWRITE       4
+#define NGX_HTTP_PHP_STAT_ACCESS        5
+#define NGX_HTTP_PHP_STAT_CONTENT       6
+#define NGX_HTTP_PHP_STAT_LOG           7
+#define NGX_HTTP_PHP_STAT_N             8
+
+/* a request not running php nor waiting in a coroutine */
+#define NGX_HTTP_PHP_STAT_IDLE          NGX_HTTP_PHP_STAT_TOTAL
+
+/* 
+ * Log-linear buckets of usecs: exact below 8, then 8 per power of two, 
+ * which keeps 3 significant bits (12.5%) up to 2^32 usecs (71 minutes).
+ */
+#define NGX_HTTP_PHP_STAT_SUB_BITS      3
+#define NGX_HTTP_PHP_STAT_MAX_BITS      32
+#define NGX_HTTP_PHP_STAT_BUCKETS                                             \
+    ((NGX_HTTP_PHP_STAT_MAX_BITS - NGX_HTTP_PHP_STAT_SUB_BITS + 1)            \
+     << NGX_HTTP_PHP_STAT_SUB_BITS)
+
+typedef struct {
+    ngx_atomic_t                count;
+    ngx_atomic_t                sum;
+    ngx_atomic_t                buckets[NGX_HTTP_PHP_STAT_BUCKETS];
+} ngx_http_php_stat_histogram_t;
+
+typedef struct {
+    ngx_atomic_t                    requests;
+    ngx_atomic_t                    errors;
+    ngx_http_php_stat_histogram_t   hist[NGX_HTTP_PHP_STAT_N];
+} ngx_http_php_stat_loc_t;
+
+/* one per slot, in the configuration */
+typedef struct {
+    ngx_str_t                   server;
+    ngx_str_t                   location;
+} ngx_http_php_stat_name_t;
+
+ngx_int_t ngx_http_php_stat_add_location(ngx_conf_t *cf, 
+    ngx_http_php_loc_conf_t *prev, ngx_http_php_loc_conf_t *conf);
+ngx_int_t ngx_http_php_stat_add_zone(ngx_conf_t *cf, 
+    ngx_http_php_main_conf_t *pmcf);
+ngx_int_t ngx_http_php_stat_add_variables(ngx_conf_t *cf);
+ngx_uint_t ngx_http_php_stat_variables_used(ngx_conf_t *cf);
+ngx_uint_t ngx_http_php_stat_variable_used(ngx_conf_t *cf, ngx_str_t *name);
+void ngx_http_php_stat_init_worker(ngx_cycle_t *cycle);
+
+void ngx_http_php_stat_enter(ngx_http_php_run_t *run, ngx_uint_t phase);
+void ngx_http_php_stat_leave(ngx_http_php_run_t *run);
+void ngx_http_php_stat_done(ngx_http_php_stat_req_t *st);
+void ngx_http_php_stat_socket_bytes(ngx_http_request_t *r, off_t bytes);
+
+ngx_int_t ngx_http_php_stat_log_handler(ngx_http_request_t *r);
+ngx_int_t ngx_http_php_stat_handler(ngx_http_request_t *r);
+
+#endif
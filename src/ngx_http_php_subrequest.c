@@ -0,0 +1,418 @@
+/*
+==============================================================================
+Copyright (c) 2016-2020, rryqszq4 <rryqszq@gmail.com>
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+
+* Redistributions of source code must retain the above copyright notice, this
+  list of conditions and the following disclaimer.
+
+* Redistributions in binary form must reproduce the above copyright notice,
+  this list of conditions and the following disclaimer in the documentation
+  and/or other materials provided with the distribution.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+==============================================================================
+*/
+
+#include "ngx_http_php_module.h"
+#include "ngx_http_php_sleep.h"
+#include "ngx_http_php_subrequest.h"
+#include "ngx_http_php_zend_uthread.h"
+
+typedef struct {
+    ngx_str_t   name;
+    ngx_uint_t  method;
+} ngx_http_php_subrequest_method_t;
+
+static ngx_int_t ngx_http_php_subrequest_post_handler(ngx_http_request_t *r, 
+    void *data, ngx_int_t rc);
+static void ngx_http_php_subrequest_wev_handler(ngx_http_request_t *r);
+static ngx_int_t ngx_http_php_subrequest_set_body(ngx_http_request_t *r, 
+    ngx_http_request_t *sr, ngx_http_php_capture_node_t *node);
+static void ngx_http_php_subrequest_result(ngx_http_request_t *r, 
+    ngx_http_php_ctx_t *ctx);
+static void ngx_http_php_subrequest_node_result(ngx_http_php_capture_node_t *node, 
+    zval *result);
+static void ngx_http_php_subrequest_header(zval *headers, u_char *name, 
+    size_t name_len, u_char *value, size_t value_len);
+
+static ngx_http_php_subrequest_method_t ngx_http_php_subrequest_methods[] = {
+    { ngx_string("GET"),        NGX_HTTP_GET },
+    { ngx_string("HEAD"),       NGX_HTTP_HEAD },
+    { ngx_string("POST"),       NGX_HTTP_POST },
+    { ngx_string("PUT"),        NGX_HTTP_PUT },
+    { ngx_string("DELETE"),     NGX_HTTP_DELETE },
+    { ngx_string("OPTIONS"),    NGX_HTTP_OPTIONS },
+    { ngx_string("PATCH"),      NGX_HTTP_PATCH },
+    { ngx_null_string, 0 }
+};
+
+ngx_int_t 
+ngx_http_php_subrequest_method(ngx_str_t *name, ngx_uint_t *method)
+{
+    ngx_http_php_subrequest_method_t    *m;
+
+    for (m = ngx_http_php_subrequest_methods; m->name.len; m++) {
+        if (m->name.len == name->len 
+            && ngx_strncasecmp(m->name.data, name->data, name->len) == 0) 
+        {
+            *method = m->method;
+            ngx_memcpy(name->data, m->name.data, name->len);
+            return NGX_OK;
+        }
+    }
+
+    return NGX_ERROR;
+}
+
+ngx_int_t 
+ngx_http_php_subrequest_post(ngx_http_request_t *r)
+{
+    ngx_uint_t                      i;
+    ngx_int_t                       rc;
+    ngx_http_request_t              *sr;
+    ngx_http_php_ctx_t              *ctx;
+    ngx_http_post_subrequest_t      *psr;
+    ngx_http_php_capture_node_t     *node;
+
+    ctx = ngx_http_get_module_ctx(r, ngx_http_php_module);
+
+    if (ctx == NULL || ctx->capture_multi == NULL) {
+        return NGX_ERROR;
+    }
+
+    ctx->capture_multi_complete_total = 0;
+    ctx->is_capture_multi_complete = 0;
+
+    node = ctx->capture_multi->elts;
+
+    for (i = 0; i < ctx->capture_multi->nelts; i++) {
+
+        node[i].request = NULL;
+        node[i].capture_buf = NULL;
+        ngx_str_null(&node[i].capture_str);
+
+        psr = ngx_palloc(r->pool, sizeof(ngx_http_post_subrequest_t));
+        if (psr == NULL) {
+            goto failed;
+        }
+
+        psr->handler = ngx_http_php_subrequest_post_handler;
+        psr->data = &node[i];
+
+        /* all subrequests run at once, their bodies are kept in memory */
+
+        rc = ngx_http_subrequest(r, &node[i].capture_uri, 
+                                 node[i].capture_args.len ? &node[i].capture_args : NULL,
+                                 &sr, psr, 
+                                 NGX_HTTP_SUBREQUEST_IN_MEMORY|NGX_HTTP_SUBREQUEST_WAITED);
+
+        if (rc != NGX_OK) {
+            goto failed;
+        }
+
+        sr->method = node[i].method;
+        sr->method_name = node[i].method_name;
+
+        if (ngx_http_php_subrequest_set_body(r, sr, &node[i]) != NGX_OK) {
+            goto failed;
+        }
+
+        node[i].request = sr;
+        node[i].status = 0;
+
+        continue;
+
+failed:
+
+        /* counted as complete, reported with status 500 */
+
+        ngx_log_error(NGX_LOG_ERR, r->connection->log, 0, 
+                      "ngx_php capture of \"%V\" failed", &node[i].capture_uri);
+
+        node[i].status = NGX_HTTP_INTERNAL_SERVER_ERROR;
+        ctx->capture_multi_complete_total++;
+    }
+
+    if (ctx->capture_multi_complete_total == ctx->capture_multi->nelts) {
+
+        /* no subrequest was started, resume on the next loop */
+
+        ctx->is_capture_multi_complete = 1;
+        ngx_http_php_subrequest_result(r, ctx);
+
+        ctx->delay_time = 0;
+        ngx_http_php_sleep(r);
+    }
+
+    return NGX_OK;
+}
+
+static ngx_int_t 
+ngx_http_php_subrequest_set_body(ngx_http_request_t *r, ngx_http_request_t *sr, 
+    ngx_http_php_capture_node_t *node)
+{
+    ngx_buf_t                   *b;
+    ngx_chain_t                 *cl;
+    ngx_http_request_body_t     *rb;
+
+    if (node->body == NULL) {
+
+        /* the parent's body is only passed on to methods expecting one */
+
+        if (node->method & (NGX_HTTP_POST|NGX_HTTP_PUT|NGX_HTTP_PATCH)) {
+            return NGX_OK;
+        }
+
+        sr->request_body = NULL;
+        sr->headers_in.content_length = NULL;
+        sr->headers_in.content_length_n = -1;
+        sr->headers_in.transfer_encoding = NULL;
+        sr->headers_in.chunked = 0;
+
+        return NGX_OK;
+    }
+
+    rb = ngx_pcalloc(r->pool, sizeof(ngx_http_request_body_t));
+    if (rb == NULL) {
+        return NGX_ERROR;
+    }
+
+    if (node->body->len) {
+        b = ngx_calloc_buf(r->pool);
+        if (b == NULL) {
+            return NGX_ERROR;
+        }
+
+        b->pos = node->body->data;
+        b->last = node->body->data + node->body->len;
+        b->start = b->pos;
+        b->end = b->last;
+        b->memory = 1;
+        b->last_buf = 1;
+
+        cl = ngx_alloc_chain_link(r->pool);
+        if (cl == NULL) {
+            return NGX_ERROR;
+        }
+
+        cl->buf = b;
+        cl->next = NULL;
+
+        rb->bufs = cl;
+        rb->buf = b;
+    }
+
+    sr->request_body = rb;
+    sr->headers_in.content_length = NULL;
+    sr->headers_in.content_length_n = node->body->len;
+    sr->headers_in.transfer_encoding = NULL;
+    sr->headers_in.chunked = 0;
+
+    return NGX_OK;
+}
+
+static ngx_int_t 
+ngx_http_php_subrequest_post_handler(ngx_http_request_t *r, void *data, ngx_int_t rc)
+{
+    ngx_http_request_t              *pr;
+    ngx_http_php_ctx_t              *ctx;
+    ngx_http_php_capture_node_t     *node = data;
+
+    pr = r->parent;
+
+    ctx = ngx_http_get_module_ctx(pr, ngx_http_php_module);
+
+    if (ctx == NULL || ctx->capture_multi == NULL || node->request != r) {
+        return rc;
+    }
+
+    if (rc == NGX_ERROR) {
+        node->status = NGX_HTTP_INTERNAL_SERVER_ERROR;
+
+    } else if (rc >= NGX_HTTP_SPECIAL_RESPONSE) {
+        node->status = rc;
+
+    } else {
+        node->status = r->headers_out.status ? (ngx_int_t) r->headers_out.status 
+                                             : NGX_HTTP_OK;
+    }
+
+    /* 
+     * since 1.13.10 the body of any in-memory subrequest is in r->out,
+     * before that only upstream modules kept it, in u->buffer
+     */
+
+    if (r->out && r->out->buf) {
+        node->capture_buf = r->out->buf;
+
+    } else if (r->upstream) {
+        node->capture_buf = &r->upstream->buffer;
+    }
+
+    if (node->capture_buf) {
+        node->capture_str.data = node->capture_buf->pos;
+        node->capture_str.len = node->capture_buf->last - node->capture_buf->pos;
+    }
+
+    ngx_php_debug("capture \"%V\" done, status: %d", &node->capture_uri, (int) node->status);
+
+    ctx->capture_multi_complete_total++;
+
+    if (ctx->capture_multi_complete_total == ctx->capture_multi->nelts) {
+        ctx->is_capture_multi_complete = 1;
+    }
+
+    /* the parent is posted right after, resume it from there */
+
+    pr->write_event_handler = ngx_http_php_subrequest_wev_handler;
+
+    return rc;
+}
+
+static void 
+ngx_http_php_subrequest_wev_handler(ngx_http_request_t *r)
+{
+    ngx_http_php_ctx_t      *ctx;
+
+    ctx = ngx_http_get_module_ctx(r, ngx_http_php_module);
+
+    if (ctx == NULL || !ctx->is_capture_multi_complete) {
+        return ;
+    }
+
+    r->write_event_handler = ngx_http_core_run_phases;
+
+    ngx_http_php_subrequest_result(r, ctx);
+
+    ctx->capture_multi = NULL;
+    ctx->is_capture_multi_complete = 0;
+
+    ngx_http_php_zend_uthread_resume(r);
+}
+
+static void 
+ngx_http_php_subrequest_result(ngx_http_request_t *r, ngx_http_php_ctx_t *ctx)
+{
+    ngx_uint_t                      i;
+    zval                            result;
+    ngx_http_php_capture_node_t     *node;
+
+    node = ctx->capture_multi->elts;
+
+    zval_ptr_dtor(&ctx->yield_retval);
+
+    if (!ctx->is_capture_multi) {
+        ngx_http_php_subrequest_node_result(&node[0], &ctx->yield_retval);
+        return ;
+    }
+
+    array_init_size(&ctx->yield_retval, ctx->capture_multi->nelts);
+
+    for (i = 0; i < ctx->capture_multi->nelts; i++) {
+        ngx_http_php_subrequest_node_result(&node[i], &result);
+        add_next_index_zval(&ctx->yield_retval, &result);
+    }
+}
+
+static void 
+ngx_http_php_subrequest_node_result(ngx_http_php_capture_node_t *node, zval *result)
+{
+    ngx_uint_t          i;
+    ngx_list_part_t     *part;
+    ngx_table_elt_t     *h;
+    ngx_http_request_t  *sr;
+    zval                headers;
+
+    array_init_size(result, 3);
+
+    add_assoc_long(result, "status", (zend_long) node->status);
+
+    array_init(&headers);
+
+    sr = node->request;
+
+    if (sr) {
+        if (sr->headers_out.content_type.len) {
+            ngx_http_php_subrequest_header(&headers, (u_char *) "content-type", 
+                                           sizeof("content-type") - 1,
+                                           sr->headers_out.content_type.data, 
+                                           sr->headers_out.content_type.len);
+        }
+
+        part = &sr->headers_out.headers.part;
+        h = part->elts;
+
+        for (i = 0; /* void */; i++) {
+
+            if (i >= part->nelts) {
+                if (part->next == NULL) {
+                    break;
+                }
+
+                part = part->next;
+                h = part->elts;
+                i = 0;
+            }
+
+            if (h[i].hash == 0) {
+                continue;
+            }
+
+            ngx_http_php_subrequest_header(&headers, h[i].key.data, h[i].key.len, 
+                                           h[i].value.data, h[i].value.len);
+        }
+    }
+
+    add_assoc_zval(result, "headers", &headers);
+
+    if (node->capture_str.len) {
+        add_assoc_stringl(result, "body", (char *) node->capture_str.data, 
+                          node->capture_str.len);
+
+    } else {
+        add_assoc_stringl(result, "body", "", 0);
+    }
+}
+
+static void 
+ngx_http_php_subrequest_header(zval *headers, u_char *name, size_t name_len, 
+    u_char *value, size_t value_len)
+{
+    zend_string     *key;
+    zval            val, *old, list;
+
+    key = zend_string_init((char *) name, name_len, 0);
+    zend_str_tolower(ZSTR_VAL(key), ZSTR_LEN(key));
+
+    ZVAL_STRINGL(&val, (char *) value, value_len);
+
+    old = zend_hash_find(Z_ARRVAL_P(headers), key);
+
+    if (old == NULL) {
+        zend_hash_add_new(Z_ARRVAL_P(headers), key, &val);
+
+    } else if (Z_TYPE_P(old) == IS_ARRAY) {
+        add_next_index_zval(old, &val);
+
+    } else {
+        array_init_size(&list, 2);
+        add_next_index_zval(&list, old);
+        add_next_index_zval(&list, &val);
+        ZVAL_COPY_VALUE(old, &list);
+    }
+
+    zend_string_release(key);
+}
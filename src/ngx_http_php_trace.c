@@ -0,0 +1,1225 @@
+/*
+==============================================================================
+Copyright (c) 2016-2020, rryqszq4 <rryqszq@gmail.com>
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+
+* Redistributions of source code must retain the above copyright notice, this
+  list of conditions and the following disclaimer.
+
+* Redistributions in binary form must reproduce the above copyright notice,
+  this list of conditions and the following disclaimer in the documentation
+  and/or other materials provided with the distribution.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+==============================================================================
+*/
+
+#include "ngx_http_php_module.h"
+#include "ngx_http_php_run.h"
+#include "ngx_http_php_trace.h"
+
+#include <zend_vm_opcodes.h>
+
+typedef struct ngx_http_php_trace_func_s ngx_http_php_trace_func_t;
+typedef struct ngx_http_php_trace_node_s ngx_http_php_trace_node_t;
+typedef struct ngx_http_php_trace_edge_s ngx_http_php_trace_edge_t;
+
+struct ngx_http_php_trace_func_s {
+    ngx_http_php_trace_func_t   *next;
+    uint32_t                    hash;
+
+    /* from 1, the pprof function and location id */
+    ngx_uint_t                  id;
+
+    ngx_str_t                   scope;
+    ngx_str_t                   function;
+    ngx_str_t                   file;
+    ngx_uint_t                  line;
+    ngx_uint_t                  opcodes;
+
+    /* summed up over the call tree */
+    ngx_uint_t                  calls;
+    ngx_uint_t                  ops;
+    uint64_t                    incl;
+    uint64_t                    excl;
+};
+
+/* a call path: the same function is a node per caller */
+struct ngx_http_php_trace_node_s {
+    ngx_http_php_trace_node_t   *parent;
+    ngx_http_php_trace_node_t   *child;
+    ngx_http_php_trace_node_t   *next;
+    ngx_http_php_trace_func_t   *func;
+
+    ngx_uint_t                  calls;
+    ngx_uint_t                  ops;
+    uint64_t                    incl;
+    uint64_t                    excl;
+};
+
+struct ngx_http_php_trace_edge_s {
+    ngx_http_php_trace_edge_t   *next;
+    ngx_http_php_trace_func_t   *caller;
+    ngx_http_php_trace_func_t   *callee;
+
+    ngx_uint_t                  calls;
+    uint64_t                    incl;
+};
+
+typedef struct {
+    ngx_http_php_trace_node_t   *node;
+    uint64_t                    start;
+    uint64_t                    children;
+} ngx_http_php_trace_frame_t;
+
+struct ngx_http_php_trace_s {
+    ngx_http_request_t          *request;
+
+    ngx_http_php_trace_func_t   *buckets[NGX_HTTP_PHP_TRACE_BUCKETS];
+    ngx_array_t                 funcs;
+
+    ngx_http_php_trace_node_t   root;
+
+    ngx_http_php_trace_frame_t  frames[NGX_HTTP_PHP_TRACE_DEPTH];
+    ngx_uint_t                  depth;
+
+    /* executed opcodes */
+    ngx_uint_t                  ops[256];
+
+    time_t                      started;
+    uint64_t                    run;
+    uint64_t                    time;
+};
+
+typedef struct {
+    u_char                      *start;
+    u_char                      *pos;
+    u_char                      *end;
+    ngx_pool_t                  *pool;
+} ngx_http_php_trace_buf_t;
+
+static ngx_http_php_trace_t *ngx_http_php_trace_create(ngx_http_request_t *r);
+static void ngx_http_php_trace_push(ngx_http_php_trace_t *tr, 
+    zend_execute_data *execute_data);
+static void ngx_http_php_trace_pop(ngx_http_php_trace_t *tr, ngx_uint_t depth);
+static ngx_http_php_trace_func_t *ngx_http_php_trace_func(
+    ngx_http_php_trace_t *tr, zend_function *fn);
+static ngx_int_t ngx_http_php_trace_str(ngx_pool_t *pool, ngx_str_t *dst, 
+    zend_string *src);
+static ngx_http_php_trace_node_t *ngx_http_php_trace_next(
+    ngx_http_php_trace_t *tr, ngx_http_php_trace_node_t *node);
+static ngx_array_t *ngx_http_php_trace_aggregate(ngx_http_php_trace_t *tr);
+static void ngx_http_php_trace_write(ngx_http_php_trace_t *tr);
+static ngx_int_t ngx_http_php_trace_json(ngx_http_php_trace_t *tr, 
+    ngx_array_t *edges, ngx_http_php_trace_buf_t *b);
+static ngx_int_t ngx_http_php_trace_pprof(ngx_http_php_trace_t *tr, 
+    ngx_http_php_trace_buf_t *b);
+static u_char *ngx_http_php_trace_reserve(ngx_http_php_trace_buf_t *b, 
+    size_t size);
+static ngx_int_t ngx_http_php_trace_name(ngx_http_php_trace_buf_t *b, 
+    ngx_http_php_trace_func_t *f);
+static ngx_int_t ngx_http_php_trace_escape(ngx_http_php_trace_buf_t *b, 
+    u_char *data, size_t len);
+static u_char *ngx_http_php_trace_seconds(u_char *p, uint64_t usec);
+static u_char *ngx_http_php_trace_varint(u_char *p, uint64_t v);
+static u_char *ngx_http_php_trace_pb_int(u_char *p, ngx_uint_t field, 
+    uint64_t v);
+static u_char *ngx_http_php_trace_pb_bytes(u_char *p, ngx_uint_t field, 
+    u_char *data, size_t len);
+static ngx_int_t ngx_http_php_trace_pb_message(ngx_http_php_trace_buf_t *b, 
+    ngx_uint_t field, u_char *data, size_t len);
+static uint64_t ngx_http_php_trace_now(void);
+
+static void ngx_http_php_trace_execute_ex(zend_execute_data *execute_data);
+static void ngx_http_php_trace_execute_internal(zend_execute_data *execute_data, 
+    zval *return_value);
+static int ngx_http_php_trace_opcode(zend_execute_data *execute_data);
+
+/* the request running php code */
+static ngx_http_php_trace_t *ngx_http_php_trace_running;
+
+static ngx_uint_t ngx_http_php_trace_sequence;
+
+static void (*ngx_http_php_trace_orig_execute_ex)(zend_execute_data *execute_data);
+static void (*ngx_http_php_trace_orig_execute_internal)(
+    zend_execute_data *execute_data, zval *return_value);
+
+/* 
+ * The hooks take the php calls out of the vm fast path and the opcode 
+ * handlers out of the jit, for every request of the worker, so they are 
+ * only set when a location has php_trace.
+ */
+void
+ngx_http_php_trace_init_worker(ngx_cycle_t *cycle)
+{
+    ngx_http_php_main_conf_t    *pmcf;
+
+    pmcf = ngx_http_cycle_get_module_main_conf(cycle, ngx_http_php_module);
+
+    if (pmcf == NULL || !pmcf->enabled_trace) {
+        return;
+    }
+
+    if (ngx_process != NGX_PROCESS_WORKER && ngx_process != NGX_PROCESS_SINGLE) {
+        return;
+    }
+
+    ngx_http_php_trace_hook();
+}
+
+/* 
+ * The opcodes get their handlers when they are compiled, so with 
+ * php_preload the hooks are set in the master before the code is, and 
+ * the workers inherit them.
+ */
+void
+ngx_http_php_trace_hook(void)
+{
+    ngx_uint_t  i;
+
+    if (zend_execute_ex == ngx_http_php_trace_execute_ex) {
+        return;
+    }
+
+    ngx_http_php_trace_orig_execute_ex = zend_execute_ex;
+    zend_execute_ex = ngx_http_php_trace_execute_ex;
+
+    ngx_http_php_trace_orig_execute_internal = zend_execute_internal;
+    zend_execute_internal = ngx_http_php_trace_execute_internal;
+
+    /* as xdebug, leave the opcodes other extensions took alone */
+
+    for (i = 0; i <= ZEND_VM_LAST_OPCODE && i < 256; i++) {
+
+        if (i == ZEND_HANDLE_EXCEPTION || zend_get_user_opcode_handler(i)) {
+            continue;
+        }
+
+        zend_set_user_opcode_handler(i, ngx_http_php_trace_opcode);
+    }
+}
+
+/* A run of php code: a phase starts or a coroutine is resumed. */
+void
+ngx_http_php_trace_enter(ngx_http_php_run_t *run)
+{
+    ngx_http_php_loc_conf_t     *plcf;
+    ngx_http_php_trace_t        *tr;
+    uint64_t                    now;
+
+    plcf = ngx_http_get_module_loc_conf(run->request, ngx_http_php_module);
+
+    if (plcf->trace_path.len == 0) {
+        return;
+    }
+
+    tr = run->trace;
+
+    if (tr == NULL) {
+        tr = ngx_http_php_trace_create(run->request);
+        if (tr == NULL) {
+            return;
+        }
+
+        run->trace = tr;
+    }
+
+    now = ngx_http_php_trace_now();
+
+    /* a resume running the next phase straight away */
+    if (ngx_http_php_trace_running == tr) {
+        tr->time += now - tr->run;
+    }
+
+    /* a bailout skipped the returns */
+    ngx_http_php_trace_pop(tr, 0);
+
+    tr->run = now;
+
+    ngx_http_php_trace_running = tr;
+}
+
+void
+ngx_http_php_trace_leave(ngx_http_php_run_t *run)
+{
+    ngx_http_php_trace_t        *tr;
+
+    tr = run->trace;
+    if (tr == NULL || ngx_http_php_trace_running != tr) {
+        return;
+    }
+
+    ngx_http_php_trace_pop(tr, 0);
+
+    tr->time += ngx_http_php_trace_now() - tr->run;
+
+    ngx_http_php_trace_running = NULL;
+}
+
+static ngx_http_php_trace_t *
+ngx_http_php_trace_create(ngx_http_request_t *r)
+{
+    ngx_http_php_trace_t        *tr;
+
+    tr = ngx_pcalloc(r->pool, sizeof(ngx_http_php_trace_t));
+    if (tr == NULL) {
+        return NULL;
+    }
+
+    if (ngx_array_init(&tr->funcs, r->pool, 32, 
+                       sizeof(ngx_http_php_trace_func_t *)) 
+        != NGX_OK) 
+    {
+        return NULL;
+    }
+
+    tr->request = r;
+    tr->started = ngx_time();
+
+    return tr;
+}
+
+/* the trace of a request is written when its pool goes */
+void
+ngx_http_php_trace_done(ngx_http_php_trace_t *tr)
+{
+
+    if (ngx_http_php_trace_running == tr) {
+        ngx_http_php_trace_running = NULL;
+    }
+
+    if (tr->root.child == NULL) {
+        return;
+    }
+
+    ngx_http_php_trace_write(tr);
+}
+
+static void
+ngx_http_php_trace_push(ngx_http_php_trace_t *tr, 
+    zend_execute_data *execute_data)
+{
+    ngx_http_php_trace_node_t   *parent, *node;
+    ngx_http_php_trace_func_t   *f;
+    ngx_http_php_trace_frame_t  *frame;
+
+    if (tr->depth >= NGX_HTTP_PHP_TRACE_DEPTH) {
+        tr->depth++;
+        return;
+    }
+
+    frame = &tr->frames[tr->depth++];
+    frame->node = NULL;
+
+    if (execute_data->func == NULL) {
+        return;
+    }
+
+    f = ngx_http_php_trace_func(tr, execute_data->func);
+    if (f == NULL) {
+        return;
+    }
+
+    parent = (tr->depth > 1) ? tr->frames[tr->depth - 2].node : &tr->root;
+
+    if (parent == NULL) {
+        parent = &tr->root;
+    }
+
+    for (node = parent->child; node; node = node->next) {
+        if (node->func == f) {
+            break;
+        }
+    }
+
+    if (node == NULL) {
+        node = ngx_pcalloc(tr->request->pool, sizeof(ngx_http_php_trace_node_t));
+        if (node == NULL) {
+            return;
+        }
+
+        node->func = f;
+        node->parent = parent;
+        node->next = parent->child;
+        parent->child = node;
+    }
+
+    node->calls++;
+
+    frame->node = node;
+    frame->start = ngx_http_php_trace_now();
+    frame->children = 0;
+}
+
+static void
+ngx_http_php_trace_pop(ngx_http_php_trace_t *tr, ngx_uint_t depth)
+{
+    ngx_http_php_trace_frame_t  *frame;
+    uint64_t                    now, incl;
+
+    if (tr->depth <= depth) {
+        return;
+    }
+
+    now = ngx_http_php_trace_now();
+
+    while (tr->depth > depth) {
+        tr->depth--;
+
+        /* past the depth, or a push that failed */
+        if (tr->depth >= NGX_HTTP_PHP_TRACE_DEPTH 
+            || tr->frames[tr->depth].node == NULL) 
+        {
+            continue;
+        }
+
+        frame = &tr->frames[tr->depth];
+
+        incl = now - frame->start;
+
+        frame->node->incl += incl;
+        frame->node->excl += incl - ngx_min(incl, frame->children);
+        frame->node = NULL;
+
+        if (tr->depth > 0 && tr->depth <= NGX_HTTP_PHP_TRACE_DEPTH) {
+            tr->frames[tr->depth - 1].children += incl;
+        }
+    }
+}
+
+/* functions are told apart by class, name and file, closures included */
+static ngx_http_php_trace_func_t *
+ngx_http_php_trace_func(ngx_http_php_trace_t *tr, zend_function *fn)
+{
+    zend_string                 *scope, *function, *file;
+    ngx_http_php_trace_func_t   *f, **fp;
+    ngx_pool_t                  *pool;
+    uint32_t                    hash;
+    ngx_uint_t                  line;
+
+    function = fn->common.function_name;
+    scope = fn->common.scope ? fn->common.scope->name : NULL;
+    file = NULL;
+    line = 0;
+
+    if (ZEND_USER_CODE(fn->type)) {
+        file = fn->op_array.filename;
+        line = fn->op_array.line_start;
+    }
+
+    hash = function ? ZSTR_HASH(function) : 0;
+    hash = hash * 31 + (scope ? ZSTR_HASH(scope) : 0);
+    hash = hash * 31 + (file ? ZSTR_HASH(file) : 0);
+    hash = hash * 31 + line;
+
+    for (f = tr->buckets[hash % NGX_HTTP_PHP_TRACE_BUCKETS]; f; f = f->next) {
+
+        if (f->hash == hash && f->line == line
+            && f->function.len == (function ? ZSTR_LEN(function) : 0)
+            && f->scope.len == (scope ? ZSTR_LEN(scope) : 0)
+            && f->file.len == (file ? ZSTR_LEN(file) : 0)
+            && (function == NULL 
+                || ngx_memcmp(f->function.data, ZSTR_VAL(function), f->function.len) == 0)
+            && (scope == NULL 
+                || ngx_memcmp(f->scope.data, ZSTR_VAL(scope), f->scope.len) == 0)
+            && (file == NULL 
+                || ngx_memcmp(f->file.data, ZSTR_VAL(file), f->file.len) == 0))
+        {
+            return f;
+        }
+    }
+
+    pool = tr->request->pool;
+
+    f = ngx_pcalloc(pool, sizeof(ngx_http_php_trace_func_t));
+    if (f == NULL) {
+        return NULL;
+    }
+
+    if (ngx_http_php_trace_str(pool, &f->function, function) != NGX_OK
+        || ngx_http_php_trace_str(pool, &f->scope, scope) != NGX_OK
+        || ngx_http_php_trace_str(pool, &f->file, file) != NGX_OK)
+    {
+        return NULL;
+    }
+
+    fp = ngx_array_push(&tr->funcs);
+    if (fp == NULL) {
+        return NULL;
+    }
+
+    *fp = f;
+
+    f->hash = hash;
+    f->id = tr->funcs.nelts;
+    f->line = line;
+    f->opcodes = ZEND_USER_CODE(fn->type) ? fn->op_array.last : 0;
+
+    f->next = tr->buckets[hash % NGX_HTTP_PHP_TRACE_BUCKETS];
+    tr->buckets[hash % NGX_HTTP_PHP_TRACE_BUCKETS] = f;
+
+    return f;
+}
+
+/* zend strings may go before the trace is written */
+static ngx_int_t
+ngx_http_php_trace_str(ngx_pool_t *pool, ngx_str_t *dst, zend_string *src)
+{
+    if (src == NULL || ZSTR_LEN(src) == 0) {
+        ngx_str_null(dst);
+        return NGX_OK;
+    }
+
+    dst->len = ZSTR_LEN(src);
+    dst->data = ngx_pnalloc(pool, dst->len);
+    if (dst->data == NULL) {
+        return NGX_ERROR;
+    }
+
+    ngx_memcpy(dst->data, ZSTR_VAL(src), dst->len);
+
+    return NGX_OK;
+}
+
+/* depth first over the call tree, without the root */
+static ngx_http_php_trace_node_t *
+ngx_http_php_trace_next(ngx_http_php_trace_t *tr, ngx_http_php_trace_node_t *node)
+{
+    if (node->child) {
+        return node->child;
+    }
+
+    while (node != &tr->root) {
+
+        if (node->next) {
+            return node->next;
+        }
+
+        node = node->parent;
+    }
+
+    return NULL;
+}
+
+/* 
+ * The totals of each function and the caller to callee edges. The 
+ * inclusive time of a recursive call is already in its outer call.
+ */
+static ngx_array_t *
+ngx_http_php_trace_aggregate(ngx_http_php_trace_t *tr)
+{
+    ngx_http_php_trace_node_t   *node, *p;
+    ngx_http_php_trace_func_t   *f;
+    ngx_http_php_trace_edge_t   **buckets, *e, **ep;
+    ngx_array_t                 *edges;
+    ngx_pool_t                  *pool;
+    ngx_uint_t                  key;
+
+    pool = tr->request->pool;
+
+    edges = ngx_array_create(pool, 32, sizeof(ngx_http_php_trace_edge_t *));
+    if (edges == NULL) {
+        return NULL;
+    }
+
+    buckets = ngx_pcalloc(pool, NGX_HTTP_PHP_TRACE_BUCKETS 
+                                * sizeof(ngx_http_php_trace_edge_t *));
+    if (buckets == NULL) {
+        return NULL;
+    }
+
+    for (node = tr->root.child; node; node = ngx_http_php_trace_next(tr, node)) {
+        f = node->func;
+
+        f->calls += node->calls;
+        f->ops += node->ops;
+        f->excl += node->excl;
+
+        for (p = node->parent; p != &tr->root; p = p->parent) {
+            if (p->func == f) {
+                break;
+            }
+        }
+
+        if (p == &tr->root) {
+            f->incl += node->incl;
+        }
+
+        if (node->parent == &tr->root) {
+            continue;
+        }
+
+        key = (node->parent->func->id * 31 + f->id) % NGX_HTTP_PHP_TRACE_BUCKETS;
+
+        for (e = buckets[key]; e; e = e->next) {
+            if (e->caller == node->parent->func && e->callee == f) {
+                break;
+            }
+        }
+
+        if (e == NULL) {
+            e = ngx_pcalloc(pool, sizeof(ngx_http_php_trace_edge_t));
+            if (e == NULL) {
+                return NULL;
+            }
+
+            ep = ngx_array_push(edges);
+            if (ep == NULL) {
+                return NULL;
+            }
+
+            *ep = e;
+
+            e->caller = node->parent->func;
+            e->callee = f;
+            e->next = buckets[key];
+            buckets[key] = e;
+        }
+
+        e->calls += node->calls;
+        e->incl += node->incl;
+    }
+
+    return edges;
+}
+
+static void
+ngx_http_php_trace_write(ngx_http_php_trace_t *tr)
+{
+    ngx_http_request_t          *r;
+    ngx_http_php_loc_conf_t     *plcf;
+    ngx_http_php_trace_buf_t    b;
+    ngx_array_t                 *edges;
+    ngx_fd_t                    fd;
+    ngx_int_t                   rc;
+    u_char                      *name;
+    char                        *ext;
+
+    r = tr->request;
+
+    plcf = ngx_http_get_module_loc_conf(r, ngx_http_php_module);
+
+    ngx_memzero(&b, sizeof(ngx_http_php_trace_buf_t));
+    b.pool = r->pool;
+
+    edges = ngx_http_php_trace_aggregate(tr);
+    if (edges == NULL) {
+        return;
+    }
+
+    if (plcf->trace_format == NGX_HTTP_PHP_TRACE_PPROF) {
+        rc = ngx_http_php_trace_pprof(tr, &b);
+        ext = "pb";
+
+    } else {
+        rc = ngx_http_php_trace_json(tr, edges, &b);
+        ext = "json";
+    }
+
+    if (rc != NGX_OK) {
+        ngx_log_error(NGX_LOG_ERR, ngx_cycle->log, 0, 
+                      "php trace of \"%V\" not written", &r->uri);
+        return;
+    }
+
+    name = ngx_pnalloc(r->pool, plcf->trace_path.len 
+                                + sizeof("/php-trace--.json") + 2 * NGX_INT64_LEN);
+    if (name == NULL) {
+        return;
+    }
+
+    ngx_sprintf(name, "%V/php-trace-%P-%ui.%s%Z", &plcf->trace_path, ngx_pid, 
+                ngx_http_php_trace_sequence++, ext);
+
+    fd = ngx_open_file(name, NGX_FILE_WRONLY, NGX_FILE_TRUNCATE, 
+                       NGX_FILE_DEFAULT_ACCESS);
+    if (fd == NGX_INVALID_FILE) {
+        ngx_log_error(NGX_LOG_ERR, ngx_cycle->log, ngx_errno, 
+                      ngx_open_file_n " \"%s\" failed", name);
+        return;
+    }
+
+    if (ngx_write_fd(fd, b.start, b.pos - b.start) == -1) {
+        ngx_log_error(NGX_LOG_ERR, ngx_cycle->log, ngx_errno, 
+                      ngx_write_fd_n " \"%s\" failed", name);
+    }
+
+    if (ngx_close_file(fd) == NGX_FILE_ERROR) {
+        ngx_log_error(NGX_LOG_ALERT, ngx_cycle->log, ngx_errno, 
+                      ngx_close_file_n " \"%s\" failed", name);
+    }
+}
+
+/* 
+ * {"uri":"/t","time":0.001200,
+ * "functions":[
+ * {"name":"foo","file":"ngx_php eval code","line":2,"opcodes":6,"calls":3,
+ *  "ops":18,"incl":0.000041,"excl":0.000041}],
+ * "edges":[
+ * {"caller":"ngx_content_1","callee":"foo","calls":3,"incl":0.000041}],
+ * "ops":{"ZEND_RETURN":3}}
+ */
+static ngx_int_t
+ngx_http_php_trace_json(ngx_http_php_trace_t *tr, ngx_array_t *edges, 
+    ngx_http_php_trace_buf_t *b)
+{
+    ngx_http_php_trace_func_t   **funcs, *f;
+    ngx_http_php_trace_edge_t   **ep, *e;
+    ngx_http_request_t          *r;
+    ngx_uint_t                  i, n;
+    const char                  *op;
+    u_char                      *p;
+
+    r = tr->request;
+
+    p = ngx_http_php_trace_reserve(b, sizeof("{\"method\":\"\",\"uri\":\"") - 1 
+                                      + r->method_name.len);
+    if (p == NULL) {
+        return NGX_ERROR;
+    }
+
+    b->pos = ngx_sprintf(p, "{\"method\":\"%V\",\"uri\":\"", &r->method_name);
+
+    if (ngx_http_php_trace_escape(b, r->uri.data, r->uri.len) != NGX_OK) {
+        return NGX_ERROR;
+    }
+
+    p = ngx_http_php_trace_reserve(b, 64);
+    if (p == NULL) {
+        return NGX_ERROR;
+    }
+
+    p = ngx_sprintf(p, "\",\"time\":");
+    p = ngx_http_php_trace_seconds(p, tr->time);
+    b->pos = ngx_sprintf(p, ",\n\"functions\":[");
+
+    funcs = tr->funcs.elts;
+
+    for (i = 0; i < tr->funcs.nelts; i++) {
+        f = funcs[i];
+
+        p = ngx_http_php_trace_reserve(b, sizeof(",\n{\"name\":\"") - 1);
+        if (p == NULL) {
+            return NGX_ERROR;
+        }
+
+        b->pos = ngx_sprintf(p, "%s\n{\"name\":\"", i ? "," : "");
+
+        if (ngx_http_php_trace_name(b, f) != NGX_OK) {
+            return NGX_ERROR;
+        }
+
+        p = ngx_http_php_trace_reserve(b, sizeof("\",\"file\":\"") - 1);
+        if (p == NULL) {
+            return NGX_ERROR;
+        }
+
+        b->pos = ngx_cpymem(p, "\",\"file\":\"", sizeof("\",\"file\":\"") - 1);
+
+        if (ngx_http_php_trace_escape(b, f->file.data, f->file.len) != NGX_OK) {
+            return NGX_ERROR;
+        }
+
+        p = ngx_http_php_trace_reserve(b, 192);
+        if (p == NULL) {
+            return NGX_ERROR;
+        }
+
+        p = ngx_sprintf(p, "\",\"line\":%ui,\"opcodes\":%ui,\"calls\":%ui,"
+                        "\"ops\":%ui,\"incl\":", 
+                        f->line, f->opcodes, f->calls, f->ops);
+        p = ngx_http_php_trace_seconds(p, f->incl);
+        p = ngx_sprintf(p, ",\"excl\":");
+        p = ngx_http_php_trace_seconds(p, f->excl);
+        *p++ = '}';
+
+        b->pos = p;
+    }
+
+    p = ngx_http_php_trace_reserve(b, sizeof("],\n\"edges\":[") - 1);
+    if (p == NULL) {
+        return NGX_ERROR;
+    }
+
+    b->pos = ngx_cpymem(p, "],\n\"edges\":[", sizeof("],\n\"edges\":[") - 1);
+
+    ep = edges->elts;
+
+    for (i = 0; i < edges->nelts; i++) {
+        e = ep[i];
+
+        p = ngx_http_php_trace_reserve(b, sizeof(",\n{\"caller\":\"") - 1);
+        if (p == NULL) {
+            return NGX_ERROR;
+        }
+
+        b->pos = ngx_sprintf(p, "%s\n{\"caller\":\"", i ? "," : "");
+
+        if (ngx_http_php_trace_name(b, e->caller) != NGX_OK) {
+            return NGX_ERROR;
+        }
+
+        p = ngx_http_php_trace_reserve(b, sizeof("\",\"callee\":\"") - 1);
+        if (p == NULL) {
+            return NGX_ERROR;
+        }
+
+        b->pos = ngx_cpymem(p, "\",\"callee\":\"", sizeof("\",\"callee\":\"") - 1);
+
+        if (ngx_http_php_trace_name(b, e->callee) != NGX_OK) {
+            return NGX_ERROR;
+        }
+
+        p = ngx_http_php_trace_reserve(b, 96);
+        if (p == NULL) {
+            return NGX_ERROR;
+        }
+
+        p = ngx_sprintf(p, "\",\"calls\":%ui,\"incl\":", e->calls);
+        p = ngx_http_php_trace_seconds(p, e->incl);
+        *p++ = '}';
+
+        b->pos = p;
+    }
+
+    p = ngx_http_php_trace_reserve(b, sizeof("],\n\"ops\":{") - 1);
+    if (p == NULL) {
+        return NGX_ERROR;
+    }
+
+    b->pos = ngx_cpymem(p, "],\n\"ops\":{", sizeof("],\n\"ops\":{") - 1);
+
+    for (i = 0, n = 0; i < 256; i++) {
+
+        if (tr->ops[i] == 0) {
+            continue;
+        }
+
+        op = zend_get_opcode_name((zend_uchar) i);
+        if (op == NULL) {
+            continue;
+        }
+
+        p = ngx_http_php_trace_reserve(b, ngx_strlen(op) + NGX_INT_T_LEN + 8);
+        if (p == NULL) {
+            return NGX_ERROR;
+        }
+
+        b->pos = ngx_sprintf(p, "%s\"%s\":%ui", n++ ? "," : "", op, tr->ops[i]);
+    }
+
+    p = ngx_http_php_trace_reserve(b, sizeof("}}\n") - 1);
+    if (p == NULL) {
+        return NGX_ERROR;
+    }
+
+    b->pos = ngx_cpymem(p, "}}\n", sizeof("}}\n") - 1);
+
+    return NGX_OK;
+}
+
+/* 
+ * A profile.proto message, uncompressed, which pprof reads as well: a 
+ * sample per call path with its calls and exclusive wall time.
+ */
+static ngx_int_t
+ngx_http_php_trace_pprof(ngx_http_php_trace_t *tr, ngx_http_php_trace_buf_t *b)
+{
+    ngx_http_php_trace_func_t   **funcs, *f;
+    ngx_http_php_trace_node_t   *node, *n;
+    ngx_uint_t                  i;
+    u_char                      *p, *q, *v;
+    u_char                      ids[NGX_HTTP_PHP_TRACE_DEPTH * 10];
+    u_char                      msg[NGX_HTTP_PHP_TRACE_DEPTH * 10 + 64];
+    u_char                      values[32];
+    ngx_str_t                   s;
+
+    static ngx_str_t            strings[] = {
+        ngx_null_string,
+        ngx_string("calls"),
+        ngx_string("count"),
+        ngx_string("wall"),
+        ngx_string("nanoseconds")
+    };
+
+    /* sample_type: calls/count, wall/nanoseconds */
+
+    p = ngx_http_php_trace_pb_int(msg, 1, 1);
+    p = ngx_http_php_trace_pb_int(p, 2, 2);
+
+    if (ngx_http_php_trace_pb_message(b, 1, msg, p - msg) != NGX_OK) {
+        return NGX_ERROR;
+    }
+
+    p = ngx_http_php_trace_pb_int(msg, 1, 3);
+    p = ngx_http_php_trace_pb_int(p, 2, 4);
+
+    if (ngx_http_php_trace_pb_message(b, 1, msg, p - msg) != NGX_OK) {
+        return NGX_ERROR;
+    }
+
+    /* sample: location_id leaf first, value */
+
+    for (node = tr->root.child; node; node = ngx_http_php_trace_next(tr, node)) {
+
+        q = ids;
+
+        for (n = node; n != &tr->root; n = n->parent) {
+            q = ngx_http_php_trace_varint(q, n->func->id);
+        }
+
+        v = ngx_http_php_trace_varint(values, node->calls);
+        v = ngx_http_php_trace_varint(v, node->excl * 1000);
+
+        p = ngx_http_php_trace_pb_bytes(msg, 1, ids, q - ids);
+        p = ngx_http_php_trace_pb_bytes(p, 2, values, v - values);
+
+        if (ngx_http_php_trace_pb_message(b, 2, msg, p - msg) != NGX_OK) {
+            return NGX_ERROR;
+        }
+    }
+
+    /* 
+     * location and function per function, the same id; the name and 
+     * file of function i are strings 5 + 2i and 6 + 2i
+     */
+
+    funcs = tr->funcs.elts;
+
+    for (i = 0; i < tr->funcs.nelts; i++) {
+        f = funcs[i];
+
+        q = ngx_http_php_trace_pb_int(ids, 1, f->id);
+        q = ngx_http_php_trace_pb_int(q, 2, f->line);
+
+        p = ngx_http_php_trace_pb_int(msg, 1, f->id);
+        p = ngx_http_php_trace_pb_bytes(p, 4, ids, q - ids);
+
+        if (ngx_http_php_trace_pb_message(b, 4, msg, p - msg) != NGX_OK) {
+            return NGX_ERROR;
+        }
+
+        p = ngx_http_php_trace_pb_int(msg, 1, f->id);
+        p = ngx_http_php_trace_pb_int(p, 2, 5 + 2 * i);
+        p = ngx_http_php_trace_pb_int(p, 3, 5 + 2 * i);
+        p = ngx_http_php_trace_pb_int(p, 4, 6 + 2 * i);
+        p = ngx_http_php_trace_pb_int(p, 5, f->line);
+
+        if (ngx_http_php_trace_pb_message(b, 5, msg, p - msg) != NGX_OK) {
+            return NGX_ERROR;
+        }
+    }
+
+    /* string_table */
+
+    for (i = 0; i < sizeof(strings) / sizeof(ngx_str_t); i++) {
+        if (ngx_http_php_trace_pb_message(b, 6, strings[i].data, strings[i].len) 
+            != NGX_OK) 
+        {
+            return NGX_ERROR;
+        }
+    }
+
+    for (i = 0; i < tr->funcs.nelts; i++) {
+        f = funcs[i];
+
+        if (f->function.len == 0) {
+            ngx_str_set(&s, "{main}");
+
+        } else if (f->scope.len) {
+            s.len = f->scope.len + 2 + f->function.len;
+            s.data = ngx_pnalloc(b->pool, s.len);
+            if (s.data == NULL) {
+                return NGX_ERROR;
+            }
+
+            p = ngx_cpymem(s.data, f->scope.data, f->scope.len);
+            p = ngx_cpymem(p, "::", 2);
+            ngx_memcpy(p, f->function.data, f->function.len);
+
+        } else {
+            s = f->function;
+        }
+
+        if (ngx_http_php_trace_pb_message(b, 6, s.data, s.len) != NGX_OK
+            || ngx_http_php_trace_pb_message(b, 6, f->file.data, f->file.len) 
+               != NGX_OK)
+        {
+            return NGX_ERROR;
+        }
+    }
+
+    /* time_nanos, duration_nanos */
+
+    p = ngx_http_php_trace_pb_int(msg, 9, (uint64_t) tr->started * 1000000000);
+    p = ngx_http_php_trace_pb_int(p, 10, tr->time * 1000);
+
+    q = ngx_http_php_trace_reserve(b, p - msg);
+    if (q == NULL) {
+        return NGX_ERROR;
+    }
+
+    b->pos = ngx_cpymem(q, msg, p - msg);
+
+    return NGX_OK;
+}
+
+static u_char *
+ngx_http_php_trace_reserve(ngx_http_php_trace_buf_t *b, size_t size)
+{
+    u_char  *p;
+    size_t  len, n;
+
+    if ((size_t) (b->end - b->pos) >= size) {
+        return b->pos;
+    }
+
+    len = b->pos - b->start;
+    n = ngx_max(2 * (size_t) (b->end - b->start), len + size);
+    n = ngx_max(n, 4096);
+
+    p = ngx_pnalloc(b->pool, n);
+    if (p == NULL) {
+        return NULL;
+    }
+
+    if (len) {
+        ngx_memcpy(p, b->start, len);
+    }
+
+    b->start = p;
+    b->pos = p + len;
+    b->end = p + n;
+
+    return b->pos;
+}
+
+/* Class::function, function, or {main} for a file */
+static ngx_int_t
+ngx_http_php_trace_name(ngx_http_php_trace_buf_t *b, ngx_http_php_trace_func_t *f)
+{
+    u_char  *p;
+
+    if (f->function.len == 0) {
+        p = ngx_http_php_trace_reserve(b, sizeof("{main}") - 1);
+        if (p == NULL) {
+            return NGX_ERROR;
+        }
+
+        b->pos = ngx_cpymem(p, "{main}", sizeof("{main}") - 1);
+
+        return NGX_OK;
+    }
+
+    if (f->scope.len) {
+        if (ngx_http_php_trace_escape(b, f->scope.data, f->scope.len) != NGX_OK) {
+            return NGX_ERROR;
+        }
+
+        p = ngx_http_php_trace_reserve(b, 2);
+        if (p == NULL) {
+            return NGX_ERROR;
+        }
+
+        b->pos = ngx_cpymem(p, "::", 2);
+    }
+
+    return ngx_http_php_trace_escape(b, f->function.data, f->function.len);
+}
+
+/* namespaces have backslashes */
+static ngx_int_t
+ngx_http_php_trace_escape(ngx_http_php_trace_buf_t *b, u_char *data, size_t len)
+{
+    u_char      *p;
+    ngx_uint_t  i;
+
+    p = ngx_http_php_trace_reserve(b, 2 * len);
+    if (p == NULL) {
+        return NGX_ERROR;
+    }
+
+    for (i = 0; i < len; i++) {
+
+        if (data[i] == '"' || data[i] == '\\') {
+            *p++ = '\\';
+            *p++ = data[i];
+
+        } else if (data[i] < 0x20) {
+            *p++ = ' ';
+
+        } else {
+            *p++ = data[i];
+        }
+    }
+
+    b->pos = p;
+
+    return NGX_OK;
+}
+
+static u_char *
+ngx_http_php_trace_seconds(u_char *p, uint64_t usec)
+{
+    return ngx_sprintf(p, "%uL.%06uL", usec / 1000000, usec % 1000000);
+}
+
+static u_char *
+ngx_http_php_trace_varint(u_char *p, uint64_t v)
+{
+    while (v >= 0x80) {
+        *p++ = (u_char) (v | 0x80);
+        v >>= 7;
+    }
+
+    *p++ = (u_char) v;
+
+    return p;
+}
+
+/* wire type 0, zero is the default and left out */
+static u_char *
+ngx_http_php_trace_pb_int(u_char *p, ngx_uint_t field, uint64_t v)
+{
+    if (v == 0) {
+        return p;
+    }
+
+    p = ngx_http_php_trace_varint(p, field << 3);
+
+    return ngx_http_php_trace_varint(p, v);
+}
+
+/* wire type 2, packed values and embedded messages */
+static u_char *
+ngx_http_php_trace_pb_bytes(u_char *p, ngx_uint_t field, u_char *data, 
+    size_t len)
+{
+    p = ngx_http_php_trace_varint(p, (field << 3) | 2);
+    p = ngx_http_php_trace_varint(p, len);
+
+    return ngx_cpymem(p, data, len);
+}
+
+static ngx_int_t
+ngx_http_php_trace_pb_message(ngx_http_php_trace_buf_t *b, ngx_uint_t field, 
+    u_char *data, size_t len)
+{
+    u_char  *p;
+
+    p = ngx_http_php_trace_reserve(b, len + 20);
+    if (p == NULL) {
+        return NGX_ERROR;
+    }
+
+    b->pos = ngx_http_php_trace_pb_bytes(p, field, data, len);
+
+    return NGX_OK;
+}
+
+static uint64_t
+ngx_http_php_trace_now(void)
+{
+#if (NGX_HAVE_CLOCK_MONOTONIC)
+    struct timespec  ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    return (uint64_t) ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+#else
+    struct timeval   tv;
+
+    ngx_gettimeofday(&tv);
+
+    return (uint64_t) tv.tv_sec * 1000000 + tv.tv_usec;
+#endif
+}
+
+/* 
+ * A generator body is executed again on each resume, so a coroutine is 
+ * counted once per run.
+ */
+static void
+ngx_http_php_trace_execute_ex(zend_execute_data *execute_data)
+{
+    ngx_http_php_trace_t    *tr;
+    ngx_uint_t              depth;
+
+    tr = ngx_http_php_trace_running;
+
+    if (tr == NULL) {
+        ngx_http_php_trace_orig_execute_ex(execute_data);
+        return;
+    }
+
+    depth = tr->depth;
+
+    ngx_http_php_trace_push(tr, execute_data);
+
+    ngx_http_php_trace_orig_execute_ex(execute_data);
+
+    ngx_http_php_trace_pop(tr, depth);
+}
+
+static void
+ngx_http_php_trace_execute_internal(zend_execute_data *execute_data, 
+    zval *return_value)
+{
+    ngx_http_php_trace_t    *tr;
+    ngx_uint_t              depth;
+
+    tr = ngx_http_php_trace_running;
+    depth = 0;
+
+    if (tr) {
+        depth = tr->depth;
+        ngx_http_php_trace_push(tr, execute_data);
+    }
+
+    if (ngx_http_php_trace_orig_execute_internal) {
+        ngx_http_php_trace_orig_execute_internal(execute_data, return_value);
+
+    } else {
+        execute_internal(execute_data, return_value);
+    }
+
+    if (tr) {
+        ngx_http_php_trace_pop(tr, depth);
+    }
+}
+
+/* opcodes of the function on top are its own, not those of its callees */
+static int
+ngx_http_php_trace_opcode(zend_execute_data *execute_data)
+{
+    ngx_http_php_trace_t        *tr;
+    ngx_http_php_trace_node_t   *node;
+
+    tr = ngx_http_php_trace_running;
+
+    if (tr) {
+        tr->ops[EX(opline)->opcode]++;
+
+        if (tr->depth && tr->depth <= NGX_HTTP_PHP_TRACE_DEPTH) {
+            node = tr->frames[tr->depth - 1].node;
+
+            if (node) {
+                node->ops++;
+            }
+        }
+    }
+
+    return ZEND_USER_OPCODE_DISPATCH;
+}
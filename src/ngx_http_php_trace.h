@@ -0,0 +1,50 @@
+/*
+==============================================================================
+Copyright (c) 2016-2020, rryqszq4 <rryqszq@gmail.com>
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+
+* Redistributions of source code must retain the above copyright notice, this
+  list of conditions and the following disclaimer.
+
+* Redistributions in binary form must reproduce the above copyright notice,
+  this list of conditions and the following disclaimer in the documentation
+  and/or other materials provided with the distribution.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+==============================================================================
+*/
+
+#ifndef __NGX_HTTP_PHP_TRACE_H__
+#define __NGX_HTTP_PHP_TRACE_H__
+
+#include "ngx_http_php_module.h"
+#include "ngx_http_php_run.h"
+
+#define NGX_HTTP_PHP_TRACE_JSON         0
+#define NGX_HTTP_PHP_TRACE_PPROF        1
+
+/* calls deeper than this count in their caller */
+#define NGX_HTTP_PHP_TRACE_DEPTH        256
+
+#define NGX_HTTP_PHP_TRACE_BUCKETS      256
+
+void ngx_http_php_trace_init_worker(ngx_cycle_t *cycle);
+void ngx_http_php_trace_hook(void);
+
+void ngx_http_php_trace_enter(ngx_http_php_run_t *run);
+void ngx_http_php_trace_leave(ngx_http_php_run_t *run);
+void ngx_http_php_trace_done(ngx_http_php_trace_t *tr);
+
+#endif
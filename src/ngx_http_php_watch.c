@@ -0,0 +1,557 @@
+/*
+==============================================================================
+Copyright (c) 2016-2020, rryqszq4 <rryqszq@gmail.com>
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+
+* Redistributions of source code must retain the above copyright notice, this
+  list of conditions and the following disclaimer.
+
+* Redistributions in binary form must reproduce the above copyright notice,
+  this list of conditions and the following disclaimer in the documentation
+  and/or other materials provided with the distribution.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+==============================================================================
+*/
+
+#include "ngx_http_php_module.h"
+#include "ngx_http_php_watch.h"
+
+#if (NGX_LINUX)
+
+#include <sys/inotify.h>
+
+#define NGX_HTTP_PHP_WATCH_MASK                                              \
+    (IN_CLOSE_WRITE|IN_MOVED_TO|IN_MOVED_FROM|IN_DELETE|IN_CREATE            \
+     |IN_DELETE_SELF|IN_ONLYDIR)
+
+/* a directory that could not be watched, see ngx_http_php_watch_dir() */
+#define NGX_HTTP_PHP_WATCH_NONE  -2
+
+typedef struct {
+    int                         wd;
+    ngx_str_t                   path;
+} ngx_http_php_watch_dir_t;
+
+static ngx_int_t ngx_http_php_watch_add_path(ngx_conf_t *cf, 
+    ngx_http_php_main_conf_t *pmcf, char *file);
+static ngx_int_t ngx_http_php_watch_tree(ngx_cycle_t *cycle, ngx_str_t *path);
+static ngx_int_t ngx_http_php_watch_dir(ngx_tree_ctx_t *ctx, ngx_str_t *path);
+static ngx_int_t ngx_http_php_watch_noop(ngx_tree_ctx_t *ctx, ngx_str_t *path);
+static zend_op_array *ngx_http_php_watch_compile_file(
+    zend_file_handle *file_handle, int type);
+static void ngx_http_php_watch_handler(ngx_event_t *rev);
+static ngx_http_php_watch_dir_t *ngx_http_php_watch_lookup(int wd);
+static void ngx_http_php_watch_invalidate(ngx_log_t *log, ngx_str_t *path);
+static void ngx_http_php_watch_call(const char *name, zval *args, 
+    uint32_t nargs);
+
+/* one inotify instance per worker, a watch per directory */
+static ngx_connection_t *ngx_http_php_watch_conn;
+static ngx_array_t *ngx_http_php_watch_dirs;
+
+static zend_op_array *(*ngx_http_php_watch_orig_compile_file)(
+    zend_file_handle *file_handle, int type);
+
+/* The directories of the *_by_php_file scripts of a location. */
+ngx_int_t
+ngx_http_php_watch_add_location(ngx_conf_t *cf, ngx_http_php_loc_conf_t *plcf)
+{
+    ngx_http_php_main_conf_t    *pmcf;
+    ngx_http_php_code_t         *code[6];
+    ngx_uint_t                  i;
+
+    pmcf = ngx_http_conf_get_module_main_conf(cf, ngx_http_php_module);
+
+    if (!pmcf->file_watch) {
+        return NGX_OK;
+    }
+
+    code[0] = plcf->rewrite_code;
+    code[1] = plcf->access_code;
+    code[2] = plcf->content_code;
+    code[3] = plcf->log_code;
+    code[4] = plcf->header_filter_code;
+    code[5] = plcf->body_filter_code;
+
+    for (i = 0; i < 6; i++) {
+        if (code[i] == NGX_CONF_UNSET_PTR || code[i] == NULL 
+            || code[i]->code_type != NGX_HTTP_PHP_CODE_TYPE_FILE)
+        {
+            continue;
+        }
+
+        if (ngx_http_php_watch_add_path(cf, pmcf, code[i]->code.file) != NGX_OK) {
+            return NGX_ERROR;
+        }
+    }
+
+    return NGX_OK;
+}
+
+static ngx_int_t
+ngx_http_php_watch_add_path(ngx_conf_t *cf, ngx_http_php_main_conf_t *pmcf, 
+    char *file)
+{
+    ngx_str_t   *path;
+    u_char      *p;
+    size_t      len;
+    ngx_uint_t  i;
+
+    /* a script path with variables has no directory to watch */
+
+    if (file[0] != '/') {
+        return NGX_OK;
+    }
+
+    p = (u_char *) strrchr(file, '/');
+    len = (p == (u_char *) file) ? 1 : (size_t) (p - (u_char *) file);
+
+    if (pmcf->file_watch_paths == NULL) {
+        pmcf->file_watch_paths = ngx_array_create(cf->pool, 4, sizeof(ngx_str_t));
+        if (pmcf->file_watch_paths == NULL) {
+            return NGX_ERROR;
+        }
+    }
+
+    path = pmcf->file_watch_paths->elts;
+
+    for (i = 0; i < pmcf->file_watch_paths->nelts; i++) {
+        if (path[i].len == len && ngx_strncmp(path[i].data, file, len) == 0) {
+            return NGX_OK;
+        }
+    }
+
+    path = ngx_array_push(pmcf->file_watch_paths);
+    if (path == NULL) {
+        return NGX_ERROR;
+    }
+
+    path->data = ngx_pnalloc(cf->pool, len + 1);
+    if (path->data == NULL) {
+        return NGX_ERROR;
+    }
+
+    ngx_cpystrn(path->data, (u_char *) file, len + 1);
+    path->len = len;
+
+    return NGX_OK;
+}
+
+/* 
+ * The compiled scripts stay in opcache until a change of their file, so 
+ * opcache stops checking the timestamps on every request. That holds for 
+ * the includes out of the configured directories too, the directory of 
+ * each compiled file is watched the first time it is seen.
+ */
+void
+ngx_http_php_watch_init_worker(ngx_cycle_t *cycle)
+{
+    ngx_http_php_main_conf_t    *pmcf;
+    ngx_connection_t            *c;
+    ngx_str_t                   *path;
+    ngx_uint_t                  i;
+    zend_string                 *name;
+    int                         fd;
+
+    pmcf = ngx_http_cycle_get_module_main_conf(cycle, ngx_http_php_module);
+
+    if (pmcf == NULL || !pmcf->file_watch || pmcf->file_watch_paths == NULL) {
+        return;
+    }
+
+    if (ngx_process != NGX_PROCESS_WORKER && ngx_process != NGX_PROCESS_SINGLE) {
+        return;
+    }
+
+    fd = inotify_init1(IN_NONBLOCK|IN_CLOEXEC);
+    if (fd == -1) {
+        ngx_log_error(NGX_LOG_ALERT, cycle->log, ngx_errno, 
+                      "inotify_init1() failed for php_file_watch");
+        return;
+    }
+
+    ngx_http_php_watch_dirs = ngx_array_create(cycle->pool, 16, 
+                                  sizeof(ngx_http_php_watch_dir_t));
+    if (ngx_http_php_watch_dirs == NULL) {
+        (void) close(fd);
+        return;
+    }
+
+    c = ngx_get_connection(fd, cycle->log);
+    if (c == NULL) {
+        (void) close(fd);
+        return;
+    }
+
+    c->read->handler = ngx_http_php_watch_handler;
+    c->read->log = cycle->log;
+
+    ngx_http_php_watch_conn = c;
+
+    path = pmcf->file_watch_paths->elts;
+
+    for (i = 0; i < pmcf->file_watch_paths->nelts; i++) {
+        (void) ngx_http_php_watch_tree(cycle, &path[i]);
+    }
+
+    if (ngx_handle_read_event(c->read, 0) != NGX_OK) {
+        ngx_close_connection(c);
+        ngx_http_php_watch_conn = NULL;
+        return;
+    }
+
+    /* on top of opcache, which then still sees each include */
+
+    ngx_http_php_watch_orig_compile_file = zend_compile_file;
+    zend_compile_file = ngx_http_php_watch_compile_file;
+
+    name = zend_string_init("opcache.validate_timestamps", 
+                            sizeof("opcache.validate_timestamps") - 1, 0);
+    (void) zend_alter_ini_entry_chars(name, "0", 1, ZEND_INI_SYSTEM, 
+                                      ZEND_INI_STAGE_RUNTIME);
+    zend_string_release(name);
+}
+
+void
+ngx_http_php_watch_exit_worker(ngx_cycle_t *cycle)
+{
+    if (ngx_http_php_watch_orig_compile_file) {
+        zend_compile_file = ngx_http_php_watch_orig_compile_file;
+        ngx_http_php_watch_orig_compile_file = NULL;
+    }
+
+    if (ngx_http_php_watch_conn) {
+        ngx_close_connection(ngx_http_php_watch_conn);
+        ngx_http_php_watch_conn = NULL;
+    }
+}
+
+static ngx_int_t
+ngx_http_php_watch_tree(ngx_cycle_t *cycle, ngx_str_t *path)
+{
+    ngx_tree_ctx_t  tree;
+
+    tree.init_handler = NULL;
+    tree.file_handler = ngx_http_php_watch_noop;
+    tree.pre_tree_handler = ngx_http_php_watch_dir;
+    tree.post_tree_handler = ngx_http_php_watch_noop;
+    tree.spec_handler = ngx_http_php_watch_noop;
+    tree.data = NULL;
+    tree.alloc = 0;
+    tree.log = cycle->log;
+
+    if (ngx_http_php_watch_dir(&tree, path) != NGX_OK) {
+        return NGX_ERROR;
+    }
+
+    return ngx_walk_tree(&tree, path);
+}
+
+static ngx_int_t
+ngx_http_php_watch_dir(ngx_tree_ctx_t *ctx, ngx_str_t *path)
+{
+    ngx_http_php_watch_dir_t    *dir;
+    u_char                      *name;
+    int                         wd;
+
+    /* ngx_walk_tree() names are null-terminated */
+
+    wd = inotify_add_watch(ngx_http_php_watch_conn->fd, (char *) path->data, 
+                           NGX_HTTP_PHP_WATCH_MASK);
+    if (wd == -1) {
+        ngx_log_error(NGX_LOG_WARN, ctx->log, ngx_errno, 
+                      "inotify_add_watch(\"%V\") failed for php_file_watch", 
+                      path);
+
+        /* kept without a watch, not to try again on every compile */
+        wd = NGX_HTTP_PHP_WATCH_NONE;
+
+    } else {
+        dir = ngx_http_php_watch_lookup(wd);
+        if (dir) {
+            return NGX_OK;
+        }
+    }
+
+    name = ngx_pnalloc(ngx_cycle->pool, path->len + 1);
+    if (name == NULL) {
+        return NGX_ABORT;
+    }
+
+    ngx_cpystrn(name, path->data, path->len + 1);
+
+    dir = ngx_array_push(ngx_http_php_watch_dirs);
+    if (dir == NULL) {
+        return NGX_ABORT;
+    }
+
+    dir->wd = wd;
+    dir->path.data = name;
+    dir->path.len = path->len;
+
+    ngx_log_debug2(NGX_LOG_DEBUG_HTTP, ctx->log, 0, 
+                   "php file watch: %V is %d", path, wd);
+
+    return NGX_OK;
+}
+
+static ngx_int_t
+ngx_http_php_watch_noop(ngx_tree_ctx_t *ctx, ngx_str_t *path)
+{
+    return NGX_OK;
+}
+
+static zend_op_array *
+ngx_http_php_watch_compile_file(zend_file_handle *file_handle, int type)
+{
+    ngx_http_php_watch_dir_t    *dir;
+    zend_op_array               *op_array;
+    ngx_tree_ctx_t              tree;
+    ngx_str_t                   path;
+    u_char                      *p;
+    ngx_uint_t                  i;
+    u_char                      name[NGX_MAX_PATH];
+
+    op_array = ngx_http_php_watch_orig_compile_file(file_handle, type);
+
+    if (op_array == NULL || op_array->filename == NULL 
+        || ngx_http_php_watch_conn == NULL)
+    {
+        return op_array;
+    }
+
+    /* stream wrappers and eval'd code have no directory */
+
+    path.data = (u_char *) ZSTR_VAL(op_array->filename);
+
+    if (path.data[0] != '/') {
+        return op_array;
+    }
+
+    p = (u_char *) strrchr((char *) path.data, '/');
+    path.len = (p == path.data) ? 1 : (size_t) (p - path.data);
+
+    if (path.len >= NGX_MAX_PATH) {
+        return op_array;
+    }
+
+    dir = ngx_http_php_watch_dirs->elts;
+
+    for (i = 0; i < ngx_http_php_watch_dirs->nelts; i++) {
+        if (dir[i].path.len == path.len 
+            && ngx_strncmp(dir[i].path.data, path.data, path.len) == 0)
+        {
+            return op_array;
+        }
+    }
+
+    path.data = ngx_cpymem(name, ZSTR_VAL(op_array->filename), path.len);
+    *path.data = '\0';
+    path.data = name;
+
+    /* only this directory, its subdirectories may hold anything */
+
+    tree.log = ngx_cycle->log;
+
+    (void) ngx_http_php_watch_dir(&tree, &path);
+
+    return op_array;
+}
+
+static void
+ngx_http_php_watch_handler(ngx_event_t *rev)
+{
+    ngx_connection_t            *c;
+    ngx_http_php_watch_dir_t    *dir;
+    struct inotify_event        *ev;
+    ngx_str_t                   path;
+    u_char                      *p, *last;
+    ssize_t                     n;
+    ngx_uint_t                  i;
+    u_char                      buf[4096] 
+                                __attribute__((aligned(__alignof__(struct inotify_event))));
+    u_char                      name[NGX_MAX_PATH];
+
+    c = rev->data;
+
+    for ( ;; ) {
+
+        n = read(c->fd, buf, sizeof(buf));
+
+        if (n == -1) {
+            if (ngx_errno != NGX_EAGAIN) {
+                ngx_log_error(NGX_LOG_ALERT, rev->log, ngx_errno, 
+                              "read() of php_file_watch failed");
+            }
+            break;
+        }
+
+        if (n == 0) {
+            break;
+        }
+
+        for (p = buf, last = buf + n; p < last; 
+             p += sizeof(struct inotify_event) + ev->len) 
+        {
+            ev = (struct inotify_event *) p;
+
+            if (ev->mask & IN_Q_OVERFLOW) {
+                /* events lost, anything may have changed */
+                ngx_log_error(NGX_LOG_WARN, rev->log, 0, 
+                              "php_file_watch queue overflow, opcache reset");
+                ngx_http_php_watch_call("opcache_reset", NULL, 0);
+                realpath_cache_clean();
+                continue;
+            }
+
+            dir = ngx_http_php_watch_lookup(ev->wd);
+            if (dir == NULL) {
+                continue;
+            }
+
+            if (ev->mask & IN_IGNORED) {
+                /* the directory is gone, a new one is watched on creation */
+                dir->wd = -1;
+                continue;
+            }
+
+            if (ev->len == 0 || ev->name[0] == '\0') {
+                continue;
+            }
+
+            path.data = name;
+            path.len = ngx_snprintf(name, sizeof(name) - 1, "%V/%s", 
+                                    &dir->path, ev->name) - name;
+            name[path.len] = '\0';
+
+            if (ev->mask & IN_ISDIR) {
+                if (ev->mask & (IN_CREATE|IN_MOVED_TO)) {
+                    (void) ngx_http_php_watch_tree((ngx_cycle_t *) ngx_cycle, 
+                                                   &path);
+                }
+                continue;
+            }
+
+            if (ev->mask & IN_CREATE) {
+                /* nothing compiled yet, its IN_CLOSE_WRITE follows */
+                continue;
+            }
+
+            ngx_http_php_watch_invalidate(rev->log, &path);
+        }
+    }
+
+    /* drop the watches of removed directories */
+
+    dir = ngx_http_php_watch_dirs->elts;
+
+    for (i = 0; i < ngx_http_php_watch_dirs->nelts; /* void */) {
+        if (dir[i].wd == -1) {
+            dir[i] = dir[--ngx_http_php_watch_dirs->nelts];
+            continue;
+        }
+        i++;
+    }
+
+    if (ngx_handle_read_event(rev, 0) != NGX_OK) {
+        ngx_close_connection(c);
+        ngx_http_php_watch_conn = NULL;
+    }
+}
+
+static ngx_http_php_watch_dir_t *
+ngx_http_php_watch_lookup(int wd)
+{
+    ngx_http_php_watch_dir_t    *dir;
+    ngx_uint_t                  i;
+
+    dir = ngx_http_php_watch_dirs->elts;
+
+    for (i = 0; i < ngx_http_php_watch_dirs->nelts; i++) {
+        if (dir[i].wd == wd) {
+            return &dir[i];
+        }
+    }
+
+    return NULL;
+}
+
+static void
+ngx_http_php_watch_invalidate(ngx_log_t *log, ngx_str_t *path)
+{
+    zval    args[2];
+
+    ngx_log_error(NGX_LOG_INFO, log, 0, "php_file_watch: %V changed", path);
+
+    realpath_cache_del((char *) path->data, path->len);
+
+    ZVAL_STRINGL(&args[0], (char *) path->data, path->len);
+    ZVAL_TRUE(&args[1]);
+
+    ngx_http_php_watch_call("opcache_invalidate", args, 2);
+
+    zval_ptr_dtor(&args[0]);
+}
+
+/* opcache is optional, without it every request compiles anyway */
+static void
+ngx_http_php_watch_call(const char *name, zval *args, uint32_t nargs)
+{
+    zval    function, retval;
+
+    if (!zend_hash_str_exists(EG(function_table), name, ngx_strlen(name))) {
+        return;
+    }
+
+    ZVAL_STRING(&function, name);
+    ZVAL_UNDEF(&retval);
+
+    zend_try {
+        (void) call_user_function(EG(function_table), NULL, &function, &retval, 
+                                  nargs, args);
+    } zend_end_try();
+
+    zval_ptr_dtor(&retval);
+    zval_ptr_dtor(&function);
+}
+
+#else
+
+ngx_int_t
+ngx_http_php_watch_add_location(ngx_conf_t *cf, ngx_http_php_loc_conf_t *plcf)
+{
+    return NGX_OK;
+}
+
+void
+ngx_http_php_watch_init_worker(ngx_cycle_t *cycle)
+{
+    ngx_http_php_main_conf_t    *pmcf;
+
+    pmcf = ngx_http_cycle_get_module_main_conf(cycle, ngx_http_php_module);
+
+    if (pmcf && pmcf->file_watch) {
+        ngx_log_error(NGX_LOG_WARN, cycle->log, 0, 
+                      "php_file_watch needs inotify, ignored");
+    }
+}
+
+void
+ngx_http_php_watch_exit_worker(ngx_cycle_t *cycle)
+{
+}
+
+#endif
@@ -29,6 +29,10 @@ OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 #include "ngx_http_php_module.h"
 #include "ngx_http_php_zend_uthread.h"
 #include "ngx_http_php_util.h"
+#include "ngx_http_php_stat.h"
+#include "ngx_http_php_run.h"
+
+static void ngx_http_php_zend_uthread_resume_routine(ngx_http_request_t *r);
 
 void 
 ngx_http_php_zend_uthread_rewrite_inline_routine(ngx_http_request_t *r)
@@ -56,6 +60,8 @@ ngx_http_php_zend_uthread_rewrite_inline_routine(ngx_http_request_t *r)
 
     ngx_php_debug("%*s, %d", (int)inline_code.len, inline_code.data, (int)inline_code.len);
 
+    ngx_http_php_run_enter(r, NGX_HTTP_PHP_STAT_REWRITE);
+
     zend_first_try {
 
         if (!plcf->enabled_rewrite_inline_compile){
@@ -72,6 +78,8 @@ ngx_http_php_zend_uthread_rewrite_inline_routine(ngx_http_request_t *r)
         ngx_http_php_zend_uthread_create(r, "ngx_rewrite");
 
     }zend_end_try();
+
+    ngx_http_php_run_leave(r);
 }
 
 void 
@@ -100,6 +108,8 @@ ngx_http_php_zend_uthread_access_inline_routine(ngx_http_request_t *r)
 
     ngx_php_debug("%*s, %d", (int)inline_code.len, inline_code.data, (int)inline_code.len);
 
+    ngx_http_php_run_enter(r, NGX_HTTP_PHP_STAT_ACCESS);
+
     zend_first_try {
 
         if (!plcf->enabled_access_inline_compile){
@@ -116,6 +126,8 @@ ngx_http_php_zend_uthread_access_inline_routine(ngx_http_request_t *r)
         ngx_http_php_zend_uthread_create(r, "ngx_access");
 
     }zend_end_try();
+
+    ngx_http_php_run_leave(r);
 }
 
 void 
@@ -159,6 +171,8 @@ ngx_http_php_zend_uthread_content_inline_routine(ngx_http_request_t *r)
 
     ngx_php_debug("%*s, %d", (int)inline_code.len, inline_code.data, (int)inline_code.len);
 
+    ngx_http_php_run_enter(r, NGX_HTTP_PHP_STAT_CONTENT);
+
     zend_first_try {
 #if 0 && (NGX_DEBUG)
         ngx_http_php_zend_eval_stringl_ex(
@@ -186,6 +200,8 @@ ngx_http_php_zend_uthread_content_inline_routine(ngx_http_request_t *r)
         ngx_http_php_zend_uthread_create(r, "ngx_content");
     
     }zend_end_try();
+
+    ngx_http_php_run_leave(r);
 }
 
 void 
@@ -214,6 +230,8 @@ ngx_http_php_zend_uthread_log_inline_routine(ngx_http_request_t *r)
 
     ngx_php_debug("%*s, %d", (int)inline_code.len, inline_code.data, (int)inline_code.len);
 
+    ngx_http_php_run_enter(r, NGX_HTTP_PHP_STAT_LOG);
+
     zend_first_try {
 
         if (!plcf->enabled_log_inline_compile){
@@ -230,6 +248,8 @@ ngx_http_php_zend_uthread_log_inline_routine(ngx_http_request_t *r)
         ngx_http_php_zend_uthread_create(r, "ngx_log");
     
     }zend_end_try();
+
+    ngx_http_php_run_leave(r);
 }
 
 void 
@@ -432,6 +452,16 @@ ngx_http_php_zend_uthread_create(ngx_http_request_t *r, char *func_prefix)
 
 void 
 ngx_http_php_zend_uthread_resume(ngx_http_request_t *r)
+{
+    ngx_http_php_run_enter(r, NGX_HTTP_PHP_STAT_IDLE);
+
+    ngx_http_php_zend_uthread_resume_routine(r);
+
+    ngx_http_php_run_leave(r);
+}
+
+static void 
+ngx_http_php_zend_uthread_resume_routine(ngx_http_request_t *r)
 {
     ngx_php_request = r;
 
@@ -461,13 +491,33 @@ ngx_http_php_zend_uthread_resume(ngx_http_request_t *r)
 
         // ngx_php_debug("uthread resume before.");
 
-        ZVAL_STRING(&func_next, "next");
-        if ( ngx_http_php_call_user_function(NULL, closure, &func_next, &retval, 0, NULL ) == FAILURE )
-        {
-            php_error_docref(NULL , E_WARNING, "Failed calling next");
-            return ;
+        if (Z_TYPE(ctx->yield_retval) != IS_UNDEF) {
+
+            /* the result of the pending operation becomes the value of yield */
+
+            ZVAL_STRING(&func_next, "send");
+            if ( ngx_http_php_call_user_function(NULL, closure, &func_next, &retval, 1, &ctx->yield_retval ) == FAILURE )
+            {
+                php_error_docref(NULL , E_WARNING, "Failed calling send");
+                zval_ptr_dtor(&func_next);
+                zval_ptr_dtor(&ctx->yield_retval);
+                ZVAL_UNDEF(&ctx->yield_retval);
+                return ;
+            }
+            zval_ptr_dtor(&func_next);
+            zval_ptr_dtor(&ctx->yield_retval);
+            ZVAL_UNDEF(&ctx->yield_retval);
+
+        }else {
+
+            ZVAL_STRING(&func_next, "next");
+            if ( ngx_http_php_call_user_function(NULL, closure, &func_next, &retval, 0, NULL ) == FAILURE )
+            {
+                php_error_docref(NULL , E_WARNING, "Failed calling next");
+                return ;
+            }
+            zval_ptr_dtor(&func_next);
         }
-        zval_ptr_dtor(&func_next);
 
         /*
         错误：变量‘ctx’能为‘longjmp’或‘vfork’所篡改 [-Werror=clobbered]
@@ -516,6 +566,12 @@ ngx_http_php_zend_uthread_resume(ngx_http_request_t *r)
             efree(ctx->generator_closure);
             ctx->generator_closure = NULL;
         }
+
+        /* ngx_exec() ends the coroutine, the handler does the redirect */
+        if ( ctx && ctx->exec_uri.len ) {
+            ctx->phase_status = NGX_OK;
+            ngx_http_core_run_phases(r);
+        }
     }zend_end_try();
 }
 
@@ -37,6 +37,11 @@ OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 #include "php_ngx_var.h"
 #include "php_ngx_header.h"
 #include "php_ngx_cookie.h"
+#include "php_ngx_http.h"
+#include "php_ngx_location.h"
+#include "php_ngx_file.h"
+#include "php_ngx_counter.h"
+#include "php_ngx_queue.h"
 
 #include "../../ngx_http_php_module.h"
 
@@ -368,9 +373,31 @@ static const zend_function_entry additional_functions[] = {
     PHP_FE(ngx_socket_recvpage,             arginfo_ngx_socket_recvpage)
     PHP_FE(ngx_socket_recvwait,             arginfo_ngx_socket_recvwait)
     PHP_FE(ngx_socket_recvsync,             arginfo_ngx_socket_recvsync)
+    PHP_FE(ngx_socket_recv_until,           arginfo_ngx_socket_recv_until)
+    PHP_FE(ngx_socket_recv_exact,           arginfo_ngx_socket_recv_exact)
+    PHP_FE(ngx_socket_setkeepalive,         arginfo_ngx_socket_setkeepalive)
     PHP_FE(ngx_socket_clear,                arginfo_ngx_socket_clear)
     PHP_FE(ngx_socket_destroy,              arginfo_ngx_socket_destroy)
 
+    PHP_FE(ngx_http_request,                ngx_http_request_arginfo)
+    PHP_FE(ngx_http_request_read,           ngx_http_request_read_arginfo)
+
+    PHP_FE(ngx_location_capture,            ngx_location_capture_arginfo)
+    PHP_FE(ngx_location_capture_multi,      ngx_location_capture_multi_arginfo)
+
+    PHP_FE(ngx_file_read,                   ngx_file_read_arginfo)
+    PHP_FE(ngx_file_write,                  ngx_file_write_arginfo)
+    PHP_FE(ngx_file_append,                 ngx_file_append_arginfo)
+    PHP_FE(ngx_file_stat,                   ngx_file_stat_arginfo)
+
+    PHP_FE(ngx_counter_incr,                ngx_counter_incr_arginfo)
+    PHP_FE(ngx_counter_get,                 ngx_counter_get_arginfo)
+    PHP_FE(ngx_limit,                       ngx_limit_arginfo)
+
+    PHP_FE(ngx_queue_push,                  ngx_queue_push_arginfo)
+    PHP_FE(ngx_queue_pop,                   ngx_queue_pop_arginfo)
+    PHP_FE(ngx_queue_fetch,                 ngx_queue_fetch_arginfo)
+
     PHP_FE(ngx_var_get,                     ngx_var_get_arginfo)
     PHP_FE(ngx_var_set,                     ngx_var_set_arginfo)
 
@@ -379,6 +406,8 @@ static const zend_function_entry additional_functions[] = {
     PHP_FE(ngx_header_get_all,              ngx_header_get_all_arginfo)
 
     PHP_FE(ngx_redirect,                    ngx_redirect_arginfo)
+    PHP_FE(ngx_exec,                        ngx_exec_arginfo)
+    PHP_FE(ngx_send_file,                   ngx_send_file_arginfo)
 
     PHP_FE(ngx_cookie_get_all,              ngx_cookie_get_all_arginfo)
     PHP_FE(ngx_cookie_get,                  ngx_cookie_get_arginfo)
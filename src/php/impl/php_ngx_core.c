@@ -27,6 +27,7 @@ OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 */
 
 #include "php_ngx_core.h"
+#include "php_ngx_location.h"
 #include "../../ngx_http_php_module.h"
 #include "../../ngx_http_php_sleep.h"
 
@@ -311,6 +312,83 @@ PHP_FUNCTION(ngx_redirect)
 
 }
 
+PHP_FUNCTION(ngx_exec)
+{
+    ngx_http_request_t  *r;
+    ngx_http_php_ctx_t  *ctx;
+    zend_string         *uri;
+    zval                *args = NULL;
+    smart_str           buf = {0};
+    ngx_str_t           ngx_uri, ngx_args;
+    ngx_uint_t          flags;
+
+    if (zend_parse_parameters(ZEND_NUM_ARGS() , "S|z", &uri, &args) == FAILURE) {
+        RETURN_FALSE;
+    }
+
+    r = ngx_php_request;
+    ctx = ngx_http_get_module_ctx(r, ngx_http_php_module);
+
+    if (ctx == NULL) {
+        RETURN_FALSE;
+    }
+
+    if (ZSTR_LEN(uri) < 2 || (ZSTR_VAL(uri)[0] != '/' && ZSTR_VAL(uri)[0] != '@')) {
+        php_error_docref(NULL, E_WARNING, "uri must start with \"/\" or \"@\"");
+        RETURN_FALSE;
+    }
+
+    ngx_uri.len = ZSTR_LEN(uri);
+    ngx_uri.data = ngx_pnalloc(r->pool, ngx_uri.len);
+    if (ngx_uri.data == NULL) {
+        RETURN_FALSE;
+    }
+
+    ngx_memcpy(ngx_uri.data, ZSTR_VAL(uri), ngx_uri.len);
+
+    ngx_str_null(&ngx_args);
+
+    if (ngx_uri.data[0] == '/') {
+        flags = NGX_HTTP_LOG_UNSAFE;
+
+        if (ngx_http_parse_unsafe_uri(r, &ngx_uri, &ngx_args, &flags) != NGX_OK) {
+            php_error_docref(NULL, E_WARNING, "unsafe uri");
+            RETURN_FALSE;
+        }
+    }
+
+    if (args && Z_TYPE_P(args) != IS_NULL) {
+        if (ngx_args.len) {
+            smart_str_appendl(&buf, (char *) ngx_args.data, ngx_args.len);
+            smart_str_appendc(&buf, '&');
+        }
+
+        php_ngx_location_build_args(&buf, args);
+
+        if (buf.s && ZSTR_LEN(buf.s)) {
+            ngx_args.len = ZSTR_LEN(buf.s);
+            ngx_args.data = ngx_pnalloc(r->pool, ngx_args.len);
+            if (ngx_args.data == NULL) {
+                smart_str_free(&buf);
+                RETURN_FALSE;
+            }
+
+            ngx_memcpy(ngx_args.data, ZSTR_VAL(buf.s), ngx_args.len);
+        }
+
+        smart_str_free(&buf);
+    }
+
+    ctx->exec_uri = ngx_uri;
+    ctx->exec_args = ngx_args;
+
+    /* like ngx_exit(), the rest of the code does not run */
+
+    EG(exit_status) = NGX_OK;
+
+    zend_bailout();
+}
+
 PHP_METHOD(ngx, _exit)
 {
     long status = 0;
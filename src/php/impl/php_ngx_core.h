@@ -59,6 +59,11 @@ ZEND_BEGIN_ARG_INFO_EX(ngx_redirect_arginfo, 0, 0, 2)
 	ZEND_ARG_INFO(0, status)
 ZEND_END_ARG_INFO()
 
+ZEND_BEGIN_ARG_INFO_EX(ngx_exec_arginfo, 0, 0, 1)
+    ZEND_ARG_INFO(0, uri)
+    ZEND_ARG_INFO(0, args)
+ZEND_END_ARG_INFO()
+
 ZEND_BEGIN_ARG_INFO_EX(ngx_status_arginfo, 0, 0, 1)
   ZEND_ARG_INFO(0, status)
 ZEND_END_ARG_INFO()
@@ -70,6 +75,7 @@ PHP_FUNCTION(ngx_post_args);
 PHP_FUNCTION(ngx_sleep);
 PHP_FUNCTION(ngx_msleep);
 PHP_FUNCTION(ngx_redirect);
+PHP_FUNCTION(ngx_exec);
 
 PHP_METHOD(ngx, _exit);
 PHP_METHOD(ngx, query_args);
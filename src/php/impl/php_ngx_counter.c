@@ -0,0 +1,101 @@
+/*
+==============================================================================
+Copyright (c) 2016-2020, rryqszq4 <rryqszq@gmail.com>
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+
+* Redistributions of source code must retain the above copyright notice, this
+  list of conditions and the following disclaimer.
+
+* Redistributions in binary form must reproduce the above copyright notice,
+  this list of conditions and the following disclaimer in the documentation
+  and/or other materials provided with the distribution.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+==============================================================================
+*/
+
+#include "php_ngx_counter.h"
+#include "../../ngx_http_php_module.h"
+#include "../../ngx_http_php_counter.h"
+
+PHP_FUNCTION(ngx_counter_incr)
+{
+    zend_string         *name;
+    zend_long           delta = 1;
+    ngx_atomic_int_t    value;
+    ngx_str_t           key;
+
+    if (zend_parse_parameters(ZEND_NUM_ARGS(), "S|l", &name, &delta) == FAILURE) {
+        RETURN_FALSE;
+    }
+
+    key.data = (u_char *) ZSTR_VAL(name);
+    key.len = ZSTR_LEN(name);
+
+    if (ngx_http_php_counter_incr(&key, (ngx_atomic_int_t) delta, &value) != NGX_OK) {
+        RETURN_FALSE;
+    }
+
+    RETURN_LONG((zend_long) value);
+}
+
+PHP_FUNCTION(ngx_counter_get)
+{
+    zend_string         *name;
+    ngx_atomic_int_t    value;
+    ngx_str_t           key;
+
+    if (zend_parse_parameters(ZEND_NUM_ARGS(), "S", &name) == FAILURE) {
+        RETURN_FALSE;
+    }
+
+    key.data = (u_char *) ZSTR_VAL(name);
+    key.len = ZSTR_LEN(name);
+
+    if (ngx_http_php_counter_get(&key, &value) != NGX_OK) {
+        RETURN_FALSE;
+    }
+
+    RETURN_LONG((zend_long) value);
+}
+
+PHP_FUNCTION(ngx_limit)
+{
+    zend_string         *name;
+    double              rate;
+    zend_long           burst = 0;
+    uint64_t            delay;
+    ngx_str_t           key;
+    ngx_int_t           rc;
+
+    if (zend_parse_parameters(ZEND_NUM_ARGS(), "Sd|l", &name, &rate, &burst) == FAILURE) {
+        RETURN_FALSE;
+    }
+
+    if (burst < 0) {
+        RETURN_FALSE;
+    }
+
+    key.data = (u_char *) ZSTR_VAL(name);
+    key.len = ZSTR_LEN(name);
+
+    rc = ngx_http_php_limit(&key, rate, (ngx_uint_t) burst, &delay);
+
+    if (rc == NGX_ERROR) {
+        RETURN_FALSE;
+    }
+
+    RETURN_DOUBLE((double) delay / 1000000);
+}
@@ -0,0 +1,280 @@
+/*
+==============================================================================
+Copyright (c) 2016-2020, rryqszq4 <rryqszq@gmail.com>
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+
+* Redistributions of source code must retain the above copyright notice, this
+  list of conditions and the following disclaimer.
+
+* Redistributions in binary form must reproduce the above copyright notice,
+  this list of conditions and the following disclaimer in the documentation
+  and/or other materials provided with the distribution.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+==============================================================================
+*/
+
+#include "php_ngx_file.h"
+#include "../../ngx_http_php_module.h"
+#include "../../ngx_http_php_sleep.h"
+#include "../../ngx_http_php_file.h"
+
+static void php_ngx_file_task(INTERNAL_FUNCTION_PARAMETERS, ngx_uint_t op);
+
+PHP_FUNCTION(ngx_send_file)
+{
+    zend_string                     *path;
+    zend_long                       offset = 0;
+    zend_long                       length = -1;
+    ngx_str_t                       name;
+    ngx_buf_t                       *b;
+    ngx_open_file_info_t            of;
+    ngx_http_request_t              *r;
+    ngx_http_php_ctx_t              *ctx;
+    ngx_http_core_loc_conf_t        *clcf;
+    ngx_http_php_rputs_chain_list_t *chain;
+    ngx_uint_t                      whole;
+
+    if (zend_parse_parameters(ZEND_NUM_ARGS(), "P|ll", &path, &offset, &length) == FAILURE) {
+        RETURN_FALSE;
+    }
+
+    r = ngx_php_request;
+    ctx = r ? ngx_http_get_module_ctx(r, ngx_http_php_module) : NULL;
+
+    if (ctx == NULL || !(ctx->output_type & OUTPUT_CONTENT)) {
+        RETURN_FALSE;
+    }
+
+    name.len = ZSTR_LEN(path);
+    name.data = ngx_pnalloc(r->pool, name.len + 1);
+    if (name.data == NULL) {
+        RETURN_FALSE;
+    }
+
+    ngx_cpystrn(name.data, (u_char *) ZSTR_VAL(path), name.len + 1);
+
+    /* the same lookup as the static module, through open_file_cache */
+
+    clcf = ngx_http_get_module_loc_conf(r, ngx_http_core_module);
+
+    ngx_memzero(&of, sizeof(ngx_open_file_info_t));
+
+    of.read_ahead = clcf->read_ahead;
+    of.directio = clcf->directio;
+    of.valid = clcf->open_file_cache_valid;
+    of.min_uses = clcf->open_file_cache_min_uses;
+    of.errors = clcf->open_file_cache_errors;
+    of.events = clcf->open_file_cache_events;
+
+    if (ngx_http_set_disable_symlinks(r, clcf, &name, &of) != NGX_OK) {
+        RETURN_FALSE;
+    }
+
+    if (ngx_open_cached_file(clcf->open_file_cache, &name, &of, r->pool) != NGX_OK) {
+        php_error_docref(NULL, E_WARNING, "%s \"%s\" failed: %s", 
+                         of.failed, name.data, strerror(of.err));
+        RETURN_FALSE;
+    }
+
+    if (!of.is_file) {
+        php_error_docref(NULL, E_WARNING, "\"%s\" is not a file", name.data);
+        RETURN_FALSE;
+    }
+
+    if (offset < 0 || offset > of.size) {
+        php_error_docref(NULL, E_WARNING, "offset out of range");
+        RETURN_FALSE;
+    }
+
+    if (length < 0 || length > of.size - offset) {
+        length = of.size - offset;
+    }
+
+    if (length == 0) {
+        RETURN_TRUE;
+    }
+
+    b = ngx_calloc_buf(r->pool);
+    if (b == NULL) {
+        RETURN_FALSE;
+    }
+
+    b->file = ngx_pcalloc(r->pool, sizeof(ngx_file_t));
+    if (b->file == NULL) {
+        RETURN_FALSE;
+    }
+
+    b->file_pos = offset;
+    b->file_last = offset + length;
+    b->in_file = 1;
+
+    b->file->fd = of.fd;
+    b->file->name = name;
+    b->file->log = r->connection->log;
+    b->file->directio = of.is_directio;
+
+    whole = (ctx->rputs_chain == NULL && offset == 0 && length == of.size);
+
+    if (ctx->rputs_chain == NULL) {
+        chain = ngx_pcalloc(r->pool, sizeof(ngx_http_php_rputs_chain_list_t));
+        if (chain == NULL) {
+            RETURN_FALSE;
+        }
+
+        chain->out = ngx_alloc_chain_link(r->pool);
+        if (chain->out == NULL) {
+            RETURN_FALSE;
+        }
+
+        chain->last = &chain->out;
+
+    } else {
+        chain = ctx->rputs_chain;
+
+        (*chain->last)->next = ngx_alloc_chain_link(r->pool);
+        if ((*chain->last)->next == NULL) {
+            RETURN_FALSE;
+        }
+
+        chain->last = &(*chain->last)->next;
+    }
+
+    (*chain->last)->buf = b;
+    (*chain->last)->next = NULL;
+
+    ctx->rputs_chain = chain;
+
+    if (r->headers_out.content_length_n == -1) {
+        r->headers_out.content_length_n += length + 1;
+    } else {
+        r->headers_out.content_length_n += length;
+    }
+
+    /* 
+     * a file sent alone is a static response, the range filter and 
+     * conditional requests apply; anything appended later undoes it
+     */
+
+    if (whole) {
+        r->allow_ranges = 1;
+        r->headers_out.last_modified_time = of.mtime;
+
+        if (ngx_http_set_etag(r) != NGX_OK) {
+            RETURN_FALSE;
+        }
+
+    } else {
+        ngx_http_php_output_not_file(r);
+    }
+
+    RETURN_TRUE;
+}
+
+/* 
+ * The file functions run on the location's php_thread_pool and resume
+ * the coroutine when done, without one they block as php's own do.
+ */
+
+static void 
+php_ngx_file_task(INTERNAL_FUNCTION_PARAMETERS, ngx_uint_t op)
+{
+    zend_string                 *path;
+    zend_string                 *data = NULL;
+    ngx_http_request_t          *r;
+    ngx_http_php_ctx_t          *ctx;
+    ngx_http_php_file_task_t    *ft;
+
+    if (op == NGX_HTTP_PHP_FILE_WRITE || op == NGX_HTTP_PHP_FILE_APPEND) {
+        if (zend_parse_parameters(ZEND_NUM_ARGS(), "PS", &path, &data) == FAILURE) {
+            RETURN_FALSE;
+        }
+
+    } else {
+        if (zend_parse_parameters(ZEND_NUM_ARGS(), "P", &path) == FAILURE) {
+            RETURN_FALSE;
+        }
+    }
+
+    r = ngx_php_request;
+    ctx = r ? ngx_http_get_module_ctx(r, ngx_http_php_module) : NULL;
+
+    if ( !ctx ) {
+        RETURN_FALSE;
+    }
+
+    ft = ngx_http_php_file_task(r);
+    if (ft == NULL) {
+        goto failed;
+    }
+
+    ft->op = op;
+
+    ft->path.len = ZSTR_LEN(path);
+    ft->path.data = ngx_pnalloc(r->pool, ft->path.len + 1);
+    if (ft->path.data == NULL) {
+        goto failed;
+    }
+
+    ngx_cpystrn(ft->path.data, (u_char *) ZSTR_VAL(path), ft->path.len + 1);
+
+    if (data && ZSTR_LEN(data)) {
+
+        /* the php string may be gone before the thread writes it */
+
+        ft->data.len = ZSTR_LEN(data);
+        ft->data.data = ngx_pnalloc(r->pool, ft->data.len);
+        if (ft->data.data == NULL) {
+            goto failed;
+        }
+
+        ngx_memcpy(ft->data.data, ZSTR_VAL(data), ft->data.len);
+    }
+
+    if (ngx_http_php_file_post(r, ft) != NGX_OK) {
+        goto failed;
+    }
+
+    RETURN_TRUE;
+
+failed:
+
+    ZVAL_FALSE(&ctx->yield_retval);
+
+    ctx->delay_time = 0;
+    ngx_http_php_sleep(r);
+
+    RETURN_FALSE;
+}
+
+PHP_FUNCTION(ngx_file_read)
+{
+    php_ngx_file_task(INTERNAL_FUNCTION_PARAM_PASSTHRU, NGX_HTTP_PHP_FILE_READ);
+}
+
+PHP_FUNCTION(ngx_file_write)
+{
+    php_ngx_file_task(INTERNAL_FUNCTION_PARAM_PASSTHRU, NGX_HTTP_PHP_FILE_WRITE);
+}
+
+PHP_FUNCTION(ngx_file_append)
+{
+    php_ngx_file_task(INTERNAL_FUNCTION_PARAM_PASSTHRU, NGX_HTTP_PHP_FILE_APPEND);
+}
+
+PHP_FUNCTION(ngx_file_stat)
+{
+    php_ngx_file_task(INTERNAL_FUNCTION_PARAM_PASSTHRU, NGX_HTTP_PHP_FILE_STAT);
+}
@@ -0,0 +1,903 @@
+/*
+==============================================================================
+Copyright (c) 2016-2020, rryqszq4 <rryqszq@gmail.com>
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+
+* Redistributions of source code must retain the above copyright notice, this
+  list of conditions and the following disclaimer.
+
+* Redistributions in binary form must reproduce the above copyright notice,
+  this list of conditions and the following disclaimer in the documentation
+  and/or other materials provided with the distribution.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+==============================================================================
+*/
+
+#include "../../ngx_http_php_module.h"
+#include "../../ngx_http_php_socket.h"
+#include "../../ngx_http_php_sleep.h"
+#include "php_ngx_http.h"
+
+enum {
+    PHP_NGX_HTTP_STATUS = 0,
+    PHP_NGX_HTTP_HEADERS,
+    PHP_NGX_HTTP_BODY,
+    PHP_NGX_HTTP_DONE
+};
+
+enum {
+    PHP_NGX_HTTP_BODY_NONE = 0,
+    PHP_NGX_HTTP_BODY_LENGTH,
+    PHP_NGX_HTTP_BODY_CHUNKED,
+    PHP_NGX_HTTP_BODY_CLOSE
+};
+
+static php_ngx_http_client_t *php_ngx_http_client(ngx_http_request_t *r, 
+    ngx_http_php_ctx_t *ctx);
+static void php_ngx_http_client_cleanup(void *data);
+static ngx_int_t php_ngx_http_header(php_ngx_http_client_t *hc);
+static void php_ngx_http_header_done(php_ngx_http_client_t *hc);
+static ngx_int_t php_ngx_http_body(php_ngx_http_client_t *hc, ngx_buf_t *b);
+static void php_ngx_http_finish(php_ngx_http_client_t *hc);
+static ngx_int_t php_ngx_http_input_filter(void *data, ngx_buf_t *b, 
+    zval *retval, zend_string **next);
+static ngx_int_t php_ngx_http_append_headers(smart_str *buf, HashTable *headers, 
+    ngx_uint_t *found);
+static ngx_int_t php_ngx_http_token(zend_string *str);
+static void php_ngx_http_yield_false(ngx_http_request_t *r, ngx_http_php_ctx_t *ctx);
+
+#define PHP_NGX_HTTP_HAS_HOST               0x01
+#define PHP_NGX_HTTP_HAS_CONNECTION         0x02
+#define PHP_NGX_HTTP_HAS_CONTENT_LENGTH     0x04
+
+static php_ngx_http_client_t *
+php_ngx_http_client(ngx_http_request_t *r, ngx_http_php_ctx_t *ctx)
+{
+    php_ngx_http_client_t   *hc;
+    ngx_pool_cleanup_t      *cln;
+
+    if (ctx->http_client) {
+        return ctx->http_client;
+    }
+
+    /* one per request, reused by every ngx_http_request() it makes */
+
+    hc = ngx_pcalloc(r->pool, sizeof(php_ngx_http_client_t));
+    if (hc == NULL) {
+        return NULL;
+    }
+
+    hc->parser = ngx_palloc(r->pool, sizeof(ngx_http_request_t));
+    if (hc->parser == NULL) {
+        return NULL;
+    }
+
+    cln = ngx_pool_cleanup_add(r->pool, 0);
+    if (cln == NULL) {
+        return NULL;
+    }
+
+    cln->handler = php_ngx_http_client_cleanup;
+    cln->data = hc;
+
+    ZVAL_UNDEF(&hc->result);
+    ZVAL_UNDEF(&hc->headers);
+
+    ctx->http_client = hc;
+
+    return hc;
+}
+
+static void 
+php_ngx_http_client_cleanup(void *data)
+{
+    php_ngx_http_client_t   *hc = data;
+
+    zval_ptr_dtor(&hc->result);
+    ZVAL_UNDEF(&hc->result);
+
+    zval_ptr_dtor(&hc->headers);
+    ZVAL_UNDEF(&hc->headers);
+
+    smart_str_free(&hc->body);
+}
+
+static ngx_int_t 
+php_ngx_http_header(php_ngx_http_client_t *hc)
+{
+    ngx_http_request_t  *p = hc->parser;
+    zend_string         *key;
+    zval                value, *old, list;
+    u_char              *v;
+    size_t              len;
+
+    key = zend_string_init((char *) p->header_name_start, 
+                           p->header_name_end - p->header_name_start, 0);
+    zend_str_tolower(ZSTR_VAL(key), ZSTR_LEN(key));
+
+    v = p->header_start;
+    len = p->header_end - p->header_start;
+
+    if (zend_string_equals_literal(key, "content-length")) {
+        hc->length = ngx_atoof(v, len);
+
+        if (hc->length == NGX_ERROR) {
+            zend_string_release(key);
+            return NGX_ERROR;
+        }
+
+    } else if (zend_string_equals_literal(key, "transfer-encoding")) {
+        if (ngx_strlcasestrn(v, v + len, (u_char *) "chunked", 7 - 1)) {
+            hc->body_mode = PHP_NGX_HTTP_BODY_CHUNKED;
+        }
+
+    } else if (zend_string_equals_literal(key, "connection")) {
+        if (ngx_strlcasestrn(v, v + len, (u_char *) "close", 5 - 1)) {
+            hc->server_close = 1;
+
+        } else if (ngx_strlcasestrn(v, v + len, (u_char *) "keep-alive", 10 - 1)) {
+            hc->server_close = 0;
+        }
+    }
+
+    /* repeated headers, e.g. set-cookie, become a list */
+
+    ZVAL_STRINGL(&value, (char *) v, len);
+
+    old = zend_hash_find(Z_ARRVAL(hc->headers), key);
+
+    if (old == NULL) {
+        zend_hash_add_new(Z_ARRVAL(hc->headers), key, &value);
+
+    } else if (Z_TYPE_P(old) == IS_ARRAY) {
+        add_next_index_zval(old, &value);
+
+    } else {
+        array_init_size(&list, 2);
+        add_next_index_zval(&list, old);
+        add_next_index_zval(&list, &value);
+        ZVAL_COPY_VALUE(old, &list);
+    }
+
+    zend_string_release(key);
+
+    return NGX_OK;
+}
+
+static void 
+php_ngx_http_header_done(php_ngx_http_client_t *hc)
+{
+    ngx_uint_t      code;
+
+    code = hc->status.code;
+
+    if (hc->head || code == 204 || code == 304 || code < 200) {
+        hc->body_mode = PHP_NGX_HTTP_BODY_NONE;
+
+    } else if (hc->body_mode == PHP_NGX_HTTP_BODY_CHUNKED) {
+        ngx_memzero(&hc->chunked, sizeof(ngx_http_chunked_t));
+
+    } else if (hc->length == 0) {
+        hc->body_mode = PHP_NGX_HTTP_BODY_NONE;
+
+    } else if (hc->length > 0) {
+        hc->body_mode = PHP_NGX_HTTP_BODY_LENGTH;
+
+    } else {
+        /* the body ends with the connection */
+        hc->body_mode = PHP_NGX_HTTP_BODY_CLOSE;
+        hc->server_close = 1;
+    }
+
+    zval_ptr_dtor(&hc->result);
+
+    array_init_size(&hc->result, 3);
+    add_assoc_long(&hc->result, "status", (zend_long) code);
+    add_assoc_zval(&hc->result, "headers", &hc->headers);
+    ZVAL_UNDEF(&hc->headers);
+
+    hc->phase = PHP_NGX_HTTP_BODY;
+}
+
+static ngx_int_t 
+php_ngx_http_body(php_ngx_http_client_t *hc, ngx_buf_t *b)
+{
+    size_t          n;
+    ngx_int_t       rc;
+
+    switch (hc->body_mode) {
+
+    case PHP_NGX_HTTP_BODY_NONE:
+        return NGX_OK;
+
+    case PHP_NGX_HTTP_BODY_LENGTH:
+        n = b->last - b->pos;
+
+        if ((off_t) n > hc->length) {
+            n = (size_t) hc->length;
+        }
+
+        smart_str_appendl(&hc->body, (char *) b->pos, n);
+        b->pos += n;
+        hc->length -= n;
+
+        if (hc->length == 0) {
+            return NGX_OK;
+        }
+
+        return b->last_buf ? NGX_ERROR : NGX_AGAIN;
+
+    case PHP_NGX_HTTP_BODY_CLOSE:
+        smart_str_appendl(&hc->body, (char *) b->pos, b->last - b->pos);
+        b->pos = b->last;
+
+        return b->last_buf ? NGX_OK : NGX_AGAIN;
+    }
+
+    /* chunked */
+
+    for ( ;; ) {
+        rc = ngx_http_parse_chunked(hc->parser, b, &hc->chunked);
+
+        if (rc == NGX_OK) {
+
+            /* a part of the chunk data is in the buffer */
+
+            n = b->last - b->pos;
+
+            if ((off_t) n > hc->chunked.size) {
+                n = (size_t) hc->chunked.size;
+            }
+
+            smart_str_appendl(&hc->body, (char *) b->pos, n);
+            b->pos += n;
+            hc->chunked.size -= n;
+
+            continue;
+        }
+
+        if (rc == NGX_DONE) {
+            return NGX_OK;
+        }
+
+        if (rc == NGX_AGAIN) {
+            return b->last_buf ? NGX_ERROR : NGX_AGAIN;
+        }
+
+        /* invalid chunked body */
+
+        return NGX_ERROR;
+    }
+}
+
+static void 
+php_ngx_http_finish(php_ngx_http_client_t *hc)
+{
+    hc->phase = PHP_NGX_HTTP_DONE;
+
+    /* the socket layer parks or closes the connection right after */
+
+    if (hc->keepalive && !hc->server_close) {
+        hc->upstream->release = NGX_HTTP_PHP_SOCKET_RELEASE_KEEPALIVE;
+
+    } else {
+        hc->upstream->release = NGX_HTTP_PHP_SOCKET_RELEASE_CLOSE;
+    }
+}
+
+static ngx_int_t 
+php_ngx_http_input_filter(void *data, ngx_buf_t *b, zval *retval, 
+    zend_string **next)
+{
+    php_ngx_http_client_t   *hc = data;
+    u_char                  *line;
+    ngx_int_t               rc;
+
+    for ( ;; ) {
+
+        switch (hc->phase) {
+
+        case PHP_NGX_HTTP_STATUS:
+            line = b->pos;
+
+            rc = ngx_http_parse_status_line(hc->parser, b, &hc->status);
+
+            if (rc == NGX_AGAIN) {
+
+                /* 
+                 * The receive buffer may be moved before the next call,
+                 * the line is parsed again from its start.
+                 */
+
+                b->pos = line;
+                hc->parser->state = 0;
+                ngx_memzero(&hc->status, sizeof(ngx_http_status_t));
+
+                return b->last_buf ? NGX_ERROR : NGX_AGAIN;
+            }
+
+            if (rc != NGX_OK) {
+                return NGX_ERROR;
+            }
+
+            hc->parser->state = 0;
+
+            hc->length = -1;
+            hc->body_mode = PHP_NGX_HTTP_BODY_NONE;
+            hc->server_close = hc->status.http_version < NGX_HTTP_VERSION_11;
+
+            zval_ptr_dtor(&hc->headers);
+            array_init(&hc->headers);
+
+            hc->phase = PHP_NGX_HTTP_HEADERS;
+            break;
+
+        case PHP_NGX_HTTP_HEADERS:
+            line = b->pos;
+
+            rc = ngx_http_parse_header_line(hc->parser, b, 1);
+
+            if (rc == NGX_OK) {
+                if (php_ngx_http_header(hc) != NGX_OK) {
+                    return NGX_ERROR;
+                }
+
+                break;
+            }
+
+            if (rc == NGX_AGAIN) {
+                b->pos = line;
+                hc->parser->state = 0;
+
+                return b->last_buf ? NGX_ERROR : NGX_AGAIN;
+            }
+
+            if (rc != NGX_HTTP_PARSE_HEADER_DONE) {
+                return NGX_ERROR;
+            }
+
+            hc->parser->state = 0;
+
+            if (hc->status.code >= 100 && hc->status.code < 200 
+                && hc->status.code != 101) 
+            {
+                /* "100 Continue" and alike, the final response follows */
+
+                ngx_memzero(&hc->status, sizeof(ngx_http_status_t));
+                hc->phase = PHP_NGX_HTTP_STATUS;
+                break;
+            }
+
+            php_ngx_http_header_done(hc);
+
+            if (hc->stream) {
+
+                /* the body is read with ngx_http_request_read() */
+
+                if (hc->body_mode == PHP_NGX_HTTP_BODY_NONE) {
+                    php_ngx_http_finish(hc);
+                }
+
+                ZVAL_COPY_VALUE(retval, &hc->result);
+                ZVAL_UNDEF(&hc->result);
+
+                return NGX_OK;
+            }
+
+            break;
+
+        case PHP_NGX_HTTP_BODY:
+            rc = php_ngx_http_body(hc, b);
+
+            if (rc == NGX_ERROR) {
+                return NGX_ERROR;
+            }
+
+            if (rc == NGX_OK) {
+                php_ngx_http_finish(hc);
+            }
+
+            if (hc->stream) {
+
+                /* whatever is there, or "" once the body is complete */
+
+                if (rc == NGX_AGAIN && (hc->body.s == NULL || ZSTR_LEN(hc->body.s) == 0)) {
+                    return NGX_AGAIN;
+                }
+
+                if (hc->body.s) {
+                    smart_str_0(&hc->body);
+                    ZVAL_STR(retval, hc->body.s);
+                    hc->body.s = NULL;
+
+                } else {
+                    ZVAL_EMPTY_STRING(retval);
+                }
+
+                return NGX_OK;
+            }
+
+            if (rc == NGX_AGAIN) {
+                return NGX_AGAIN;
+            }
+
+            if (hc->body.s) {
+                smart_str_0(&hc->body);
+                add_assoc_str(&hc->result, "body", hc->body.s);
+                hc->body.s = NULL;
+
+            } else {
+                add_assoc_stringl(&hc->result, "body", "", 0);
+            }
+
+            ZVAL_COPY_VALUE(retval, &hc->result);
+            ZVAL_UNDEF(&hc->result);
+
+            return NGX_OK;
+
+        default:
+            return NGX_ERROR;
+        }
+    }
+}
+
+static ngx_int_t 
+php_ngx_http_append_headers(smart_str *buf, HashTable *headers, ngx_uint_t *found)
+{
+    zend_string     *name, *str;
+    zval            *val, *item;
+    HashTable       *values;
+    size_t          i;
+
+    ZEND_HASH_FOREACH_STR_KEY_VAL(headers, name, val) {
+        if (name == NULL) {
+            return NGX_ERROR;
+        }
+
+        for (i = 0; i < ZSTR_LEN(name); i++) {
+            if (ZSTR_VAL(name)[i] <= ' ' || ZSTR_VAL(name)[i] == ':') {
+                return NGX_ERROR;
+            }
+        }
+
+        if (zend_string_equals_literal_ci(name, "host")) {
+            *found |= PHP_NGX_HTTP_HAS_HOST;
+
+        } else if (zend_string_equals_literal_ci(name, "connection")) {
+            *found |= PHP_NGX_HTTP_HAS_CONNECTION;
+
+        } else if (zend_string_equals_literal_ci(name, "content-length")) {
+            *found |= PHP_NGX_HTTP_HAS_CONTENT_LENGTH;
+        }
+
+        ZVAL_DEREF(val);
+
+        /* "name" => ["v1", "v2"] sends the header twice */
+
+        values = NULL;
+        item = val;
+
+        if (Z_TYPE_P(val) == IS_ARRAY) {
+            values = Z_ARRVAL_P(val);
+        }
+
+        if (values) {
+            ZEND_HASH_FOREACH_VAL(values, item) {
+                str = zval_get_string(item);
+
+                if (memchr(ZSTR_VAL(str), '\r', ZSTR_LEN(str)) 
+                    || memchr(ZSTR_VAL(str), '\n', ZSTR_LEN(str))) 
+                {
+                    zend_string_release(str);
+                    return NGX_ERROR;
+                }
+
+                smart_str_append(buf, name);
+                smart_str_appendl(buf, ": ", 2);
+                smart_str_append(buf, str);
+                smart_str_appendl(buf, "\r\n", 2);
+
+                zend_string_release(str);
+            } ZEND_HASH_FOREACH_END();
+
+            continue;
+        }
+
+        str = zval_get_string(item);
+
+        if (memchr(ZSTR_VAL(str), '\r', ZSTR_LEN(str)) 
+            || memchr(ZSTR_VAL(str), '\n', ZSTR_LEN(str))) 
+        {
+            zend_string_release(str);
+            return NGX_ERROR;
+        }
+
+        smart_str_append(buf, name);
+        smart_str_appendl(buf, ": ", 2);
+        smart_str_append(buf, str);
+        smart_str_appendl(buf, "\r\n", 2);
+
+        zend_string_release(str);
+    } ZEND_HASH_FOREACH_END();
+
+    return NGX_OK;
+}
+
+/* a method is a token of RFC 7230, nothing to end the request line with */
+static ngx_int_t 
+php_ngx_http_token(zend_string *str)
+{
+    u_char  c;
+    size_t  i;
+
+    if (ZSTR_LEN(str) == 0) {
+        return NGX_ERROR;
+    }
+
+    for (i = 0; i < ZSTR_LEN(str); i++) {
+        c = (u_char) ZSTR_VAL(str)[i];
+
+        if ((c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') 
+            || (c >= '0' && c <= '9')) 
+        {
+            continue;
+        }
+
+        if (c == '\0' || ngx_strchr("!#$%&'*+-.^_`|~", c) == NULL) {
+            return NGX_ERROR;
+        }
+    }
+
+    return NGX_OK;
+}
+
+static void 
+php_ngx_http_yield_false(ngx_http_request_t *r, ngx_http_php_ctx_t *ctx)
+{
+    ZVAL_FALSE(&ctx->yield_retval);
+
+    ctx->delay_time = 0;
+    ngx_http_php_sleep(r);
+}
+
+PHP_FUNCTION(ngx_http_request)
+{
+    zend_string             *url;
+    zval                    *options = NULL;
+    zval                    *opt;
+    zend_string             *method = NULL;
+    zend_string             *body = NULL;
+    HashTable               *headers = NULL;
+    zend_long               timeout = 0;
+    zend_bool               keepalive = 1;
+    zend_bool               stream = 0;
+    zend_string             *pool = NULL;
+
+    u_char                  *p, *last, *host, *host_end, *authority, *authority_end;
+    ngx_int_t               port;
+    ngx_uint_t              found;
+    smart_str               buf = {0};
+
+    ngx_http_request_t      *r;
+    ngx_http_php_ctx_t      *ctx;
+    php_ngx_http_client_t   *hc;
+
+    if (zend_parse_parameters(ZEND_NUM_ARGS(), "S|a", &url, &options) == FAILURE) {
+        RETURN_FALSE;
+    }
+
+    r = ngx_php_request;
+    ctx = r ? ngx_http_get_module_ctx(r, ngx_http_php_module) : NULL;
+
+    if ( !ctx ) {
+        RETURN_FALSE;
+    }
+
+    if (options) {
+        if ((opt = zend_hash_str_find(Z_ARRVAL_P(options), "method", sizeof("method") - 1))) {
+            method = zval_get_string(opt);
+        }
+
+        if ((opt = zend_hash_str_find(Z_ARRVAL_P(options), "body", sizeof("body") - 1))) {
+            body = zval_get_string(opt);
+        }
+
+        if ((opt = zend_hash_str_find(Z_ARRVAL_P(options), "headers", sizeof("headers") - 1)) 
+            && Z_TYPE_P(opt) == IS_ARRAY) 
+        {
+            headers = Z_ARRVAL_P(opt);
+        }
+
+        if ((opt = zend_hash_str_find(Z_ARRVAL_P(options), "timeout", sizeof("timeout") - 1))) {
+            timeout = zval_get_long(opt);
+        }
+
+        if ((opt = zend_hash_str_find(Z_ARRVAL_P(options), "keepalive", sizeof("keepalive") - 1))) {
+            keepalive = zend_is_true(opt);
+        }
+
+        if ((opt = zend_hash_str_find(Z_ARRVAL_P(options), "stream", sizeof("stream") - 1))) {
+            stream = zend_is_true(opt);
+        }
+
+        if ((opt = zend_hash_str_find(Z_ARRVAL_P(options), "pool", sizeof("pool") - 1))) {
+            pool = zval_get_string(opt);
+        }
+    }
+
+    /* http://host[:port][/path][?query] */
+
+    p = (u_char *) ZSTR_VAL(url);
+    last = p + ZSTR_LEN(url);
+
+    if (ZSTR_LEN(url) < 8 || ngx_strncasecmp(p, (u_char *) "http://", 7) != 0) {
+        php_error_docref(NULL, E_WARNING, "only http:// urls are supported");
+        goto failed;
+    }
+
+    /* the url goes into the request line and the host header as is */
+
+    for (p += 7; p < last; p++) {
+        if (*p <= ' ' || *p == 0x7f) {
+            php_error_docref(NULL, E_WARNING, "invalid url");
+            goto failed;
+        }
+    }
+
+    if (method && php_ngx_http_token(method) != NGX_OK) {
+        php_error_docref(NULL, E_WARNING, "invalid method");
+        goto failed;
+    }
+
+    p = (u_char *) ZSTR_VAL(url) + 7;
+    authority = p;
+
+    while (p < last && *p != '/' && *p != '?' && *p != '#') {
+        p++;
+    }
+
+    authority_end = p;
+
+    host = authority;
+    host_end = authority_end;
+    port = 80;
+
+    if (host < host_end && *host == '[') {
+        /* [::1]:8080 */
+        host_end = ngx_strlchr(host, authority_end, ']');
+
+        if (host_end == NULL) {
+            php_error_docref(NULL, E_WARNING, "invalid url");
+            goto failed;
+        }
+
+        host_end++;
+    }
+
+    p = ngx_strlchr(host_end, authority_end, ':');
+
+    if (p) {
+        port = ngx_atoi(p + 1, authority_end - p - 1);
+
+        if (port < 1 || port > 65535) {
+            php_error_docref(NULL, E_WARNING, "invalid port in url");
+            goto failed;
+        }
+
+        host_end = p;
+    }
+
+    if (host == host_end) {
+        php_error_docref(NULL, E_WARNING, "invalid url");
+        goto failed;
+    }
+
+    /* the request */
+
+    found = 0;
+
+    if (method) {
+        smart_str_append(&buf, method);
+
+    } else if (body) {
+        smart_str_appendl(&buf, "POST", 4);
+
+    } else {
+        smart_str_appendl(&buf, "GET", 3);
+    }
+
+    smart_str_appendc(&buf, ' ');
+
+    if (authority_end == last || *authority_end != '/') {
+        smart_str_appendc(&buf, '/');
+    }
+
+    p = ngx_strlchr(authority_end, last, '#');
+    smart_str_appendl(&buf, (char *) authority_end, (p ? p : last) - authority_end);
+
+    smart_str_appendl(&buf, " HTTP/1.1\r\n", sizeof(" HTTP/1.1\r\n") - 1);
+
+    if (headers && php_ngx_http_append_headers(&buf, headers, &found) != NGX_OK) {
+        php_error_docref(NULL, E_WARNING, "invalid header");
+        goto failed;
+    }
+
+    if (!(found & PHP_NGX_HTTP_HAS_HOST)) {
+        smart_str_appendl(&buf, "Host: ", 6);
+        smart_str_appendl(&buf, (char *) authority, authority_end - authority);
+        smart_str_appendl(&buf, "\r\n", 2);
+    }
+
+    if (!(found & PHP_NGX_HTTP_HAS_CONNECTION)) {
+        if (keepalive) {
+            smart_str_appendl(&buf, "Connection: keep-alive\r\n", 
+                              sizeof("Connection: keep-alive\r\n") - 1);
+
+        } else {
+            smart_str_appendl(&buf, "Connection: close\r\n", 
+                              sizeof("Connection: close\r\n") - 1);
+        }
+    }
+
+    if (body && !(found & PHP_NGX_HTTP_HAS_CONTENT_LENGTH)) {
+        smart_str_appendl(&buf, "Content-Length: ", sizeof("Content-Length: ") - 1);
+        smart_str_append_unsigned(&buf, (zend_ulong) ZSTR_LEN(body));
+        smart_str_appendl(&buf, "\r\n", 2);
+    }
+
+    smart_str_appendl(&buf, "\r\n", 2);
+
+    if (body) {
+        smart_str_append(&buf, body);
+    }
+
+    smart_str_0(&buf);
+
+    /* the parser state */
+
+    hc = php_ngx_http_client(r, ctx);
+    if (hc == NULL) {
+        goto failed;
+    }
+
+    ngx_memcpy(hc->parser, r, sizeof(ngx_http_request_t));
+    hc->parser->state = 0;
+
+    ngx_memzero(&hc->status, sizeof(ngx_http_status_t));
+    hc->phase = PHP_NGX_HTTP_STATUS;
+    hc->body_mode = PHP_NGX_HTTP_BODY_NONE;
+    hc->length = -1;
+    hc->head = method && zend_string_equals_literal_ci(method, "HEAD");
+    hc->stream = stream;
+    hc->keepalive = keepalive;
+    hc->server_close = 0;
+
+    php_ngx_http_client_cleanup(hc);
+
+    /* one connection per request, a previous one is not reused implicitly */
+
+    if (ctx->upstream && ctx->upstream->peer.connection) {
+        ngx_http_php_socket_clear(r);
+    }
+
+    ctx->host.data = ngx_pnalloc(r->pool, host_end - host + 1);
+    if (ctx->host.data == NULL) {
+        goto failed;
+    }
+
+    ctx->host.len = ngx_cpymem(ctx->host.data, host, host_end - host) - ctx->host.data;
+    ctx->host.data[ctx->host.len] = '\0';
+    ctx->port = (in_port_t) port;
+
+    ctx->pool_name.len = 0;
+
+    if (pool && ZSTR_LEN(pool)) {
+        ctx->pool_name.data = ngx_pnalloc(r->pool, ZSTR_LEN(pool));
+        if (ctx->pool_name.data == NULL) {
+            goto failed;
+        }
+
+        ctx->pool_name.len = ngx_cpymem(ctx->pool_name.data, ZSTR_VAL(pool), ZSTR_LEN(pool)) 
+                             - ctx->pool_name.data;
+    }
+
+    if (ngx_http_php_socket_connect(r) == NGX_ERROR) {
+        goto failed;
+    }
+
+    hc->upstream = ctx->upstream;
+
+    if (timeout > 0) {
+        ngx_http_php_socket_set_deadline(r, (ngx_msec_t) timeout);
+    }
+
+    /* sent once connected, the response becomes the value of "yield" */
+
+    (void) ngx_http_php_socket_request(r, buf.s, php_ngx_http_input_filter, hc);
+
+    if (method) {
+        zend_string_release(method);
+    }
+
+    if (body) {
+        zend_string_release(body);
+    }
+
+    if (pool) {
+        zend_string_release(pool);
+    }
+
+    RETURN_TRUE;
+
+failed:
+
+    smart_str_free(&buf);
+
+    if (method) {
+        zend_string_release(method);
+    }
+
+    if (body) {
+        zend_string_release(body);
+    }
+
+    if (pool) {
+        zend_string_release(pool);
+    }
+
+    php_ngx_http_yield_false(r, ctx);
+
+    RETURN_FALSE;
+}
+
+PHP_FUNCTION(ngx_http_request_read)
+{
+    ngx_http_request_t      *r;
+    ngx_http_php_ctx_t      *ctx;
+    php_ngx_http_client_t   *hc;
+
+    if (zend_parse_parameters_none() == FAILURE) {
+        RETURN_FALSE;
+    }
+
+    r = ngx_php_request;
+    ctx = r ? ngx_http_get_module_ctx(r, ngx_http_php_module) : NULL;
+
+    if ( !ctx ) {
+        RETURN_FALSE;
+    }
+
+    hc = ctx->http_client;
+
+    if (hc == NULL || !hc->stream || hc->phase < PHP_NGX_HTTP_BODY) {
+        php_error_docref(NULL, E_WARNING, "no streamed response to read");
+        php_ngx_http_yield_false(r, ctx);
+        RETURN_FALSE;
+    }
+
+    if (hc->phase == PHP_NGX_HTTP_DONE) {
+        ZVAL_EMPTY_STRING(&ctx->yield_retval);
+
+        ctx->delay_time = 0;
+        ngx_http_php_sleep(r);
+
+        RETURN_TRUE;
+    }
+
+    (void) ngx_http_php_socket_request(r, NULL, php_ngx_http_input_filter, hc);
+
+    RETURN_TRUE;
+}
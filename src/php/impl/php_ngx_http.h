@@ -0,0 +1,79 @@
+/*
+==============================================================================
+Copyright (c) 2016-2020, rryqszq4 <rryqszq@gmail.com>
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+
+* Redistributions of source code must retain the above copyright notice, this
+  list of conditions and the following disclaimer.
+
+* Redistributions in binary form must reproduce the above copyright notice,
+  this list of conditions and the following disclaimer in the documentation
+  and/or other materials provided with the distribution.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+==============================================================================
+*/
+
+#ifndef __PHP_NGX_HTTP_H__
+#define __PHP_NGX_HTTP_H__
+
+#include <php.h>
+#include <php_ini.h>
+#include <ext/standard/info.h>
+#include <zend_smart_str.h>
+#include <ngx_http.h>
+
+#include "../../ngx_http_php_socket.h"
+
+typedef struct {
+
+    /* 
+     * ngx_http_parse_*() keep their state in a request, a copy of the
+     * current one is used so that the real request is not touched
+     */
+    ngx_http_request_t              *parser;
+
+    ngx_http_php_socket_upstream_t  *upstream;
+
+    ngx_uint_t                      phase;
+    ngx_uint_t                      body_mode;
+
+    ngx_http_status_t               status;
+    ngx_http_chunked_t              chunked;
+    off_t                           length;
+
+    zval                            result;
+    zval                            headers;
+    smart_str                       body;
+
+    unsigned                        head:1;
+    unsigned                        stream:1;
+    unsigned                        keepalive:1;
+    unsigned                        server_close:1;
+
+} php_ngx_http_client_t;
+
+ZEND_BEGIN_ARG_INFO_EX(ngx_http_request_arginfo, 0, 0, 1)
+    ZEND_ARG_INFO(0, url)
+    ZEND_ARG_ARRAY_INFO(0, options, 0)
+ZEND_END_ARG_INFO()
+
+ZEND_BEGIN_ARG_INFO_EX(ngx_http_request_read_arginfo, 0, 0, 0)
+ZEND_END_ARG_INFO()
+
+PHP_FUNCTION(ngx_http_request);
+PHP_FUNCTION(ngx_http_request_read);
+
+#endif
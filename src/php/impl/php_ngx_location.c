@@ -0,0 +1,335 @@
+/*
+==============================================================================
+Copyright (c) 2016-2020, rryqszq4 <rryqszq@gmail.com>
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+
+* Redistributions of source code must retain the above copyright notice, this
+  list of conditions and the following disclaimer.
+
+* Redistributions in binary form must reproduce the above copyright notice,
+  this list of conditions and the following disclaimer in the documentation
+  and/or other materials provided with the distribution.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+==============================================================================
+*/
+
+#include <ext/standard/url.h>
+
+#include "php_ngx_location.h"
+#include "../../ngx_http_php_module.h"
+#include "../../ngx_http_php_sleep.h"
+#include "../../ngx_http_php_subrequest.h"
+
+static ngx_int_t php_ngx_location_node(ngx_http_request_t *r, 
+    ngx_http_php_capture_node_t *node, zend_string *uri, zval *options);
+static ngx_int_t php_ngx_location_copy(ngx_http_request_t *r, ngx_str_t *dst, 
+    const char *data, size_t len);
+static void php_ngx_location_yield_false(ngx_http_request_t *r, 
+    ngx_http_php_ctx_t *ctx);
+
+static ngx_int_t 
+php_ngx_location_copy(ngx_http_request_t *r, ngx_str_t *dst, const char *data, 
+    size_t len)
+{
+    dst->len = len;
+
+    if (len == 0) {
+        dst->data = NULL;
+        return NGX_OK;
+    }
+
+    dst->data = ngx_pnalloc(r->pool, len);
+    if (dst->data == NULL) {
+        return NGX_ERROR;
+    }
+
+    ngx_memcpy(dst->data, data, len);
+
+    return NGX_OK;
+}
+
+ngx_int_t 
+php_ngx_location_build_args(smart_str *buf, zval *args)
+{
+    zend_string     *key, *str, *enc;
+    zend_ulong      idx;
+    zval            *val;
+
+    if (Z_TYPE_P(args) != IS_ARRAY) {
+        str = zval_get_string(args);
+        smart_str_append(buf, str);
+        zend_string_release(str);
+        return NGX_OK;
+    }
+
+    /* ["a" => 1, "b" => "x y"] as a=1&b=x%20y */
+
+    ZEND_HASH_FOREACH_KEY_VAL(Z_ARRVAL_P(args), idx, key, val) {
+        if (buf->s && ZSTR_LEN(buf->s)) {
+            smart_str_appendc(buf, '&');
+        }
+
+        if (key) {
+            enc = php_raw_url_encode(ZSTR_VAL(key), ZSTR_LEN(key));
+            smart_str_append(buf, enc);
+            zend_string_release(enc);
+
+        } else {
+            smart_str_append_unsigned(buf, idx);
+        }
+
+        if (Z_TYPE_P(val) == IS_TRUE) {
+            continue;
+        }
+
+        str = zval_get_string(val);
+        enc = php_raw_url_encode(ZSTR_VAL(str), ZSTR_LEN(str));
+
+        smart_str_appendc(buf, '=');
+        smart_str_append(buf, enc);
+
+        zend_string_release(enc);
+        zend_string_release(str);
+    } ZEND_HASH_FOREACH_END();
+
+    return NGX_OK;
+}
+
+static ngx_int_t 
+php_ngx_location_node(ngx_http_request_t *r, ngx_http_php_capture_node_t *node, 
+    zend_string *uri, zval *options)
+{
+    zval            *opt;
+    zend_string     *str;
+    smart_str       args = {0};
+    ngx_str_t       uri_args;
+    ngx_uint_t      flags;
+    ngx_int_t       rc;
+
+    ngx_memzero(node, sizeof(ngx_http_php_capture_node_t));
+
+    if (ZSTR_LEN(uri) == 0 || ZSTR_VAL(uri)[0] != '/') {
+        php_error_docref(NULL, E_WARNING, "capture uri must start with \"/\"");
+        return NGX_ERROR;
+    }
+
+    if (php_ngx_location_copy(r, &node->capture_uri, ZSTR_VAL(uri), ZSTR_LEN(uri)) 
+        != NGX_OK) 
+    {
+        return NGX_ERROR;
+    }
+
+    /* splits "?args" off and rejects unsafe uris */
+
+    ngx_str_null(&uri_args);
+    flags = NGX_HTTP_LOG_UNSAFE;
+
+    if (ngx_http_parse_unsafe_uri(r, &node->capture_uri, &uri_args, &flags) != NGX_OK) {
+        php_error_docref(NULL, E_WARNING, "unsafe capture uri");
+        return NGX_ERROR;
+    }
+
+    if (uri_args.len) {
+        smart_str_appendl(&args, (char *) uri_args.data, uri_args.len);
+    }
+
+    node->method = NGX_HTTP_GET;
+    ngx_str_set(&node->method_name, "GET");
+
+    if (options && Z_TYPE_P(options) == IS_ARRAY) {
+
+        if ((opt = zend_hash_str_find(Z_ARRVAL_P(options), "args", sizeof("args") - 1))) {
+            if (args.s && ZSTR_LEN(args.s)) {
+                smart_str_appendc(&args, '&');
+            }
+
+            php_ngx_location_build_args(&args, opt);
+        }
+
+        if ((opt = zend_hash_str_find(Z_ARRVAL_P(options), "method", sizeof("method") - 1))) {
+            str = zval_get_string(opt);
+
+            rc = php_ngx_location_copy(r, &node->method_name, ZSTR_VAL(str), ZSTR_LEN(str));
+
+            zend_string_release(str);
+
+            if (rc != NGX_OK 
+                || ngx_http_php_subrequest_method(&node->method_name, &node->method) != NGX_OK) 
+            {
+                php_error_docref(NULL, E_WARNING, "unsupported capture method");
+                smart_str_free(&args);
+                return NGX_ERROR;
+            }
+        }
+
+        if ((opt = zend_hash_str_find(Z_ARRVAL_P(options), "body", sizeof("body") - 1))) {
+            node->body = ngx_palloc(r->pool, sizeof(ngx_str_t));
+            if (node->body == NULL) {
+                smart_str_free(&args);
+                return NGX_ERROR;
+            }
+
+            str = zval_get_string(opt);
+
+            rc = php_ngx_location_copy(r, node->body, ZSTR_VAL(str), ZSTR_LEN(str));
+
+            zend_string_release(str);
+
+            if (rc != NGX_OK) {
+                smart_str_free(&args);
+                return NGX_ERROR;
+            }
+        }
+    }
+
+    if (args.s) {
+        rc = php_ngx_location_copy(r, &node->capture_args, ZSTR_VAL(args.s), ZSTR_LEN(args.s));
+        smart_str_free(&args);
+
+        if (rc != NGX_OK) {
+            return NGX_ERROR;
+        }
+    }
+
+    return NGX_OK;
+}
+
+static void 
+php_ngx_location_yield_false(ngx_http_request_t *r, ngx_http_php_ctx_t *ctx)
+{
+    ZVAL_FALSE(&ctx->yield_retval);
+
+    ctx->delay_time = 0;
+    ngx_http_php_sleep(r);
+}
+
+PHP_FUNCTION(ngx_location_capture)
+{
+    zend_string                     *uri;
+    zval                            *options = NULL;
+    ngx_http_request_t              *r;
+    ngx_http_php_ctx_t              *ctx;
+    ngx_http_php_capture_node_t     *node;
+
+    if (zend_parse_parameters(ZEND_NUM_ARGS(), "S|a", &uri, &options) == FAILURE) {
+        RETURN_FALSE;
+    }
+
+    r = ngx_php_request;
+    ctx = r ? ngx_http_get_module_ctx(r, ngx_http_php_module) : NULL;
+
+    if ( !ctx ) {
+        RETURN_FALSE;
+    }
+
+    ctx->capture_multi = ngx_array_create(r->pool, 1, sizeof(ngx_http_php_capture_node_t));
+    if (ctx->capture_multi == NULL) {
+        php_ngx_location_yield_false(r, ctx);
+        RETURN_FALSE;
+    }
+
+    ctx->is_capture_multi = 0;
+
+    node = ngx_array_push(ctx->capture_multi);
+
+    if (node == NULL 
+        || php_ngx_location_node(r, node, uri, options) != NGX_OK
+        || ngx_http_php_subrequest_post(r) != NGX_OK) 
+    {
+        ctx->capture_multi = NULL;
+        php_ngx_location_yield_false(r, ctx);
+        RETURN_FALSE;
+    }
+
+    RETURN_TRUE;
+}
+
+PHP_FUNCTION(ngx_location_capture_multi)
+{
+    zval                            *requests;
+    zval                            *item, *uri, *options;
+    ngx_http_request_t              *r;
+    ngx_http_php_ctx_t              *ctx;
+    ngx_http_php_capture_node_t     *node;
+    zend_string                     *str;
+    ngx_int_t                       rc;
+
+    if (zend_parse_parameters(ZEND_NUM_ARGS(), "a", &requests) == FAILURE) {
+        RETURN_FALSE;
+    }
+
+    r = ngx_php_request;
+    ctx = r ? ngx_http_get_module_ctx(r, ngx_http_php_module) : NULL;
+
+    if ( !ctx ) {
+        RETURN_FALSE;
+    }
+
+    if (zend_hash_num_elements(Z_ARRVAL_P(requests)) == 0) {
+        php_error_docref(NULL, E_WARNING, "no capture requests");
+        php_ngx_location_yield_false(r, ctx);
+        RETURN_FALSE;
+    }
+
+    ctx->capture_multi = ngx_array_create(r->pool, 
+                                          zend_hash_num_elements(Z_ARRVAL_P(requests)), 
+                                          sizeof(ngx_http_php_capture_node_t));
+    if (ctx->capture_multi == NULL) {
+        php_ngx_location_yield_false(r, ctx);
+        RETURN_FALSE;
+    }
+
+    ctx->is_capture_multi = 1;
+
+    /* each request is "/uri" or ["/uri", $options] */
+
+    ZEND_HASH_FOREACH_VAL(Z_ARRVAL_P(requests), item) {
+        uri = item;
+        options = NULL;
+
+        if (Z_TYPE_P(item) == IS_ARRAY) {
+            uri = zend_hash_index_find(Z_ARRVAL_P(item), 0);
+            options = zend_hash_index_find(Z_ARRVAL_P(item), 1);
+        }
+
+        node = ngx_array_push(ctx->capture_multi);
+
+        if (uri == NULL || node == NULL) {
+            goto failed;
+        }
+
+        str = zval_get_string(uri);
+        rc = php_ngx_location_node(r, node, str, options);
+        zend_string_release(str);
+
+        if (rc != NGX_OK) {
+            goto failed;
+        }
+    } ZEND_HASH_FOREACH_END();
+
+    if (ngx_http_php_subrequest_post(r) != NGX_OK) {
+        goto failed;
+    }
+
+    RETURN_TRUE;
+
+failed:
+
+    ctx->capture_multi = NULL;
+    php_ngx_location_yield_false(r, ctx);
+
+    RETURN_FALSE;
+}
@@ -0,0 +1,53 @@
+/*
+==============================================================================
+Copyright (c) 2016-2020, rryqszq4 <rryqszq@gmail.com>
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+
+* Redistributions of source code must retain the above copyright notice, this
+  list of conditions and the following disclaimer.
+
+* Redistributions in binary form must reproduce the above copyright notice,
+  this list of conditions and the following disclaimer in the documentation
+  and/or other materials provided with the distribution.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+==============================================================================
+*/
+
+#ifndef __PHP_NGX_LOCATION_H__
+#define __PHP_NGX_LOCATION_H__
+
+#include <php.h>
+#include <php_ini.h>
+#include <ext/standard/info.h>
+#include <zend_smart_str.h>
+#include <ngx_http.h>
+
+ZEND_BEGIN_ARG_INFO_EX(ngx_location_capture_arginfo, 0, 0, 1)
+    ZEND_ARG_INFO(0, uri)
+    ZEND_ARG_ARRAY_INFO(0, options, 0)
+ZEND_END_ARG_INFO()
+
+ZEND_BEGIN_ARG_INFO_EX(ngx_location_capture_multi_arginfo, 0, 0, 1)
+    ZEND_ARG_ARRAY_INFO(0, requests, 0)
+ZEND_END_ARG_INFO()
+
+/* a query string from a string, or an array url-encoded */
+ngx_int_t php_ngx_location_build_args(smart_str *buf, zval *args);
+
+PHP_FUNCTION(ngx_location_capture);
+PHP_FUNCTION(ngx_location_capture_multi);
+
+#endif
@@ -0,0 +1,1288 @@
+/*
+==============================================================================
+Copyright (c) 2016-2020, rryqszq4 <rryqszq@gmail.com>
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+
+* Redistributions of source code must retain the above copyright notice, this
+  list of conditions and the following disclaimer.
+
+* Redistributions in binary form must reproduce the above copyright notice,
+  this list of conditions and the following disclaimer in the documentation
+  and/or other materials provided with the distribution.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+==============================================================================
+*/
+
+#include <zend_smart_str.h>
+
+#include "../../ngx_http_php_module.h"
+#include "../../ngx_http_php_socket.h"
+#include "../../ngx_http_php_sleep.h"
+#include "php_ngx_memcached.h"
+
+#define PHP_NGX_MEMCACHED_REQUEST_MAGIC     0x80
+#define PHP_NGX_MEMCACHED_RESPONSE_MAGIC    0x81
+
+#define PHP_NGX_MEMCACHED_OP_GET            0x00
+#define PHP_NGX_MEMCACHED_OP_SET            0x01
+#define PHP_NGX_MEMCACHED_OP_DELETE         0x04
+#define PHP_NGX_MEMCACHED_OP_INCREMENT      0x05
+#define PHP_NGX_MEMCACHED_OP_DECREMENT      0x06
+#define PHP_NGX_MEMCACHED_OP_NOOP           0x0a
+#define PHP_NGX_MEMCACHED_OP_GETKQ          0x0d
+
+#define PHP_NGX_MEMCACHED_STATUS_OK         0x0000
+#define PHP_NGX_MEMCACHED_STATUS_NOT_FOUND  0x0001
+
+#define PHP_NGX_MEMCACHED_HEADER_LEN        24
+
+enum {
+    PHP_NGX_MEMCACHED_GET = 0,
+    PHP_NGX_MEMCACHED_GETS,
+    PHP_NGX_MEMCACHED_GET_MULTI,
+    PHP_NGX_MEMCACHED_STORE,
+    PHP_NGX_MEMCACHED_INCR,
+    PHP_NGX_MEMCACHED_DELETE
+};
+
+#define php_ngx_memcached_fetch(obj)                                          \
+    ((php_ngx_memcached_t *) ((char *) (obj) - XtOffsetOf(php_ngx_memcached_t, std)))
+
+static zend_class_entry *php_ngx_memcached_class_entry;
+static zend_object_handlers php_ngx_memcached_handlers;
+
+/* server lists seen by this worker */
+static php_ngx_memcached_ring_t *php_ngx_memcached_rings;
+
+static zend_object *php_ngx_memcached_create_object(zend_class_entry *ce);
+static void php_ngx_memcached_free_object(zend_object *object);
+static int ngx_libc_cdecl php_ngx_memcached_cmp_points(const void *one, 
+    const void *two);
+static php_ngx_memcached_ring_t *php_ngx_memcached_ring(HashTable *servers);
+static php_ngx_memcached_server_t *php_ngx_memcached_locate(
+    php_ngx_memcached_ring_t *ring, u_char *key, size_t len);
+static uint64_t php_ngx_memcached_uint(u_char *p, size_t n);
+static void php_ngx_memcached_set_error(php_ngx_memcached_t *mc, u_char *msg, 
+    size_t len);
+static ngx_int_t php_ngx_memcached_number(u_char **pp, u_char *end, uint64_t *v);
+static ngx_int_t php_ngx_memcached_text_value(php_ngx_memcached_t *mc, ngx_buf_t *b, 
+    u_char *p, u_char *end, u_char *data);
+static ngx_int_t php_ngx_memcached_text_filter(void *data, ngx_buf_t *b, 
+    zval *retval, zend_string **next);
+static ngx_int_t php_ngx_memcached_binary_filter(void *data, ngx_buf_t *b, 
+    zval *retval, zend_string **next);
+static void php_ngx_memcached_append_header(smart_str *buf, u_char opcode, 
+    size_t keylen, size_t extlen, size_t bodylen, uint64_t cas);
+static void php_ngx_memcached_append_uint(smart_str *buf, uint64_t v, size_t n);
+static ngx_int_t php_ngx_memcached_check_key(php_ngx_memcached_t *mc, 
+    zend_string *key);
+static void php_ngx_memcached_get(INTERNAL_FUNCTION_PARAMETERS, ngx_uint_t op);
+static void php_ngx_memcached_store(INTERNAL_FUNCTION_PARAMETERS, ngx_uint_t with_cas);
+static void php_ngx_memcached_request(php_ngx_memcached_t *mc, smart_str *buf, 
+    ngx_uint_t op, zval *return_value);
+static void php_ngx_memcached_yield_false(void);
+
+static zend_object *
+php_ngx_memcached_create_object(zend_class_entry *ce)
+{
+    php_ngx_memcached_t     *mc;
+
+    mc = ecalloc(1, sizeof(php_ngx_memcached_t) + zend_object_properties_size(ce));
+
+    zend_object_std_init(&mc->std, ce);
+    object_properties_init(&mc->std, ce);
+
+    mc->std.handlers = &php_ngx_memcached_handlers;
+
+    mc->binary = 1;
+
+    return &mc->std;
+}
+
+static void 
+php_ngx_memcached_free_object(zend_object *object)
+{
+    php_ngx_memcached_t             *mc;
+    ngx_http_request_t              *r;
+    ngx_http_php_ctx_t              *ctx;
+    ngx_http_php_socket_upstream_t  *u;
+
+    mc = php_ngx_memcached_fetch(object);
+
+    /* the object may go away with a reply still being read */
+
+    r = ngx_php_request;
+    if (r) {
+        ctx = ngx_http_get_module_ctx(r, ngx_http_php_module);
+        u = ctx ? ctx->upstream : NULL;
+
+        if (u && u->recv_filter_data == mc) {
+            u->recv_mode = 0;
+            u->recv_filter = NULL;
+            u->recv_filter_data = NULL;
+        }
+    }
+
+    zval_ptr_dtor(&mc->result);
+
+    if (mc->error) {
+        zend_string_release(mc->error);
+    }
+
+    zend_object_std_dtor(object);
+}
+
+static int ngx_libc_cdecl
+php_ngx_memcached_cmp_points(const void *one, const void *two)
+{
+    const php_ngx_memcached_point_t *first = one;
+    const php_ngx_memcached_point_t *second = two;
+
+    if (first->point < second->point) {
+        return -1;
+    }
+
+    if (first->point > second->point) {
+        return 1;
+    }
+
+    return 0;
+}
+
+/*
+ * A ketama continuum as libmemcached builds it: every server gets 160
+ * points taken from md5("host:port-N"), or md5("host-N") on the default port.
+ */
+static php_ngx_memcached_ring_t *
+php_ngx_memcached_ring(HashTable *servers)
+{
+    php_ngx_memcached_ring_t    *ring;
+    php_ngx_memcached_server_t  *server;
+    php_ngx_memcached_point_t   *point;
+    smart_str                   key = {0};
+    zend_string                 *str;
+    zval                        *val;
+    ngx_uint_t                  n, i, j, k;
+    uint32_t                    hash;
+    u_char                      *p, *last, *colon;
+    u_char                      label[NGX_SOCKADDR_STRLEN + NGX_INT_T_LEN + 2];
+    u_char                      digest[16];
+    size_t                      size;
+    ngx_md5_t                   md5;
+
+    n = 0;
+
+    ZEND_HASH_FOREACH_VAL(servers, val) {
+        str = zval_get_string(val);
+
+        if (ZSTR_LEN(str) == 0 || ZSTR_LEN(str) > NGX_SOCKADDR_STRLEN 
+            || ngx_strlchr((u_char *) ZSTR_VAL(str), 
+                           (u_char *) ZSTR_VAL(str) + ZSTR_LEN(str), ',')) 
+        {
+            zend_string_release(str);
+            smart_str_free(&key);
+            return NULL;
+        }
+
+        if (n++) {
+            smart_str_appendc(&key, ',');
+        }
+
+        smart_str_append(&key, str);
+        zend_string_release(str);
+    } ZEND_HASH_FOREACH_END();
+
+    if (n == 0) {
+        return NULL;
+    }
+
+    smart_str_0(&key);
+
+    hash = ngx_crc32_long((u_char *) ZSTR_VAL(key.s), ZSTR_LEN(key.s));
+
+    for (ring = php_ngx_memcached_rings; ring; ring = ring->next) {
+        if (ring->hash == hash 
+            && ring->key.len == ZSTR_LEN(key.s) 
+            && ngx_memcmp(ring->key.data, ZSTR_VAL(key.s), ring->key.len) == 0)
+        {
+            smart_str_free(&key);
+            return ring;
+        }
+    }
+
+    size = sizeof(php_ngx_memcached_ring_t) 
+           + n * PHP_NGX_MEMCACHED_POINTS * sizeof(php_ngx_memcached_point_t) 
+           + n * sizeof(php_ngx_memcached_server_t) 
+           + ZSTR_LEN(key.s);
+
+    ring = ngx_alloc(size, ngx_cycle->log);
+    if (ring == NULL) {
+        smart_str_free(&key);
+        return NULL;
+    }
+
+    ring->points = (php_ngx_memcached_point_t *) (ring + 1);
+    ring->npoints = n * PHP_NGX_MEMCACHED_POINTS;
+    ring->servers = (php_ngx_memcached_server_t *) (ring->points + ring->npoints);
+    ring->nservers = n;
+    ring->key.data = (u_char *) (ring->servers + n);
+    ring->key.len = ZSTR_LEN(key.s);
+    ring->hash = hash;
+
+    ngx_memcpy(ring->key.data, ZSTR_VAL(key.s), ring->key.len);
+    smart_str_free(&key);
+
+    p = ring->key.data;
+    last = p + ring->key.len;
+    point = ring->points;
+
+    for (i = 0; i < n; i++) {
+        server = &ring->servers[i];
+
+        server->host.data = p;
+
+        while (p < last && *p != ',') {
+            p++;
+        }
+
+        server->host.len = p - server->host.data;
+        server->port = PHP_NGX_MEMCACHED_DEFAULT_PORT;
+
+        /* "host:port", "host" or "unix:/path/to/memcached.sock" */
+
+        if (server->host.len > 5 
+            && ngx_strncmp(server->host.data, "unix:", 5) == 0) 
+        {
+            server->port = 0;
+
+        } else {
+            colon = ngx_strlchr(server->host.data, p, ':');
+
+            if (colon) {
+                server->port = ngx_atoi(colon + 1, p - colon - 1);
+
+                if (server->port == NGX_ERROR || server->port > 65535) {
+                    ngx_free(ring);
+                    return NULL;
+                }
+
+                server->host.len = colon - server->host.data;
+            }
+        }
+
+        for (j = 0; j < PHP_NGX_MEMCACHED_POINTS / 4; j++) {
+
+            if (server->port == 0 || server->port == PHP_NGX_MEMCACHED_DEFAULT_PORT) {
+                size = ngx_sprintf(label, "%V-%ui", &server->host, j) - label;
+
+            } else {
+                size = ngx_sprintf(label, "%V:%i-%ui", &server->host, server->port, j) 
+                       - label;
+            }
+
+            ngx_md5_init(&md5);
+            ngx_md5_update(&md5, label, size);
+            ngx_md5_final(digest, &md5);
+
+            for (k = 0; k < 4; k++) {
+                point->point = ((uint32_t) digest[3 + k * 4] << 24) 
+                               | ((uint32_t) digest[2 + k * 4] << 16) 
+                               | ((uint32_t) digest[1 + k * 4] << 8) 
+                               | digest[k * 4];
+                point->server = i;
+                point++;
+            }
+        }
+
+        p++;
+    }
+
+    ngx_qsort(ring->points, ring->npoints, sizeof(php_ngx_memcached_point_t), 
+              php_ngx_memcached_cmp_points);
+
+    ring->next = php_ngx_memcached_rings;
+    php_ngx_memcached_rings = ring;
+
+    return ring;
+}
+
+static php_ngx_memcached_server_t *
+php_ngx_memcached_locate(php_ngx_memcached_ring_t *ring, u_char *key, size_t len)
+{
+    ngx_md5_t       md5;
+    u_char          digest[16];
+    uint32_t        hash;
+    ngx_uint_t      lo, hi, mid;
+
+    ngx_md5_init(&md5);
+    ngx_md5_update(&md5, key, len);
+    ngx_md5_final(digest, &md5);
+
+    hash = ((uint32_t) digest[3] << 24) | ((uint32_t) digest[2] << 16) 
+           | ((uint32_t) digest[1] << 8) | digest[0];
+
+    /* the first point not below the hash, wrapping around */
+
+    lo = 0;
+    hi = ring->npoints;
+
+    while (lo < hi) {
+        mid = lo + (hi - lo) / 2;
+
+        if (ring->points[mid].point < hash) {
+            lo = mid + 1;
+
+        } else {
+            hi = mid;
+        }
+    }
+
+    if (lo == ring->npoints) {
+        lo = 0;
+    }
+
+    return &ring->servers[ring->points[lo].server];
+}
+
+static uint64_t 
+php_ngx_memcached_uint(u_char *p, size_t n)
+{
+    uint64_t    v;
+    size_t      i;
+
+    /* the binary protocol is big endian */
+
+    v = 0;
+
+    for (i = 0; i < n; i++) {
+        v = (v << 8) | p[i];
+    }
+
+    return v;
+}
+
+static void 
+php_ngx_memcached_set_error(php_ngx_memcached_t *mc, u_char *msg, size_t len)
+{
+    if (mc->error) {
+        zend_string_release(mc->error);
+    }
+
+    mc->error = zend_string_init((char *) msg, len, 0);
+}
+
+static ngx_int_t 
+php_ngx_memcached_number(u_char **pp, u_char *end, uint64_t *v)
+{
+    u_char      *p;
+
+    p = *pp;
+
+    while (p < end && *p == ' ') {
+        p++;
+    }
+
+    if (p == end || *p < '0' || *p > '9') {
+        return NGX_ERROR;
+    }
+
+    *v = 0;
+
+    while (p < end && *p >= '0' && *p <= '9') {
+        *v = *v * 10 + (*p++ - '0');
+    }
+
+    *pp = p;
+
+    return NGX_OK;
+}
+
+/* "VALUE <key> <flags> <bytes> [<cas>]" followed by the data block */
+static ngx_int_t 
+php_ngx_memcached_text_value(php_ngx_memcached_t *mc, ngx_buf_t *b, u_char *p, 
+    u_char *end, u_char *data)
+{
+    u_char      *key;
+    size_t      keylen;
+    uint64_t    flags, bytes, cas;
+    zval        value;
+
+    key = p;
+
+    while (p < end && *p != ' ') {
+        p++;
+    }
+
+    keylen = p - key;
+
+    if (php_ngx_memcached_number(&p, end, &flags) != NGX_OK 
+        || php_ngx_memcached_number(&p, end, &bytes) != NGX_OK 
+        || bytes > NGX_MAX_SIZE_T_VALUE / 2)
+    {
+        return NGX_ERROR;
+    }
+
+    cas = 0;
+    (void) php_ngx_memcached_number(&p, end, &cas);
+
+    if ((uint64_t) (b->last - data) < bytes + 2) {
+        mc->need = (data - b->pos) + (size_t) bytes + 2;
+        return NGX_AGAIN;
+    }
+
+    if (data[bytes] != CR || data[bytes + 1] != LF) {
+        return NGX_ERROR;
+    }
+
+    switch (mc->op) {
+
+    case PHP_NGX_MEMCACHED_GETS:
+        zval_ptr_dtor(&mc->result);
+        array_init_size(&mc->result, 2);
+        add_assoc_stringl(&mc->result, "value", (char *) data, (size_t) bytes);
+        add_assoc_long(&mc->result, "cas", (zend_long) cas);
+        break;
+
+    case PHP_NGX_MEMCACHED_GET_MULTI:
+        ZVAL_STRINGL(&value, (char *) data, (size_t) bytes);
+        zend_symtable_str_update(Z_ARRVAL(mc->result), (char *) key, keylen, &value);
+        break;
+
+    default:
+        zval_ptr_dtor(&mc->result);
+        ZVAL_STRINGL(&mc->result, (char *) data, (size_t) bytes);
+    }
+
+    b->pos = data + bytes + 2;
+
+    return NGX_OK;
+}
+
+static ngx_int_t 
+php_ngx_memcached_text_filter(void *data, ngx_buf_t *b, zval *retval, 
+    zend_string **next)
+{
+    php_ngx_memcached_t     *mc = data;
+    u_char                  *line, *eol, *p;
+    size_t                  n;
+    uint64_t                v;
+    ngx_int_t               rc;
+
+    for ( ;; ) {
+
+        if ((size_t) (b->last - b->pos) < mc->need) {
+            return NGX_AGAIN;
+        }
+
+        line = b->pos;
+
+        eol = ngx_strlchr(line, b->last, LF);
+        if (eol == NULL) {
+            mc->need = b->last - b->pos + 1;
+            return NGX_AGAIN;
+        }
+
+        mc->need = 0;
+
+        n = eol - line;
+        if (n && line[n - 1] == CR) {
+            n--;
+        }
+
+        if (mc->op == PHP_NGX_MEMCACHED_GET 
+            || mc->op == PHP_NGX_MEMCACHED_GETS 
+            || mc->op == PHP_NGX_MEMCACHED_GET_MULTI)
+        {
+            if (n == 3 && ngx_strncmp(line, "END", 3) == 0) {
+                b->pos = eol + 1;
+
+                if (Z_TYPE(mc->result) == IS_UNDEF) {
+                    ZVAL_NULL(retval);
+
+                } else {
+                    ZVAL_COPY_VALUE(retval, &mc->result);
+                    ZVAL_UNDEF(&mc->result);
+                }
+
+                return NGX_OK;
+            }
+
+            if (n > 6 && ngx_strncmp(line, "VALUE ", 6) == 0) {
+                rc = php_ngx_memcached_text_value(mc, b, line + 6, line + n, eol + 1);
+
+                if (rc != NGX_OK) {
+                    return rc;
+                }
+
+                continue;
+            }
+        }
+
+        b->pos = eol + 1;
+
+        switch (mc->op) {
+
+        case PHP_NGX_MEMCACHED_STORE:
+            if (n == 6 && ngx_strncmp(line, "STORED", 6) == 0) {
+                ZVAL_TRUE(retval);
+                return NGX_OK;
+            }
+
+            break;
+
+        case PHP_NGX_MEMCACHED_DELETE:
+            if (n == 7 && ngx_strncmp(line, "DELETED", 7) == 0) {
+                ZVAL_TRUE(retval);
+                return NGX_OK;
+            }
+
+            break;
+
+        case PHP_NGX_MEMCACHED_INCR:
+            p = line;
+
+            if (php_ngx_memcached_number(&p, line + n, &v) == NGX_OK) {
+                ZVAL_LONG(retval, (zend_long) v);
+                return NGX_OK;
+            }
+
+            break;
+        }
+
+        /* NOT_STORED, EXISTS, NOT_FOUND, ERROR, CLIENT_ERROR, SERVER_ERROR */
+
+        php_ngx_memcached_set_error(mc, line, n);
+
+        zval_ptr_dtor(&mc->result);
+        ZVAL_UNDEF(&mc->result);
+
+        ZVAL_FALSE(retval);
+
+        return NGX_OK;
+    }
+}
+
+static ngx_int_t 
+php_ngx_memcached_binary_filter(void *data, ngx_buf_t *b, zval *retval, 
+    zend_string **next)
+{
+    php_ngx_memcached_t     *mc = data;
+    u_char                  *h, *key, *value;
+    size_t                  len, body, keylen, extlen, vlen;
+    ngx_uint_t              status;
+    uint64_t                cas;
+    zval                    zv;
+
+    for ( ;; ) {
+
+        len = b->last - b->pos;
+
+        if (len < PHP_NGX_MEMCACHED_HEADER_LEN || len < mc->need) {
+            return NGX_AGAIN;
+        }
+
+        /* 
+         * magic, opcode, key length, extras length, data type, status,
+         * total body length, opaque, cas
+         */
+
+        h = b->pos;
+
+        if (h[0] != PHP_NGX_MEMCACHED_RESPONSE_MAGIC) {
+            return NGX_ERROR;
+        }
+
+        body = (size_t) php_ngx_memcached_uint(h + 8, 4);
+
+        if (len < PHP_NGX_MEMCACHED_HEADER_LEN + body) {
+            mc->need = PHP_NGX_MEMCACHED_HEADER_LEN + body;
+            return NGX_AGAIN;
+        }
+
+        mc->need = 0;
+
+        keylen = (size_t) php_ngx_memcached_uint(h + 2, 2);
+        extlen = h[4];
+        status = (ngx_uint_t) php_ngx_memcached_uint(h + 6, 2);
+        cas = php_ngx_memcached_uint(h + 16, 8);
+
+        if (extlen + keylen > body) {
+            return NGX_ERROR;
+        }
+
+        key = h + PHP_NGX_MEMCACHED_HEADER_LEN + extlen;
+        value = key + keylen;
+        vlen = body - extlen - keylen;
+
+        b->pos = h + PHP_NGX_MEMCACHED_HEADER_LEN + body;
+
+        if (mc->op == PHP_NGX_MEMCACHED_GET_MULTI) {
+
+            /* misses are quiet, the noop marks the end of the replies */
+
+            if (h[1] == PHP_NGX_MEMCACHED_OP_NOOP) {
+                ZVAL_COPY_VALUE(retval, &mc->result);
+                ZVAL_UNDEF(&mc->result);
+                return NGX_OK;
+            }
+
+            if (status == PHP_NGX_MEMCACHED_STATUS_OK) {
+                ZVAL_STRINGL(&zv, (char *) value, vlen);
+                zend_symtable_str_update(Z_ARRVAL(mc->result), (char *) key, keylen, &zv);
+
+            } else if (status != PHP_NGX_MEMCACHED_STATUS_NOT_FOUND) {
+                php_ngx_memcached_set_error(mc, value, vlen);
+            }
+
+            continue;
+        }
+
+        if (status != PHP_NGX_MEMCACHED_STATUS_OK) {
+            if (status == PHP_NGX_MEMCACHED_STATUS_NOT_FOUND 
+                && (mc->op == PHP_NGX_MEMCACHED_GET || mc->op == PHP_NGX_MEMCACHED_GETS))
+            {
+                ZVAL_NULL(retval);
+                return NGX_OK;
+            }
+
+            php_ngx_memcached_set_error(mc, value, vlen);
+            ZVAL_FALSE(retval);
+            return NGX_OK;
+        }
+
+        switch (mc->op) {
+
+        case PHP_NGX_MEMCACHED_GET:
+            ZVAL_STRINGL(retval, (char *) value, vlen);
+            break;
+
+        case PHP_NGX_MEMCACHED_GETS:
+            array_init_size(retval, 2);
+            add_assoc_stringl(retval, "value", (char *) value, vlen);
+            add_assoc_long(retval, "cas", (zend_long) cas);
+            break;
+
+        case PHP_NGX_MEMCACHED_INCR:
+            if (vlen != 8) {
+                return NGX_ERROR;
+            }
+
+            ZVAL_LONG(retval, (zend_long) php_ngx_memcached_uint(value, 8));
+            break;
+
+        default:
+            ZVAL_TRUE(retval);
+        }
+
+        return NGX_OK;
+    }
+}
+
+static void 
+php_ngx_memcached_append_header(smart_str *buf, u_char opcode, size_t keylen, 
+    size_t extlen, size_t bodylen, uint64_t cas)
+{
+    smart_str_appendc(buf, (char) PHP_NGX_MEMCACHED_REQUEST_MAGIC);
+    smart_str_appendc(buf, (char) opcode);
+    php_ngx_memcached_append_uint(buf, keylen, 2);
+    smart_str_appendc(buf, (char) extlen);
+
+    /* data type, vbucket */
+    php_ngx_memcached_append_uint(buf, 0, 3);
+
+    php_ngx_memcached_append_uint(buf, bodylen, 4);
+
+    /* opaque */
+    php_ngx_memcached_append_uint(buf, 0, 4);
+
+    php_ngx_memcached_append_uint(buf, cas, 8);
+}
+
+static void 
+php_ngx_memcached_append_uint(smart_str *buf, uint64_t v, size_t n)
+{
+    while (n--) {
+        smart_str_appendc(buf, (char) ((v >> (n * 8)) & 0xff));
+    }
+}
+
+static ngx_int_t 
+php_ngx_memcached_check_key(php_ngx_memcached_t *mc, zend_string *key)
+{
+    size_t      i;
+    u_char      c;
+
+    if (ZSTR_LEN(key) == 0 || ZSTR_LEN(key) > PHP_NGX_MEMCACHED_MAX_KEY) {
+        return NGX_ERROR;
+    }
+
+    /* the text protocol separates keys with spaces */
+
+    if (mc->binary) {
+        return NGX_OK;
+    }
+
+    for (i = 0; i < ZSTR_LEN(key); i++) {
+        c = (u_char) ZSTR_VAL(key)[i];
+
+        if (c <= ' ' || c == 0x7f) {
+            return NGX_ERROR;
+        }
+    }
+
+    return NGX_OK;
+}
+
+static void 
+php_ngx_memcached_yield_false(void)
+{
+    ngx_http_request_t  *r;
+    ngx_http_php_ctx_t  *ctx;
+
+    r = ngx_php_request;
+    ctx = r ? ngx_http_get_module_ctx(r, ngx_http_php_module) : NULL;
+
+    if ( !ctx ) {
+        return ;
+    }
+
+    ZVAL_FALSE(&ctx->yield_retval);
+
+    ctx->delay_time = 0;
+    ngx_http_php_sleep(r);
+}
+
+static void 
+php_ngx_memcached_request(php_ngx_memcached_t *mc, smart_str *buf, ngx_uint_t op, 
+    zval *return_value)
+{
+    ngx_http_request_t  *r;
+    ngx_http_php_ctx_t  *ctx;
+
+    r = ngx_php_request;
+    ctx = r ? ngx_http_get_module_ctx(r, ngx_http_php_module) : NULL;
+
+    if ( !ctx ) {
+        smart_str_free(buf);
+        RETURN_FALSE;
+    }
+
+    zval_ptr_dtor(&mc->result);
+    ZVAL_UNDEF(&mc->result);
+
+    mc->op = op;
+    mc->need = 0;
+
+    if (op == PHP_NGX_MEMCACHED_GET_MULTI) {
+        array_init(&mc->result);
+    }
+
+    smart_str_0(buf);
+
+    if (ngx_http_php_socket_request(r, buf->s, 
+                                    mc->binary ? php_ngx_memcached_binary_filter 
+                                               : php_ngx_memcached_text_filter, 
+                                    mc) 
+        == NGX_ERROR)
+    {
+        RETURN_FALSE;
+    }
+
+    RETURN_TRUE;
+}
+
+PHP_METHOD(ngx_memcached, __construct)
+{
+    zval                    *servers = NULL;
+    zend_bool               binary = 1;
+    php_ngx_memcached_t     *mc;
+
+    if (zend_parse_parameters(ZEND_NUM_ARGS(), "|a!b", &servers, &binary) == FAILURE) {
+        RETURN_FALSE;
+    }
+
+    mc = php_ngx_memcached_fetch(Z_OBJ_P(getThis()));
+
+    mc->binary = binary ? 1 : 0;
+
+    if (servers && zend_hash_num_elements(Z_ARRVAL_P(servers))) {
+        mc->ring = php_ngx_memcached_ring(Z_ARRVAL_P(servers));
+
+        if (mc->ring == NULL) {
+            php_error_docref(NULL, E_WARNING, "invalid server list");
+        }
+    }
+}
+
+PHP_METHOD(ngx_memcached, locate)
+{
+    zend_string                 *key;
+    php_ngx_memcached_t         *mc;
+    php_ngx_memcached_server_t  *server;
+
+    if (zend_parse_parameters(ZEND_NUM_ARGS(), "S", &key) == FAILURE) {
+        RETURN_FALSE;
+    }
+
+    mc = php_ngx_memcached_fetch(Z_OBJ_P(getThis()));
+
+    if (mc->ring == NULL) {
+        RETURN_FALSE;
+    }
+
+    server = php_ngx_memcached_locate(mc->ring, (u_char *) ZSTR_VAL(key), ZSTR_LEN(key));
+
+    array_init_size(return_value, 2);
+    add_next_index_stringl(return_value, (char *) server->host.data, server->host.len);
+    add_next_index_long(return_value, (zend_long) server->port);
+}
+
+PHP_METHOD(ngx_memcached, connect)
+{
+    zend_string         *host;
+    zend_long           port = PHP_NGX_MEMCACHED_DEFAULT_PORT;
+    char                *pool = NULL;
+    size_t              pool_len = 0;
+
+    ngx_http_request_t  *r;
+    ngx_http_php_ctx_t  *ctx;
+
+    if (zend_parse_parameters(ZEND_NUM_ARGS(), "S|ls!", &host, &port, &pool, &pool_len) == FAILURE) {
+        RETURN_FALSE;
+    }
+
+    r = ngx_php_request;
+    ctx = r ? ngx_http_get_module_ctx(r, ngx_http_php_module) : NULL;
+
+    if ( !ctx ) {
+        RETURN_FALSE;
+    }
+
+    ctx->pool_name.len = 0;
+
+    if (pool_len) {
+        ctx->pool_name.data = ngx_pnalloc(r->pool, pool_len);
+        if (ctx->pool_name.data == NULL) {
+            RETURN_FALSE;
+        }
+
+        ctx->pool_name.len = ngx_cpymem(ctx->pool_name.data, pool, pool_len) 
+                             - ctx->pool_name.data;
+    }
+
+    ctx->host.data = ngx_pnalloc(r->pool, ZSTR_LEN(host) + 1);
+    if (ctx->host.data == NULL) {
+        RETURN_FALSE;
+    }
+
+    ctx->host.len = ZSTR_LEN(host);
+    ngx_memcpy(ctx->host.data, ZSTR_VAL(host), ZSTR_LEN(host) + 1);
+
+    /* "unix:/path/to/memcached.sock" has no port */
+
+    if (ZSTR_LEN(host) > 5 && ngx_strncmp(ZSTR_VAL(host), "unix:", 5) == 0) {
+        port = 0;
+    }
+
+    ctx->port = (ngx_int_t) port;
+
+    if (ngx_http_php_socket_connect(r) == NGX_ERROR) {
+        php_ngx_memcached_yield_false();
+        RETURN_FALSE;
+    }
+
+    /* 
+     * turned into false by the connect handler if the connection fails, 
+     * which may already have happened 
+     */
+    if (Z_TYPE(ctx->yield_retval) == IS_UNDEF) {
+        ZVAL_TRUE(&ctx->yield_retval);
+    }
+
+    RETURN_TRUE;
+}
+
+static void 
+php_ngx_memcached_get(INTERNAL_FUNCTION_PARAMETERS, ngx_uint_t op)
+{
+    zend_string             *key;
+    php_ngx_memcached_t     *mc;
+    smart_str               buf = {0};
+
+    if (zend_parse_parameters(ZEND_NUM_ARGS(), "S", &key) == FAILURE) {
+        RETURN_FALSE;
+    }
+
+    mc = php_ngx_memcached_fetch(Z_OBJ_P(getThis()));
+
+    if (php_ngx_memcached_check_key(mc, key) != NGX_OK) {
+        php_error_docref(NULL, E_WARNING, "invalid key");
+        php_ngx_memcached_yield_false();
+        RETURN_FALSE;
+    }
+
+    if (mc->binary) {
+        php_ngx_memcached_append_header(&buf, PHP_NGX_MEMCACHED_OP_GET, 
+                                        ZSTR_LEN(key), 0, ZSTR_LEN(key), 0);
+        smart_str_append(&buf, key);
+
+    } else {
+        smart_str_appendl(&buf, op == PHP_NGX_MEMCACHED_GETS ? "gets " : "get ", 
+                          op == PHP_NGX_MEMCACHED_GETS ? 5 : 4);
+        smart_str_append(&buf, key);
+        smart_str_appendl(&buf, "\r\n", 2);
+    }
+
+    php_ngx_memcached_request(mc, &buf, op, return_value);
+}
+
+PHP_METHOD(ngx_memcached, get)
+{
+    php_ngx_memcached_get(INTERNAL_FUNCTION_PARAM_PASSTHRU, PHP_NGX_MEMCACHED_GET);
+}
+
+PHP_METHOD(ngx_memcached, gets)
+{
+    php_ngx_memcached_get(INTERNAL_FUNCTION_PARAM_PASSTHRU, PHP_NGX_MEMCACHED_GETS);
+}
+
+PHP_METHOD(ngx_memcached, getMulti)
+{
+    zval                    *keys, *val;
+    zend_string             *key;
+    php_ngx_memcached_t     *mc;
+    smart_str               buf = {0};
+
+    ngx_http_request_t      *r;
+    ngx_http_php_ctx_t      *ctx;
+
+    if (zend_parse_parameters(ZEND_NUM_ARGS(), "a", &keys) == FAILURE) {
+        RETURN_FALSE;
+    }
+
+    mc = php_ngx_memcached_fetch(Z_OBJ_P(getThis()));
+
+    if (zend_hash_num_elements(Z_ARRVAL_P(keys)) == 0) {
+        r = ngx_php_request;
+        ctx = r ? ngx_http_get_module_ctx(r, ngx_http_php_module) : NULL;
+
+        if ( !ctx ) {
+            RETURN_FALSE;
+        }
+
+        array_init(&ctx->yield_retval);
+        ctx->delay_time = 0;
+        ngx_http_php_sleep(r);
+
+        RETURN_TRUE;
+    }
+
+    /* 
+     * One round trip: quiet gets answered only on a hit and a noop behind
+     * them, or a single "get k1 k2 ..." line.
+     */
+
+    if (!mc->binary) {
+        smart_str_appendl(&buf, "get", 3);
+    }
+
+    ZEND_HASH_FOREACH_VAL(Z_ARRVAL_P(keys), val) {
+        key = zval_get_string(val);
+
+        if (php_ngx_memcached_check_key(mc, key) != NGX_OK) {
+            zend_string_release(key);
+            smart_str_free(&buf);
+            php_error_docref(NULL, E_WARNING, "invalid key");
+            php_ngx_memcached_yield_false();
+            RETURN_FALSE;
+        }
+
+        if (mc->binary) {
+            php_ngx_memcached_append_header(&buf, PHP_NGX_MEMCACHED_OP_GETKQ, 
+                                            ZSTR_LEN(key), 0, ZSTR_LEN(key), 0);
+            smart_str_append(&buf, key);
+
+        } else {
+            smart_str_appendc(&buf, ' ');
+            smart_str_append(&buf, key);
+        }
+
+        zend_string_release(key);
+    } ZEND_HASH_FOREACH_END();
+
+    if (mc->binary) {
+        php_ngx_memcached_append_header(&buf, PHP_NGX_MEMCACHED_OP_NOOP, 0, 0, 0, 0);
+
+    } else {
+        smart_str_appendl(&buf, "\r\n", 2);
+    }
+
+    php_ngx_memcached_request(mc, &buf, PHP_NGX_MEMCACHED_GET_MULTI, return_value);
+}
+
+static void 
+php_ngx_memcached_store(INTERNAL_FUNCTION_PARAMETERS, ngx_uint_t with_cas)
+{
+    zend_string             *key;
+    zval                    *val;
+    zend_string             *value;
+    zend_long               cas = 0;
+    zend_long               exptime = 0;
+    zend_long               flags = 0;
+    php_ngx_memcached_t     *mc;
+    smart_str               buf = {0};
+
+    if (with_cas) {
+        if (zend_parse_parameters(ZEND_NUM_ARGS(), "Szl|ll", &key, &val, &cas, 
+                                  &exptime, &flags) == FAILURE) 
+        {
+            RETURN_FALSE;
+        }
+
+    } else {
+        if (zend_parse_parameters(ZEND_NUM_ARGS(), "Sz|ll", &key, &val, 
+                                  &exptime, &flags) == FAILURE) 
+        {
+            RETURN_FALSE;
+        }
+    }
+
+    mc = php_ngx_memcached_fetch(Z_OBJ_P(getThis()));
+
+    if (php_ngx_memcached_check_key(mc, key) != NGX_OK) {
+        php_error_docref(NULL, E_WARNING, "invalid key");
+        php_ngx_memcached_yield_false();
+        RETURN_FALSE;
+    }
+
+    value = zval_get_string(val);
+
+    if (mc->binary) {
+
+        /* extras: flags, expiration */
+
+        php_ngx_memcached_append_header(&buf, PHP_NGX_MEMCACHED_OP_SET, ZSTR_LEN(key), 
+                                        8, 8 + ZSTR_LEN(key) + ZSTR_LEN(value), 
+                                        (uint64_t) cas);
+        php_ngx_memcached_append_uint(&buf, (uint32_t) flags, 4);
+        php_ngx_memcached_append_uint(&buf, (uint32_t) exptime, 4);
+        smart_str_append(&buf, key);
+        smart_str_append(&buf, value);
+
+    } else {
+        smart_str_appendl(&buf, with_cas ? "cas " : "set ", 4);
+        smart_str_append(&buf, key);
+        smart_str_appendc(&buf, ' ');
+        smart_str_append_unsigned(&buf, (zend_ulong) (uint32_t) flags);
+        smart_str_appendc(&buf, ' ');
+        smart_str_append_long(&buf, exptime);
+        smart_str_appendc(&buf, ' ');
+        smart_str_append_unsigned(&buf, (zend_ulong) ZSTR_LEN(value));
+
+        if (with_cas) {
+            smart_str_appendc(&buf, ' ');
+            smart_str_append_unsigned(&buf, (zend_ulong) cas);
+        }
+
+        smart_str_appendl(&buf, "\r\n", 2);
+        smart_str_append(&buf, value);
+        smart_str_appendl(&buf, "\r\n", 2);
+    }
+
+    zend_string_release(value);
+
+    php_ngx_memcached_request(mc, &buf, PHP_NGX_MEMCACHED_STORE, return_value);
+}
+
+PHP_METHOD(ngx_memcached, set)
+{
+    php_ngx_memcached_store(INTERNAL_FUNCTION_PARAM_PASSTHRU, 0);
+}
+
+PHP_METHOD(ngx_memcached, cas)
+{
+    php_ngx_memcached_store(INTERNAL_FUNCTION_PARAM_PASSTHRU, 1);
+}
+
+PHP_METHOD(ngx_memcached, incr)
+{
+    zend_string             *key;
+    zend_long               delta = 1;
+    php_ngx_memcached_t     *mc;
+    smart_str               buf = {0};
+    zend_ulong              n;
+
+    if (zend_parse_parameters(ZEND_NUM_ARGS(), "S|l", &key, &delta) == FAILURE) {
+        RETURN_FALSE;
+    }
+
+    mc = php_ngx_memcached_fetch(Z_OBJ_P(getThis()));
+
+    if (php_ngx_memcached_check_key(mc, key) != NGX_OK) {
+        php_error_docref(NULL, E_WARNING, "invalid key");
+        php_ngx_memcached_yield_false();
+        RETURN_FALSE;
+    }
+
+    /* a negative delta decrements */
+
+    n = delta < 0 ? (zend_ulong) 0 - (zend_ulong) delta : (zend_ulong) delta;
+
+    if (mc->binary) {
+
+        /* extras: delta, initial value, expiration (0xffffffff: no autovivify) */
+
+        php_ngx_memcached_append_header(&buf, delta < 0 ? PHP_NGX_MEMCACHED_OP_DECREMENT 
+                                                        : PHP_NGX_MEMCACHED_OP_INCREMENT, 
+                                        ZSTR_LEN(key), 20, 20 + ZSTR_LEN(key), 0);
+        php_ngx_memcached_append_uint(&buf, n, 8);
+        php_ngx_memcached_append_uint(&buf, 0, 8);
+        php_ngx_memcached_append_uint(&buf, 0xffffffff, 4);
+        smart_str_append(&buf, key);
+
+    } else {
+        smart_str_appendl(&buf, delta < 0 ? "decr " : "incr ", 5);
+        smart_str_append(&buf, key);
+        smart_str_appendc(&buf, ' ');
+        smart_str_append_unsigned(&buf, n);
+        smart_str_appendl(&buf, "\r\n", 2);
+    }
+
+    php_ngx_memcached_request(mc, &buf, PHP_NGX_MEMCACHED_INCR, return_value);
+}
+
+PHP_METHOD(ngx_memcached, delete)
+{
+    zend_string             *key;
+    php_ngx_memcached_t     *mc;
+    smart_str               buf = {0};
+
+    if (zend_parse_parameters(ZEND_NUM_ARGS(), "S", &key) == FAILURE) {
+        RETURN_FALSE;
+    }
+
+    mc = php_ngx_memcached_fetch(Z_OBJ_P(getThis()));
+
+    if (php_ngx_memcached_check_key(mc, key) != NGX_OK) {
+        php_error_docref(NULL, E_WARNING, "invalid key");
+        php_ngx_memcached_yield_false();
+        RETURN_FALSE;
+    }
+
+    if (mc->binary) {
+        php_ngx_memcached_append_header(&buf, PHP_NGX_MEMCACHED_OP_DELETE, 
+                                        ZSTR_LEN(key), 0, ZSTR_LEN(key), 0);
+        smart_str_append(&buf, key);
+
+    } else {
+        smart_str_appendl(&buf, "delete ", 7);
+        smart_str_append(&buf, key);
+        smart_str_appendl(&buf, "\r\n", 2);
+    }
+
+    php_ngx_memcached_request(mc, &buf, PHP_NGX_MEMCACHED_DELETE, return_value);
+}
+
+PHP_METHOD(ngx_memcached, setkeepalive)
+{
+    zend_long           timeout = 0;
+    zend_long           size = 0;
+
+    ngx_http_request_t  *r;
+    ngx_http_php_ctx_t  *ctx;
+
+    if (zend_parse_parameters(ZEND_NUM_ARGS(), "|ll", &timeout, &size) == FAILURE) {
+        RETURN_FALSE;
+    }
+
+    if (timeout < 0 || size < 0) {
+        RETURN_FALSE;
+    }
+
+    r = ngx_php_request;
+    ctx = r ? ngx_http_get_module_ctx(r, ngx_http_php_module) : NULL;
+
+    if ( !ctx ) {
+        RETURN_FALSE;
+    }
+
+    if (ngx_http_php_socket_setkeepalive(r, (ngx_msec_t) timeout, (ngx_uint_t) size) != NGX_OK) {
+        RETURN_FALSE;
+    }
+
+    RETURN_TRUE;
+}
+
+PHP_METHOD(ngx_memcached, close)
+{
+    ngx_http_request_t  *r;
+    ngx_http_php_ctx_t  *ctx;
+
+    r = ngx_php_request;
+    ctx = r ? ngx_http_get_module_ctx(r, ngx_http_php_module) : NULL;
+
+    if ( !ctx ) {
+        RETURN_FALSE;
+    }
+
+    ngx_http_php_socket_clear(r);
+
+    RETURN_TRUE;
+}
+
+PHP_METHOD(ngx_memcached, getLastError)
+{
+    php_ngx_memcached_t     *mc;
+
+    mc = php_ngx_memcached_fetch(Z_OBJ_P(getThis()));
+
+    if (mc->error == NULL) {
+        RETURN_NULL();
+    }
+
+    RETURN_STR_COPY(mc->error);
+}
+
+static const zend_function_entry php_ngx_memcached_class_functions[] = {
+    PHP_ME(ngx_memcached, __construct, ngx_memcached_construct_arginfo, ZEND_ACC_PUBLIC)
+    PHP_ME(ngx_memcached, locate, ngx_memcached_key_arginfo, ZEND_ACC_PUBLIC)
+    PHP_ME(ngx_memcached, connect, ngx_memcached_connect_arginfo, ZEND_ACC_PUBLIC)
+    PHP_ME(ngx_memcached, get, ngx_memcached_key_arginfo, ZEND_ACC_PUBLIC)
+    PHP_ME(ngx_memcached, gets, ngx_memcached_key_arginfo, ZEND_ACC_PUBLIC)
+    PHP_ME(ngx_memcached, getMulti, ngx_memcached_getmulti_arginfo, ZEND_ACC_PUBLIC)
+    PHP_ME(ngx_memcached, set, ngx_memcached_set_arginfo, ZEND_ACC_PUBLIC)
+    PHP_ME(ngx_memcached, cas, ngx_memcached_cas_arginfo, ZEND_ACC_PUBLIC)
+    PHP_ME(ngx_memcached, incr, ngx_memcached_incr_arginfo, ZEND_ACC_PUBLIC)
+    PHP_ME(ngx_memcached, delete, ngx_memcached_key_arginfo, ZEND_ACC_PUBLIC)
+    PHP_ME(ngx_memcached, setkeepalive, ngx_memcached_setkeepalive_arginfo, ZEND_ACC_PUBLIC)
+    PHP_ME(ngx_memcached, close, ngx_memcached_void_arginfo, ZEND_ACC_PUBLIC)
+    PHP_ME(ngx_memcached, getLastError, ngx_memcached_void_arginfo, ZEND_ACC_PUBLIC)
+    {NULL, NULL, NULL, 0, 0}
+};
+
+void
+php_impl_ngx_memcached_init(int module_number)
+{
+    zend_class_entry ngx_memcached_class_entry;
+    INIT_NS_CLASS_ENTRY(ngx_memcached_class_entry, "ngx", "memcached", php_ngx_memcached_class_functions);
+    php_ngx_memcached_class_entry = zend_register_internal_class(&ngx_memcached_class_entry);
+    php_ngx_memcached_class_entry->create_object = php_ngx_memcached_create_object;
+
+    memcpy(&php_ngx_memcached_handlers, zend_get_std_object_handlers(), sizeof(zend_object_handlers));
+    php_ngx_memcached_handlers.offset = XtOffsetOf(php_ngx_memcached_t, std);
+    php_ngx_memcached_handlers.free_obj = php_ngx_memcached_free_object;
+    php_ngx_memcached_handlers.clone_obj = NULL;
+}
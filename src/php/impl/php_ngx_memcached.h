@@ -0,0 +1,156 @@
+/*
+==============================================================================
+Copyright (c) 2016-2020, rryqszq4 <rryqszq@gmail.com>
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+
+* Redistributions of source code must retain the above copyright notice, this
+  list of conditions and the following disclaimer.
+
+* Redistributions in binary form must reproduce the above copyright notice,
+  this list of conditions and the following disclaimer in the documentation
+  and/or other materials provided with the distribution.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+==============================================================================
+*/
+
+#ifndef __PHP_NGX_MEMCACHED_H__
+#define __PHP_NGX_MEMCACHED_H__
+
+#include <php.h>
+#include <php_ini.h>
+#include <ext/standard/info.h>
+#include <ngx_http.h>
+
+#define PHP_NGX_MEMCACHED_DEFAULT_PORT  11211
+#define PHP_NGX_MEMCACHED_MAX_KEY       250
+
+/* ketama: 40 md5 digests of 4 points each per server */
+#define PHP_NGX_MEMCACHED_POINTS        160
+
+typedef struct {
+
+    ngx_str_t       host;
+    ngx_int_t       port;
+
+} php_ngx_memcached_server_t;
+
+typedef struct {
+
+    uint32_t        point;
+    ngx_uint_t      server;
+
+} php_ngx_memcached_point_t;
+
+typedef struct php_ngx_memcached_ring_s php_ngx_memcached_ring_t;
+
+/* continuum of a server list, built once per worker and never freed */
+struct php_ngx_memcached_ring_s {
+
+    php_ngx_memcached_ring_t    *next;
+
+    ngx_str_t                   key;
+    uint32_t                    hash;
+
+    php_ngx_memcached_server_t  *servers;
+    ngx_uint_t                  nservers;
+
+    php_ngx_memcached_point_t   *points;
+    ngx_uint_t                  npoints;
+
+};
+
+typedef struct php_ngx_memcached_s {
+
+    ngx_uint_t      op;
+
+    /* do not parse again before this many bytes are buffered */
+    size_t          need;
+
+    zval            result;
+    zend_string     *error;
+
+    php_ngx_memcached_ring_t    *ring;
+
+    unsigned        binary:1;
+
+    zend_object     std;
+
+} php_ngx_memcached_t;
+
+ZEND_BEGIN_ARG_INFO_EX(ngx_memcached_construct_arginfo, 0, 0, 0)
+    ZEND_ARG_ARRAY_INFO(0, servers, 0)
+    ZEND_ARG_INFO(0, binary)
+ZEND_END_ARG_INFO()
+
+ZEND_BEGIN_ARG_INFO_EX(ngx_memcached_key_arginfo, 0, 0, 1)
+    ZEND_ARG_INFO(0, key)
+ZEND_END_ARG_INFO()
+
+ZEND_BEGIN_ARG_INFO_EX(ngx_memcached_connect_arginfo, 0, 0, 1)
+    ZEND_ARG_INFO(0, host)
+    ZEND_ARG_INFO(0, port)
+    ZEND_ARG_INFO(0, pool)
+ZEND_END_ARG_INFO()
+
+ZEND_BEGIN_ARG_INFO_EX(ngx_memcached_getmulti_arginfo, 0, 0, 1)
+    ZEND_ARG_ARRAY_INFO(0, keys, 0)
+ZEND_END_ARG_INFO()
+
+ZEND_BEGIN_ARG_INFO_EX(ngx_memcached_set_arginfo, 0, 0, 2)
+    ZEND_ARG_INFO(0, key)
+    ZEND_ARG_INFO(0, value)
+    ZEND_ARG_INFO(0, exptime)
+    ZEND_ARG_INFO(0, flags)
+ZEND_END_ARG_INFO()
+
+ZEND_BEGIN_ARG_INFO_EX(ngx_memcached_cas_arginfo, 0, 0, 3)
+    ZEND_ARG_INFO(0, key)
+    ZEND_ARG_INFO(0, value)
+    ZEND_ARG_INFO(0, cas)
+    ZEND_ARG_INFO(0, exptime)
+    ZEND_ARG_INFO(0, flags)
+ZEND_END_ARG_INFO()
+
+ZEND_BEGIN_ARG_INFO_EX(ngx_memcached_incr_arginfo, 0, 0, 1)
+    ZEND_ARG_INFO(0, key)
+    ZEND_ARG_INFO(0, delta)
+ZEND_END_ARG_INFO()
+
+ZEND_BEGIN_ARG_INFO_EX(ngx_memcached_setkeepalive_arginfo, 0, 0, 0)
+    ZEND_ARG_INFO(0, timeout)
+    ZEND_ARG_INFO(0, size)
+ZEND_END_ARG_INFO()
+
+ZEND_BEGIN_ARG_INFO_EX(ngx_memcached_void_arginfo, 0, 0, 0)
+ZEND_END_ARG_INFO()
+
+PHP_METHOD(ngx_memcached, __construct);
+PHP_METHOD(ngx_memcached, locate);
+PHP_METHOD(ngx_memcached, connect);
+PHP_METHOD(ngx_memcached, get);
+PHP_METHOD(ngx_memcached, gets);
+PHP_METHOD(ngx_memcached, getMulti);
+PHP_METHOD(ngx_memcached, set);
+PHP_METHOD(ngx_memcached, cas);
+PHP_METHOD(ngx_memcached, incr);
+PHP_METHOD(ngx_memcached, delete);
+PHP_METHOD(ngx_memcached, setkeepalive);
+PHP_METHOD(ngx_memcached, close);
+PHP_METHOD(ngx_memcached, getLastError);
+
+void php_impl_ngx_memcached_init(int module_number);
+
+#endif
@@ -0,0 +1,2101 @@
+/*
+==============================================================================
+Copyright (c) 2016-2020, rryqszq4 <rryqszq@gmail.com>
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+
+* Redistributions of source code must retain the above copyright notice, this
+  list of conditions and the following disclaimer.
+
+* Redistributions in binary form must reproduce the above copyright notice,
+  this list of conditions and the following disclaimer in the documentation
+  and/or other materials provided with the distribution.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+==============================================================================
+*/
+
+#include <zend_smart_str.h>
+#include <ext/standard/sha1.h>
+#include <ext/hash/php_hash_sha.h>
+
+#include "../../ngx_http_php_module.h"
+#include "../../ngx_http_php_socket.h"
+#include "../../ngx_http_php_sleep.h"
+#include "php_ngx_mysql.h"
+
+#if (NGX_OPENSSL)
+#include <openssl/evp.h>
+#include <openssl/pem.h>
+#include <openssl/rsa.h>
+#endif
+
+#define PHP_NGX_MYSQL_CLIENT_LONG_PASSWORD       0x00000001
+#define PHP_NGX_MYSQL_CLIENT_LONG_FLAG           0x00000004
+#define PHP_NGX_MYSQL_CLIENT_CONNECT_WITH_DB     0x00000008
+#define PHP_NGX_MYSQL_CLIENT_PROTOCOL_41         0x00000200
+#define PHP_NGX_MYSQL_CLIENT_TRANSACTIONS        0x00002000
+#define PHP_NGX_MYSQL_CLIENT_SECURE_CONNECTION   0x00008000
+#define PHP_NGX_MYSQL_CLIENT_MULTI_RESULTS       0x00020000
+#define PHP_NGX_MYSQL_CLIENT_PLUGIN_AUTH         0x00080000
+
+#define PHP_NGX_MYSQL_SERVER_MORE_RESULTS_EXISTS 0x0008
+
+#define PHP_NGX_MYSQL_COM_QUERY                  0x03
+#define PHP_NGX_MYSQL_COM_STMT_PREPARE           0x16
+#define PHP_NGX_MYSQL_COM_STMT_EXECUTE           0x17
+#define PHP_NGX_MYSQL_COM_STMT_CLOSE             0x19
+
+#define PHP_NGX_MYSQL_TYPE_DECIMAL               0
+#define PHP_NGX_MYSQL_TYPE_TINY                  1
+#define PHP_NGX_MYSQL_TYPE_SHORT                 2
+#define PHP_NGX_MYSQL_TYPE_LONG                  3
+#define PHP_NGX_MYSQL_TYPE_FLOAT                 4
+#define PHP_NGX_MYSQL_TYPE_DOUBLE                5
+#define PHP_NGX_MYSQL_TYPE_NULL                  6
+#define PHP_NGX_MYSQL_TYPE_TIMESTAMP             7
+#define PHP_NGX_MYSQL_TYPE_LONGLONG              8
+#define PHP_NGX_MYSQL_TYPE_INT24                 9
+#define PHP_NGX_MYSQL_TYPE_DATE                  10
+#define PHP_NGX_MYSQL_TYPE_TIME                  11
+#define PHP_NGX_MYSQL_TYPE_DATETIME              12
+#define PHP_NGX_MYSQL_TYPE_YEAR                  13
+#define PHP_NGX_MYSQL_TYPE_VAR_STRING            253
+
+#define PHP_NGX_MYSQL_UNSIGNED_FLAG              32
+
+/* utf8mb4_general_ci */
+#define PHP_NGX_MYSQL_CHARSET                    45
+
+#define PHP_NGX_MYSQL_MAX_PACKET                 0xffffff
+
+enum {
+    PHP_NGX_MYSQL_GREETING = 0,
+    PHP_NGX_MYSQL_AUTH,
+    PHP_NGX_MYSQL_AUTH_KEY,
+    PHP_NGX_MYSQL_RESULT,
+    PHP_NGX_MYSQL_COLUMNS,
+    PHP_NGX_MYSQL_COLUMNS_EOF,
+    PHP_NGX_MYSQL_ROWS,
+    PHP_NGX_MYSQL_PREPARE,
+    PHP_NGX_MYSQL_PREPARE_SKIP
+};
+
+#define php_ngx_mysql_fetch(obj)                                              \
+    ((php_ngx_mysql_t *) ((char *) (obj) - XtOffsetOf(php_ngx_mysql_t, std)))
+
+static zend_class_entry *php_ngx_mysql_class_entry;
+static zend_object_handlers php_ngx_mysql_handlers;
+
+static zend_object *php_ngx_mysql_create_object(zend_class_entry *ce);
+static void php_ngx_mysql_free_object(zend_object *object);
+static void php_ngx_mysql_free_columns(php_ngx_mysql_t *mysql);
+static uint64_t php_ngx_mysql_uint(u_char *p, size_t n);
+static void php_ngx_mysql_append_uint(smart_str *buf, uint64_t v, size_t n);
+static void php_ngx_mysql_append_lenenc(smart_str *buf, uint64_t v);
+static size_t php_ngx_mysql_packet_begin(smart_str *buf);
+static ngx_int_t php_ngx_mysql_packet_end(smart_str *buf, size_t start, u_char seq);
+static ngx_int_t php_ngx_mysql_lenenc(u_char **pp, u_char *end, uint64_t *v);
+static ngx_int_t php_ngx_mysql_lenenc_str(u_char **pp, u_char *end, u_char **s, 
+    size_t *len);
+static void php_ngx_mysql_set_error(php_ngx_mysql_t *mysql, u_char *p, u_char *end);
+static ngx_int_t php_ngx_mysql_scramble(php_ngx_mysql_t *mysql, u_char *plugin, 
+    size_t len, smart_str *buf, ngx_uint_t lenprefix);
+static ngx_int_t php_ngx_mysql_greeting(php_ngx_mysql_t *mysql, u_char *p, 
+    u_char *end, zend_string **next);
+static ngx_int_t php_ngx_mysql_auth(php_ngx_mysql_t *mysql, u_char *p, 
+    u_char *end, zval *retval, zend_string **next);
+static ngx_int_t php_ngx_mysql_column(php_ngx_mysql_t *mysql, u_char *p, u_char *end);
+static void php_ngx_mysql_text_value(zval *zv, php_ngx_mysql_column_t *col, 
+    u_char *s, size_t len);
+static ngx_int_t php_ngx_mysql_text_row(php_ngx_mysql_t *mysql, u_char *p, u_char *end);
+static ngx_int_t php_ngx_mysql_binary_value(zval *zv, php_ngx_mysql_column_t *col, 
+    u_char **pp, u_char *end);
+static ngx_int_t php_ngx_mysql_binary_row(php_ngx_mysql_t *mysql, u_char *p, u_char *end);
+static ngx_int_t php_ngx_mysql_result_end(php_ngx_mysql_t *mysql, zval *value, 
+    ngx_uint_t status);
+static ngx_int_t php_ngx_mysql_prepared(php_ngx_mysql_t *mysql, zend_string **next);
+static ngx_int_t php_ngx_mysql_packet(php_ngx_mysql_t *mysql, u_char *p, u_char *end, 
+    zval *retval, zend_string **next);
+static ngx_int_t php_ngx_mysql_input_filter(void *data, ngx_buf_t *b, zval *retval, 
+    zend_string **next);
+static ngx_int_t php_ngx_mysql_append_command(smart_str *buf, u_char cmd, 
+    zend_string *sql);
+static ngx_int_t php_ngx_mysql_append_execute(smart_str *buf, 
+    php_ngx_mysql_stmt_t *stmt, zval *params);
+static php_ngx_mysql_conn_t *php_ngx_mysql_conn(ngx_http_php_socket_upstream_t *u);
+static void php_ngx_mysql_conn_cleanup(void *data);
+static void php_ngx_mysql_request(php_ngx_mysql_t *mysql, smart_str *buf, 
+    ngx_uint_t state, ngx_uint_t results, unsigned pipeline, unsigned binary, 
+    zval *return_value);
+static void php_ngx_mysql_yield_false(ngx_http_request_t *r, ngx_http_php_ctx_t *ctx);
+
+static zend_object *
+php_ngx_mysql_create_object(zend_class_entry *ce)
+{
+    php_ngx_mysql_t     *mysql;
+
+    mysql = ecalloc(1, sizeof(php_ngx_mysql_t) + zend_object_properties_size(ce));
+
+    zend_object_std_init(&mysql->std, ce);
+    object_properties_init(&mysql->std, ce);
+
+    mysql->std.handlers = &php_ngx_mysql_handlers;
+
+    return &mysql->std;
+}
+
+static void 
+php_ngx_mysql_free_object(zend_object *object)
+{
+    php_ngx_mysql_t                 *mysql;
+    ngx_http_request_t              *r;
+    ngx_http_php_ctx_t              *ctx;
+    ngx_http_php_socket_upstream_t  *u;
+
+    mysql = php_ngx_mysql_fetch(object);
+
+    /* the object may go away with a reply still being read */
+
+    r = ngx_php_request;
+    if (r) {
+        ctx = ngx_http_get_module_ctx(r, ngx_http_php_module);
+        u = ctx ? ctx->upstream : NULL;
+
+        if (u && u->recv_filter_data == mysql) {
+            u->recv_mode = 0;
+            u->recv_filter = NULL;
+            u->recv_filter_data = NULL;
+        }
+    }
+
+    php_ngx_mysql_free_columns(mysql);
+
+    zval_ptr_dtor(&mysql->rows);
+    zval_ptr_dtor(&mysql->result);
+    zval_ptr_dtor(&mysql->params);
+
+    if (mysql->user) {
+        zend_string_release(mysql->user);
+    }
+
+    if (mysql->password) {
+        zend_string_release(mysql->password);
+    }
+
+    if (mysql->database) {
+        zend_string_release(mysql->database);
+    }
+
+    if (mysql->sql) {
+        zend_string_release(mysql->sql);
+    }
+
+    if (mysql->error) {
+        zend_string_release(mysql->error);
+    }
+
+    zend_object_std_dtor(object);
+}
+
+static void 
+php_ngx_mysql_free_columns(php_ngx_mysql_t *mysql)
+{
+    ngx_uint_t      i;
+
+    if (mysql->columns == NULL) {
+        return ;
+    }
+
+    for (i = 0; i < mysql->column; i++) {
+        zend_string_release(mysql->columns[i].name);
+    }
+
+    efree(mysql->columns);
+
+    mysql->columns = NULL;
+    mysql->ncolumns = 0;
+    mysql->column = 0;
+}
+
+static uint64_t 
+php_ngx_mysql_uint(u_char *p, size_t n)
+{
+    uint64_t    v;
+
+    v = 0;
+
+    while (n--) {
+        v = (v << 8) | p[n];
+    }
+
+    return v;
+}
+
+static void 
+php_ngx_mysql_append_uint(smart_str *buf, uint64_t v, size_t n)
+{
+    while (n--) {
+        smart_str_appendc(buf, (char) (v & 0xff));
+        v >>= 8;
+    }
+}
+
+static void 
+php_ngx_mysql_append_lenenc(smart_str *buf, uint64_t v)
+{
+    if (v < 251) {
+        php_ngx_mysql_append_uint(buf, v, 1);
+
+    } else if (v < 0x10000) {
+        smart_str_appendc(buf, (char) 0xfc);
+        php_ngx_mysql_append_uint(buf, v, 2);
+
+    } else if (v < 0x1000000) {
+        smart_str_appendc(buf, (char) 0xfd);
+        php_ngx_mysql_append_uint(buf, v, 3);
+
+    } else {
+        smart_str_appendc(buf, (char) 0xfe);
+        php_ngx_mysql_append_uint(buf, v, 8);
+    }
+}
+
+/* the header is filled in by php_ngx_mysql_packet_end() */
+static size_t 
+php_ngx_mysql_packet_begin(smart_str *buf)
+{
+    size_t      start;
+
+    start = buf->s ? ZSTR_LEN(buf->s) : 0;
+
+    smart_str_appendl(buf, "\0\0\0\0", 4);
+
+    return start;
+}
+
+static ngx_int_t 
+php_ngx_mysql_packet_end(smart_str *buf, size_t start, u_char seq)
+{
+    u_char      *p;
+    size_t      len;
+
+    len = ZSTR_LEN(buf->s) - start - 4;
+
+    if (len >= PHP_NGX_MYSQL_MAX_PACKET) {
+        /* split packets are not supported */
+        return NGX_ERROR;
+    }
+
+    p = (u_char *) ZSTR_VAL(buf->s) + start;
+
+    p[0] = (u_char) (len & 0xff);
+    p[1] = (u_char) ((len >> 8) & 0xff);
+    p[2] = (u_char) ((len >> 16) & 0xff);
+    p[3] = seq;
+
+    return NGX_OK;
+}
+
+/* NGX_DECLINED is the NULL value of text rows */
+static ngx_int_t 
+php_ngx_mysql_lenenc(u_char **pp, u_char *end, uint64_t *v)
+{
+    u_char      *p;
+    size_t      n;
+
+    p = *pp;
+
+    if (p >= end) {
+        return NGX_ERROR;
+    }
+
+    switch (*p) {
+
+    case 0xfb:
+        *pp = p + 1;
+        return NGX_DECLINED;
+
+    case 0xfc:
+        n = 2;
+        break;
+
+    case 0xfd:
+        n = 3;
+        break;
+
+    case 0xfe:
+        n = 8;
+        break;
+
+    case 0xff:
+        return NGX_ERROR;
+
+    default:
+        *v = *p;
+        *pp = p + 1;
+        return NGX_OK;
+    }
+
+    if ((size_t) (end - p) < n + 1) {
+        return NGX_ERROR;
+    }
+
+    *v = php_ngx_mysql_uint(p + 1, n);
+    *pp = p + 1 + n;
+
+    return NGX_OK;
+}
+
+static ngx_int_t 
+php_ngx_mysql_lenenc_str(u_char **pp, u_char *end, u_char **s, size_t *len)
+{
+    uint64_t    n;
+    ngx_int_t   rc;
+
+    rc = php_ngx_mysql_lenenc(pp, end, &n);
+    if (rc != NGX_OK) {
+        return rc;
+    }
+
+    if ((uint64_t) (end - *pp) < n) {
+        return NGX_ERROR;
+    }
+
+    *s = *pp;
+    *len = (size_t) n;
+    *pp += n;
+
+    return NGX_OK;
+}
+
+static void 
+php_ngx_mysql_set_error(php_ngx_mysql_t *mysql, u_char *p, u_char *end)
+{
+    /* 0xff, code, "#" sql state, message */
+
+    if (mysql->error) {
+        zend_string_release(mysql->error);
+    }
+
+    p++;
+
+    if (end - p < 2) {
+        mysql->errcode = 0;
+        mysql->error = zend_string_init("malformed error packet", 
+                                        sizeof("malformed error packet") - 1, 0);
+        return ;
+    }
+
+    mysql->errcode = (zend_long) php_ngx_mysql_uint(p, 2);
+    p += 2;
+
+    if (end - p >= 6 && *p == '#') {
+        p += 6;
+    }
+
+    mysql->error = zend_string_init((char *) p, end - p, 0);
+}
+
+/* 
+ * Appends the authentication data for the plugin, with a length byte in
+ * the handshake response and without it in an auth switch response. 
+ */
+static ngx_int_t 
+php_ngx_mysql_scramble(php_ngx_mysql_t *mysql, u_char *plugin, size_t len, 
+    smart_str *buf, ngx_uint_t lenprefix)
+{
+    PHP_SHA1_CTX        sha1;
+    PHP_SHA256_CTX      sha256;
+    u_char              stage1[32], stage2[32], digest[32];
+    u_char              *password;
+    size_t              password_len, n, i;
+
+    password = mysql->password ? (u_char *) ZSTR_VAL(mysql->password) : NULL;
+    password_len = mysql->password ? ZSTR_LEN(mysql->password) : 0;
+
+    if (len == sizeof("mysql_native_password") - 1
+        && ngx_strncmp(plugin, "mysql_native_password", len) == 0)
+    {
+        n = 20;
+
+        if (password_len) {
+
+            /* SHA1(password) ^ SHA1(scramble + SHA1(SHA1(password))) */
+
+            PHP_SHA1Init(&sha1);
+            PHP_SHA1Update(&sha1, password, password_len);
+            PHP_SHA1Final(stage1, &sha1);
+
+            PHP_SHA1Init(&sha1);
+            PHP_SHA1Update(&sha1, stage1, 20);
+            PHP_SHA1Final(stage2, &sha1);
+
+            PHP_SHA1Init(&sha1);
+            PHP_SHA1Update(&sha1, mysql->scramble, PHP_NGX_MYSQL_SCRAMBLE_LEN);
+            PHP_SHA1Update(&sha1, stage2, 20);
+            PHP_SHA1Final(digest, &sha1);
+        }
+
+    } else if (len == sizeof("caching_sha2_password") - 1
+               && ngx_strncmp(plugin, "caching_sha2_password", len) == 0)
+    {
+        n = 32;
+
+        if (password_len) {
+
+            /* SHA256(password) ^ SHA256(SHA256(SHA256(password)) + scramble) */
+
+            PHP_SHA256Init(&sha256);
+            PHP_SHA256Update(&sha256, password, password_len);
+            PHP_SHA256Final(stage1, &sha256);
+
+            PHP_SHA256Init(&sha256);
+            PHP_SHA256Update(&sha256, stage1, 32);
+            PHP_SHA256Final(stage2, &sha256);
+
+            PHP_SHA256Init(&sha256);
+            PHP_SHA256Update(&sha256, stage2, 32);
+            PHP_SHA256Update(&sha256, mysql->scramble, PHP_NGX_MYSQL_SCRAMBLE_LEN);
+            PHP_SHA256Final(digest, &sha256);
+        }
+
+    } else {
+        if (mysql->error) {
+            zend_string_release(mysql->error);
+        }
+
+        mysql->errcode = 0;
+        mysql->error = zend_strpprintf(0, "authentication plugin \"%.*s\" is not supported", 
+                                       (int) len, (char *) plugin);
+        return NGX_ERROR;
+    }
+
+    if (password_len == 0) {
+        if (lenprefix) {
+            smart_str_appendc(buf, '\0');
+        }
+
+        return NGX_OK;
+    }
+
+    for (i = 0; i < n; i++) {
+        digest[i] ^= stage1[i];
+    }
+
+    if (lenprefix) {
+        smart_str_appendc(buf, (char) n);
+    }
+
+    smart_str_appendl(buf, (char *) digest, n);
+
+    return NGX_OK;
+}
+
+static ngx_int_t 
+php_ngx_mysql_greeting(php_ngx_mysql_t *mysql, u_char *p, u_char *end, 
+    zend_string **next)
+{
+    u_char          *plugin, *q;
+    size_t          plugin_len, n;
+    uint32_t        caps;
+    smart_str       buf = {0};
+    size_t          start;
+
+    if (*p != 10) {
+        /* protocol version 10 only */
+        return NGX_ERROR;
+    }
+
+    p++;
+
+    /* server version */
+    p = ngx_strlchr(p, end, '\0');
+    if (p == NULL) {
+        return NGX_ERROR;
+    }
+
+    p++;
+
+    /* connection id, scramble part 1, filler, capabilities */
+    if (end - p < 4 + 8 + 1 + 2 + 1 + 2 + 2 + 1 + 10) {
+        return NGX_ERROR;
+    }
+
+    p += 4;
+
+    ngx_memcpy(mysql->scramble, p, 8);
+    p += 8 + 1;
+
+    caps = (uint32_t) php_ngx_mysql_uint(p, 2);
+    p += 2;
+
+    /* character set, status flags */
+    p += 1 + 2;
+
+    caps |= (uint32_t) php_ngx_mysql_uint(p, 2) << 16;
+    p += 2;
+
+    n = *p;
+    p += 1 + 10;
+
+    if (!(caps & PHP_NGX_MYSQL_CLIENT_PROTOCOL_41)
+        || !(caps & PHP_NGX_MYSQL_CLIENT_SECURE_CONNECTION))
+    {
+        return NGX_ERROR;
+    }
+
+    n = ngx_max(13, n > 8 ? n - 8 : 0);
+    if ((size_t) (end - p) < n) {
+        return NGX_ERROR;
+    }
+
+    ngx_memcpy(mysql->scramble + 8, p, PHP_NGX_MYSQL_SCRAMBLE_LEN - 8);
+    p += n;
+
+    plugin = (u_char *) "mysql_native_password";
+    plugin_len = sizeof("mysql_native_password") - 1;
+
+    if ((caps & PHP_NGX_MYSQL_CLIENT_PLUGIN_AUTH) && p < end) {
+        q = ngx_strlchr(p, end, '\0');
+        plugin = p;
+        plugin_len = (q ? q : end) - p;
+    }
+
+    /* HandshakeResponse41 */
+
+    caps = PHP_NGX_MYSQL_CLIENT_LONG_PASSWORD
+           | PHP_NGX_MYSQL_CLIENT_LONG_FLAG
+           | PHP_NGX_MYSQL_CLIENT_PROTOCOL_41
+           | PHP_NGX_MYSQL_CLIENT_TRANSACTIONS
+           | PHP_NGX_MYSQL_CLIENT_SECURE_CONNECTION
+           | PHP_NGX_MYSQL_CLIENT_MULTI_RESULTS
+           | PHP_NGX_MYSQL_CLIENT_PLUGIN_AUTH;
+
+    if (mysql->database && ZSTR_LEN(mysql->database)) {
+        caps |= PHP_NGX_MYSQL_CLIENT_CONNECT_WITH_DB;
+    }
+
+    start = php_ngx_mysql_packet_begin(&buf);
+
+    php_ngx_mysql_append_uint(&buf, caps, 4);
+    php_ngx_mysql_append_uint(&buf, PHP_NGX_MYSQL_MAX_PACKET + 1, 4);
+    php_ngx_mysql_append_uint(&buf, PHP_NGX_MYSQL_CHARSET, 1);
+    smart_str_appendl(&buf, "\0\0\0\0\0\0\0\0\0\0\0\0\0\0\0\0\0\0\0\0\0\0\0", 23);
+
+    if (mysql->user) {
+        smart_str_append(&buf, mysql->user);
+    }
+
+    smart_str_appendc(&buf, '\0');
+
+    if (php_ngx_mysql_scramble(mysql, plugin, plugin_len, &buf, 1) != NGX_OK) {
+        smart_str_free(&buf);
+        return NGX_ERROR;
+    }
+
+    if (caps & PHP_NGX_MYSQL_CLIENT_CONNECT_WITH_DB) {
+        smart_str_append(&buf, mysql->database);
+        smart_str_appendc(&buf, '\0');
+    }
+
+    smart_str_appendl(&buf, (char *) plugin, plugin_len);
+    smart_str_appendc(&buf, '\0');
+
+    if (php_ngx_mysql_packet_end(&buf, start, (u_char) (mysql->seq + 1)) != NGX_OK) {
+        smart_str_free(&buf);
+        return NGX_ERROR;
+    }
+
+    smart_str_0(&buf);
+    *next = buf.s;
+
+    mysql->state = PHP_NGX_MYSQL_AUTH;
+
+    return NGX_DONE;
+}
+
+#if (NGX_OPENSSL)
+
+/* full caching_sha2_password authentication over a plain connection */
+static ngx_int_t 
+php_ngx_mysql_auth_rsa(php_ngx_mysql_t *mysql, u_char *pem, size_t len, 
+    smart_str *buf)
+{
+    BIO             *bio;
+    EVP_PKEY        *pkey;
+    EVP_PKEY_CTX    *pctx;
+    u_char          *in, *out;
+    size_t          in_len, out_len, i;
+    ngx_int_t       rc;
+
+    rc = NGX_ERROR;
+    pkey = NULL;
+    pctx = NULL;
+    in = NULL;
+    out = NULL;
+
+    bio = BIO_new_mem_buf(pem, (int) len);
+    if (bio == NULL) {
+        return NGX_ERROR;
+    }
+
+    pkey = PEM_read_bio_PUBKEY(bio, NULL, NULL, NULL);
+    if (pkey == NULL) {
+        goto done;
+    }
+
+    /* the password with its terminating zero, xor'ed with the scramble */
+
+    in_len = (mysql->password ? ZSTR_LEN(mysql->password) : 0) + 1;
+    in = emalloc(in_len);
+
+    for (i = 0; i < in_len; i++) {
+        in[i] = (i < in_len - 1 ? (u_char) ZSTR_VAL(mysql->password)[i] : '\0')
+                ^ mysql->scramble[i % PHP_NGX_MYSQL_SCRAMBLE_LEN];
+    }
+
+    pctx = EVP_PKEY_CTX_new(pkey, NULL);
+    if (pctx == NULL
+        || EVP_PKEY_encrypt_init(pctx) <= 0
+        || EVP_PKEY_CTX_set_rsa_padding(pctx, RSA_PKCS1_OAEP_PADDING) <= 0
+        || EVP_PKEY_encrypt(pctx, NULL, &out_len, in, in_len) <= 0)
+    {
+        goto done;
+    }
+
+    out = emalloc(out_len);
+
+    if (EVP_PKEY_encrypt(pctx, out, &out_len, in, in_len) <= 0) {
+        goto done;
+    }
+
+    smart_str_appendl(buf, (char *) out, out_len);
+
+    rc = NGX_OK;
+
+done:
+
+    if (out) {
+        efree(out);
+    }
+
+    if (in) {
+        efree(in);
+    }
+
+    if (pctx) {
+        EVP_PKEY_CTX_free(pctx);
+    }
+
+    if (pkey) {
+        EVP_PKEY_free(pkey);
+    }
+
+    BIO_free(bio);
+
+    return rc;
+}
+
+#endif
+
+static ngx_int_t 
+php_ngx_mysql_auth(php_ngx_mysql_t *mysql, u_char *p, u_char *end, 
+    zval *retval, zend_string **next)
+{
+    u_char          *plugin, *q;
+    smart_str       buf = {0};
+    size_t          start;
+
+    switch (*p) {
+
+    case 0x00:
+        ZVAL_TRUE(retval);
+        return NGX_OK;
+
+    case 0xff:
+        php_ngx_mysql_set_error(mysql, p, end);
+        ZVAL_FALSE(retval);
+        return NGX_OK;
+
+    case 0xfe:
+
+        /* auth switch request: plugin name, new scramble */
+
+        plugin = p + 1;
+        q = ngx_strlchr(plugin, end, '\0');
+        if (q == NULL) {
+            return NGX_ERROR;
+        }
+
+        if (end - (q + 1) >= PHP_NGX_MYSQL_SCRAMBLE_LEN) {
+            ngx_memcpy(mysql->scramble, q + 1, PHP_NGX_MYSQL_SCRAMBLE_LEN);
+        }
+
+        start = php_ngx_mysql_packet_begin(&buf);
+
+        if (php_ngx_mysql_scramble(mysql, plugin, q - plugin, &buf, 0) != NGX_OK) {
+            smart_str_free(&buf);
+            return NGX_ERROR;
+        }
+
+        break;
+
+    case 0x01:
+
+        if (mysql->state == PHP_NGX_MYSQL_AUTH_KEY) {
+
+            /* the server's public key */
+
+#if (NGX_OPENSSL)
+            start = php_ngx_mysql_packet_begin(&buf);
+
+            if (php_ngx_mysql_auth_rsa(mysql, p + 1, end - p - 1, &buf) != NGX_OK) {
+                smart_str_free(&buf);
+                return NGX_ERROR;
+            }
+
+            mysql->state = PHP_NGX_MYSQL_AUTH;
+            break;
+#else
+            return NGX_ERROR;
+#endif
+        }
+
+        /* caching_sha2_password: 3 - fast auth succeeded, 4 - full auth */
+
+        if (end - p < 2) {
+            return NGX_ERROR;
+        }
+
+        if (p[1] == 0x03) {
+            return NGX_AGAIN;
+        }
+
+        if (p[1] != 0x04) {
+            return NGX_ERROR;
+        }
+
+#if (NGX_OPENSSL)
+        start = php_ngx_mysql_packet_begin(&buf);
+        smart_str_appendc(&buf, 0x02);
+
+        mysql->state = PHP_NGX_MYSQL_AUTH_KEY;
+        break;
+#else
+        if (mysql->error) {
+            zend_string_release(mysql->error);
+        }
+
+        mysql->errcode = 0;
+        mysql->error = zend_string_init("caching_sha2_password full authentication needs openssl", 
+                            sizeof("caching_sha2_password full authentication needs openssl") - 1, 0);
+        return NGX_ERROR;
+#endif
+
+    default:
+        return NGX_ERROR;
+    }
+
+    if (php_ngx_mysql_packet_end(&buf, start, (u_char) (mysql->seq + 1)) != NGX_OK) {
+        smart_str_free(&buf);
+        return NGX_ERROR;
+    }
+
+    smart_str_0(&buf);
+    *next = buf.s;
+
+    return NGX_DONE;
+}
+
+static ngx_int_t 
+php_ngx_mysql_column(php_ngx_mysql_t *mysql, u_char *p, u_char *end)
+{
+    php_ngx_mysql_column_t  *col;
+    u_char                  *s, *name;
+    size_t                  len, name_len;
+    uint64_t                n;
+    ngx_uint_t              i;
+
+    /* catalog, schema, table, org_table, name, org_name */
+
+    name = NULL;
+    name_len = 0;
+
+    for (i = 0; i < 6; i++) {
+        if (php_ngx_mysql_lenenc_str(&p, end, &s, &len) != NGX_OK) {
+            return NGX_ERROR;
+        }
+
+        if (i == 4) {
+            name = s;
+            name_len = len;
+        }
+    }
+
+    /* charset, length, type, flags, decimals */
+
+    if (php_ngx_mysql_lenenc(&p, end, &n) != NGX_OK || end - p < 10) {
+        return NGX_ERROR;
+    }
+
+    col = &mysql->columns[mysql->column++];
+
+    col->type = p[6];
+    col->flags = (uint16_t) php_ngx_mysql_uint(p + 7, 2);
+    col->name = zend_string_init((char *) name, name_len, 0);
+
+    return NGX_OK;
+}
+
+static void 
+php_ngx_mysql_text_value(zval *zv, php_ngx_mysql_column_t *col, u_char *s, 
+    size_t len)
+{
+    char        tmp[64];
+
+    /* numbers that surely fit are returned as numbers, like mysqlnd does */
+
+    switch (col->type) {
+
+    case PHP_NGX_MYSQL_TYPE_TINY:
+    case PHP_NGX_MYSQL_TYPE_SHORT:
+    case PHP_NGX_MYSQL_TYPE_LONG:
+    case PHP_NGX_MYSQL_TYPE_INT24:
+    case PHP_NGX_MYSQL_TYPE_LONGLONG:
+    case PHP_NGX_MYSQL_TYPE_YEAR:
+        if (len && len < MAX_LENGTH_OF_LONG - 1) {
+            ngx_memcpy(tmp, s, len);
+            tmp[len] = '\0';
+
+            ZVAL_LONG(zv, ZEND_STRTOL(tmp, NULL, 10));
+            return ;
+        }
+
+        break;
+
+    case PHP_NGX_MYSQL_TYPE_FLOAT:
+    case PHP_NGX_MYSQL_TYPE_DOUBLE:
+        if (len && len < sizeof(tmp)) {
+            ngx_memcpy(tmp, s, len);
+            tmp[len] = '\0';
+
+            ZVAL_DOUBLE(zv, zend_strtod(tmp, NULL));
+            return ;
+        }
+
+        break;
+    }
+
+    ZVAL_STRINGL(zv, (char *) s, len);
+}
+
+static ngx_int_t 
+php_ngx_mysql_text_row(php_ngx_mysql_t *mysql, u_char *p, u_char *end)
+{
+    zval            row, value;
+    u_char          *s;
+    size_t          len;
+    ngx_uint_t      i;
+    ngx_int_t       rc;
+
+    array_init_size(&row, (uint32_t) mysql->ncolumns);
+
+    for (i = 0; i < mysql->ncolumns; i++) {
+        rc = php_ngx_mysql_lenenc_str(&p, end, &s, &len);
+
+        if (rc == NGX_ERROR) {
+            zval_ptr_dtor(&row);
+            return NGX_ERROR;
+        }
+
+        if (rc == NGX_DECLINED) {
+            ZVAL_NULL(&value);
+
+        } else {
+            php_ngx_mysql_text_value(&value, &mysql->columns[i], s, len);
+        }
+
+        zend_symtable_update(Z_ARRVAL(row), mysql->columns[i].name, &value);
+    }
+
+    add_next_index_zval(&mysql->rows, &row);
+
+    return NGX_OK;
+}
+
+static ngx_int_t 
+php_ngx_mysql_binary_value(zval *zv, php_ngx_mysql_column_t *col, u_char **pp, 
+    u_char *end)
+{
+    u_char          *p, *s, *last;
+    u_char          tmp[64];
+    size_t          n, len;
+    uint64_t        v;
+    int64_t         sv;
+    float           f;
+    double          d;
+    ngx_uint_t      year, month, day, hour, minute, second, usec, days;
+
+    p = *pp;
+
+    switch (col->type) {
+
+    case PHP_NGX_MYSQL_TYPE_TINY:
+        n = 1;
+        break;
+
+    case PHP_NGX_MYSQL_TYPE_SHORT:
+    case PHP_NGX_MYSQL_TYPE_YEAR:
+        n = 2;
+        break;
+
+    case PHP_NGX_MYSQL_TYPE_LONG:
+    case PHP_NGX_MYSQL_TYPE_INT24:
+        n = 4;
+        break;
+
+    case PHP_NGX_MYSQL_TYPE_LONGLONG:
+        n = 8;
+        break;
+
+    case PHP_NGX_MYSQL_TYPE_FLOAT:
+        if (end - p < 4) {
+            return NGX_ERROR;
+        }
+
+        ngx_memcpy(&f, p, 4);
+        ZVAL_DOUBLE(zv, f);
+
+        *pp = p + 4;
+        return NGX_OK;
+
+    case PHP_NGX_MYSQL_TYPE_DOUBLE:
+        if (end - p < 8) {
+            return NGX_ERROR;
+        }
+
+        ngx_memcpy(&d, p, 8);
+        ZVAL_DOUBLE(zv, d);
+
+        *pp = p + 8;
+        return NGX_OK;
+
+    case PHP_NGX_MYSQL_TYPE_DATE:
+    case PHP_NGX_MYSQL_TYPE_DATETIME:
+    case PHP_NGX_MYSQL_TYPE_TIMESTAMP:
+
+        /* length, year, month, day, hour, minute, second, microseconds */
+
+        if (p >= end || end - p - 1 < *p) {
+            return NGX_ERROR;
+        }
+
+        len = *p++;
+
+        year = len >= 4 ? (ngx_uint_t) php_ngx_mysql_uint(p, 2) : 0;
+        month = len >= 4 ? p[2] : 0;
+        day = len >= 4 ? p[3] : 0;
+        hour = len >= 7 ? p[4] : 0;
+        minute = len >= 7 ? p[5] : 0;
+        second = len >= 7 ? p[6] : 0;
+        usec = len >= 11 ? (ngx_uint_t) php_ngx_mysql_uint(p + 7, 4) : 0;
+
+        last = ngx_sprintf(tmp, "%04ui-%02ui-%02ui", year, month, day);
+
+        if (col->type != PHP_NGX_MYSQL_TYPE_DATE) {
+            last = ngx_sprintf(last, " %02ui:%02ui:%02ui", hour, minute, second);
+
+            if (usec) {
+                last = ngx_sprintf(last, ".%06ui", usec);
+            }
+        }
+
+        ZVAL_STRINGL(zv, (char *) tmp, last - tmp);
+
+        *pp = p + len;
+        return NGX_OK;
+
+    case PHP_NGX_MYSQL_TYPE_TIME:
+
+        /* length, is negative, days, hour, minute, second, microseconds */
+
+        if (p >= end || end - p - 1 < *p) {
+            return NGX_ERROR;
+        }
+
+        len = *p++;
+
+        days = len >= 8 ? (ngx_uint_t) php_ngx_mysql_uint(p + 1, 4) : 0;
+        hour = len >= 8 ? p[5] : 0;
+        minute = len >= 8 ? p[6] : 0;
+        second = len >= 8 ? p[7] : 0;
+        usec = len >= 12 ? (ngx_uint_t) php_ngx_mysql_uint(p + 8, 4) : 0;
+
+        last = ngx_sprintf(tmp, "%s%02ui:%02ui:%02ui", 
+                           (len >= 8 && p[0]) ? "-" : "", 
+                           days * 24 + hour, minute, second);
+
+        if (usec) {
+            last = ngx_sprintf(last, ".%06ui", usec);
+        }
+
+        ZVAL_STRINGL(zv, (char *) tmp, last - tmp);
+
+        *pp = p + len;
+        return NGX_OK;
+
+    default:
+
+        /* decimals, strings, blobs, json, bit, enum, set, geometry */
+
+        if (php_ngx_mysql_lenenc_str(&p, end, &s, &len) != NGX_OK) {
+            return NGX_ERROR;
+        }
+
+        ZVAL_STRINGL(zv, (char *) s, len);
+
+        *pp = p;
+        return NGX_OK;
+    }
+
+    if ((size_t) (end - p) < n) {
+        return NGX_ERROR;
+    }
+
+    v = php_ngx_mysql_uint(p, n);
+    *pp = p + n;
+
+    if (col->flags & PHP_NGX_MYSQL_UNSIGNED_FLAG) {
+        if (v > (uint64_t) ZEND_LONG_MAX) {
+            last = ngx_sprintf(tmp, "%uL", v);
+            ZVAL_STRINGL(zv, (char *) tmp, last - tmp);
+            return NGX_OK;
+        }
+
+        ZVAL_LONG(zv, (zend_long) v);
+        return NGX_OK;
+    }
+
+    /* sign extension */
+    sv = (int64_t) (v << (64 - n * 8)) >> (64 - n * 8);
+
+    ZVAL_LONG(zv, (zend_long) sv);
+
+    return NGX_OK;
+}
+
+static ngx_int_t 
+php_ngx_mysql_binary_row(php_ngx_mysql_t *mysql, u_char *p, u_char *end)
+{
+    zval            row, value;
+    u_char          *bitmap;
+    size_t          n;
+    ngx_uint_t      i, bit;
+
+    /* 0x00, NULL bitmap with an offset of 2 bits, values */
+
+    p++;
+
+    n = (mysql->ncolumns + 7 + 2) / 8;
+    if ((size_t) (end - p) < n) {
+        return NGX_ERROR;
+    }
+
+    bitmap = p;
+    p += n;
+
+    array_init_size(&row, (uint32_t) mysql->ncolumns);
+
+    for (i = 0; i < mysql->ncolumns; i++) {
+        bit = i + 2;
+
+        if (bitmap[bit >> 3] & (1 << (bit & 7))) {
+            ZVAL_NULL(&value);
+
+        } else if (php_ngx_mysql_binary_value(&value, &mysql->columns[i], &p, end) 
+                   != NGX_OK)
+        {
+            zval_ptr_dtor(&row);
+            return NGX_ERROR;
+        }
+
+        zend_symtable_update(Z_ARRVAL(row), mysql->columns[i].name, &value);
+    }
+
+    add_next_index_zval(&mysql->rows, &row);
+
+    return NGX_OK;
+}
+
+static ngx_int_t 
+php_ngx_mysql_result_end(php_ngx_mysql_t *mysql, zval *value, ngx_uint_t status)
+{
+    php_ngx_mysql_free_columns(mysql);
+
+    if (mysql->discard) {
+        /* further result sets of a multi result statement */
+        zval_ptr_dtor(value);
+
+    } else if (mysql->pipeline) {
+        add_next_index_zval(&mysql->result, value);
+
+    } else {
+        ZVAL_COPY_VALUE(&mysql->result, value);
+    }
+
+    mysql->state = PHP_NGX_MYSQL_RESULT;
+
+    if (status & PHP_NGX_MYSQL_SERVER_MORE_RESULTS_EXISTS) {
+        mysql->discard = 1;
+        return NGX_AGAIN;
+    }
+
+    mysql->discard = 0;
+
+    if (--mysql->results) {
+        return NGX_AGAIN;
+    }
+
+    return NGX_OK;
+}
+
+static ngx_int_t 
+php_ngx_mysql_prepared(php_ngx_mysql_t *mysql, zend_string **next)
+{
+    php_ngx_mysql_stmt_t    *stmt;
+    smart_str               buf = {0};
+    zval                    value;
+    ngx_int_t               rc;
+
+    stmt = &mysql->conn->stmts[mysql->slot];
+
+    rc = php_ngx_mysql_append_execute(&buf, stmt, &mysql->params);
+
+    if (mysql->sql) {
+        zend_string_release(mysql->sql);
+        mysql->sql = NULL;
+    }
+
+    zval_ptr_dtor(&mysql->params);
+    ZVAL_UNDEF(&mysql->params);
+
+    mysql->state = PHP_NGX_MYSQL_RESULT;
+    mysql->binary = 1;
+
+    if (rc != NGX_OK) {
+        smart_str_free(&buf);
+
+        if (mysql->error) {
+            zend_string_release(mysql->error);
+        }
+
+        mysql->errcode = 0;
+        mysql->error = zend_strpprintf(0, "the statement expects %d parameters", 
+                                       (int) stmt->params);
+
+        ZVAL_FALSE(&value);
+        return php_ngx_mysql_result_end(mysql, &value, 0);
+    }
+
+    smart_str_0(&buf);
+    *next = buf.s;
+
+    return NGX_DONE;
+}
+
+/* 
+ * Returns NGX_AGAIN once the packet is processed and more are expected,
+ * NGX_DONE with *next to send, NGX_OK when the reply is complete.
+ */
+static ngx_int_t 
+php_ngx_mysql_packet(php_ngx_mysql_t *mysql, u_char *p, u_char *end, 
+    zval *retval, zend_string **next)
+{
+    php_ngx_mysql_stmt_t    *stmt;
+    zval                    value;
+    uint64_t                n;
+    ngx_uint_t              status, columns, params;
+
+    if (p == end) {
+        return NGX_ERROR;
+    }
+
+    switch (mysql->state) {
+
+    case PHP_NGX_MYSQL_GREETING:
+        if (*p == 0xff) {
+            /* e.g. too many connections */
+            php_ngx_mysql_set_error(mysql, p, end);
+            ZVAL_FALSE(retval);
+            return NGX_OK;
+        }
+
+        return php_ngx_mysql_greeting(mysql, p, end, next);
+
+    case PHP_NGX_MYSQL_AUTH:
+    case PHP_NGX_MYSQL_AUTH_KEY:
+        return php_ngx_mysql_auth(mysql, p, end, retval, next);
+
+    case PHP_NGX_MYSQL_RESULT:
+
+        if (*p == 0x00) {
+
+            /* OK: affected rows, last insert id, status */
+
+            p++;
+
+            array_init_size(&value, 2);
+
+            if (php_ngx_mysql_lenenc(&p, end, &n) != NGX_OK) {
+                zval_ptr_dtor(&value);
+                return NGX_ERROR;
+            }
+
+            add_assoc_long(&value, "affected_rows", (zend_long) n);
+
+            if (php_ngx_mysql_lenenc(&p, end, &n) != NGX_OK) {
+                zval_ptr_dtor(&value);
+                return NGX_ERROR;
+            }
+
+            add_assoc_long(&value, "insert_id", (zend_long) n);
+
+            status = end - p >= 2 ? (ngx_uint_t) php_ngx_mysql_uint(p, 2) : 0;
+
+            return php_ngx_mysql_result_end(mysql, &value, status);
+        }
+
+        if (*p == 0xff) {
+            php_ngx_mysql_set_error(mysql, p, end);
+            ZVAL_FALSE(&value);
+            return php_ngx_mysql_result_end(mysql, &value, 0);
+        }
+
+        if (*p == 0xfb) {
+            /* LOAD DATA LOCAL INFILE is not supported */
+            return NGX_ERROR;
+        }
+
+        if (php_ngx_mysql_lenenc(&p, end, &n) != NGX_OK || n == 0 || n > 4096) {
+            return NGX_ERROR;
+        }
+
+        mysql->columns = ecalloc((size_t) n, sizeof(php_ngx_mysql_column_t));
+        mysql->ncolumns = (ngx_uint_t) n;
+        mysql->column = 0;
+
+        mysql->state = PHP_NGX_MYSQL_COLUMNS;
+
+        return NGX_AGAIN;
+
+    case PHP_NGX_MYSQL_COLUMNS:
+        if (php_ngx_mysql_column(mysql, p, end) != NGX_OK) {
+            return NGX_ERROR;
+        }
+
+        if (mysql->column == mysql->ncolumns) {
+            mysql->state = PHP_NGX_MYSQL_COLUMNS_EOF;
+        }
+
+        return NGX_AGAIN;
+
+    case PHP_NGX_MYSQL_COLUMNS_EOF:
+        if (*p != 0xfe) {
+            return NGX_ERROR;
+        }
+
+        array_init(&mysql->rows);
+        mysql->state = PHP_NGX_MYSQL_ROWS;
+
+        return NGX_AGAIN;
+
+    case PHP_NGX_MYSQL_ROWS:
+
+        if (*p == 0xfe && end - p < 9) {
+
+            /* EOF: warnings, status */
+
+            status = end - p >= 5 ? (ngx_uint_t) php_ngx_mysql_uint(p + 3, 2) : 0;
+
+            ZVAL_COPY_VALUE(&value, &mysql->rows);
+            ZVAL_UNDEF(&mysql->rows);
+
+            return php_ngx_mysql_result_end(mysql, &value, status);
+        }
+
+        if (*p == 0xff) {
+            php_ngx_mysql_set_error(mysql, p, end);
+
+            zval_ptr_dtor(&mysql->rows);
+            ZVAL_UNDEF(&mysql->rows);
+
+            ZVAL_FALSE(&value);
+            return php_ngx_mysql_result_end(mysql, &value, 0);
+        }
+
+        if (mysql->binary) {
+            return php_ngx_mysql_binary_row(mysql, p, end) == NGX_OK ? NGX_AGAIN : NGX_ERROR;
+        }
+
+        return php_ngx_mysql_text_row(mysql, p, end) == NGX_OK ? NGX_AGAIN : NGX_ERROR;
+
+    case PHP_NGX_MYSQL_PREPARE:
+
+        if (*p == 0xff) {
+            php_ngx_mysql_set_error(mysql, p, end);
+
+            mysql->state = PHP_NGX_MYSQL_RESULT;
+
+            ZVAL_FALSE(&value);
+            return php_ngx_mysql_result_end(mysql, &value, 0);
+        }
+
+        /* 0x00, statement id, columns, params, filler, warnings */
+
+        if (*p != 0x00 || end - p < 12) {
+            return NGX_ERROR;
+        }
+
+        stmt = &mysql->conn->stmts[mysql->slot];
+
+        stmt->id = (uint32_t) php_ngx_mysql_uint(p + 1, 4);
+        columns = (ngx_uint_t) php_ngx_mysql_uint(p + 5, 2);
+        params = (ngx_uint_t) php_ngx_mysql_uint(p + 7, 2);
+        stmt->params = (uint16_t) params;
+
+        stmt->sql.data = ngx_alloc(ZSTR_LEN(mysql->sql), ngx_cycle->log);
+        if (stmt->sql.data) {
+            stmt->sql.len = ZSTR_LEN(mysql->sql);
+            ngx_memcpy(stmt->sql.data, ZSTR_VAL(mysql->sql), stmt->sql.len);
+            stmt->hash = ngx_crc32_long(stmt->sql.data, stmt->sql.len);
+        }
+
+        /* the parameter and column definitions are not needed */
+
+        mysql->skip = (params ? params + 1 : 0) + (columns ? columns + 1 : 0);
+
+        if (mysql->skip) {
+            mysql->state = PHP_NGX_MYSQL_PREPARE_SKIP;
+            return NGX_AGAIN;
+        }
+
+        return php_ngx_mysql_prepared(mysql, next);
+
+    case PHP_NGX_MYSQL_PREPARE_SKIP:
+        if (--mysql->skip) {
+            return NGX_AGAIN;
+        }
+
+        return php_ngx_mysql_prepared(mysql, next);
+    }
+
+    return NGX_ERROR;
+}
+
+static ngx_int_t 
+php_ngx_mysql_input_filter(void *data, ngx_buf_t *b, zval *retval, 
+    zend_string **next)
+{
+    php_ngx_mysql_t     *mysql = data;
+    u_char              *p;
+    size_t              len, plen;
+    ngx_int_t           rc;
+
+    for ( ;; ) {
+
+        len = b->last - b->pos;
+
+        if (len < 4 || len < mysql->need) {
+            return NGX_AGAIN;
+        }
+
+        /* 3 bytes length, sequence id */
+
+        plen = (size_t) php_ngx_mysql_uint(b->pos, 3);
+
+        if (plen == PHP_NGX_MYSQL_MAX_PACKET) {
+            /* a row of 16M and more comes split, not supported */
+            return NGX_ERROR;
+        }
+
+        if (len < 4 + plen) {
+            mysql->need = 4 + plen;
+            return NGX_AGAIN;
+        }
+
+        mysql->need = 0;
+        mysql->seq = b->pos[3];
+
+        p = b->pos + 4;
+        b->pos = p + plen;
+
+        rc = php_ngx_mysql_packet(mysql, p, p + plen, retval, next);
+
+        if (rc == NGX_AGAIN) {
+            continue;
+        }
+
+        if (rc == NGX_OK && Z_TYPE(mysql->result) != IS_UNDEF) {
+            ZVAL_COPY_VALUE(retval, &mysql->result);
+            ZVAL_UNDEF(&mysql->result);
+        }
+
+        return rc;
+    }
+}
+
+static ngx_int_t 
+php_ngx_mysql_append_command(smart_str *buf, u_char cmd, zend_string *sql)
+{
+    size_t      start;
+
+    start = php_ngx_mysql_packet_begin(buf);
+
+    smart_str_appendc(buf, (char) cmd);
+    smart_str_append(buf, sql);
+
+    return php_ngx_mysql_packet_end(buf, start, 0);
+}
+
+static ngx_int_t 
+php_ngx_mysql_append_execute(smart_str *buf, php_ngx_mysql_stmt_t *stmt, 
+    zval *params)
+{
+    zval            *val;
+    zend_string     *str;
+    uint32_t        n, i;
+    size_t          start, bitmap;
+    double          d;
+
+    n = (params && Z_TYPE_P(params) == IS_ARRAY) ? zend_hash_num_elements(Z_ARRVAL_P(params)) : 0;
+
+    if (n != stmt->params) {
+        return NGX_DECLINED;
+    }
+
+    /* statement id, flags, iteration count */
+
+    start = php_ngx_mysql_packet_begin(buf);
+
+    smart_str_appendc(buf, PHP_NGX_MYSQL_COM_STMT_EXECUTE);
+    php_ngx_mysql_append_uint(buf, stmt->id, 4);
+    smart_str_appendc(buf, '\0');
+    php_ngx_mysql_append_uint(buf, 1, 4);
+
+    if (n == 0) {
+        return php_ngx_mysql_packet_end(buf, start, 0);
+    }
+
+    /* NULL bitmap, new params bound flag, types, values */
+
+    bitmap = ZSTR_LEN(buf->s);
+
+    for (i = 0; i < (n + 7) / 8; i++) {
+        smart_str_appendc(buf, '\0');
+    }
+
+    i = 0;
+    ZEND_HASH_FOREACH_VAL(Z_ARRVAL_P(params), val) {
+        ZVAL_DEREF(val);
+
+        if (Z_TYPE_P(val) == IS_NULL) {
+            ZSTR_VAL(buf->s)[bitmap + i / 8] |= (char) (1 << (i % 8));
+        }
+
+        i++;
+    } ZEND_HASH_FOREACH_END();
+
+    smart_str_appendc(buf, 1);
+
+    ZEND_HASH_FOREACH_VAL(Z_ARRVAL_P(params), val) {
+        ZVAL_DEREF(val);
+
+        switch (Z_TYPE_P(val)) {
+
+        case IS_LONG:
+            smart_str_appendc(buf, PHP_NGX_MYSQL_TYPE_LONGLONG);
+            break;
+
+        case IS_DOUBLE:
+            smart_str_appendc(buf, PHP_NGX_MYSQL_TYPE_DOUBLE);
+            break;
+
+        case IS_NULL:
+            smart_str_appendc(buf, PHP_NGX_MYSQL_TYPE_NULL);
+            break;
+
+        case IS_TRUE:
+        case IS_FALSE:
+            smart_str_appendc(buf, PHP_NGX_MYSQL_TYPE_TINY);
+            break;
+
+        default:
+            smart_str_appendc(buf, (char) PHP_NGX_MYSQL_TYPE_VAR_STRING);
+        }
+
+        smart_str_appendc(buf, '\0');
+    } ZEND_HASH_FOREACH_END();
+
+    ZEND_HASH_FOREACH_VAL(Z_ARRVAL_P(params), val) {
+        ZVAL_DEREF(val);
+
+        switch (Z_TYPE_P(val)) {
+
+        case IS_LONG:
+            php_ngx_mysql_append_uint(buf, (uint64_t) Z_LVAL_P(val), 8);
+            break;
+
+        case IS_DOUBLE:
+            d = Z_DVAL_P(val);
+            smart_str_appendl(buf, (char *) &d, 8);
+            break;
+
+        case IS_NULL:
+            break;
+
+        case IS_TRUE:
+        case IS_FALSE:
+            smart_str_appendc(buf, Z_TYPE_P(val) == IS_TRUE ? 1 : 0);
+            break;
+
+        default:
+            str = zval_get_string(val);
+            php_ngx_mysql_append_lenenc(buf, ZSTR_LEN(str));
+            smart_str_append(buf, str);
+            zend_string_release(str);
+        }
+    } ZEND_HASH_FOREACH_END();
+
+    return php_ngx_mysql_packet_end(buf, start, 0);
+}
+
+static php_ngx_mysql_conn_t *
+php_ngx_mysql_conn(ngx_http_php_socket_upstream_t *u)
+{
+    ngx_connection_t        *c;
+    ngx_pool_cleanup_t      *cln;
+    php_ngx_mysql_conn_t    *conn;
+
+    c = u->peer.connection;
+    if (c == NULL || c->pool == NULL) {
+        return NULL;
+    }
+
+    if (u->keepalive.data) {
+        return u->keepalive.data;
+    }
+
+    /* lives as long as the connection, in or out of the keepalive pool */
+
+    conn = ngx_pcalloc(c->pool, sizeof(php_ngx_mysql_conn_t));
+    if (conn == NULL) {
+        return NULL;
+    }
+
+    cln = ngx_pool_cleanup_add(c->pool, 0);
+    if (cln == NULL) {
+        return NULL;
+    }
+
+    cln->handler = php_ngx_mysql_conn_cleanup;
+    cln->data = conn;
+
+    u->keepalive.data = conn;
+
+    return conn;
+}
+
+static void 
+php_ngx_mysql_conn_cleanup(void *data)
+{
+    php_ngx_mysql_conn_t    *conn = data;
+    ngx_uint_t              i;
+
+    for (i = 0; i < PHP_NGX_MYSQL_STMT_CACHE_SIZE; i++) {
+        if (conn->stmts[i].sql.data) {
+            ngx_free(conn->stmts[i].sql.data);
+        }
+    }
+}
+
+static void 
+php_ngx_mysql_yield_false(ngx_http_request_t *r, ngx_http_php_ctx_t *ctx)
+{
+    ZVAL_FALSE(&ctx->yield_retval);
+
+    ctx->delay_time = 0;
+    ngx_http_php_sleep(r);
+}
+
+/* sends the encoded commands, the result becomes the value of "yield" */
+static void 
+php_ngx_mysql_request(php_ngx_mysql_t *mysql, smart_str *buf, ngx_uint_t state, 
+    ngx_uint_t results, unsigned pipeline, unsigned binary, zval *return_value)
+{
+    ngx_http_request_t  *r;
+    ngx_http_php_ctx_t  *ctx;
+
+    r = ngx_php_request;
+    ctx = r ? ngx_http_get_module_ctx(r, ngx_http_php_module) : NULL;
+
+    if ( !ctx ) {
+        smart_str_free(buf);
+        RETURN_FALSE;
+    }
+
+    php_ngx_mysql_free_columns(mysql);
+
+    zval_ptr_dtor(&mysql->rows);
+    ZVAL_UNDEF(&mysql->rows);
+
+    zval_ptr_dtor(&mysql->result);
+    ZVAL_UNDEF(&mysql->result);
+
+    mysql->state = state;
+    mysql->results = results;
+    mysql->need = 0;
+    mysql->pipeline = pipeline;
+    mysql->binary = binary;
+    mysql->discard = 0;
+
+    if (pipeline) {
+        array_init_size(&mysql->result, (uint32_t) results);
+    }
+
+    smart_str_0(buf);
+
+    if (ngx_http_php_socket_request(r, buf->s, php_ngx_mysql_input_filter, mysql) 
+        == NGX_ERROR)
+    {
+        RETURN_FALSE;
+    }
+
+    RETURN_TRUE;
+}
+
+PHP_METHOD(ngx_mysql, connect)
+{
+    zend_string         *host;
+    zend_long           port = PHP_NGX_MYSQL_DEFAULT_PORT;
+    zend_string         *user = NULL;
+    zend_string         *password = NULL;
+    zend_string         *database = NULL;
+    char                *pool = NULL;
+    size_t              pool_len = 0;
+
+    php_ngx_mysql_t     *mysql;
+    ngx_http_request_t  *r;
+    ngx_http_php_ctx_t  *ctx;
+
+    if (zend_parse_parameters(ZEND_NUM_ARGS(), "S|lSSSs!", &host, &port, &user, 
+                              &password, &database, &pool, &pool_len) == FAILURE) 
+    {
+        RETURN_FALSE;
+    }
+
+    r = ngx_php_request;
+    ctx = r ? ngx_http_get_module_ctx(r, ngx_http_php_module) : NULL;
+
+    if ( !ctx ) {
+        RETURN_FALSE;
+    }
+
+    mysql = php_ngx_mysql_fetch(Z_OBJ_P(getThis()));
+
+    if (mysql->user) {
+        zend_string_release(mysql->user);
+    }
+
+    if (mysql->password) {
+        zend_string_release(mysql->password);
+    }
+
+    if (mysql->database) {
+        zend_string_release(mysql->database);
+    }
+
+    mysql->user = user ? zend_string_copy(user) : ZSTR_EMPTY_ALLOC();
+    mysql->password = password ? zend_string_copy(password) : ZSTR_EMPTY_ALLOC();
+    mysql->database = database ? zend_string_copy(database) : ZSTR_EMPTY_ALLOC();
+
+    /* "unix:/var/run/mysqld/mysqld.sock" has no port */
+
+    if (ZSTR_LEN(host) > 5 && ngx_strncmp(ZSTR_VAL(host), "unix:", 5) == 0) {
+        port = 0;
+    }
+
+    /* 
+     * A pooled connection stays authenticated as its user on its database, 
+     * the pool is per "user:database@host:port" (or "@pool" when named), 
+     * the lengths ahead keep a ':' or '@' in the names unambiguous.
+     */
+
+    ctx->pool_name.data = ngx_pnalloc(r->pool, ZSTR_LEN(mysql->user) 
+                                      + ZSTR_LEN(mysql->database) 
+                                      + ZSTR_LEN(host) + pool_len 
+                                      + sizeof(",/:@:") - 1 
+                                      + 2 * NGX_SIZE_T_LEN + NGX_INT_T_LEN);
+    if (ctx->pool_name.data == NULL) {
+        RETURN_FALSE;
+    }
+
+    if (pool_len) {
+        ctx->pool_name.len = ngx_sprintf(ctx->pool_name.data, "%uz,%uz/%*s:%*s@%*s", 
+                                 ZSTR_LEN(mysql->user), ZSTR_LEN(mysql->database), 
+                                 ZSTR_LEN(mysql->user), ZSTR_VAL(mysql->user), 
+                                 ZSTR_LEN(mysql->database), ZSTR_VAL(mysql->database), 
+                                 pool_len, pool) 
+                             - ctx->pool_name.data;
+
+    } else {
+        ctx->pool_name.len = ngx_sprintf(ctx->pool_name.data, "%uz,%uz/%*s:%*s@%*s:%i", 
+                                 ZSTR_LEN(mysql->user), ZSTR_LEN(mysql->database), 
+                                 ZSTR_LEN(mysql->user), ZSTR_VAL(mysql->user), 
+                                 ZSTR_LEN(mysql->database), ZSTR_VAL(mysql->database), 
+                                 ZSTR_LEN(host), ZSTR_VAL(host), (ngx_int_t) port) 
+                             - ctx->pool_name.data;
+    }
+
+    ctx->host.data = ngx_pnalloc(r->pool, ZSTR_LEN(host) + 1);
+    if (ctx->host.data == NULL) {
+        RETURN_FALSE;
+    }
+
+    ctx->host.len = ZSTR_LEN(host);
+    ngx_memcpy(ctx->host.data, ZSTR_VAL(host), ZSTR_LEN(host) + 1);
+
+    ctx->port = (ngx_int_t) port;
+
+    if (ngx_http_php_socket_connect(r) == NGX_ERROR) {
+        php_ngx_mysql_yield_false(r, ctx);
+        RETURN_FALSE;
+    }
+
+    /* 
+     * A new connection reads the greeting and authenticates before resuming,
+     * one taken from the keepalive pool is ready as is.
+     */
+
+    php_ngx_mysql_free_columns(mysql);
+
+    mysql->state = PHP_NGX_MYSQL_GREETING;
+    mysql->results = 0;
+    mysql->need = 0;
+
+    ngx_http_php_socket_handshake(r, php_ngx_mysql_input_filter, mysql);
+
+    if (Z_TYPE(ctx->yield_retval) == IS_UNDEF) {
+        ZVAL_TRUE(&ctx->yield_retval);
+    }
+
+    RETURN_TRUE;
+}
+
+PHP_METHOD(ngx_mysql, query)
+{
+    zend_string         *sql;
+    smart_str           buf = {0};
+
+    ngx_http_request_t  *r;
+    ngx_http_php_ctx_t  *ctx;
+
+    if (zend_parse_parameters(ZEND_NUM_ARGS(), "S", &sql) == FAILURE) {
+        RETURN_FALSE;
+    }
+
+    if (php_ngx_mysql_append_command(&buf, PHP_NGX_MYSQL_COM_QUERY, sql) != NGX_OK) {
+        smart_str_free(&buf);
+        php_error_docref(NULL, E_WARNING, "the query is too large");
+
+        /* the caller yields already, resume it with false */
+
+        r = ngx_php_request;
+        ctx = r ? ngx_http_get_module_ctx(r, ngx_http_php_module) : NULL;
+
+        if (ctx) {
+            php_ngx_mysql_yield_false(r, ctx);
+        }
+
+        RETURN_FALSE;
+    }
+
+    php_ngx_mysql_request(php_ngx_mysql_fetch(Z_OBJ_P(getThis())), &buf, 
+                          PHP_NGX_MYSQL_RESULT, 1, 0, 0, return_value);
+}
+
+PHP_METHOD(ngx_mysql, execute)
+{
+    zend_string                     *sql;
+    zval                            *params = NULL;
+    smart_str                       buf = {0};
+    uint32_t                        hash;
+    ngx_uint_t                      i, slot;
+    size_t                          start;
+
+    php_ngx_mysql_t                 *mysql;
+    php_ngx_mysql_conn_t            *conn;
+    php_ngx_mysql_stmt_t            *stmt;
+    ngx_http_request_t              *r;
+    ngx_http_php_ctx_t              *ctx;
+
+    if (zend_parse_parameters(ZEND_NUM_ARGS(), "S|a", &sql, &params) == FAILURE) {
+        RETURN_FALSE;
+    }
+
+    r = ngx_php_request;
+    ctx = r ? ngx_http_get_module_ctx(r, ngx_http_php_module) : NULL;
+
+    if ( !ctx ) {
+        RETURN_FALSE;
+    }
+
+    mysql = php_ngx_mysql_fetch(Z_OBJ_P(getThis()));
+
+    conn = ctx->upstream ? php_ngx_mysql_conn(ctx->upstream) : NULL;
+    if (conn == NULL) {
+        php_ngx_mysql_yield_false(r, ctx);
+        RETURN_FALSE;
+    }
+
+    /* the statement handle is looked up by the text of the query */
+
+    hash = ngx_crc32_long((u_char *) ZSTR_VAL(sql), ZSTR_LEN(sql));
+
+    for (i = 0; i < PHP_NGX_MYSQL_STMT_CACHE_SIZE; i++) {
+        stmt = &conn->stmts[i];
+
+        if (stmt->sql.data 
+            && stmt->hash == hash 
+            && stmt->sql.len == ZSTR_LEN(sql) 
+            && ngx_memcmp(stmt->sql.data, ZSTR_VAL(sql), stmt->sql.len) == 0)
+        {
+            if (php_ngx_mysql_append_execute(&buf, stmt, params) != NGX_OK) {
+                smart_str_free(&buf);
+                php_error_docref(NULL, E_WARNING, "the statement expects %d parameters", 
+                                 (int) stmt->params);
+                php_ngx_mysql_yield_false(r, ctx);
+                RETURN_FALSE;
+            }
+
+            php_ngx_mysql_request(mysql, &buf, PHP_NGX_MYSQL_RESULT, 1, 0, 1, 
+                                  return_value);
+            return ;
+        }
+    }
+
+    /* prepare, the execute is sent as soon as the handle comes back */
+
+    for (slot = 0; slot < PHP_NGX_MYSQL_STMT_CACHE_SIZE; slot++) {
+        if (conn->stmts[slot].sql.data == NULL) {
+            break;
+        }
+    }
+
+    if (slot == PHP_NGX_MYSQL_STMT_CACHE_SIZE) {
+        slot = conn->next;
+        conn->next = (conn->next + 1) % PHP_NGX_MYSQL_STMT_CACHE_SIZE;
+
+        stmt = &conn->stmts[slot];
+
+        start = php_ngx_mysql_packet_begin(&buf);
+        smart_str_appendc(&buf, PHP_NGX_MYSQL_COM_STMT_CLOSE);
+        php_ngx_mysql_append_uint(&buf, stmt->id, 4);
+        (void) php_ngx_mysql_packet_end(&buf, start, 0);
+
+        ngx_free(stmt->sql.data);
+        ngx_memzero(stmt, sizeof(php_ngx_mysql_stmt_t));
+    }
+
+    if (php_ngx_mysql_append_command(&buf, PHP_NGX_MYSQL_COM_STMT_PREPARE, sql) != NGX_OK) {
+        smart_str_free(&buf);
+        php_error_docref(NULL, E_WARNING, "the query is too large");
+        php_ngx_mysql_yield_false(r, ctx);
+        RETURN_FALSE;
+    }
+
+    if (mysql->sql) {
+        zend_string_release(mysql->sql);
+    }
+
+    zval_ptr_dtor(&mysql->params);
+
+    mysql->conn = conn;
+    mysql->slot = slot;
+    mysql->sql = zend_string_copy(sql);
+
+    if (params) {
+        ZVAL_COPY(&mysql->params, params);
+
+    } else {
+        ZVAL_UNDEF(&mysql->params);
+    }
+
+    php_ngx_mysql_request(mysql, &buf, PHP_NGX_MYSQL_PREPARE, 1, 0, 0, return_value);
+}
+
+PHP_METHOD(ngx_mysql, pipeline)
+{
+    zval                *queries, *query;
+    zend_string         *sql;
+    uint32_t            n;
+    smart_str           buf = {0};
+    ngx_int_t           rc;
+
+    ngx_http_request_t  *r;
+    ngx_http_php_ctx_t  *ctx;
+
+    if (zend_parse_parameters(ZEND_NUM_ARGS(), "a", &queries) == FAILURE) {
+        RETURN_FALSE;
+    }
+
+    /* all queries go out with one send, the results come back as an array */
+
+    n = 0;
+
+    ZEND_HASH_FOREACH_VAL(Z_ARRVAL_P(queries), query) {
+        sql = zval_get_string(query);
+        rc = php_ngx_mysql_append_command(&buf, PHP_NGX_MYSQL_COM_QUERY, sql);
+        zend_string_release(sql);
+
+        if (rc != NGX_OK) {
+            smart_str_free(&buf);
+            php_error_docref(NULL, E_WARNING, "the query is too large");
+
+            r = ngx_php_request;
+            ctx = r ? ngx_http_get_module_ctx(r, ngx_http_php_module) : NULL;
+
+            if (ctx) {
+                php_ngx_mysql_yield_false(r, ctx);
+            }
+
+            RETURN_FALSE;
+        }
+
+        n++;
+    } ZEND_HASH_FOREACH_END();
+
+    if (n == 0) {
+        r = ngx_php_request;
+        ctx = r ? ngx_http_get_module_ctx(r, ngx_http_php_module) : NULL;
+
+        if ( !ctx ) {
+            RETURN_FALSE;
+        }
+
+        array_init(&ctx->yield_retval);
+        ctx->delay_time = 0;
+        ngx_http_php_sleep(r);
+
+        RETURN_TRUE;
+    }
+
+    php_ngx_mysql_request(php_ngx_mysql_fetch(Z_OBJ_P(getThis())), &buf, 
+                          PHP_NGX_MYSQL_RESULT, n, 1, 0, return_value);
+}
+
+PHP_METHOD(ngx_mysql, setkeepalive)
+{
+    zend_long           timeout = 0;
+    zend_long           size = 0;
+
+    ngx_http_request_t  *r;
+    ngx_http_php_ctx_t  *ctx;
+
+    if (zend_parse_parameters(ZEND_NUM_ARGS(), "|ll", &timeout, &size) == FAILURE) {
+        RETURN_FALSE;
+    }
+
+    if (timeout < 0 || size < 0) {
+        RETURN_FALSE;
+    }
+
+    r = ngx_php_request;
+    ctx = r ? ngx_http_get_module_ctx(r, ngx_http_php_module) : NULL;
+
+    if ( !ctx ) {
+        RETURN_FALSE;
+    }
+
+    if (ngx_http_php_socket_setkeepalive(r, (ngx_msec_t) timeout, (ngx_uint_t) size) != NGX_OK) {
+        RETURN_FALSE;
+    }
+
+    RETURN_TRUE;
+}
+
+PHP_METHOD(ngx_mysql, close)
+{
+    ngx_http_request_t  *r;
+    ngx_http_php_ctx_t  *ctx;
+
+    r = ngx_php_request;
+    ctx = r ? ngx_http_get_module_ctx(r, ngx_http_php_module) : NULL;
+
+    if ( !ctx ) {
+        RETURN_FALSE;
+    }
+
+    ngx_http_php_socket_clear(r);
+
+    RETURN_TRUE;
+}
+
+PHP_METHOD(ngx_mysql, getLastError)
+{
+    php_ngx_mysql_t     *mysql;
+
+    mysql = php_ngx_mysql_fetch(Z_OBJ_P(getThis()));
+
+    if (mysql->error == NULL) {
+        RETURN_NULL();
+    }
+
+    RETURN_STR_COPY(mysql->error);
+}
+
+PHP_METHOD(ngx_mysql, getLastErrno)
+{
+    php_ngx_mysql_t     *mysql;
+
+    mysql = php_ngx_mysql_fetch(Z_OBJ_P(getThis()));
+
+    RETURN_LONG(mysql->errcode);
+}
+
+static const zend_function_entry php_ngx_mysql_class_functions[] = {
+    PHP_ME(ngx_mysql, connect, ngx_mysql_connect_arginfo, ZEND_ACC_PUBLIC)
+    PHP_ME(ngx_mysql, query, ngx_mysql_query_arginfo, ZEND_ACC_PUBLIC)
+    PHP_ME(ngx_mysql, execute, ngx_mysql_execute_arginfo, ZEND_ACC_PUBLIC)
+    PHP_ME(ngx_mysql, pipeline, ngx_mysql_pipeline_arginfo, ZEND_ACC_PUBLIC)
+    PHP_ME(ngx_mysql, setkeepalive, ngx_mysql_setkeepalive_arginfo, ZEND_ACC_PUBLIC)
+    PHP_ME(ngx_mysql, close, ngx_mysql_void_arginfo, ZEND_ACC_PUBLIC)
+    PHP_ME(ngx_mysql, getLastError, ngx_mysql_void_arginfo, ZEND_ACC_PUBLIC)
+    PHP_ME(ngx_mysql, getLastErrno, ngx_mysql_void_arginfo, ZEND_ACC_PUBLIC)
+    {NULL, NULL, NULL, 0, 0}
+};
+
+void
+php_impl_ngx_mysql_init(int module_number)
+{
+    zend_class_entry ngx_mysql_class_entry;
+    INIT_NS_CLASS_ENTRY(ngx_mysql_class_entry, "ngx", "mysql", php_ngx_mysql_class_functions);
+    php_ngx_mysql_class_entry = zend_register_internal_class(&ngx_mysql_class_entry);
+    php_ngx_mysql_class_entry->create_object = php_ngx_mysql_create_object;
+
+    memcpy(&php_ngx_mysql_handlers, zend_get_std_object_handlers(), sizeof(zend_object_handlers));
+    php_ngx_mysql_handlers.offset = XtOffsetOf(php_ngx_mysql_t, std);
+    php_ngx_mysql_handlers.free_obj = php_ngx_mysql_free_object;
+    php_ngx_mysql_handlers.clone_obj = NULL;
+}
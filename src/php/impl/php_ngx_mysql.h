@@ -0,0 +1,151 @@
+/*
+==============================================================================
+Copyright (c) 2016-2020, rryqszq4 <rryqszq@gmail.com>
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+
+* Redistributions of source code must retain the above copyright notice, this
+  list of conditions and the following disclaimer.
+
+* Redistributions in binary form must reproduce the above copyright notice,
+  this list of conditions and the following disclaimer in the documentation
+  and/or other materials provided with the distribution.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+==============================================================================
+*/
+
+#ifndef __PHP_NGX_MYSQL_H__
+#define __PHP_NGX_MYSQL_H__
+
+#include <php.h>
+#include <php_ini.h>
+#include <ext/standard/info.h>
+#include <ngx_http.h>
+
+#define PHP_NGX_MYSQL_DEFAULT_PORT      3306
+#define PHP_NGX_MYSQL_STMT_CACHE_SIZE   64
+#define PHP_NGX_MYSQL_SCRAMBLE_LEN      20
+
+typedef struct {
+
+    zend_string     *name;
+    u_char          type;
+    uint16_t        flags;
+
+} php_ngx_mysql_column_t;
+
+typedef struct {
+
+    ngx_str_t       sql;
+    uint32_t        hash;
+    uint32_t        id;
+    uint16_t        params;
+
+} php_ngx_mysql_stmt_t;
+
+/* prepared statements of a connection, kept with it in the keepalive pool */
+typedef struct {
+
+    php_ngx_mysql_stmt_t    stmts[PHP_NGX_MYSQL_STMT_CACHE_SIZE];
+    ngx_uint_t              next;
+
+} php_ngx_mysql_conn_t;
+
+typedef struct php_ngx_mysql_s {
+
+    ngx_uint_t      state;
+
+    /* results still expected for the commands in flight */
+    ngx_uint_t      results;
+
+    /* do not parse again before this many bytes are buffered */
+    size_t          need;
+
+    u_char          seq;
+
+    php_ngx_mysql_column_t  *columns;
+    ngx_uint_t              ncolumns;
+    ngx_uint_t              column;
+
+    /* metadata packets of a prepare response still to be skipped */
+    ngx_uint_t      skip;
+
+    zval            rows;
+    zval            result;
+
+    zend_string     *user;
+    zend_string     *password;
+    zend_string     *database;
+    u_char          scramble[PHP_NGX_MYSQL_SCRAMBLE_LEN];
+
+    /* statement being prepared, executed once the handle is known */
+    php_ngx_mysql_conn_t    *conn;
+    ngx_uint_t              slot;
+    zend_string             *sql;
+    zval                    params;
+
+    zend_string     *error;
+    zend_long       errcode;
+
+    unsigned        binary:1;
+    unsigned        pipeline:1;
+    unsigned        discard:1;
+
+    zend_object     std;
+
+} php_ngx_mysql_t;
+
+ZEND_BEGIN_ARG_INFO_EX(ngx_mysql_connect_arginfo, 0, 0, 1)
+    ZEND_ARG_INFO(0, host)
+    ZEND_ARG_INFO(0, port)
+    ZEND_ARG_INFO(0, user)
+    ZEND_ARG_INFO(0, password)
+    ZEND_ARG_INFO(0, database)
+    ZEND_ARG_INFO(0, pool)
+ZEND_END_ARG_INFO()
+
+ZEND_BEGIN_ARG_INFO_EX(ngx_mysql_query_arginfo, 0, 0, 1)
+    ZEND_ARG_INFO(0, sql)
+ZEND_END_ARG_INFO()
+
+ZEND_BEGIN_ARG_INFO_EX(ngx_mysql_execute_arginfo, 0, 0, 1)
+    ZEND_ARG_INFO(0, sql)
+    ZEND_ARG_ARRAY_INFO(0, params, 0)
+ZEND_END_ARG_INFO()
+
+ZEND_BEGIN_ARG_INFO_EX(ngx_mysql_pipeline_arginfo, 0, 0, 1)
+    ZEND_ARG_ARRAY_INFO(0, queries, 0)
+ZEND_END_ARG_INFO()
+
+ZEND_BEGIN_ARG_INFO_EX(ngx_mysql_setkeepalive_arginfo, 0, 0, 0)
+    ZEND_ARG_INFO(0, timeout)
+    ZEND_ARG_INFO(0, size)
+ZEND_END_ARG_INFO()
+
+ZEND_BEGIN_ARG_INFO_EX(ngx_mysql_void_arginfo, 0, 0, 0)
+ZEND_END_ARG_INFO()
+
+PHP_METHOD(ngx_mysql, connect);
+PHP_METHOD(ngx_mysql, query);
+PHP_METHOD(ngx_mysql, execute);
+PHP_METHOD(ngx_mysql, pipeline);
+PHP_METHOD(ngx_mysql, setkeepalive);
+PHP_METHOD(ngx_mysql, close);
+PHP_METHOD(ngx_mysql, getLastError);
+PHP_METHOD(ngx_mysql, getLastErrno);
+
+void php_impl_ngx_mysql_init(int module_number);
+
+#endif
@@ -0,0 +1,164 @@
+/*
+==============================================================================
+Copyright (c) 2016-2020, rryqszq4 <rryqszq@gmail.com>
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+
+* Redistributions of source code must retain the above copyright notice, this
+  list of conditions and the following disclaimer.
+
+* Redistributions in binary form must reproduce the above copyright notice,
+  this list of conditions and the following disclaimer in the documentation
+  and/or other materials provided with the distribution.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+==============================================================================
+*/
+
+#include "php_ngx_queue.h"
+#include "../../ngx_http_php_module.h"
+#include "../../ngx_http_php_sleep.h"
+#include "../../ngx_http_php_queue.h"
+
+static void php_ngx_queue_wait(INTERNAL_FUNCTION_PARAMETERS, zend_string *name, 
+    ngx_uint_t pop, int64_t after, double timeout);
+
+PHP_FUNCTION(ngx_queue_push)
+{
+    zend_string         *name;
+    zend_string         *message;
+    ngx_shm_zone_t      *zone;
+    ngx_str_t           key, msg;
+    uint64_t            seq;
+
+    if (zend_parse_parameters(ZEND_NUM_ARGS(), "SS", &name, &message) == FAILURE) {
+        RETURN_FALSE;
+    }
+
+    key.data = (u_char *) ZSTR_VAL(name);
+    key.len = ZSTR_LEN(name);
+
+    zone = ngx_http_php_queue_zone(&key);
+    if (zone == NULL) {
+        php_error_docref(NULL, E_WARNING, "php_shared_queue \"%s\" is not defined", 
+                         ZSTR_VAL(name));
+        RETURN_FALSE;
+    }
+
+    msg.data = (u_char *) ZSTR_VAL(message);
+    msg.len = ZSTR_LEN(message);
+
+    if (ngx_http_php_queue_push(zone, &msg, &seq) != NGX_OK) {
+        php_error_docref(NULL, E_WARNING, "message too large for php_shared_queue \"%s\"",
+                         ZSTR_VAL(name));
+        RETURN_FALSE;
+    }
+
+    RETURN_LONG((zend_long) seq);
+}
+
+PHP_FUNCTION(ngx_queue_pop)
+{
+    zend_string         *name;
+    double              timeout = 0;
+
+    if (zend_parse_parameters(ZEND_NUM_ARGS(), "S|d", &name, &timeout) == FAILURE) {
+        RETURN_FALSE;
+    }
+
+    php_ngx_queue_wait(INTERNAL_FUNCTION_PARAM_PASSTHRU, name, 1, -1, timeout);
+}
+
+PHP_FUNCTION(ngx_queue_fetch)
+{
+    zend_string         *name;
+    zend_long           after = -1;
+    zend_bool           after_null = 1;
+    double              timeout = 0;
+
+    if (zend_parse_parameters(ZEND_NUM_ARGS(), "S|l!d", &name, &after, &after_null, 
+                              &timeout) == FAILURE) 
+    {
+        RETURN_FALSE;
+    }
+
+    if (after_null || after < 0) {
+        after = -1;
+    }
+
+    php_ngx_queue_wait(INTERNAL_FUNCTION_PARAM_PASSTHRU, name, 0, (int64_t) after, timeout);
+}
+
+/* 
+ * Both take what is there at once, or wait in the event loop for a 
+ * push from any worker; the coroutine resumes with the result.
+ */
+
+static void 
+php_ngx_queue_wait(INTERNAL_FUNCTION_PARAMETERS, zend_string *name, 
+    ngx_uint_t pop, int64_t after, double timeout)
+{
+    ngx_http_request_t  *r;
+    ngx_http_php_ctx_t  *ctx;
+    ngx_shm_zone_t      *zone;
+    ngx_str_t           key;
+    ngx_msec_t          msec;
+    ngx_int_t           rc;
+
+    r = ngx_php_request;
+    ctx = r ? ngx_http_get_module_ctx(r, ngx_http_php_module) : NULL;
+
+    if ( !ctx ) {
+        RETURN_FALSE;
+    }
+
+    key.data = (u_char *) ZSTR_VAL(name);
+    key.len = ZSTR_LEN(name);
+
+    zone = ngx_http_php_queue_zone(&key);
+    if (zone == NULL) {
+        php_error_docref(NULL, E_WARNING, "php_shared_queue \"%s\" is not defined", 
+                         ZSTR_VAL(name));
+        goto failed;
+    }
+
+    if (timeout <= 0) {
+        msec = 0;
+    } else {
+        msec = (ngx_msec_t) (timeout * 1000);
+        msec = msec ? msec : 1;
+    }
+
+    rc = ngx_http_php_queue_wait(r, zone, pop, after, msec, &ctx->yield_retval);
+
+    if (rc == NGX_AGAIN) {
+        RETURN_TRUE;
+    }
+
+    if (rc == NGX_OK) {
+        ctx->delay_time = 0;
+        ngx_http_php_sleep(r);
+
+        RETURN_TRUE;
+    }
+
+failed:
+
+    ZVAL_FALSE(&ctx->yield_retval);
+
+    ctx->delay_time = 0;
+    ngx_http_php_sleep(r);
+
+    RETURN_FALSE;
+}
@@ -0,0 +1,698 @@
+/*
+==============================================================================
+Copyright (c) 2016-2020, rryqszq4 <rryqszq@gmail.com>
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+
+* Redistributions of source code must retain the above copyright notice, this
+  list of conditions and the following disclaimer.
+
+* Redistributions in binary form must reproduce the above copyright notice,
+  this list of conditions and the following disclaimer in the documentation
+  and/or other materials provided with the distribution.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+==============================================================================
+*/
+
+#include <zend_smart_str.h>
+
+#include "../../ngx_http_php_module.h"
+#include "../../ngx_http_php_socket.h"
+#include "../../ngx_http_php_sleep.h"
+#include "php_ngx_redis.h"
+
+#define php_ngx_redis_fetch(obj)                                              \
+    ((php_ngx_redis_t *) ((char *) (obj) - XtOffsetOf(php_ngx_redis_t, std)))
+
+static zend_class_entry *php_ngx_redis_class_entry;
+static zend_object_handlers php_ngx_redis_handlers;
+
+static zend_object *php_ngx_redis_create_object(zend_class_entry *ce);
+static void php_ngx_redis_free_object(zend_object *object);
+static ngx_int_t php_ngx_redis_atoi(u_char *line, size_t len, ngx_int_t *n);
+static ngx_int_t php_ngx_redis_parse_reply(php_ngx_redis_t *redis, u_char **pp, 
+    u_char *last, zval *rv, ngx_uint_t depth, u_char **hint);
+static ngx_int_t php_ngx_redis_input_filter(void *data, ngx_buf_t *b, zval *retval, 
+    zend_string **next);
+static uint32_t php_ngx_redis_count_args(zval *args, uint32_t argc);
+static void php_ngx_redis_append_arg(smart_str *buf, zend_string *str);
+static void php_ngx_redis_encode(smart_str *buf, zend_string *cmd, zval *args, 
+    uint32_t argc);
+static void php_ngx_redis_request(php_ngx_redis_t *redis, smart_str *buf, 
+    ngx_uint_t replies, unsigned pipeline, zval *return_value);
+static void php_ngx_redis_yield_false(ngx_http_request_t *r, ngx_http_php_ctx_t *ctx);
+
+static zend_object *
+php_ngx_redis_create_object(zend_class_entry *ce)
+{
+    php_ngx_redis_t     *redis;
+
+    redis = ecalloc(1, sizeof(php_ngx_redis_t) + zend_object_properties_size(ce));
+
+    zend_object_std_init(&redis->std, ce);
+    object_properties_init(&redis->std, ce);
+
+    redis->std.handlers = &php_ngx_redis_handlers;
+
+    return &redis->std;
+}
+
+static void 
+php_ngx_redis_free_object(zend_object *object)
+{
+    php_ngx_redis_t                 *redis;
+    ngx_http_request_t              *r;
+    ngx_http_php_ctx_t              *ctx;
+    ngx_http_php_socket_upstream_t  *u;
+
+    redis = php_ngx_redis_fetch(object);
+
+    /* the object may go away with a reply still being read */
+
+    r = ngx_php_request;
+    if (r) {
+        ctx = ngx_http_get_module_ctx(r, ngx_http_php_module);
+        u = ctx ? ctx->upstream : NULL;
+
+        if (u && u->recv_filter_data == redis) {
+            u->recv_mode = 0;
+            u->recv_filter = NULL;
+            u->recv_filter_data = NULL;
+        }
+    }
+
+    zval_ptr_dtor(&redis->result);
+
+    if (redis->error) {
+        zend_string_release(redis->error);
+    }
+
+    zend_object_std_dtor(object);
+}
+
+static ngx_int_t 
+php_ngx_redis_atoi(u_char *line, size_t len, ngx_int_t *n)
+{
+    ngx_int_t   sign;
+
+    sign = 1;
+
+    if (len && line[0] == '-') {
+        sign = -1;
+        line++;
+        len--;
+    }
+
+    *n = ngx_atoi(line, len);
+    if (*n == NGX_ERROR) {
+        return NGX_ERROR;
+    }
+
+    *n *= sign;
+
+    return NGX_OK;
+}
+
+/*
+ * Parses one RESP reply starting at *pp, nested arrays recursively. 
+ * On NGX_AGAIN *hint tells how far the buffer has to be filled before
+ * trying again, so that large bulk strings are not parsed byte by byte.
+ */
+static ngx_int_t 
+php_ngx_redis_parse_reply(php_ngx_redis_t *redis, u_char **pp, u_char *last, 
+    zval *rv, ngx_uint_t depth, u_char **hint)
+{
+    u_char      *p, *line, *eol;
+    size_t      len;
+    ngx_int_t   n, i, rc;
+    zval        item;
+
+    p = *pp;
+
+    eol = ngx_strlchr(p, last, LF);
+    if (eol == NULL) {
+        *hint = last + 1;
+        return NGX_AGAIN;
+    }
+
+    if (eol - p < 2 || eol[-1] != CR) {
+        return NGX_ERROR;
+    }
+
+    line = p + 1;
+    len = eol - 1 - line;
+
+    p = eol + 1;
+
+    switch (**pp) {
+
+    case '+':
+        ZVAL_STRINGL(rv, (char *) line, len);
+        break;
+
+    case '-':
+        if (redis->error) {
+            zend_string_release(redis->error);
+        }
+
+        redis->error = zend_string_init((char *) line, len, 0);
+
+        ZVAL_FALSE(rv);
+        break;
+
+    case ':':
+        if (php_ngx_redis_atoi(line, len, &n) != NGX_OK) {
+            return NGX_ERROR;
+        }
+
+        ZVAL_LONG(rv, n);
+        break;
+
+    case '$':
+        if (php_ngx_redis_atoi(line, len, &n) != NGX_OK || n < -1) {
+            return NGX_ERROR;
+        }
+
+        if (n == -1) {
+            ZVAL_NULL(rv);
+            break;
+        }
+
+        if (last - p < n + 2) {
+            *hint = p + n + 2;
+            return NGX_AGAIN;
+        }
+
+        if (p[n] != CR || p[n + 1] != LF) {
+            return NGX_ERROR;
+        }
+
+        ZVAL_STRINGL(rv, (char *) p, n);
+        p += n + 2;
+        break;
+
+    case '*':
+        if (php_ngx_redis_atoi(line, len, &n) != NGX_OK || n < -1) {
+            return NGX_ERROR;
+        }
+
+        if (n == -1) {
+            ZVAL_NULL(rv);
+            break;
+        }
+
+        if (depth >= PHP_NGX_REDIS_MAX_DEPTH) {
+            return NGX_ERROR;
+        }
+
+        /* do not trust the length for the allocation before the data is here */
+        array_init_size(rv, (uint32_t) ngx_min(n, last - p));
+
+        for (i = 0; i < n; i++) {
+            rc = php_ngx_redis_parse_reply(redis, &p, last, &item, depth + 1, hint);
+
+            if (rc != NGX_OK) {
+                zval_ptr_dtor(rv);
+                ZVAL_UNDEF(rv);
+                return rc;
+            }
+
+            add_next_index_zval(rv, &item);
+        }
+
+        break;
+
+    default:
+        return NGX_ERROR;
+    }
+
+    *pp = p;
+
+    return NGX_OK;
+}
+
+static ngx_int_t 
+php_ngx_redis_input_filter(void *data, ngx_buf_t *b, zval *retval, 
+    zend_string **next)
+{
+    php_ngx_redis_t     *redis = data;
+    u_char              *p, *hint;
+    ngx_int_t           rc;
+    zval                reply;
+
+    while (redis->replies) {
+
+        if ((size_t) (b->last - b->pos) < redis->need) {
+            return NGX_AGAIN;
+        }
+
+        p = b->pos;
+        hint = NULL;
+
+        rc = php_ngx_redis_parse_reply(redis, &p, b->last, &reply, 0, &hint);
+
+        if (rc == NGX_AGAIN) {
+            /* the buffer may be moved meanwhile, keep an offset */
+            redis->need = hint ? (size_t) (hint - b->pos) : 0;
+            return NGX_AGAIN;
+        }
+
+        if (rc == NGX_ERROR) {
+            return NGX_ERROR;
+        }
+
+        b->pos = p;
+
+        redis->need = 0;
+        redis->replies--;
+
+        if (!redis->pipeline) {
+            ZVAL_COPY_VALUE(retval, &reply);
+            return NGX_OK;
+        }
+
+        add_next_index_zval(&redis->result, &reply);
+    }
+
+    ZVAL_COPY_VALUE(retval, &redis->result);
+    ZVAL_UNDEF(&redis->result);
+
+    return NGX_OK;
+}
+
+/* arrays are flattened one level, string keys are sent before the values */
+static uint32_t 
+php_ngx_redis_count_args(zval *args, uint32_t argc)
+{
+    uint32_t        i, n;
+    zend_string     *key;
+    zval            *val;
+
+    n = 0;
+
+    for (i = 0; i < argc; i++) {
+        if (Z_TYPE(args[i]) != IS_ARRAY) {
+            n++;
+            continue;
+        }
+
+        ZEND_HASH_FOREACH_STR_KEY_VAL(Z_ARRVAL(args[i]), key, val) {
+            (void) val;
+            n += key ? 2 : 1;
+        } ZEND_HASH_FOREACH_END();
+    }
+
+    return n;
+}
+
+static void 
+php_ngx_redis_append_arg(smart_str *buf, zend_string *str)
+{
+    smart_str_appendc(buf, '$');
+    smart_str_append_unsigned(buf, ZSTR_LEN(str));
+    smart_str_appendl(buf, "\r\n", 2);
+    smart_str_append(buf, str);
+    smart_str_appendl(buf, "\r\n", 2);
+}
+
+static void 
+php_ngx_redis_encode(smart_str *buf, zend_string *cmd, zval *args, uint32_t argc)
+{
+    uint32_t        i;
+    zend_string     *key, *str;
+    zval            *val;
+
+    smart_str_appendc(buf, '*');
+    smart_str_append_unsigned(buf, 1 + php_ngx_redis_count_args(args, argc));
+    smart_str_appendl(buf, "\r\n", 2);
+
+    php_ngx_redis_append_arg(buf, cmd);
+
+    for (i = 0; i < argc; i++) {
+        if (Z_TYPE(args[i]) != IS_ARRAY) {
+            str = zval_get_string(&args[i]);
+            php_ngx_redis_append_arg(buf, str);
+            zend_string_release(str);
+            continue;
+        }
+
+        ZEND_HASH_FOREACH_STR_KEY_VAL(Z_ARRVAL(args[i]), key, val) {
+            if (key) {
+                php_ngx_redis_append_arg(buf, key);
+            }
+
+            str = zval_get_string(val);
+            php_ngx_redis_append_arg(buf, str);
+            zend_string_release(str);
+        } ZEND_HASH_FOREACH_END();
+    }
+}
+
+/* sends the encoded commands, the reply becomes the result of "yield" */
+static void 
+php_ngx_redis_request(php_ngx_redis_t *redis, smart_str *buf, 
+    ngx_uint_t replies, unsigned pipeline, zval *return_value)
+{
+    ngx_http_request_t  *r;
+    ngx_http_php_ctx_t  *ctx;
+
+    r = ngx_php_request;
+    ctx = r ? ngx_http_get_module_ctx(r, ngx_http_php_module) : NULL;
+
+    if ( !ctx ) {
+        smart_str_free(buf);
+        RETURN_FALSE;
+    }
+
+    zval_ptr_dtor(&redis->result);
+    ZVAL_UNDEF(&redis->result);
+
+    /* getLastError() is about the last command only */
+
+    if (redis->error) {
+        zend_string_release(redis->error);
+        redis->error = NULL;
+    }
+
+    redis->replies = replies;
+    redis->need = 0;
+    redis->pipeline = pipeline;
+
+    if (pipeline) {
+        array_init_size(&redis->result, (uint32_t) replies);
+    }
+
+    smart_str_0(buf);
+
+    /* the encoded string is sent as is and released once written */
+
+    if (ngx_http_php_socket_request(r, buf->s, php_ngx_redis_input_filter, redis) 
+        == NGX_ERROR)
+    {
+        RETURN_FALSE;
+    }
+
+    RETURN_TRUE;
+}
+
+static void 
+php_ngx_redis_yield_false(ngx_http_request_t *r, ngx_http_php_ctx_t *ctx)
+{
+    ZVAL_FALSE(&ctx->yield_retval);
+
+    ctx->delay_time = 0;
+    ngx_http_php_sleep(r);
+}
+
+PHP_METHOD(ngx_redis, connect)
+{
+    zend_string         *host;
+    zend_long           port = PHP_NGX_REDIS_DEFAULT_PORT;
+    char                *pool = NULL;
+    size_t              pool_len = 0;
+
+    ngx_http_request_t  *r;
+    ngx_http_php_ctx_t  *ctx;
+
+    if (zend_parse_parameters(ZEND_NUM_ARGS(), "S|ls!", &host, &port, &pool, &pool_len) == FAILURE) {
+        RETURN_FALSE;
+    }
+
+    r = ngx_php_request;
+    ctx = r ? ngx_http_get_module_ctx(r, ngx_http_php_module) : NULL;
+
+    if ( !ctx ) {
+        RETURN_FALSE;
+    }
+
+    ctx->pool_name.len = 0;
+
+    if (pool_len) {
+        ctx->pool_name.data = ngx_pnalloc(r->pool, pool_len);
+        if (ctx->pool_name.data == NULL) {
+            RETURN_FALSE;
+        }
+
+        ctx->pool_name.len = ngx_cpymem(ctx->pool_name.data, pool, pool_len) 
+                             - ctx->pool_name.data;
+    }
+
+    ctx->host.data = ngx_pnalloc(r->pool, ZSTR_LEN(host) + 1);
+    if (ctx->host.data == NULL) {
+        RETURN_FALSE;
+    }
+
+    ctx->host.len = ZSTR_LEN(host);
+    ngx_memcpy(ctx->host.data, ZSTR_VAL(host), ZSTR_LEN(host) + 1);
+
+    /* "unix:/path/to/redis.sock" has no port */
+
+    if (ZSTR_LEN(host) > 5 && ngx_strncmp(ZSTR_VAL(host), "unix:", 5) == 0) {
+        port = 0;
+    }
+
+    ctx->port = (ngx_int_t) port;
+
+    if (ngx_http_php_socket_connect(r) == NGX_ERROR) {
+        ZVAL_FALSE(&ctx->yield_retval);
+        ctx->delay_time = 0;
+        ngx_http_php_sleep(r);
+        RETURN_FALSE;
+    }
+
+    /* 
+     * turned into false by the connect handler if the connection fails, 
+     * which may already have happened 
+     */
+    if (Z_TYPE(ctx->yield_retval) == IS_UNDEF) {
+        ZVAL_TRUE(&ctx->yield_retval);
+    }
+
+    RETURN_TRUE;
+}
+
+PHP_METHOD(ngx_redis, command)
+{
+    zend_string         *cmd;
+    zval                *args = NULL;
+#if PHP_MAJOR_VERSION >= 8
+    uint32_t            argc = 0;
+#else
+    int                 argc = 0;
+#endif
+    smart_str           buf = {0};
+
+    if (zend_parse_parameters(ZEND_NUM_ARGS(), "S*", &cmd, &args, &argc) == FAILURE) {
+        RETURN_FALSE;
+    }
+
+    php_ngx_redis_encode(&buf, cmd, args, (uint32_t) argc);
+
+    php_ngx_redis_request(php_ngx_redis_fetch(Z_OBJ_P(getThis())), &buf, 1, 0, 
+                          return_value);
+}
+
+PHP_METHOD(ngx_redis, __call)
+{
+    zend_string         *name;
+    zval                *params, *args, *val;
+    uint32_t            argc, i;
+    smart_str           buf = {0};
+
+    if (zend_parse_parameters(ZEND_NUM_ARGS(), "Sa", &name, &params) == FAILURE) {
+        RETURN_FALSE;
+    }
+
+    /* $redis->hset($key, $field, $value) */
+
+    argc = zend_hash_num_elements(Z_ARRVAL_P(params));
+    args = argc ? safe_emalloc(argc, sizeof(zval), 0) : NULL;
+
+    i = 0;
+    ZEND_HASH_FOREACH_VAL(Z_ARRVAL_P(params), val) {
+        ZVAL_DEREF(val);
+        ZVAL_COPY_VALUE(&args[i++], val);
+    } ZEND_HASH_FOREACH_END();
+
+    php_ngx_redis_encode(&buf, name, args, argc);
+
+    if (args) {
+        efree(args);
+    }
+
+    php_ngx_redis_request(php_ngx_redis_fetch(Z_OBJ_P(getThis())), &buf, 1, 0, 
+                          return_value);
+}
+
+PHP_METHOD(ngx_redis, pipeline)
+{
+    zval                *commands, *command, *args, *val;
+    zend_string         *cmd;
+    uint32_t            argc, n;
+    smart_str           buf = {0};
+
+    ngx_http_request_t  *r;
+    ngx_http_php_ctx_t  *ctx;
+
+    if (zend_parse_parameters(ZEND_NUM_ARGS(), "a", &commands) == FAILURE) {
+        RETURN_FALSE;
+    }
+
+    /* all commands go out with one send, the replies come back as an array */
+
+    n = 0;
+
+    ZEND_HASH_FOREACH_VAL(Z_ARRVAL_P(commands), command) {
+        ZVAL_DEREF(command);
+
+        if (Z_TYPE_P(command) != IS_ARRAY 
+            || zend_hash_num_elements(Z_ARRVAL_P(command)) == 0) 
+        {
+            smart_str_free(&buf);
+            php_error_docref(NULL, E_WARNING, "every command must be a non-empty array");
+
+            /* the caller yields already, resume it with false */
+
+            r = ngx_php_request;
+            ctx = r ? ngx_http_get_module_ctx(r, ngx_http_php_module) : NULL;
+
+            if (ctx) {
+                php_ngx_redis_yield_false(r, ctx);
+            }
+
+            RETURN_FALSE;
+        }
+
+        argc = zend_hash_num_elements(Z_ARRVAL_P(command));
+        args = safe_emalloc(argc, sizeof(zval), 0);
+
+        argc = 0;
+        ZEND_HASH_FOREACH_VAL(Z_ARRVAL_P(command), val) {
+            ZVAL_DEREF(val);
+            ZVAL_COPY_VALUE(&args[argc++], val);
+        } ZEND_HASH_FOREACH_END();
+
+        cmd = zval_get_string(&args[0]);
+        php_ngx_redis_encode(&buf, cmd, args + 1, argc - 1);
+        zend_string_release(cmd);
+
+        efree(args);
+
+        n++;
+    } ZEND_HASH_FOREACH_END();
+
+    if (n == 0) {
+        r = ngx_php_request;
+        ctx = r ? ngx_http_get_module_ctx(r, ngx_http_php_module) : NULL;
+
+        if ( !ctx ) {
+            RETURN_FALSE;
+        }
+
+        array_init(&ctx->yield_retval);
+        ctx->delay_time = 0;
+        ngx_http_php_sleep(r);
+
+        RETURN_TRUE;
+    }
+
+    php_ngx_redis_request(php_ngx_redis_fetch(Z_OBJ_P(getThis())), &buf, n, 1, 
+                          return_value);
+}
+
+PHP_METHOD(ngx_redis, setkeepalive)
+{
+    zend_long           timeout = 0;
+    zend_long           size = 0;
+
+    ngx_http_request_t  *r;
+    ngx_http_php_ctx_t  *ctx;
+
+    if (zend_parse_parameters(ZEND_NUM_ARGS(), "|ll", &timeout, &size) == FAILURE) {
+        RETURN_FALSE;
+    }
+
+    if (timeout < 0 || size < 0) {
+        RETURN_FALSE;
+    }
+
+    r = ngx_php_request;
+    ctx = r ? ngx_http_get_module_ctx(r, ngx_http_php_module) : NULL;
+
+    if ( !ctx ) {
+        RETURN_FALSE;
+    }
+
+    if (ngx_http_php_socket_setkeepalive(r, (ngx_msec_t) timeout, (ngx_uint_t) size) != NGX_OK) {
+        RETURN_FALSE;
+    }
+
+    RETURN_TRUE;
+}
+
+PHP_METHOD(ngx_redis, close)
+{
+    ngx_http_request_t  *r;
+    ngx_http_php_ctx_t  *ctx;
+
+    r = ngx_php_request;
+    ctx = r ? ngx_http_get_module_ctx(r, ngx_http_php_module) : NULL;
+
+    if ( !ctx ) {
+        RETURN_FALSE;
+    }
+
+    ngx_http_php_socket_clear(r);
+
+    RETURN_TRUE;
+}
+
+PHP_METHOD(ngx_redis, getLastError)
+{
+    php_ngx_redis_t     *redis;
+
+    redis = php_ngx_redis_fetch(Z_OBJ_P(getThis()));
+
+    if (redis->error == NULL) {
+        RETURN_NULL();
+    }
+
+    RETURN_STR_COPY(redis->error);
+}
+
+static const zend_function_entry php_ngx_redis_class_functions[] = {
+    PHP_ME(ngx_redis, connect, ngx_redis_connect_arginfo, ZEND_ACC_PUBLIC)
+    PHP_ME(ngx_redis, command, ngx_redis_command_arginfo, ZEND_ACC_PUBLIC)
+    PHP_ME(ngx_redis, __call, ngx_redis_call_arginfo, ZEND_ACC_PUBLIC)
+    PHP_ME(ngx_redis, pipeline, ngx_redis_pipeline_arginfo, ZEND_ACC_PUBLIC)
+    PHP_ME(ngx_redis, setkeepalive, ngx_redis_setkeepalive_arginfo, ZEND_ACC_PUBLIC)
+    PHP_ME(ngx_redis, close, ngx_redis_void_arginfo, ZEND_ACC_PUBLIC)
+    PHP_ME(ngx_redis, getLastError, ngx_redis_void_arginfo, ZEND_ACC_PUBLIC)
+    {NULL, NULL, NULL, 0, 0}
+};
+
+void
+php_impl_ngx_redis_init(int module_number)
+{
+    zend_class_entry ngx_redis_class_entry;
+    INIT_NS_CLASS_ENTRY(ngx_redis_class_entry, "ngx", "redis", php_ngx_redis_class_functions);
+    php_ngx_redis_class_entry = zend_register_internal_class(&ngx_redis_class_entry);
+    php_ngx_redis_class_entry->create_object = php_ngx_redis_create_object;
+
+    memcpy(&php_ngx_redis_handlers, zend_get_std_object_handlers(), sizeof(zend_object_handlers));
+    php_ngx_redis_handlers.offset = XtOffsetOf(php_ngx_redis_t, std);
+    php_ngx_redis_handlers.free_obj = php_ngx_redis_free_object;
+    php_ngx_redis_handlers.clone_obj = NULL;
+}
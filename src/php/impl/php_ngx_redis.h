@@ -0,0 +1,97 @@
+/*
+==============================================================================
+Copyright (c) 2016-2020, rryqszq4 <rryqszq@gmail.com>
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+
+* Redistributions of source code must retain the above copyright notice, this
+  list of conditions and the following disclaimer.
+
+* Redistributions in binary form must reproduce the above copyright notice,
+  this list of conditions and the following disclaimer in the documentation
+  and/or other materials provided with the distribution.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+==============================================================================
+*/
+
+#ifndef __PHP_NGX_REDIS_H__
+#define __PHP_NGX_REDIS_H__
+
+#include <php.h>
+#include <php_ini.h>
+#include <ext/standard/info.h>
+#include <ngx_http.h>
+
+#define PHP_NGX_REDIS_DEFAULT_PORT  6379
+#define PHP_NGX_REDIS_MAX_DEPTH     16
+
+typedef struct php_ngx_redis_s {
+
+    /* replies still expected for the command in flight */
+    ngx_uint_t      replies;
+
+    /* do not parse again before this many bytes are buffered */
+    size_t          need;
+
+    /* replies of a pipeline collected so far */
+    zval            result;
+
+    zend_string     *error;
+
+    unsigned        pipeline:1;
+
+    zend_object     std;
+
+} php_ngx_redis_t;
+
+ZEND_BEGIN_ARG_INFO_EX(ngx_redis_connect_arginfo, 0, 0, 1)
+    ZEND_ARG_INFO(0, host)
+    ZEND_ARG_INFO(0, port)
+    ZEND_ARG_INFO(0, pool)
+ZEND_END_ARG_INFO()
+
+ZEND_BEGIN_ARG_INFO_EX(ngx_redis_command_arginfo, 0, 0, 1)
+    ZEND_ARG_INFO(0, command)
+    ZEND_ARG_VARIADIC_INFO(0, args)
+ZEND_END_ARG_INFO()
+
+ZEND_BEGIN_ARG_INFO_EX(ngx_redis_call_arginfo, 0, 0, 2)
+    ZEND_ARG_INFO(0, name)
+    ZEND_ARG_INFO(0, args)
+ZEND_END_ARG_INFO()
+
+ZEND_BEGIN_ARG_INFO_EX(ngx_redis_pipeline_arginfo, 0, 0, 1)
+    ZEND_ARG_ARRAY_INFO(0, commands, 0)
+ZEND_END_ARG_INFO()
+
+ZEND_BEGIN_ARG_INFO_EX(ngx_redis_setkeepalive_arginfo, 0, 0, 0)
+    ZEND_ARG_INFO(0, timeout)
+    ZEND_ARG_INFO(0, size)
+ZEND_END_ARG_INFO()
+
+ZEND_BEGIN_ARG_INFO_EX(ngx_redis_void_arginfo, 0, 0, 0)
+ZEND_END_ARG_INFO()
+
+PHP_METHOD(ngx_redis, connect);
+PHP_METHOD(ngx_redis, command);
+PHP_METHOD(ngx_redis, __call);
+PHP_METHOD(ngx_redis, pipeline);
+PHP_METHOD(ngx_redis, setkeepalive);
+PHP_METHOD(ngx_redis, close);
+PHP_METHOD(ngx_redis, getLastError);
+
+void php_impl_ngx_redis_init(int module_number);
+
+#endif
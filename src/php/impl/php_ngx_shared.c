@@ -0,0 +1,328 @@
+/*
+==============================================================================
+Copyright (c) 2016-2020, rryqszq4 <rryqszq@gmail.com>
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+
+* Redistributions of source code must retain the above copyright notice, this
+  list of conditions and the following disclaimer.
+
+* Redistributions in binary form must reproduce the above copyright notice,
+  this list of conditions and the following disclaimer in the documentation
+  and/or other materials provided with the distribution.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+==============================================================================
+*/
+
+#include "../../ngx_http_php_module.h"
+#include "../../ngx_http_php_shdict.h"
+#include "php_ngx_shared.h"
+
+#define php_ngx_shared_fetch(obj)                                             \
+    ((php_ngx_shared_t *) ((char *) (obj) - XtOffsetOf(php_ngx_shared_t, std)))
+
+static zend_class_entry *php_ngx_shared_class_entry;
+static zend_object_handlers php_ngx_shared_handlers;
+
+static zend_object *php_ngx_shared_create_object(zend_class_entry *ce);
+static void php_ngx_shared_free_object(zend_object *object);
+static ngx_shm_zone_t *php_ngx_shared_zone(zval *object, zend_string *key);
+static ngx_int_t php_ngx_shared_number(zval *src, zval *dst);
+static void php_ngx_shared_store(INTERNAL_FUNCTION_PARAMETERS, ngx_uint_t op);
+
+static zend_object *
+php_ngx_shared_create_object(zend_class_entry *ce)
+{
+    php_ngx_shared_t    *shared;
+
+    shared = ecalloc(1, sizeof(php_ngx_shared_t) + zend_object_properties_size(ce));
+
+    zend_object_std_init(&shared->std, ce);
+    object_properties_init(&shared->std, ce);
+
+    shared->std.handlers = &php_ngx_shared_handlers;
+
+    return &shared->std;
+}
+
+static void 
+php_ngx_shared_free_object(zend_object *object)
+{
+    zend_object_std_dtor(object);
+}
+
+/* NULL for a dictionary that was never opened or a key it cannot hold */
+static ngx_shm_zone_t *
+php_ngx_shared_zone(zval *object, zend_string *key)
+{
+    php_ngx_shared_t    *shared;
+
+    shared = php_ngx_shared_fetch(Z_OBJ_P(object));
+
+    if (ZSTR_LEN(key) == 0 || ZSTR_LEN(key) > NGX_HTTP_PHP_SHDICT_MAX_KEY) {
+        return NULL;
+    }
+
+    return shared->zone;
+}
+
+/* incr() takes ints, floats and numeric strings */
+static ngx_int_t
+php_ngx_shared_number(zval *src, zval *dst)
+{
+    zend_long   l;
+    double      d;
+
+    switch (Z_TYPE_P(src)) {
+
+    case IS_LONG:
+        ZVAL_LONG(dst, Z_LVAL_P(src));
+        return NGX_OK;
+
+    case IS_DOUBLE:
+        ZVAL_DOUBLE(dst, Z_DVAL_P(src));
+        return NGX_OK;
+
+    case IS_STRING:
+        switch (is_numeric_string(Z_STRVAL_P(src), Z_STRLEN_P(src), &l, &d, 0)) {
+        case IS_LONG:
+            ZVAL_LONG(dst, l);
+            return NGX_OK;
+        case IS_DOUBLE:
+            ZVAL_DOUBLE(dst, d);
+            return NGX_OK;
+        }
+        break;
+    }
+
+    return NGX_ERROR;
+}
+
+static void
+php_ngx_shared_store(INTERNAL_FUNCTION_PARAMETERS, ngx_uint_t op)
+{
+    zend_string         *key;
+    zval                *value;
+    double              ttl = 0;
+    ngx_msec_t          exptime;
+    ngx_shm_zone_t      *zone;
+    ngx_str_t           k;
+
+    if (zend_parse_parameters(ZEND_NUM_ARGS(), "Sz|d", &key, &value, &ttl) == FAILURE) {
+        RETURN_FALSE;
+    }
+
+    zone = php_ngx_shared_zone(getThis(), key);
+    if (zone == NULL || ttl < 0) {
+        RETURN_FALSE;
+    }
+
+    k.data = (u_char *) ZSTR_VAL(key);
+    k.len = ZSTR_LEN(key);
+
+    /* 0 keeps the key forever, anything shorter than 1ms rounds up */
+    exptime = (ngx_msec_t) (ttl * 1000);
+    if (ttl > 0 && exptime == 0) {
+        exptime = 1;
+    }
+
+    if (ngx_http_php_shdict_set(zone, &k, value, exptime, op) != NGX_OK) {
+        RETURN_FALSE;
+    }
+
+    RETURN_TRUE;
+}
+
+PHP_METHOD(ngx_shared, __construct)
+{
+    zend_string         *name;
+    php_ngx_shared_t    *shared;
+    ngx_str_t           n;
+
+    if (zend_parse_parameters(ZEND_NUM_ARGS(), "S", &name) == FAILURE) {
+        return;
+    }
+
+    shared = php_ngx_shared_fetch(Z_OBJ_P(getThis()));
+
+    n.data = (u_char *) ZSTR_VAL(name);
+    n.len = ZSTR_LEN(name);
+
+    shared->zone = ngx_http_php_shdict_zone(&n);
+
+    if (shared->zone == NULL) {
+        zend_throw_error(NULL, "php_shared_dict \"%s\" is not defined", ZSTR_VAL(name));
+    }
+}
+
+PHP_METHOD(ngx_shared, get)
+{
+    zend_string         *key;
+    ngx_shm_zone_t      *zone;
+    ngx_str_t           k;
+
+    if (zend_parse_parameters(ZEND_NUM_ARGS(), "S", &key) == FAILURE) {
+        RETURN_NULL();
+    }
+
+    zone = php_ngx_shared_zone(getThis(), key);
+    if (zone == NULL) {
+        RETURN_NULL();
+    }
+
+    k.data = (u_char *) ZSTR_VAL(key);
+    k.len = ZSTR_LEN(key);
+
+    if (ngx_http_php_shdict_get(zone, &k, return_value) != NGX_OK) {
+        RETURN_NULL();
+    }
+}
+
+PHP_METHOD(ngx_shared, set)
+{
+    php_ngx_shared_store(INTERNAL_FUNCTION_PARAM_PASSTHRU, NGX_HTTP_PHP_SHDICT_SET);
+}
+
+PHP_METHOD(ngx_shared, add)
+{
+    php_ngx_shared_store(INTERNAL_FUNCTION_PARAM_PASSTHRU, NGX_HTTP_PHP_SHDICT_ADD);
+}
+
+PHP_METHOD(ngx_shared, replace)
+{
+    php_ngx_shared_store(INTERNAL_FUNCTION_PARAM_PASSTHRU, NGX_HTTP_PHP_SHDICT_REPLACE);
+}
+
+PHP_METHOD(ngx_shared, incr)
+{
+    zend_string         *key;
+    zval                *delta = NULL;
+    zval                *init = NULL;
+    zval                d, i;
+    ngx_shm_zone_t      *zone;
+    ngx_str_t           k;
+    ngx_int_t           rc;
+
+    if (zend_parse_parameters(ZEND_NUM_ARGS(), "S|zz", &key, &delta, &init) == FAILURE) {
+        RETURN_FALSE;
+    }
+
+    zone = php_ngx_shared_zone(getThis(), key);
+    if (zone == NULL) {
+        RETURN_FALSE;
+    }
+
+    if (delta == NULL) {
+        ZVAL_LONG(&d, 1);
+
+    } else if (php_ngx_shared_number(delta, &d) != NGX_OK) {
+        RETURN_FALSE;
+    }
+
+    if (init && Z_TYPE_P(init) != IS_NULL) {
+        if (php_ngx_shared_number(init, &i) != NGX_OK) {
+            RETURN_FALSE;
+        }
+
+        init = &i;
+
+    } else {
+        init = NULL;
+    }
+
+    k.data = (u_char *) ZSTR_VAL(key);
+    k.len = ZSTR_LEN(key);
+
+    rc = ngx_http_php_shdict_incr(zone, &k, &d, init, return_value);
+
+    if (rc == NGX_DECLINED) {
+        RETURN_NULL();
+    }
+
+    if (rc != NGX_OK) {
+        RETURN_FALSE;
+    }
+}
+
+PHP_METHOD(ngx_shared, delete)
+{
+    zend_string         *key;
+    zval                null;
+    ngx_shm_zone_t      *zone;
+    ngx_str_t           k;
+
+    if (zend_parse_parameters(ZEND_NUM_ARGS(), "S", &key) == FAILURE) {
+        RETURN_FALSE;
+    }
+
+    zone = php_ngx_shared_zone(getThis(), key);
+    if (zone == NULL) {
+        RETURN_FALSE;
+    }
+
+    k.data = (u_char *) ZSTR_VAL(key);
+    k.len = ZSTR_LEN(key);
+
+    ZVAL_NULL(&null);
+
+    ngx_http_php_shdict_set(zone, &k, &null, 0, NGX_HTTP_PHP_SHDICT_SET);
+
+    RETURN_TRUE;
+}
+
+PHP_METHOD(ngx_shared, flush_expired)
+{
+    zend_long           max = 0;
+    php_ngx_shared_t    *shared;
+
+    if (zend_parse_parameters(ZEND_NUM_ARGS(), "|l", &max) == FAILURE) {
+        RETURN_FALSE;
+    }
+
+    shared = php_ngx_shared_fetch(Z_OBJ_P(getThis()));
+
+    if (shared->zone == NULL || max < 0) {
+        RETURN_FALSE;
+    }
+
+    RETURN_LONG((zend_long) ngx_http_php_shdict_flush_expired(shared->zone, 
+                                                              (ngx_uint_t) max));
+}
+
+static const zend_function_entry php_ngx_shared_class_functions[] = {
+    PHP_ME(ngx_shared, __construct, ngx_shared_construct_arginfo, ZEND_ACC_PUBLIC)
+    PHP_ME(ngx_shared, get, ngx_shared_key_arginfo, ZEND_ACC_PUBLIC)
+    PHP_ME(ngx_shared, set, ngx_shared_set_arginfo, ZEND_ACC_PUBLIC)
+    PHP_ME(ngx_shared, add, ngx_shared_set_arginfo, ZEND_ACC_PUBLIC)
+    PHP_ME(ngx_shared, replace, ngx_shared_set_arginfo, ZEND_ACC_PUBLIC)
+    PHP_ME(ngx_shared, incr, ngx_shared_incr_arginfo, ZEND_ACC_PUBLIC)
+    PHP_ME(ngx_shared, delete, ngx_shared_key_arginfo, ZEND_ACC_PUBLIC)
+    PHP_ME(ngx_shared, flush_expired, ngx_shared_flush_expired_arginfo, ZEND_ACC_PUBLIC)
+    {NULL, NULL, NULL, 0, 0}
+};
+
+void
+php_impl_ngx_shared_init(int module_number)
+{
+    zend_class_entry ngx_shared_class_entry;
+    INIT_CLASS_ENTRY(ngx_shared_class_entry, "ngx_shared", php_ngx_shared_class_functions);
+    php_ngx_shared_class_entry = zend_register_internal_class(&ngx_shared_class_entry);
+    php_ngx_shared_class_entry->create_object = php_ngx_shared_create_object;
+
+    memcpy(&php_ngx_shared_handlers, zend_get_std_object_handlers(), sizeof(zend_object_handlers));
+    php_ngx_shared_handlers.offset = XtOffsetOf(php_ngx_shared_t, std);
+    php_ngx_shared_handlers.free_obj = php_ngx_shared_free_object;
+    php_ngx_shared_handlers.clone_obj = NULL;
+}
@@ -83,6 +83,7 @@ PHP_METHOD(ngx_socket, connect)
     ctx->host.data[ZSTR_LEN(host_str)] = '\0';
 
     ctx->port = port;
+    ctx->pool_name.len = 0;
 
     ngx_http_php_socket_connect(r);
 
@@ -28,6 +28,7 @@ OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 
 #include "../../ngx_http_php_module.h"
 #include "../../ngx_http_php_socket.h"
+#include "../../ngx_http_php_sleep.h"
 #include "php_ngx_sockets.h"
 
 static int le_socket;
@@ -36,6 +37,7 @@ static int le_socket;
 //static int php_ngx_socket_le_socket(void);
 static php_ngx_socket_t *php_ngx_socket_create(void);
 static void php_ngx_socket_destroy(zend_resource *rsrc);
+static void php_ngx_socket_yield_false(ngx_http_request_t *r, ngx_http_php_ctx_t *ctx);
 
 /*static int php_ngx_socket_le_socket(void)
 {
@@ -66,6 +68,15 @@ static void php_ngx_socket_destroy(zend_resource *rsrc)
     }
 }
 
+/* let a yielding call fail without waiting for an event */
+static void php_ngx_socket_yield_false(ngx_http_request_t *r, ngx_http_php_ctx_t *ctx)
+{
+    ZVAL_FALSE(&ctx->yield_retval);
+
+    ctx->delay_time = 0;
+    ngx_http_php_sleep(r);
+}
+
 PHP_FUNCTION(ngx_socket_create)
 {
     zend_long       arg1, arg2, arg3;
@@ -128,12 +139,15 @@ PHP_FUNCTION(ngx_socket_connect)
     char                *addr;
     size_t              addr_len;
     zend_long           port = 0;
+    char                *pool = NULL;
+    size_t              pool_len = 0;
+    ngx_int_t           rc;
     //int                 retval;
 
     ngx_http_request_t  *r;
     ngx_http_php_ctx_t  *ctx;
 
-    if (zend_parse_parameters(ZEND_NUM_ARGS(), "zs|l", &arg1, &addr, &addr_len, &port) == FAILURE) {
+    if (zend_parse_parameters(ZEND_NUM_ARGS(), "zs|ls", &arg1, &addr, &addr_len, &port, &pool, &pool_len) == FAILURE) {
         RETURN_FALSE;
     }
 
@@ -149,8 +163,24 @@ PHP_FUNCTION(ngx_socket_connect)
         RETURN_FALSE;
     } 
 
+    ctx->pool_name.len = 0;
+
+    if (pool_len) {
+        ctx->pool_name.data = ngx_pnalloc(r->pool, pool_len);
+        if (ctx->pool_name.data == NULL) {
+            RETURN_FALSE;
+        }
+
+        ngx_memcpy(ctx->pool_name.data, (u_char *)pool, pool_len);
+        ctx->pool_name.len = pool_len;
+    }
+
     switch(ngx_sock->type) {
-        case AF_INET: {
+        case AF_INET:
+#if (NGX_HAVE_INET6)
+        case AF_INET6:
+#endif
+        {
             ctx->host.data = ngx_palloc(r->pool, addr_len + 1);
             ctx->host.len = addr_len;
 
@@ -158,15 +188,42 @@ PHP_FUNCTION(ngx_socket_connect)
             ctx->host.data[addr_len] = '\0';
 
             ctx->port = port;
-            ngx_http_php_socket_connect(r);
+            rc = ngx_http_php_socket_connect(r);
             break;
         }
 
+#if (NGX_HAVE_UNIX_DOMAIN)
+        case AF_UNIX: {
+
+            /* ngx_parse_url() wants the "unix:" prefix, the path alone is accepted too */
+
+            if (addr_len > 5 && ngx_strncmp(addr, "unix:", 5) == 0) {
+                ctx->host.data = ngx_palloc(r->pool, addr_len + 1);
+                ctx->host.len = ngx_cpymem(ctx->host.data, addr, addr_len) - ctx->host.data;
+            }else {
+                ctx->host.data = ngx_palloc(r->pool, sizeof("unix:") - 1 + addr_len + 1);
+                ctx->host.len = ngx_sprintf(ctx->host.data, "unix:%*s", addr_len, addr) - ctx->host.data;
+            }
+
+            ctx->host.data[ctx->host.len] = '\0';
+
+            ctx->port = 0;
+            rc = ngx_http_php_socket_connect(r);
+            break;
+        }
+#endif
+
         default:
             //php_error_docref(NULL, E_WARNING, "Unsupported socket type %d", ctx->php_socket->type);
             RETURN_FALSE;
     }
 
+    if (rc == NGX_ERROR) {
+        /* e.g. a missing unix socket, fail the yield instead of waiting forever */
+        php_ngx_socket_yield_false(r, ctx);
+        RETURN_FALSE;
+    }
+
     /*if (retval != NGX_OK) {
         php_error_docref(NULL, E_WARNING, "unable to connect");
         RETURN_FALSE;
@@ -212,25 +269,18 @@ PHP_FUNCTION(ngx_socket_close)
 
 PHP_FUNCTION(ngx_socket_send)
 {
-    zval                            *arg1;
+    zval                            *arg1, *data, *entry;
     //php_ngx_socket_t                *ngx_sock;
-    size_t                          buf_len, retval;
-    zend_long                       len;
-    char                            *buf;
+    ngx_int_t                       retval;
+    zend_long                       len = -1;
+    zend_string                     *str;
 
     ngx_http_request_t              *r;
     ngx_http_php_ctx_t              *ctx;
     ngx_http_php_socket_upstream_t  *u;
-    ngx_str_t                       ns;
-    ngx_buf_t                       *b;
-    ngx_chain_t                     *cl;
+    ngx_chain_t                     *out, **last;
 
-    if (zend_parse_parameters(ZEND_NUM_ARGS(), "zsl", &arg1, &buf, &buf_len, &len) == FAILURE) {
-        RETURN_FALSE;
-    }
-
-    if (len < 0) {
-        //php_error_docref(NULL, E_WARNING, "Length cannot be negative");
+    if (zend_parse_parameters(ZEND_NUM_ARGS(), "zz|l", &arg1, &data, &len) == FAILURE) {
         RETURN_FALSE;
     }
 
@@ -246,23 +296,59 @@ PHP_FUNCTION(ngx_socket_send)
         RETURN_FALSE;
     } 
 
-    ns.data = (u_char *)buf;
-    ns.len = buf_len;
+    u = ctx->upstream;
+
+    if (u == NULL || u->peer.connection == NULL) {
+        php_ngx_socket_yield_false(r, ctx);
+        RETURN_FALSE;
+    }
+
+    out = NULL;
+    last = &out;
 
-    b = ngx_create_temp_buf(r->pool, ns.len + 1);
+    if (Z_TYPE_P(data) == IS_ARRAY) {
 
-    cl = ngx_alloc_chain_link(r->pool);
+        /* ngx_socket_send($fd, [$a, $b, $c]) sends all parts with one writev() */
 
-    cl->buf = b;
-    cl->next = NULL;
+        ZEND_HASH_FOREACH_VAL(Z_ARRVAL_P(data), entry) {
+            str = zval_get_string(entry);
 
-    u = ctx->upstream;
-    u->request_bufs = cl;
+            if (ngx_http_php_socket_append_str(r, u, &last, str, ZSTR_LEN(str)) != NGX_OK) {
+                ngx_http_php_socket_release_strs(u);
+                php_ngx_socket_yield_false(r, ctx);
+                RETURN_FALSE;
+            }
+        } ZEND_HASH_FOREACH_END();
+
+    } else {
+        str = zval_get_string(data);
+
+        if (len < 0 || (size_t) len > ZSTR_LEN(str)) {
+            len = ZSTR_LEN(str);
+        }
+
+        if (ngx_http_php_socket_append_str(r, u, &last, str, (size_t) len) != NGX_OK) {
+            ngx_http_php_socket_release_strs(u);
+            php_ngx_socket_yield_false(r, ctx);
+            RETURN_FALSE;
+        }
+    }
+
+    if (out == NULL) {
+        /* nothing to send */
+        ctx->delay_time = 0;
+        ngx_http_php_sleep(r);
+        RETURN_LONG(NGX_OK);
+    }
 
-    b->last = ngx_copy(b->last, ns.data, ns.len);
+    u->request_bufs = out;
 
     retval = ngx_http_php_socket_send(r);
 
+    if (retval == NGX_ERROR) {
+        php_ngx_socket_yield_false(r, ctx);
+    }
+
     RETURN_LONG(retval);
 }
 
@@ -485,6 +571,75 @@ PHP_FUNCTION(ngx_socket_recvsync)
     RETURN_LONG(retval);
 }
 
+PHP_FUNCTION(ngx_socket_recv_until)
+{
+    zval                            *arg1;
+    zend_string                     *delim;
+    zend_long                       max = 0;
+    ngx_int_t                       retval;
+    ngx_str_t                       pattern;
+
+    ngx_http_request_t              *r;
+    ngx_http_php_ctx_t              *ctx;
+
+    if (zend_parse_parameters(ZEND_NUM_ARGS(), "zS|l", &arg1, &delim, &max) == FAILURE) {
+        RETURN_FALSE;
+    }
+
+    r = ngx_php_request;
+    ctx = ngx_http_get_module_ctx(r, ngx_http_php_module);
+
+    if ( !ctx ) {
+        RETURN_FALSE;
+    }
+
+    if (ZSTR_LEN(delim) == 0 || max < 0) {
+        php_error_docref(NULL, E_WARNING, "Invalid delimiter or length");
+        php_ngx_socket_yield_false(r, ctx);
+        RETURN_FALSE;
+    }
+
+    /* copied by the upstream */
+
+    pattern.len = ZSTR_LEN(delim);
+    pattern.data = (u_char *) ZSTR_VAL(delim);
+
+    retval = ngx_http_php_socket_recv_until(r, &pattern, (size_t) max);
+
+    RETURN_LONG(retval);
+}
+
+PHP_FUNCTION(ngx_socket_recv_exact)
+{
+    zval                            *arg1;
+    zend_long                       len;
+    ngx_int_t                       retval;
+
+    ngx_http_request_t              *r;
+    ngx_http_php_ctx_t              *ctx;
+
+    if (zend_parse_parameters(ZEND_NUM_ARGS(), "zl", &arg1, &len) == FAILURE) {
+        RETURN_FALSE;
+    }
+
+    r = ngx_php_request;
+    ctx = ngx_http_get_module_ctx(r, ngx_http_php_module);
+
+    if ( !ctx ) {
+        RETURN_FALSE;
+    }
+
+    if (len < 0) {
+        php_error_docref(NULL, E_WARNING, "Length cannot be negative");
+        php_ngx_socket_yield_false(r, ctx);
+        RETURN_FALSE;
+    }
+
+    retval = ngx_http_php_socket_recv_exact(r, (size_t) len);
+
+    RETURN_LONG(retval);
+}
+
 PHP_FUNCTION(ngx_socket_settimeout)
 {
     ngx_http_request_t              *r;
@@ -511,6 +666,37 @@ PHP_FUNCTION(ngx_socket_settimeout)
     RETURN_TRUE;
 }
 
+PHP_FUNCTION(ngx_socket_setkeepalive)
+{
+    zval                *arg1;
+    zend_long           timeout = 0;
+    zend_long           size = 0;
+
+    ngx_http_request_t  *r;
+    ngx_http_php_ctx_t  *ctx;
+
+    if (zend_parse_parameters(ZEND_NUM_ARGS(), "z|ll", &arg1, &timeout, &size) == FAILURE) {
+        RETURN_FALSE;
+    }
+
+    if (timeout < 0 || size < 0) {
+        RETURN_FALSE;
+    }
+
+    r = ngx_php_request;
+    ctx = ngx_http_get_module_ctx(r, ngx_http_php_module);
+
+    if ( !ctx ) {
+        RETURN_FALSE;
+    }
+
+    if (ngx_http_php_socket_setkeepalive(r, (ngx_msec_t) timeout, (ngx_uint_t) size) != NGX_OK) {
+        RETURN_FALSE;
+    }
+
+    RETURN_TRUE;
+}
+
 PHP_FUNCTION(ngx_socket_clear)
 {
     zval                *arg1;
@@ -562,5 +748,13 @@ PHP_FUNCTION(ngx_socket_destroy)
 void php_impl_ngx_sockets_init(int module_number )
 {
     le_socket = zend_register_list_destructors_ex(NULL, NULL, le_socket_name, module_number);
+
+    REGISTER_LONG_CONSTANT("NGX_AF_INET", AF_INET, CONST_CS);
+#if (NGX_HAVE_INET6)
+    REGISTER_LONG_CONSTANT("NGX_AF_INET6", AF_INET6, CONST_CS);
+#endif
+#if (NGX_HAVE_UNIX_DOMAIN)
+    REGISTER_LONG_CONSTANT("NGX_AF_UNIX", AF_UNIX, CONST_CS);
+#endif
 }
 
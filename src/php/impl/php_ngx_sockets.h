@@ -64,13 +64,14 @@ ZEND_BEGIN_ARG_INFO_EX(arginfo_ngx_socket_connect, 0, 0, 2)
     ZEND_ARG_INFO(0, socket)
     ZEND_ARG_INFO(0, addr)
     ZEND_ARG_INFO(0, port)
+    ZEND_ARG_INFO(0, pool)
 ZEND_END_ARG_INFO()
 
 ZEND_BEGIN_ARG_INFO_EX(arginfo_ngx_socket_close, 0, 0, 1)
     ZEND_ARG_INFO(0, socket)
 ZEND_END_ARG_INFO()
 
-ZEND_BEGIN_ARG_INFO_EX(arginfo_ngx_socket_send, 0, 0, 3)
+ZEND_BEGIN_ARG_INFO_EX(arginfo_ngx_socket_send, 0, 0, 2)
     ZEND_ARG_INFO(0, socket)
     ZEND_ARG_INFO(0, buf)
     ZEND_ARG_INFO(0, len)
@@ -100,11 +101,24 @@ ZEND_BEGIN_ARG_INFO_EX(arginfo_ngx_socket_recvsync, 0, 0, 2)
     ZEND_ARG_INFO(0, len)
 ZEND_END_ARG_INFO()
 
+ZEND_BEGIN_ARG_INFO_EX(arginfo_ngx_socket_recv_until, 0, 0, 2)
+    ZEND_ARG_INFO(0, socket)
+    ZEND_ARG_INFO(0, delimiter)
+    ZEND_ARG_INFO(0, max_len)
+ZEND_END_ARG_INFO()
+
+ZEND_BEGIN_ARG_INFO_EX(arginfo_ngx_socket_recv_exact, 0, 0, 2)
+    ZEND_ARG_INFO(0, socket)
+    ZEND_ARG_INFO(0, len)
+ZEND_END_ARG_INFO()
+
 ZEND_BEGIN_ARG_INFO_EX(arginfo_ngx_socket_settimeout, 0, 0, 1)
     ZEND_ARG_INFO(0, time)
 ZEND_END_ARG_INFO()
 
 ZEND_BEGIN_ARG_INFO_EX(arginfo_ngx_socket_setkeepalive, 0, 0, 1)
+    ZEND_ARG_INFO(0, socket)
+    ZEND_ARG_INFO(0, timeout)
     ZEND_ARG_INFO(0, size)
 ZEND_END_ARG_INFO()
 
@@ -124,6 +138,8 @@ PHP_FUNCTION(ngx_socket_recv);
 PHP_FUNCTION(ngx_socket_recvpage);
 PHP_FUNCTION(ngx_socket_recvwait);
 PHP_FUNCTION(ngx_socket_recvsync);
+PHP_FUNCTION(ngx_socket_recv_until);
+PHP_FUNCTION(ngx_socket_recv_exact);
 PHP_FUNCTION(ngx_socket_read);
 PHP_FUNCTION(ngx_socket_write);
 PHP_FUNCTION(ngx_socket_close);
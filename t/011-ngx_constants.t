@@ -12,7 +12,10 @@ location = /ngx_constants {
     content_by_php '
         $ngx_const = get_defined_constants();
         foreach ($ngx_const as $k => $v) {
-            if (!strncmp($k, "NGX_", 4)) {
+            if ($k === "NGX_AF_INET6") {
+                /* 10 on linux only, php knows the value of the platform */
+                echo "{$k} = ", $v === STREAM_PF_INET6 ? "STREAM_PF_INET6" : $v, "\n";
+            } else if (!strncmp($k, "NGX_", 4)) {
                 echo "{$k} = {$v}\n";
             }
         }
@@ -80,3 +83,6 @@ NGX_LOG_WARN = 5
 NGX_LOG_NOTICE = 6
 NGX_LOG_INFO = 7
 NGX_LOG_DEBUG = 8
+NGX_AF_INET = 2
+NGX_AF_INET6 = STREAM_PF_INET6
+NGX_AF_UNIX = 1
@@ -53,14 +53,33 @@ ngx_socket_recv
 ngx_socket_recvpage
 ngx_socket_recvwait
 ngx_socket_recvsync
+ngx_socket_recv_until
+ngx_socket_recv_exact
+ngx_socket_setkeepalive
 ngx_socket_clear
 ngx_socket_destroy
+ngx_http_request
+ngx_http_request_read
+ngx_location_capture
+ngx_location_capture_multi
+ngx_file_read
+ngx_file_write
+ngx_file_append
+ngx_file_stat
+ngx_counter_incr
+ngx_counter_get
+ngx_limit
+ngx_queue_push
+ngx_queue_pop
+ngx_queue_fetch
 ngx_var_get
 ngx_var_set
 ngx_header_set
 ngx_header_get
 ngx_header_get_all
 ngx_redirect
+ngx_exec
+ngx_send_file
 ngx_cookie_get_all
 ngx_cookie_get
 ngx_cookie_set
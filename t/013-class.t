@@ -26,3 +26,4 @@ ngx_log
 ngx_request
 ngx_socket
 ngx_var
+ngx_shared
@@ -0,0 +1,74 @@
+# vim:set ft= ts=4 sw=4 et fdm=marker:
+
+use Test::Nginx::Socket 'no_plan';
+
+run_tests();
+
+__DATA__
+=== TEST 1: ngx_socket_setkeepalive
+reuse a pooled connection
+--- http_config
+    server {
+        listen 127.0.0.1:1990;
+        location / {
+            return 200 "ok";
+        }
+    }
+--- config
+location = /t1 {
+    content_by_php_block {
+        $req = "GET / HTTP/1.1\r\nHost: 127.0.0.1\r\n\r\n";
+        for ($i = 0; $i < 3; $i++) {
+            $fd = ngx_socket_create();
+            yield ngx_socket_connect($fd, "127.0.0.1", 1990);
+            var_dump(ngx_socket_iskeepalive());
+            yield ngx_socket_send($fd, $req, strlen($req));
+            $ret = "";
+            yield ngx_socket_recv($fd, $ret, 1024);
+            var_dump(ngx_socket_setkeepalive($fd, 10000, 4));
+        }
+    }
+}
+--- request
+GET /t1
+--- response_body
+bool(false)
+bool(true)
+bool(true)
+bool(true)
+bool(true)
+bool(true)
+
+
+
+=== TEST 2: php_keepalive requests
+close connection after max reuse count
+--- http_config
+    server {
+        listen 127.0.0.1:1990;
+        location / {
+            return 200 "ok";
+        }
+    }
+--- config
+php_keepalive 4 timeout=10s requests=2;
+location = /t2 {
+    content_by_php_block {
+        $req = "GET / HTTP/1.1\r\nHost: 127.0.0.1\r\n\r\n";
+        for ($i = 0; $i < 3; $i++) {
+            $fd = ngx_socket_create();
+            yield ngx_socket_connect($fd, "127.0.0.1", 1990, "t2");
+            var_dump(ngx_socket_iskeepalive());
+            yield ngx_socket_send($fd, $req, strlen($req));
+            $ret = "";
+            yield ngx_socket_recv($fd, $ret, 1024);
+            yield ngx_socket_close($fd);
+        }
+    }
+}
+--- request
+GET /t2
+--- response_body
+bool(false)
+bool(true)
+bool(false)
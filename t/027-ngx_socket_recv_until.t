@@ -0,0 +1,70 @@
+# vim:set ft= ts=4 sw=4 et fdm=marker:
+
+use Test::Nginx::Socket 'no_plan';
+
+run_tests();
+
+__DATA__
+=== TEST 1: ngx_socket_recv_until and ngx_socket_recv_exact
+parse a http response
+--- http_config
+    server {
+        listen 127.0.0.1:1990;
+        location / {
+            return 200 "hello world";
+        }
+    }
+--- config
+location = /t1 {
+    content_by_php_block {
+        $fd = ngx_socket_create();
+        yield ngx_socket_connect($fd, "127.0.0.1", 1990);
+        $req = "GET / HTTP/1.1\r\nHost: 127.0.0.1\r\nConnection: close\r\n\r\n";
+        yield ngx_socket_send($fd, $req, strlen($req));
+        $status = yield ngx_socket_recv_until($fd, "\r\n");
+        $len = 0;
+        while (($line = yield ngx_socket_recv_until($fd, "\r\n")) !== "") {
+            if (!strncasecmp($line, "Content-Length:", 15)) {
+                $len = (int) trim(substr($line, 15));
+            }
+        }
+        $body = yield ngx_socket_recv_exact($fd, $len);
+        var_dump($status);
+        var_dump($body);
+        var_dump(yield ngx_socket_recv_exact($fd, 1));
+        yield ngx_socket_close($fd);
+    }
+}
+--- request
+GET /t1
+--- response_body
+string(15) "HTTP/1.1 200 OK"
+string(11) "hello world"
+bool(false)
+
+
+
+=== TEST 2: ngx_socket_recv_until max length
+delimiter not found
+--- http_config
+    server {
+        listen 127.0.0.1:1990;
+        location / {
+            return 200 "hello world";
+        }
+    }
+--- config
+location = /t2 {
+    content_by_php_block {
+        $fd = ngx_socket_create();
+        yield ngx_socket_connect($fd, "127.0.0.1", 1990);
+        $req = "GET / HTTP/1.1\r\nHost: 127.0.0.1\r\nConnection: close\r\n\r\n";
+        yield ngx_socket_send($fd, $req, strlen($req));
+        var_dump(yield ngx_socket_recv_until($fd, "\r\n\r\n", 8));
+        yield ngx_socket_close($fd);
+    }
+}
+--- request
+GET /t2
+--- response_body
+bool(false)
@@ -0,0 +1,114 @@
+# vim:set ft= ts=4 sw=4 et fdm=marker:
+
+use Test::Nginx::Socket 'no_plan';
+
+run_tests();
+
+__DATA__
+=== TEST 1: unix socket with unix: prefix
+connect to a unix domain socket
+--- http_config
+    server {
+        listen unix:$TEST_NGINX_HTML_DIR/echo.sock;
+        location / {
+            return 200 $uri;
+        }
+    }
+--- config
+location = /t1 {
+    content_by_php_block {
+        $fd = ngx_socket_create();
+        yield ngx_socket_connect($fd, "unix:$TEST_NGINX_HTML_DIR/echo.sock");
+        $req = "GET /echo HTTP/1.1\r\nHost: localhost\r\nConnection: close\r\n\r\n";
+        yield ngx_socket_send($fd, $req, strlen($req));
+        var_dump(yield ngx_socket_recv_until($fd, "\r\n"));
+        while ((yield ngx_socket_recv_until($fd, "\r\n")) !== "") {}
+        var_dump(yield ngx_socket_recv_exact($fd, 5));
+        yield ngx_socket_close($fd);
+    }
+}
+--- request
+GET /t1
+--- response_body
+string(15) "HTTP/1.1 200 OK"
+string(5) "/echo"
+
+
+
+=== TEST 2: NGX_AF_UNIX socket with a plain path
+connect to a unix domain socket
+--- http_config
+    server {
+        listen unix:$TEST_NGINX_HTML_DIR/echo.sock;
+        location / {
+            return 200 $uri;
+        }
+    }
+--- config
+location = /t2 {
+    content_by_php_block {
+        $fd = ngx_socket_create(NGX_AF_UNIX);
+        yield ngx_socket_connect($fd, "$TEST_NGINX_HTML_DIR/echo.sock");
+        $req = "GET /plain HTTP/1.1\r\nHost: localhost\r\nConnection: close\r\n\r\n";
+        yield ngx_socket_send($fd, $req, strlen($req));
+        while ((yield ngx_socket_recv_until($fd, "\r\n")) !== "") {}
+        var_dump(yield ngx_socket_recv_exact($fd, 6));
+        yield ngx_socket_close($fd);
+    }
+}
+--- request
+GET /t2
+--- response_body
+string(6) "/plain"
+
+
+
+=== TEST 3: unix socket keepalive
+reuse a pooled unix socket connection
+--- http_config
+    server {
+        listen unix:$TEST_NGINX_HTML_DIR/echo.sock;
+        location / {
+            return 200 $uri;
+        }
+    }
+--- config
+location = /t3 {
+    content_by_php_block {
+        for ($i = 0; $i < 2; $i++) {
+            $fd = ngx_socket_create();
+            yield ngx_socket_connect($fd, "unix:$TEST_NGINX_HTML_DIR/echo.sock");
+            var_dump(ngx_socket_iskeepalive());
+            $req = "GET /k$i HTTP/1.1\r\nHost: localhost\r\n\r\n";
+            yield ngx_socket_send($fd, $req, strlen($req));
+            while ((yield ngx_socket_recv_until($fd, "\r\n")) !== "") {}
+            var_dump(yield ngx_socket_recv_exact($fd, 3));
+            ngx_socket_setkeepalive($fd);
+        }
+    }
+}
+--- request
+GET /t3
+--- response_body
+bool(false)
+string(3) "/k0"
+bool(true)
+string(3) "/k1"
+
+
+
+=== TEST 4: missing unix socket
+connect fails
+--- config
+location = /t4 {
+    content_by_php_block {
+        $fd = ngx_socket_create();
+        var_dump(yield ngx_socket_connect($fd, "unix:$TEST_NGINX_HTML_DIR/missing.sock"));
+    }
+}
+--- request
+GET /t4
+--- response_body
+bool(false)
+--- error_log
+connect() to unix:
@@ -0,0 +1,75 @@
+# vim:set ft= ts=4 sw=4 et fdm=marker:
+
+use Test::Nginx::Socket 'no_plan';
+
+run_tests();
+
+__DATA__
+=== TEST 1: ngx_socket_send array
+send a pipeline with one call
+--- http_config
+    server {
+        listen 127.0.0.1:1990;
+        location / {
+            return 200 $uri;
+        }
+    }
+--- config
+location = /t1 {
+    content_by_php_block {
+        $fd = ngx_socket_create();
+        yield ngx_socket_connect($fd, "127.0.0.1", 1990);
+        $reqs = [];
+        foreach (["/a", "/b", "/c"] as $uri) {
+            $reqs[] = "GET {$uri} HTTP/1.1\r\n";
+            $reqs[] = "Host: 127.0.0.1\r\n";
+            $reqs[] = ($uri == "/c") ? "Connection: close\r\n\r\n" : "\r\n";
+        }
+        yield ngx_socket_send($fd, $reqs);
+        unset($reqs);
+        for ($i = 0; $i < 3; $i++) {
+            $len = 0;
+            while (($line = yield ngx_socket_recv_until($fd, "\r\n")) !== "") {
+                if (!strncasecmp($line, "Content-Length:", 15)) {
+                    $len = (int) trim(substr($line, 15));
+                }
+            }
+            echo (yield ngx_socket_recv_exact($fd, $len)), "\n";
+        }
+        yield ngx_socket_close($fd);
+    }
+}
+--- request
+GET /t1
+--- response_body
+/a
+/b
+/c
+
+
+
+=== TEST 2: ngx_socket_send string with len
+send a prefix of the string
+--- http_config
+    server {
+        listen 127.0.0.1:1990;
+        location / {
+            return 200 $uri;
+        }
+    }
+--- config
+location = /t2 {
+    content_by_php_block {
+        $fd = ngx_socket_create();
+        yield ngx_socket_connect($fd, "127.0.0.1", 1990);
+        $req = "GET /len HTTP/1.1\r\nHost: 127.0.0.1\r\nConnection: close\r\n\r\nGARBAGE";
+        yield ngx_socket_send($fd, $req, strlen($req) - 7);
+        while ((yield ngx_socket_recv_until($fd, "\r\n")) !== "") {}
+        echo yield ngx_socket_recv_exact($fd, 4);
+        yield ngx_socket_close($fd);
+    }
+}
+--- request
+GET /t2
+--- response_body chomp
+/len
@@ -0,0 +1,136 @@
+# vim:set ft= ts=4 sw=4 et fdm=marker:
+
+use Test::Nginx::Socket 'no_plan';
+
+run_tests();
+
+__DATA__
+=== TEST 1: ngx\redis set and get
+set and get
+--- config
+location = /t1 {
+    content_by_php_block {
+        $redis = new ngx\redis();
+        var_dump(yield $redis->connect("127.0.0.1", 6379));
+        var_dump(yield $redis->set("ngx_redis_foo", "123456789"));
+        var_dump(yield $redis->get("ngx_redis_foo"));
+        var_dump(yield $redis->command("del", "ngx_redis_foo"));
+        var_dump(yield $redis->get("ngx_redis_foo"));
+        $redis->close();
+    }
+}
+--- request
+GET /t1
+--- response_body
+bool(true)
+string(2) "OK"
+string(9) "123456789"
+int(1)
+NULL
+
+
+
+=== TEST 2: ngx\redis nested replies
+arrays and error replies
+--- config
+location = /t2 {
+    content_by_php_block {
+        $redis = new ngx\redis();
+        yield $redis->connect("127.0.0.1", 6379);
+        yield $redis->del("ngx_redis_list", "ngx_redis_hash");
+        yield $redis->rpush("ngx_redis_list", ["a", "b", "c"]);
+        echo implode(",", yield $redis->lrange("ngx_redis_list", 0, -1)), "\n";
+        yield $redis->hmset("ngx_redis_hash", ["f1" => "v1", "f2" => "v2"]);
+        echo implode(",", yield $redis->hmget("ngx_redis_hash", "f1", "f2", "f3")), "\n";
+        $ret = yield $redis->eval("return {1, {2, 'x'}, redis.status_reply('ok')}", 0);
+        echo json_encode($ret), "\n";
+        var_dump(yield $redis->incr("ngx_redis_list"));
+        echo strtok($redis->getLastError(), " "), "\n";
+        yield $redis->del("ngx_redis_list", "ngx_redis_hash");
+        $redis->close();
+    }
+}
+--- request
+GET /t2
+--- response_body
+a,b,c
+v1,v2,
+[1,[2,"x"],"ok"]
+bool(false)
+WRONGTYPE
+
+
+
+=== TEST 3: ngx\redis pipeline
+all commands in one send
+--- config
+location = /t3 {
+    content_by_php_block {
+        $redis = new ngx\redis();
+        yield $redis->connect("127.0.0.1", 6379);
+        $cmds = [["set", "ngx_redis_n", 10]];
+        for ($i = 0; $i < 100; $i++) {
+            $cmds[] = ["incr", "ngx_redis_n"];
+        }
+        $cmds[] = ["set", "ngx_redis_big", str_repeat("x", 100000)];
+        $cmds[] = ["get", "ngx_redis_big"];
+        $cmds[] = ["del", "ngx_redis_n", "ngx_redis_big"];
+        $replies = yield $redis->pipeline($cmds);
+        echo count($replies), "\n";
+        echo $replies[100], "\n";
+        echo strlen($replies[102]), "\n";
+        echo $replies[103], "\n";
+        var_dump(yield $redis->pipeline([]));
+        $redis->close();
+    }
+}
+--- request
+GET /t3
+--- response_body
+104
+110
+100000
+2
+array(0) {
+}
+
+
+
+=== TEST 4: ngx\redis keepalive
+the connection is reused by the next request
+--- config
+php_keepalive 10;
+location = /t4 {
+    content_by_php_block {
+        $redis = new ngx\redis();
+        yield $redis->connect("127.0.0.1", 6379, "redis");
+        yield $redis->client("setname", "ngx_redis_pooled");
+        $redis->setkeepalive();
+        $redis = new ngx\redis();
+        yield $redis->connect("127.0.0.1", 6379, "redis");
+        echo yield $redis->client("getname"), "\n";
+        $redis->close();
+    }
+}
+--- request
+GET /t4
+--- response_body
+ngx_redis_pooled
+
+
+
+=== TEST 5: ngx\redis connect failure
+connect returns false
+--- config
+location = /t5 {
+    content_by_php_block {
+        $redis = new ngx\redis();
+        var_dump(yield $redis->connect("unix:/nonexistent/redis.sock"));
+        var_dump(yield $redis->get("foo"));
+    }
+}
+--- request
+GET /t5
+--- response_body
+bool(false)
+bool(false)
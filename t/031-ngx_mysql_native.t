@@ -0,0 +1,109 @@
+# vim:set ft= ts=4 sw=4 et fdm=marker:
+
+use Test::Nginx::Socket 'no_plan';
+
+run_tests();
+
+__DATA__
+=== TEST 1: ngx\mysql query
+text protocol
+--- config
+location = /t1 {
+    content_by_php_block {
+        $mysql = new ngx\mysql();
+        var_dump(yield $mysql->connect("127.0.0.1", 3306, "root", "root", "world"));
+        $rows = yield $mysql->query("select * from world.city order by ID asc limit 1");
+        echo implode(",", $rows[0]), "\n";
+        var_dump($rows[0]["ID"]);
+        var_dump(yield $mysql->query("select * from world.no_such_table"));
+        var_dump($mysql->getLastErrno());
+        $mysql->close();
+    }
+}
+--- request
+GET /t1
+--- response_body
+bool(true)
+1,Kabul,AFG,Kabol,1780000
+int(1)
+bool(false)
+int(1146)
+
+
+
+=== TEST 2: ngx\mysql execute
+binary protocol with parameters
+--- config
+location = /t2 {
+    content_by_php_block {
+        $mysql = new ngx\mysql();
+        yield $mysql->connect("127.0.0.1", 3306, "root", "root", "world");
+        $sql = "select ID, Name, Population from city where ID = ? or Name = ?";
+        $rows = yield $mysql->execute($sql, [1, "Kandahar"]);
+        echo json_encode($rows), "\n";
+        $rows = yield $mysql->execute($sql, [3, null]);
+        echo json_encode($rows), "\n";
+        var_dump(yield $mysql->execute($sql, [1]));
+        $mysql->close();
+    }
+}
+--- request
+GET /t2
+--- response_body
+[{"ID":1,"Name":"Kabul","Population":1780000},{"ID":2,"Name":"Qandahar","Population":237500}]
+[{"ID":3,"Name":"Herat","Population":186800}]
+bool(false)
+--- error_log
+the statement expects 2 parameters
+
+
+
+=== TEST 3: ngx\mysql pipeline
+several queries with a single write
+--- config
+location = /t3 {
+    content_by_php_block {
+        $mysql = new ngx\mysql();
+        yield $mysql->connect("127.0.0.1", 3306, "root", "root", "world");
+        $results = yield $mysql->pipeline([
+            "select 1 as a",
+            "select Name from city where ID = 1",
+            "select * from no_such_table",
+            "select 2 as b",
+        ]);
+        echo json_encode($results), "\n";
+        echo json_encode(yield $mysql->pipeline([])), "\n";
+        $mysql->close();
+    }
+}
+--- request
+GET /t3
+--- response_body
+[[{"a":1}],[{"Name":"Kabul"}],false,[{"b":2}]]
+[]
+
+
+
+=== TEST 4: ngx\mysql keepalive
+prepared statements survive in the pool
+--- config
+location = /t4 {
+    content_by_php_block {
+        for ($i = 0; $i < 3; $i++) {
+            $mysql = new ngx\mysql();
+            var_dump(yield $mysql->connect("127.0.0.1", 3306, "root", "root", "world", "mysql"));
+            $rows = yield $mysql->execute("select Name from city where ID = ?", [$i + 1]);
+            echo $rows[0]["Name"], "\n";
+            $mysql->setkeepalive(0, 4);
+        }
+    }
+}
+--- request
+GET /t4
+--- response_body
+bool(true)
+Kabul
+bool(true)
+Qandahar
+bool(true)
+Herat
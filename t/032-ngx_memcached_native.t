@@ -0,0 +1,148 @@
+# vim:set ft= ts=4 sw=4 et fdm=marker:
+
+use Test::Nginx::Socket 'no_plan';
+
+run_tests();
+
+__DATA__
+=== TEST 1: ngx\memcached binary protocol
+set, get, gets, cas, incr, delete
+--- config
+location = /t1 {
+    content_by_php_block {
+        $mc = new ngx\memcached();
+        var_dump(yield $mc->connect("127.0.0.1", 11211));
+        var_dump(yield $mc->set("ngx_mc_foo", "bar"));
+        var_dump(yield $mc->get("ngx_mc_foo"));
+        $ret = yield $mc->gets("ngx_mc_foo");
+        var_dump(yield $mc->cas("ngx_mc_foo", "baz", $ret["cas"]));
+        var_dump(yield $mc->cas("ngx_mc_foo", "qux", $ret["cas"]));
+        var_dump(yield $mc->get("ngx_mc_foo"));
+        yield $mc->set("ngx_mc_n", "10");
+        var_dump(yield $mc->incr("ngx_mc_n", 5));
+        var_dump(yield $mc->incr("ngx_mc_n", -3));
+        var_dump(yield $mc->delete("ngx_mc_foo"));
+        var_dump(yield $mc->get("ngx_mc_foo"));
+        var_dump(yield $mc->incr("ngx_mc_foo"));
+        $mc->close();
+    }
+}
+--- request
+GET /t1
+--- response_body
+bool(true)
+bool(true)
+string(3) "bar"
+bool(true)
+bool(false)
+string(3) "baz"
+int(15)
+int(12)
+bool(true)
+NULL
+bool(false)
+
+
+
+=== TEST 2: ngx\memcached text protocol
+the same commands over the text protocol
+--- config
+location = /t2 {
+    content_by_php_block {
+        $mc = new ngx\memcached(null, false);
+        yield $mc->connect("127.0.0.1", 11211);
+        var_dump(yield $mc->set("ngx_mc_foo", "bar"));
+        var_dump(yield $mc->get("ngx_mc_foo"));
+        $ret = yield $mc->gets("ngx_mc_foo");
+        var_dump(yield $mc->cas("ngx_mc_foo", "baz", $ret["cas"]));
+        var_dump(yield $mc->cas("ngx_mc_foo", "qux", $ret["cas"]));
+        echo $mc->getLastError(), "\n";
+        var_dump(yield $mc->incr("ngx_mc_foo"));
+        var_dump(yield $mc->delete("ngx_mc_foo"));
+        var_dump(yield $mc->get("ngx_mc_foo"));
+        var_dump(yield $mc->get("bad key"));
+        $mc->close();
+    }
+}
+--- request
+GET /t2
+--- response_body
+bool(true)
+string(3) "bar"
+bool(true)
+bool(false)
+EXISTS
+bool(false)
+bool(true)
+NULL
+bool(false)
+
+
+
+=== TEST 3: ngx\memcached getMulti
+one round trip for many keys
+--- config
+location = /t3 {
+    content_by_php_block {
+        foreach ([true, false] as $binary) {
+            $mc = new ngx\memcached(null, $binary);
+            yield $mc->connect("127.0.0.1", 11211);
+            $keys = [];
+            for ($i = 0; $i < 50; $i++) {
+                $keys[] = "ngx_mc_k$i";
+                if ($i % 2 == 0) {
+                    yield $mc->set("ngx_mc_k$i", "v$i");
+                }
+            }
+            $ret = yield $mc->getMulti($keys);
+            echo count($ret), " ", $ret["ngx_mc_k0"], " ", $ret["ngx_mc_k48"], "\n";
+            echo json_encode(yield $mc->getMulti([])), "\n";
+            $mc->close();
+        }
+    }
+}
+--- request
+GET /t3
+--- response_body
+25 v0 v48
+[]
+25 v0 v48
+[]
+
+
+
+=== TEST 4: ngx\memcached locate
+consistent hashing over a server list
+--- config
+location = /t4 {
+    content_by_php_block {
+        $servers = ["127.0.0.1:11211", "127.0.0.1:11212", "unix:/tmp/memcached.sock"];
+        $a = new ngx\memcached($servers);
+        $b = new ngx\memcached($servers);
+        $same = true;
+        $seen = [];
+        for ($i = 0; $i < 1000; $i++) {
+            $s = $a->locate("key$i");
+            $same = $same && $s == $b->locate("key$i");
+            $seen[$s[0] . ":" . $s[1]] = 1;
+        }
+        var_dump($same, count($seen));
+        $c = new ngx\memcached(["127.0.0.1:11211", "127.0.0.1:11212"]);
+        $moved = 0;
+        for ($i = 0; $i < 1000; $i++) {
+            $s = $a->locate("key$i");
+            if ($s[1] != 0 && $s != $c->locate("key$i")) {
+                $moved++;
+            }
+        }
+        var_dump($moved);
+        var_dump((new ngx\memcached())->locate("key"));
+    }
+}
+--- request
+GET /t4
+--- response_body
+bool(true)
+int(3)
+int(0)
+bool(false)
@@ -0,0 +1,196 @@
+# vim:set ft= ts=4 sw=4 et fdm=marker:
+
+use Test::Nginx::Socket 'no_plan';
+
+run_tests();
+
+__DATA__
+=== TEST 1: ngx_http_request content-length
+status, lowercased headers and body
+--- http_config
+    server {
+        listen 127.0.0.1:1990;
+        location / {
+            add_header X-Foo $http_x_foo;
+            return 200 "ok";
+        }
+    }
+--- config
+location = /t1 {
+    content_by_php_block {
+        $res = yield ngx_http_request("http://127.0.0.1:1990/", [
+            "headers" => ["X-Foo" => "bar"]
+        ]);
+        var_dump($res["status"]);
+        var_dump($res["headers"]["content-length"]);
+        var_dump($res["headers"]["x-foo"]);
+        var_dump($res["body"]);
+    }
+}
+--- request
+GET /t1
+--- response_body
+int(200)
+string(1) "2"
+string(3) "bar"
+string(2) "ok"
+
+
+
+=== TEST 2: ngx_http_request chunked
+a chunked body is decoded
+--- http_config
+    server {
+        listen 127.0.0.1:1990;
+        location / {
+            content_by_php_block {
+                echo "hello";
+                echo " world";
+            }
+        }
+    }
+--- config
+location = /t2 {
+    content_by_php_block {
+        $res = yield ngx_http_request("http://127.0.0.1:1990/chunked");
+        var_dump($res["status"]);
+        var_dump($res["headers"]["transfer-encoding"]);
+        var_dump($res["body"]);
+    }
+}
+--- request
+GET /t2
+--- response_body
+int(200)
+string(7) "chunked"
+string(11) "hello world"
+
+
+
+=== TEST 3: ngx_http_request keepalive
+the connection goes back to the pool after each response
+--- http_config
+    server {
+        listen 127.0.0.1:1990;
+        location / {
+            return 200 "$connection_requests";
+        }
+    }
+--- config
+location = /t3 {
+    content_by_php_block {
+        for ($i = 0; $i < 3; $i++) {
+            $res = yield ngx_http_request("http://127.0.0.1:1990/", ["pool" => "t3"]);
+            echo $res["body"], "\n";
+        }
+        $res = yield ngx_http_request("http://127.0.0.1:1990/", ["keepalive" => false]);
+        echo $res["body"], "\n";
+    }
+}
+--- request
+GET /t3
+--- response_body
+1
+2
+3
+1
+
+
+
+=== TEST 4: ngx_http_request timeout
+the deadline covers the whole exchange
+--- http_config
+    server {
+        listen 127.0.0.1:1990;
+        location / {
+            content_by_php_block {
+                yield ngx_msleep(1000);
+                echo "late";
+            }
+        }
+    }
+--- config
+location = /t4 {
+    content_by_php_block {
+        var_dump(yield ngx_http_request("http://127.0.0.1:1990/", ["timeout" => 100]));
+    }
+}
+--- request
+GET /t4
+--- response_body
+bool(false)
+--- error_log
+timed out
+
+
+
+=== TEST 5: ngx_http_request stream
+the body is read in parts
+--- http_config
+    server {
+        listen 127.0.0.1:1990;
+        location / {
+            content_by_php_block {
+                echo str_repeat("a", 300000);
+            }
+        }
+    }
+--- config
+location = /t5 {
+    content_by_php_block {
+        $res = yield ngx_http_request("http://127.0.0.1:1990/", ["stream" => true]);
+        var_dump($res["status"]);
+        var_dump(isset($res["body"]));
+        $len = 0;
+        while (($chunk = yield ngx_http_request_read()) !== "" && $chunk !== false) {
+            $len += strlen($chunk);
+        }
+        var_dump($len);
+    }
+}
+--- request
+GET /t5
+--- response_body
+int(200)
+bool(false)
+int(300000)
+
+
+
+=== TEST 6: ngx_http_request https
+only http:// urls are supported
+--- config
+location = /t6 {
+    content_by_php_block {
+        var_dump(yield ngx_http_request("https://127.0.0.1/"));
+    }
+}
+--- request
+GET /t6
+--- response_body
+bool(false)
+--- error_log
+only http:// urls are supported
+
+
+
+=== TEST 7: ngx_http_request request line injection
+a method or url that would end the request line is refused
+--- config
+location = /t7 {
+    content_by_php_block {
+        var_dump(yield ngx_http_request("http://127.0.0.1:1990/", 
+                                        ["method" => "GET / HTTP/1.1\r\nX-Injected: 1\r\n\r\nGET"]));
+        var_dump(yield ngx_http_request("http://127.0.0.1:1990/a b"));
+        var_dump(yield ngx_http_request("http://127.0.0.1:1990/\r\nX-Injected: 1"));
+    }
+}
+--- request
+GET /t7
+--- response_body
+bool(false)
+bool(false)
+bool(false)
+--- error_log
+invalid method
+invalid url
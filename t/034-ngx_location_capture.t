@@ -0,0 +1,96 @@
+# vim:set ft= ts=4 sw=4 et fdm=marker:
+
+use Test::Nginx::Socket 'no_plan';
+
+run_tests();
+
+__DATA__
+=== TEST 1: ngx_location_capture
+status, headers and body of a subrequest
+--- config
+location = /sub {
+    add_header X-Foo bar;
+    return 200 "hello $arg_a $arg_b";
+}
+location = /t1 {
+    content_by_php_block {
+        $res = yield ngx_location_capture("/sub?a=1", ["args" => ["b" => "x y"]]);
+        var_dump($res["status"]);
+        var_dump($res["headers"]["x-foo"]);
+        var_dump($res["body"]);
+    }
+}
+--- request
+GET /t1
+--- response_body
+int(200)
+string(3) "bar"
+string(13) "hello 1 x%20y"
+
+
+
+=== TEST 2: ngx_location_capture_multi
+subrequests run in parallel, results keep their order
+--- config
+location = /a {
+    return 200 "a";
+}
+location = /b {
+    return 404;
+}
+location = /c {
+    content_by_php_block {
+        yield ngx_msleep(10);
+        echo "c";
+    }
+}
+location = /t2 {
+    content_by_php_block {
+        $res = yield ngx_location_capture_multi(["/c", "/a", ["/b"]]);
+        foreach ($res as $r) {
+            echo $r["status"], " ", $r["body"] === "" ? "-" : $r["body"], "\n";
+        }
+    }
+}
+--- request
+GET /t2
+--- response_body_like
+^200 c
+200 a
+404 .*
+
+
+
+=== TEST 3: ngx_location_capture with a body
+POST to a php location
+--- config
+location = /echo {
+    content_by_php_block {
+        echo ngx_request_method(), " ", ngx_request_body();
+    }
+}
+location = /t3 {
+    content_by_php_block {
+        $res = yield ngx_location_capture("/echo", ["method" => "post", "body" => "ping"]);
+        echo $res["body"], "\n";
+    }
+}
+--- request
+GET /t3
+--- response_body
+POST ping
+
+
+
+=== TEST 4: ngx_location_capture invalid uri
+the yield value is false
+--- config
+location = /t4 {
+    content_by_php_block {
+        var_dump(yield ngx_location_capture("relative"));
+    }
+}
+--- request
+GET /t4
+--- response_body
+bool(false)
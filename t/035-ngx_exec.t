@@ -0,0 +1,62 @@
+# vim:set ft= ts=4 sw=4 et fdm=marker:
+
+use Test::Nginx::Socket 'no_plan';
+
+run_tests();
+
+__DATA__
+=== TEST 1: ngx_exec
+internal redirect with args
+--- config
+location = /target {
+    return 200 "target $args";
+}
+location = /t1 {
+    content_by_php_block {
+        echo "dropped";
+        ngx_exec("/target?a=1", ["b" => 2]);
+        echo "not reached";
+    }
+}
+--- request
+GET /t1
+--- response_body chomp
+target a=1&b=2
+
+
+
+=== TEST 2: ngx_exec named location
+from rewrite_by_php
+--- config
+location @named {
+    return 200 "named $args";
+}
+location = /t2 {
+    rewrite_by_php_block {
+        ngx_exec("@named", "c=3");
+    }
+    return 200 "not reached";
+}
+--- request
+GET /t2
+--- response_body chomp
+named c=3
+
+
+
+=== TEST 3: ngx_exec after yield
+the coroutine ends and the request is redirected
+--- config
+location = /target {
+    return 200 "target";
+}
+location = /t3 {
+    content_by_php_block {
+        yield ngx_msleep(1);
+        ngx_exec("/target");
+    }
+}
+--- request
+GET /t3
+--- response_body chomp
+target
@@ -0,0 +1,106 @@
+# vim:set ft= ts=4 sw=4 et fdm=marker:
+
+use Test::Nginx::Socket 'no_plan';
+
+run_tests();
+
+__DATA__
+=== TEST 1: ngx_send_file
+the whole file
+--- user_files
+>>> hello.txt
+hello world
+--- config
+location = /t1 {
+    content_by_php_block {
+        ngx_send_file(ngx_request_document_root() . "/hello.txt");
+    }
+}
+--- request
+GET /t1
+--- response_headers_like
+Last-Modified: .+
+ETag: .+
+--- response_body
+hello world
+
+
+
+=== TEST 2: ngx_send_file range
+a range request on a file sent alone
+--- user_files
+>>> hello.txt
+hello world
+--- config
+location = /t2 {
+    content_by_php_block {
+        ngx_send_file(ngx_request_document_root() . "/hello.txt");
+    }
+}
+--- request
+GET /t2
+--- more_headers
+Range: bytes=6-10
+--- error_code: 206
+--- response_body chomp
+world
+
+
+
+=== TEST 3: ngx_send_file offset and length
+mixed with echo
+--- user_files
+>>> hello.txt
+hello world
+--- config
+location = /t3 {
+    content_by_php_block {
+        echo "[";
+        ngx_send_file(ngx_request_document_root() . "/hello.txt", 6, 5);
+        echo "]";
+    }
+}
+--- request
+GET /t3
+--- response_body chomp
+[world]
+
+
+
+=== TEST 4: ngx_send_file missing file
+returns false
+--- config
+location = /t4 {
+    content_by_php_block {
+        var_dump(@ngx_send_file(ngx_request_document_root() . "/missing.txt"));
+    }
+}
+--- request
+GET /t4
+--- response_body
+bool(false)
+
+
+
+=== TEST 5: ngx_send_file then a warning
+the warning is appended, the response is no longer the file
+--- user_files
+>>> hello.txt
+hello world
+--- config
+location = /t5 {
+    content_by_php_block {
+        ngx_send_file(ngx_request_document_root() . "/hello.txt");
+        trigger_error("after the file", E_USER_WARNING);
+    }
+}
+--- request
+GET /t5
+--- more_headers
+Range: bytes=0-4
+--- error_code: 500
+--- response_headers
+Last-Modified:
+ETag:
+--- response_body_like
+^hello world\n.*Warning: after the file
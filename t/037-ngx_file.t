@@ -0,0 +1,67 @@
+# vim:set ft= ts=4 sw=4 et fdm=marker:
+
+use Test::Nginx::Socket 'no_plan';
+
+run_tests();
+
+__DATA__
+=== TEST 1: ngx_file_write, ngx_file_append, ngx_file_read
+on the default thread pool
+--- config
+php_thread_pool;
+location = /t1 {
+    content_by_php_block {
+        $file = ngx_request_document_root() . "/ngx_file.txt";
+        var_dump(yield ngx_file_write($file, "hello"));
+        var_dump(yield ngx_file_append($file, " world"));
+        var_dump(yield ngx_file_read($file));
+        $st = yield ngx_file_stat($file);
+        var_dump($st["size"], $st["is_file"], $st["is_dir"]);
+    }
+}
+--- request
+GET /t1
+--- response_body
+int(5)
+int(6)
+string(11) "hello world"
+int(11)
+bool(true)
+bool(false)
+
+
+
+=== TEST 2: ngx_file_read missing file
+false and an error log entry
+--- config
+php_thread_pool;
+location = /t2 {
+    content_by_php_block {
+        var_dump(yield ngx_file_read(ngx_request_document_root() . "/missing.txt"));
+    }
+}
+--- request
+GET /t2
+--- response_body
+bool(false)
+--- error_log
+ngx_php file operation on
+
+
+
+=== TEST 3: ngx_file_read without php_thread_pool
+blocking fallback
+--- user_files
+>>> hello.txt
+hello
+--- config
+location = /t3 {
+    content_by_php_block {
+        var_dump(yield ngx_file_read(ngx_request_document_root() . "/hello.txt"));
+    }
+}
+--- request
+GET /t3
+--- response_body
+string(6) "hello
+"
@@ -0,0 +1,182 @@
+# vim:set ft= ts=4 sw=4 et fdm=marker:
+
+use Test::Nginx::Socket 'no_plan';
+
+run_tests();
+
+__DATA__
+=== TEST 1: ngx_shared set, get
+strings, ints, floats and bools keep their type
+--- http_config
+php_shared_dict dogs 1m;
+--- config
+location = /t1 {
+    content_by_php_block {
+        $dict = new ngx_shared("dogs");
+        var_dump($dict->set("s", "bark"));
+        var_dump($dict->set("i", 8));
+        var_dump($dict->set("f", 1.5));
+        var_dump($dict->set("b", false));
+        var_dump($dict->get("s"), $dict->get("i"), $dict->get("f"), $dict->get("b"));
+        var_dump($dict->get("missing"));
+        var_dump($dict->set("a", [1]));
+    }
+}
+--- request
+GET /t1
+--- response_body
+bool(true)
+bool(true)
+bool(true)
+bool(true)
+string(4) "bark"
+int(8)
+float(1.5)
+bool(false)
+NULL
+bool(false)
+
+
+
+=== TEST 2: ngx_shared add, replace, delete
+--- http_config
+php_shared_dict dogs 1m;
+--- config
+location = /t2 {
+    content_by_php_block {
+        $dict = new ngx_shared("dogs");
+        var_dump($dict->replace("k", 1));
+        var_dump($dict->add("k", 1));
+        var_dump($dict->add("k", 2));
+        var_dump($dict->replace("k", "two"));
+        var_dump($dict->get("k"));
+        var_dump($dict->delete("k"));
+        var_dump($dict->get("k"));
+    }
+}
+--- request
+GET /t2
+--- response_body
+bool(false)
+bool(true)
+bool(false)
+bool(true)
+string(3) "two"
+bool(true)
+NULL
+
+
+
+=== TEST 3: ngx_shared incr
+--- http_config
+php_shared_dict dogs 1m;
+--- config
+location = /t3 {
+    content_by_php_block {
+        $dict = new ngx_shared("dogs");
+        var_dump($dict->incr("n"));
+        var_dump($dict->incr("n", 1, 10));
+        var_dump($dict->incr("n", -3));
+        var_dump($dict->incr("n", 0.5));
+        $dict->set("s", "bark");
+        var_dump($dict->incr("s"));
+        $dict->set("m", PHP_INT_MAX);
+        var_dump(is_float($dict->incr("m")));
+    }
+}
+--- request
+GET /t3
+--- response_body
+NULL
+int(11)
+int(8)
+float(8.5)
+bool(false)
+bool(true)
+
+
+
+=== TEST 4: ngx_shared ttl, flush_expired
+--- http_config
+php_shared_dict dogs 1m;
+--- config
+location = /t4 {
+    content_by_php_block {
+        $dict = new ngx_shared("dogs");
+        $dict->set("a", 1, 0.1);
+        $dict->set("b", 2, 0.1);
+        $dict->set("c", 3);
+        yield ngx_msleep(200);
+        var_dump($dict->get("a"));
+        var_dump($dict->flush_expired());
+        var_dump($dict->get("c"));
+    }
+}
+--- request
+GET /t4
+--- response_body
+NULL
+int(2)
+int(3)
+
+
+
+=== TEST 5: ngx_shared lru eviction
+the oldest keys go when the zone is full
+--- http_config
+php_shared_dict dogs 32k;
+--- config
+location = /t5 {
+    content_by_php_block {
+        $dict = new ngx_shared("dogs");
+        $value = str_repeat("x", 1000);
+        for ($i = 0; $i < 200; $i++) {
+            if (!$dict->set("key" . $i, $value)) {
+                echo "failed {$i}\n";
+            }
+        }
+        var_dump($dict->get("key0"));
+        var_dump(strlen($dict->get("key199")));
+    }
+}
+--- request
+GET /t5
+--- response_body
+NULL
+int(1000)
+
+
+
+=== TEST 6: ngx_shared shared between requests
+--- http_config
+php_shared_dict dogs 1m;
+--- config
+location = /t6 {
+    content_by_php_block {
+        $dict = new ngx_shared("dogs");
+        $dict->add("first", ngx_request_query_string());
+        echo $dict->get("first"), "\n";
+    }
+}
+--- pipelined_requests eval
+["GET /t6?a", "GET /t6?b"]
+--- response_body eval
+["a\n", "a\n"]
+
+
+
+=== TEST 7: ngx_shared unknown zone
+--- config
+location = /t7 {
+    content_by_php_block {
+        try {
+            new ngx_shared("cats");
+        } catch (Error $e) {
+            echo $e->getMessage(), "\n";
+        }
+    }
+}
+--- request
+GET /t7
+--- response_body
+php_shared_dict "cats" is not defined
@@ -0,0 +1,166 @@
+# vim:set ft= ts=4 sw=4 et fdm=marker:
+
+use Test::Nginx::Socket 'no_plan';
+
+run_tests();
+
+__DATA__
+=== TEST 1: php_cache hit
+the second request is served without running php
+--- http_config
+php_shared_dict counters 1m;
+php_shared_dict microcache 1m;
+--- config
+location = /t1 {
+    php_cache microcache $uri 10s;
+    content_by_php_block {
+        $count = new ngx_shared("counters");
+        ngx_header_set("X-Runs", $count->incr("t1", 1, 0));
+        echo "hello\n";
+    }
+}
+--- pipelined_requests eval
+["GET /t1", "GET /t1"]
+--- response_headers eval
+["X-Runs: 1", "X-Runs: 1"]
+--- response_body eval
+["hello\n", "hello\n"]
+
+
+
+=== TEST 2: php_cache key with variables
+--- http_config
+php_shared_dict counters 1m;
+php_shared_dict microcache 1m;
+--- config
+location = /t2 {
+    php_cache microcache $uri$is_args$args 10s;
+    content_by_php_block {
+        $count = new ngx_shared("counters");
+        echo $count->incr("t2", 1, 0), "\n";
+    }
+}
+--- pipelined_requests eval
+["GET /t2?a=1", "GET /t2?a=2", "GET /t2?a=1"]
+--- response_body eval
+["1\n", "2\n", "1\n"]
+
+
+
+=== TEST 3: php_cache content type
+--- http_config
+php_shared_dict microcache 1m;
+--- config
+location = /t3 {
+    php_cache microcache $uri 10s;
+    content_by_php_block {
+        ngx_header_set("Content-Type", "application/json");
+        echo json_encode(["a" => 1]);
+    }
+}
+--- pipelined_requests eval
+["GET /t3", "GET /t3"]
+--- response_headers eval
+["Content-Type: application/json", "Content-Type: application/json"]
+--- response_body eval
+['{"a":1}', '{"a":1}']
+
+
+
+=== TEST 4: php_cache skips Set-Cookie, errors and POST
+--- http_config
+php_shared_dict counters 1m;
+php_shared_dict microcache 1m;
+--- config
+location = /t4 {
+    php_cache microcache $uri 10s;
+    content_by_php_block {
+        $count = new ngx_shared("counters");
+        ngx_cookie_set("sid=1");
+        echo $count->incr("t4", 1, 0), "\n";
+    }
+}
+location = /t5 {
+    php_cache microcache $uri 10s;
+    content_by_php_block {
+        $count = new ngx_shared("counters");
+        echo $count->incr("t5", 1, 0), "\n";
+    }
+}
+--- pipelined_requests eval
+["GET /t4", "GET /t4", "POST /t5\r\nContent-Length: 1\r\n\r\na", "POST /t5\r\nContent-Length: 1\r\n\r\na"]
+--- response_body eval
+["1\n", "2\n", "1\n", "2\n"]
+
+
+
+=== TEST 5: php_cache ttl
+--- http_config
+php_shared_dict counters 1m;
+php_shared_dict microcache 1m;
+--- config
+location = /t6 {
+    php_cache microcache $uri 100ms;
+    content_by_php_block {
+        $count = new ngx_shared("counters");
+        echo $count->incr("t6", 1, 0), "\n";
+    }
+}
+location = /wait {
+    content_by_php_block {
+        yield ngx_msleep(200);
+        echo "ok\n";
+    }
+}
+--- pipelined_requests eval
+["GET /t6", "GET /t6", "GET /wait", "GET /t6"]
+--- response_body eval
+["1\n", "1\n", "ok\n", "2\n"]
+
+
+
+=== TEST 6: php_cache single flight
+concurrent misses run the php code once
+--- http_config
+php_shared_dict counters 1m;
+php_shared_dict microcache 1m;
+--- config
+location = /t7 {
+    php_cache microcache $uri 10s;
+    content_by_php_block {
+        $count = new ngx_shared("counters");
+        $n = $count->incr("t7", 1, 0);
+        yield ngx_msleep(100);
+        echo $n, "\n";
+    }
+}
+location = /t {
+    content_by_php_block {
+        $r = yield ngx_location_capture_multi(["/t7", "/t7", "/t7"]);
+        foreach ($r as $res) {
+            echo $res["body"];
+        }
+    }
+}
+--- request
+GET /t
+--- response_body
+1
+1
+1
+
+
+
+=== TEST 7: php_cache on a zone that is not a php_shared_dict
+--- http_config
+php_shared_queue jobs 1m;
+--- config
+location = /t8 {
+    php_cache jobs $uri 10s;
+    content_by_php_block {
+        echo "hello\n";
+    }
+}
+--- must_die
+--- error_log
+"jobs" is not a php_shared_dict zone
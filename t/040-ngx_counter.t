@@ -0,0 +1,130 @@
+# vim:set ft= ts=4 sw=4 et fdm=marker:
+
+use Test::Nginx::Socket 'no_plan';
+
+run_tests();
+
+__DATA__
+=== TEST 1: ngx_counter_incr, ngx_counter_get
+--- http_config
+php_counter_zone 1m;
+--- config
+location = /t1 {
+    content_by_php_block {
+        var_dump(ngx_counter_get("hits"));
+        var_dump(ngx_counter_incr("hits"));
+        var_dump(ngx_counter_incr("hits", 10));
+        var_dump(ngx_counter_incr("hits", -4));
+        var_dump(ngx_counter_get("hits"));
+        var_dump(ngx_counter_incr(str_repeat("x", 200)));
+    }
+}
+--- request
+GET /t1
+--- response_body
+int(0)
+int(1)
+int(11)
+int(7)
+int(7)
+bool(false)
+
+
+
+=== TEST 2: ngx_counter_incr across requests
+--- http_config
+php_counter_zone 1m;
+--- config
+location = /t2 {
+    content_by_php_block {
+        echo ngx_counter_incr("t2"), "\n";
+    }
+}
+--- pipelined_requests eval
+["GET /t2", "GET /t2", "GET /t2"]
+--- response_body eval
+["1\n", "2\n", "3\n"]
+
+
+
+=== TEST 3: ngx_counter_incr without php_counter_zone
+--- config
+location = /t3 {
+    content_by_php_block {
+        var_dump(ngx_counter_incr("hits"));
+        var_dump(ngx_limit("ip", 1));
+    }
+}
+--- request
+GET /t3
+--- response_body
+bool(false)
+bool(false)
+
+
+
+=== TEST 4: ngx_limit burst
+1 + burst requests pass at once, then the rate applies
+--- http_config
+php_counter_zone 1m;
+--- config
+location = /t4 {
+    content_by_php_block {
+        for ($i = 0; $i < 4; $i++) {
+            $delay = ngx_limit("t4", 1, 2);
+            echo $delay == 0 ? "pass" : "wait", "\n";
+        }
+        $delay = ngx_limit("t4", 1, 2);
+        var_dump($delay > 0.9 && $delay <= 1);
+    }
+}
+--- request
+GET /t4
+--- response_body
+pass
+pass
+pass
+wait
+bool(true)
+
+
+
+=== TEST 5: ngx_limit rate
+--- http_config
+php_counter_zone 1m;
+--- config
+location = /t5 {
+    content_by_php_block {
+        var_dump(ngx_limit("t5", 10));
+        var_dump(ngx_limit("t5", 10) > 0);
+        yield ngx_msleep(150);
+        var_dump(ngx_limit("t5", 10));
+    }
+}
+--- request
+GET /t5
+--- response_body
+float(0)
+bool(true)
+float(0)
+
+
+
+=== TEST 6: ngx_limit in access_by_php
+--- http_config
+php_counter_zone 1m;
+--- config
+location = /t6 {
+    access_by_php_block {
+        if (ngx_limit("t6", 1) > 0) {
+            ngx_exit(429);
+        }
+    }
+    content_by_php_block {
+        echo "ok\n";
+    }
+}
+--- pipelined_requests eval
+["GET /t6", "GET /t6"]
+--- error_code eval
+[200, 429]
@@ -0,0 +1,134 @@
+# vim:set ft= ts=4 sw=4 et fdm=marker:
+
+use Test::Nginx::Socket 'no_plan';
+
+run_tests();
+
+__DATA__
+=== TEST 1: ngx_queue_push, ngx_queue_pop
+--- http_config
+php_shared_queue jobs 1m;
+--- config
+location = /t1 {
+    content_by_php_block {
+        var_dump(ngx_queue_push("jobs", "a"));
+        var_dump(ngx_queue_push("jobs", "b"));
+        var_dump(yield ngx_queue_pop("jobs"));
+        var_dump(yield ngx_queue_pop("jobs"));
+        var_dump(yield ngx_queue_pop("jobs"));
+    }
+}
+--- request
+GET /t1
+--- response_body
+int(1)
+int(2)
+string(1) "a"
+string(1) "b"
+NULL
+
+
+
+=== TEST 2: ngx_queue_fetch
+every reader sees every message after the given sequence number
+--- http_config
+php_shared_queue events 1m;
+--- config
+location = /t2 {
+    content_by_php_block {
+        ngx_queue_push("events", "x");
+        ngx_queue_push("events", "y");
+        ngx_queue_push("events", "z");
+        var_dump(yield ngx_queue_fetch("events", 1));
+        var_dump(yield ngx_queue_fetch("events", 0));
+        var_dump(yield ngx_queue_fetch("events"));
+    }
+}
+--- request
+GET /t2
+--- response_body
+array(2) {
+  [2]=>
+  string(1) "y"
+  [3]=>
+  string(1) "z"
+}
+array(3) {
+  [1]=>
+  string(1) "x"
+  [2]=>
+  string(1) "y"
+  [3]=>
+  string(1) "z"
+}
+array(0) {
+}
+
+
+
+=== TEST 3: ngx_queue_pop wakes up on push
+--- http_config
+php_shared_queue jobs 1m;
+--- config
+location = /wait {
+    content_by_php_block {
+        $start = microtime(true);
+        $msg = yield ngx_queue_pop("jobs", 5);
+        echo $msg, " ", microtime(true) - $start < 1 ? "fast" : "slow";
+    }
+}
+location = /push {
+    content_by_php_block {
+        yield ngx_msleep(50);
+        ngx_queue_push("jobs", "hello");
+        echo "pushed";
+    }
+}
+location = /t3 {
+    content_by_php_block {
+        $res = yield ngx_location_capture_multi(["/wait", "/push"]);
+        foreach ($res as $r) {
+            echo $r["body"], "\n";
+        }
+    }
+}
+--- request
+GET /t3
+--- response_body
+hello fast
+pushed
+
+
+
+=== TEST 4: ngx_queue_pop timeout
+--- http_config
+php_shared_queue jobs 1m;
+--- config
+location = /t4 {
+    content_by_php_block {
+        var_dump(yield ngx_queue_pop("jobs", 0.1));
+        var_dump(yield ngx_queue_fetch("jobs", null, 0.1));
+    }
+}
+--- request
+GET /t4
+--- response_body
+NULL
+array(0) {
+}
+
+
+
+=== TEST 5: undefined queue
+--- config
+location = /t5 {
+    content_by_php_block {
+        var_dump(@ngx_queue_push("nope", "a"));
+        var_dump(yield @ngx_queue_pop("nope"));
+    }
+}
+--- request
+GET /t5
+--- response_body
+bool(false)
+bool(false)
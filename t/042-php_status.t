@@ -0,0 +1,78 @@
+# vim:set ft= ts=4 sw=4 et fdm=marker:
+
+use Test::Nginx::Socket 'no_plan';
+
+run_tests();
+
+__DATA__
+=== TEST 1: php_status prometheus
+--- config
+location = /t1 {
+    content_by_php_block {
+        echo "hello\n";
+    }
+}
+location = /status {
+    php_status;
+}
+--- pipelined_requests eval
+["GET /t1", "GET /status"]
+--- response_headers eval
+["", "Content-Type: text/plain; version=0.0.4"]
+--- response_body_like eval
+["hello\n", 
+qr/ngx_php_requests_total\{server="localhost",location="\/t1"\} 1\n(.|\n)*ngx_php_phase_seconds_count\{server="localhost",location="\/t1",phase="content"\} 1\n/]
+
+
+
+=== TEST 2: php_status json
+--- config
+location = /t2 {
+    rewrite_by_php_block {
+        yield ngx_msleep(100);
+    }
+    content_by_php_block {
+        echo "hello\n";
+    }
+}
+location = /status {
+    php_status;
+}
+--- pipelined_requests eval
+["GET /t2", "GET /status?format=json"]
+--- response_headers eval
+["", "Content-Type: application/json"]
+--- response_body_like eval
+["hello\n", 
+qr/^\{"locations":\[\{"server":"localhost","location":"\/t2","requests":1,"errors":0,"request":\{"count":1,.*"suspended":\{"count":1,"sum":0\.1\d+,.*"phases":\{"rewrite":\{"count":1,.*"content":\{"count":1,/]
+
+
+
+=== TEST 3: php_status errors
+--- config
+location = /t3 {
+    content_by_php_block {
+        ngx_exit(500);
+    }
+}
+location = /status {
+    php_status;
+}
+--- pipelined_requests eval
+["GET /t3", "GET /status"]
+--- error_code eval
+[500, 200]
+--- response_body_like eval
+[qr/500/, 
+qr/ngx_php_errors_total\{server="localhost",location="\/t3"\} 1\n/]
+
+
+
+=== TEST 4: php_status method not allowed
+--- config
+location = /status {
+    php_status;
+}
+--- request
+POST /status
+--- error_code: 405
@@ -0,0 +1,63 @@
+# vim:set ft= ts=4 sw=4 et fdm=marker:
+
+use Test::Nginx::Socket 'no_plan';
+
+run_tests();
+
+__DATA__
+=== TEST 1: php_profile status
+--- http_config
+php_profile_path logs;
+--- config
+location = /profile {
+    php_profile;
+}
+--- request
+GET /profile
+--- response_body_like
+^running: 0
+generation: 0
+interval: 10ms
+started: 0
+path: .*/logs
+$
+
+
+
+=== TEST 2: php_profile start, stop
+--- http_config
+php_profile_path logs;
+--- config
+location = /profile {
+    php_profile;
+}
+location = /t2 {
+    content_by_php_block {
+        $n = 0;
+        $end = microtime(true) + 0.2;
+        while (microtime(true) < $end) {
+            $n++;
+        }
+        echo "ok\n";
+    }
+}
+--- pipelined_requests eval
+["GET /profile?action=start&interval=1ms", "GET /t2", "GET /profile?action=stop"]
+--- response_body_like eval
+[qr/^running: 1\ngeneration: 1\ninterval: 1ms\n/, "ok\n", qr/^running: 0\ngeneration: 2\n/]
+--- log_level: notice
+--- error_log eval
+["php profile 1 started, every 1ms", qr/php profile 1 stopped, [1-9]\d* samples in \d+ stacks/]
+
+
+
+=== TEST 3: php_profile bad interval
+--- http_config
+php_profile_path logs;
+--- config
+location = /profile {
+    php_profile;
+}
+--- request
+GET /profile?action=start&interval=5s
+--- error_code: 400
@@ -0,0 +1,68 @@
+# vim:set ft= ts=4 sw=4 et fdm=marker:
+
+use Test::Nginx::Socket 'no_plan';
+
+run_tests();
+
+__DATA__
+=== TEST 1: php_slowlog suspended
+--- config
+php_slowlog logs/error.log;
+php_slowlog_timeout 100ms;
+location = /t1 {
+    content_by_php_block {
+        yield ngx_msleep(300);
+        echo "ok\n";
+    }
+}
+--- request
+GET /t1
+--- response_body
+ok
+--- error_log eval
+[qr/pid \d+, GET \/t1, content suspended for \d+ms, sleeping/, 
+qr/^    ngx_content_\w+\(\) ngx_php eval code:\d+$/m]
+
+
+
+=== TEST 2: php_slowlog running
+--- config
+php_slowlog logs/error.log;
+php_slowlog_timeout 100ms;
+location = /t2 {
+    content_by_php_block {
+        function busy() {
+            $end = microtime(true) + 0.3;
+            while (microtime(true) < $end) {
+            }
+        }
+        busy();
+        echo "ok\n";
+    }
+}
+--- request
+GET /t2?a=1
+--- response_body
+ok
+--- error_log eval
+[qr/pid \d+, GET \/t2\?a=1, content running for \d+ms/, 
+qr/^    busy\(\) ngx_php eval code:\d+$/m]
+
+
+
+=== TEST 3: php_slowlog under the timeout
+--- config
+php_slowlog logs/error.log;
+php_slowlog_timeout 1s;
+location = /t3 {
+    content_by_php_block {
+        yield ngx_msleep(10);
+        echo "ok\n";
+    }
+}
+--- request
+GET /t3
+--- response_body
+ok
+--- no_error_log
+suspended for
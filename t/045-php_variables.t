@@ -0,0 +1,63 @@
+# vim:set ft= ts=4 sw=4 et fdm=marker:
+
+use Test::Nginx::Socket 'no_plan';
+
+run_tests();
+
+__DATA__
+=== TEST 1: $php_exec_time, $php_wait_time, $php_yield_count
+--- http_config
+log_format php 'php: exec=$php_exec_time wait=$php_wait_time yields=$php_yield_count compile=$php_compile_time';
+--- config
+location = /t1 {
+    access_log logs/error.log php;
+    content_by_php_block {
+        yield ngx_msleep(100);
+        yield ngx_msleep(100);
+        echo "ok\n";
+    }
+}
+--- request
+GET /t1
+--- response_body
+ok
+--- error_log eval
+qr/php: exec=0\.\d{6} wait=0\.[2-9]\d{5} yields=2 compile=0\.\d{6}/
+
+
+
+=== TEST 2: $php_mem_peak
+--- http_config
+log_format php 'php: mem=$php_mem_peak';
+--- config
+location = /t2 {
+    access_log logs/error.log php;
+    content_by_php_block {
+        $s = str_repeat("x", 1024 * 1024);
+        yield ngx_msleep(1);
+        echo strlen($s), "\n";
+    }
+}
+--- request
+GET /t2
+--- response_body
+1048576
+--- error_log eval
+qr/php: mem=(1[0-9]{6}|[2-9][0-9]{6}|[0-9]{8,})\b/
+
+
+
+=== TEST 3: no php code
+--- http_config
+log_format php 'php: exec=$php_exec_time socket=$php_socket_bytes';
+--- config
+location = /t3 {
+    access_log logs/error.log php;
+    return 200 "ok\n";
+}
+--- request
+GET /t3
+--- response_body
+ok
+--- error_log
+php: exec=- socket=-
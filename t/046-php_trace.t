@@ -0,0 +1,88 @@
+# vim:set ft= ts=4 sw=4 et fdm=marker:
+
+use Test::Nginx::Socket 'no_plan';
+
+run_tests();
+
+__DATA__
+=== TEST 1: php_trace json
+--- config
+location = /t1 {
+    php_trace logs;
+    content_by_php_block {
+        function foo($n) {
+            return $n * 2;
+        }
+        foo(1);
+        foo(2);
+        foo(3);
+        echo "ok\n";
+    }
+}
+location = /check {
+    content_by_php_block {
+        $files = glob(dirname(ngx_request_document_root()) . "/logs/php-trace-*.json");
+        $trace = json_decode(file_get_contents(end($files)), true);
+        echo $trace["uri"], "\n";
+        foreach ($trace["functions"] as $f) {
+            if ($f["name"] == "foo") {
+                echo "foo calls ", $f["calls"], ", ops ", $f["ops"] > 0 ? "yes" : "no", "\n";
+            }
+        }
+        foreach ($trace["edges"] as $e) {
+            if ($e["callee"] == "foo") {
+                echo "caller ", preg_match('/^ngx_content_\w+$/', $e["caller"]), "\n";
+            }
+        }
+        echo "return ", $trace["ops"]["ZEND_RETURN"] >= 3 ? "yes" : "no", "\n";
+    }
+}
+--- pipelined_requests eval
+["GET /t1", "GET /check"]
+--- response_body eval
+["ok\n", "/t1\nfoo calls 3, ops yes\ncaller 1\nreturn yes\n"]
+
+
+
+=== TEST 2: php_trace pprof
+--- config
+location = /t2 {
+    php_trace logs pprof;
+    content_by_php_block {
+        echo strtoupper("ok\n");
+    }
+}
+location = /check {
+    content_by_php_block {
+        $files = glob(dirname(ngx_request_document_root()) . "/logs/php-trace-*.pb");
+        $data = file_get_contents(end($files));
+        echo bin2hex($data[0]), " ", strpos($data, "strtoupper") !== false ? "yes" : "no", "\n";
+    }
+}
+--- pipelined_requests eval
+["GET /t2", "GET /check"]
+--- response_body eval
+["OK\n", "0a yes\n"]
+
+
+
+=== TEST 3: php_trace off
+--- http_config
+php_trace logs;
+--- config
+location = /t3 {
+    php_trace off;
+    content_by_php_block {
+        echo "ok\n";
+    }
+}
+location = /check {
+    php_trace off;
+    content_by_php_block {
+        echo count(glob(dirname(ngx_request_document_root()) . "/logs/php-trace-*")), "\n";
+    }
+}
+--- pipelined_requests eval
+["GET /t3", "GET /check"]
+--- response_body eval
+["ok\n", "0\n"]
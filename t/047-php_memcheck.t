@@ -0,0 +1,64 @@
+# vim:set ft= ts=4 sw=4 et fdm=marker:
+
+use Test::Nginx::Socket 'no_plan';
+
+run_tests();
+
+__DATA__
+=== TEST 1: php_memcheck window
+--- config
+location = /t1 {
+    php_memcheck logs/memcheck1.log window=2;
+    content_by_php_block {
+        $a = str_repeat("x", 1024);
+        echo "ok\n";
+    }
+}
+location = /check {
+    content_by_php_block {
+        echo file_get_contents(dirname(ngx_request_document_root()) . "/logs/memcheck1.log");
+    }
+}
+--- pipelined_requests eval
+["GET /t1", "GET /t1", "GET /check"]
+--- response_body_like eval
+["ok\n", "ok\n", qr/^\[.+\] pid \d+, 2 requests, heap \d+ bytes at rest \(\+0\), request pool up to \d+ bytes and \d+ large\n$/]
+
+
+
+=== TEST 2: php_memcheck growing heap
+--- config
+location = /t2 {
+    php_memcheck logs/memcheck2.log window=1;
+    content_by_php_block {
+        $GLOBALS["leak"][] = str_repeat("x", 1024);
+        echo "ok\n";
+    }
+}
+location = /check {
+    content_by_php_block {
+        echo file_get_contents(dirname(ngx_request_document_root()) . "/logs/memcheck2.log");
+    }
+}
+--- pipelined_requests eval
+["GET /t2", "GET /t2", "GET /t2", "GET /t2", "GET /t2", "GET /t2", "GET /check"]
+--- response_body_like eval
+["ok\n", "ok\n", "ok\n", "ok\n", "ok\n", "ok\n", 
+qr/ growing for 5 windows: [\d.]+ bytes per request, last GET \/t2\n$/]
+--- error_log
+php heap grew for 5 windows of 1 requests in a row
+
+
+
+=== TEST 3: php_memcheck off
+--- config
+location = /t3 {
+    php_memcheck off;
+    content_by_php_block {
+        echo "ok\n";
+    }
+}
+--- request
+GET /t3
+--- response_body
+ok
@@ -0,0 +1,111 @@
+# vim:set ft= ts=4 sw=4 et fdm=marker:
+
+use Test::Nginx::Socket 'no_plan';
+
+run_tests();
+
+__DATA__
+=== TEST 1: php_preload on
+inline code compiled at configuration time, the other location's too
+--- http_config
+php_preload on;
+--- config
+location = /t1 {
+    set $preload "";
+    rewrite_by_php_block {
+        ngx_var::set("preload", "rewrite");
+    }
+    content_by_php_block {
+        echo ngx_var::get("preload"), "\n";
+        $n = 0;
+        foreach (get_defined_functions()["user"] as $name) {
+            if (strncmp($name, "ngx_content_", 12) == 0) {
+                $n++;
+            }
+        }
+        echo $n, "\n";
+    }
+}
+location = /never {
+    content_by_php_block {
+        echo "never requested\n";
+    }
+}
+--- request
+GET /t1
+--- response_body
+rewrite
+2
+
+
+
+=== TEST 2: php_preload file
+functions and classes of the preload file
+--- user_files
+>>> preload.php
+<?php
+function preloaded_hello($name) {
+    return "hello " . $name;
+}
+class PreloadedCounter {
+    public static $n = 0;
+    public static function next() {
+        return ++self::$n;
+    }
+}
+--- http_config
+php_preload $TEST_NGINX_HTML_DIR/preload.php;
+--- config
+location = /t2 {
+    content_by_php_block {
+        echo preloaded_hello("ngx_php"), "\n";
+        echo PreloadedCounter::next(), "\n";
+    }
+}
+--- request
+GET /t2
+--- response_body
+hello ngx_php
+1
+
+
+
+=== TEST 3: php_preload with init_worker_by_php_block
+the worker init code runs after the preload
+--- user_files
+>>> preload.php
+<?php
+function preloaded_value() {
+    return "preloaded";
+}
+--- http_config
+php_preload $TEST_NGINX_HTML_DIR/preload.php;
+init_worker_by_php_block {
+    define('PRELOADED', preloaded_value());
+}
+--- config
+location = /t3 {
+    content_by_php_block {
+        echo PRELOADED, "\n";
+    }
+}
+--- request
+GET /t3
+--- response_body
+preloaded
+
+
+
+=== TEST 4: php_preload syntax error
+a syntax error in an inline block fails the configuration
+--- http_config
+php_preload on;
+--- config
+location = /t4 {
+    content_by_php_block {
+        echo "missing semicolon"
+    }
+}
+--- must_die
+--- error_log
+php_preload failed to compile the inline code
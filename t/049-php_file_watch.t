@@ -0,0 +1,105 @@
+# vim:set ft= ts=4 sw=4 et fdm=marker:
+
+use Test::Nginx::Socket 'no_plan';
+
+run_tests();
+
+__DATA__
+=== TEST 1: php_file_watch on
+a changed script runs without a reload, opcache does not check its timestamp
+--- user_files
+>>> watch.php
+<?php
+echo "version 1\n";
+--- http_config
+php_ini_path $TEST_NGINX_BUILD_DIR/.github/ngx-php/php/php.ini;
+php_file_watch on;
+--- config
+location = /t1 {
+    content_by_php_file $TEST_NGINX_HTML_DIR/watch.php;
+}
+location = /deploy {
+    content_by_php_block {
+        $file = ngx_request_document_root() . "/watch.php";
+        file_put_contents($file . ".tmp", "<?php\necho \"version 2\\n\";\n");
+        rename($file . ".tmp", $file);
+        yield ngx_msleep(100);
+        /* without opcache, there is nothing stale to test */
+        echo function_exists("opcache_get_status") && opcache_get_status() 
+            ? "deployed\n" : "no opcache\n";
+    }
+}
+--- pipelined_requests eval
+["GET /t1", "GET /deploy", "GET /t1"]
+--- response_body eval
+["version 1\n", "deployed\n", "version 2\n"]
+
+
+
+=== TEST 2: php_file_watch directory
+a changed include in a subdirectory of the watched one
+--- user_files
+>>> watch2.php
+<?php
+echo (include __DIR__ . "/lib/inc.php"), "\n";
+>>> lib/inc.php
+<?php
+return "inc 1";
+--- http_config
+php_ini_path $TEST_NGINX_BUILD_DIR/.github/ngx-php/php/php.ini;
+php_file_watch $TEST_NGINX_HTML_DIR;
+--- config
+location = /t2 {
+    content_by_php_file $TEST_NGINX_HTML_DIR/watch2.php;
+}
+location = /deploy {
+    content_by_php_block {
+        file_put_contents(ngx_request_document_root() . "/lib/inc.php", 
+            "<?php\nreturn \"inc 2\";\n");
+        yield ngx_msleep(100);
+        /* without opcache, there is nothing stale to test */
+        echo function_exists("opcache_get_status") && opcache_get_status() 
+            ? "deployed\n" : "no opcache\n";
+    }
+}
+--- pipelined_requests eval
+["GET /t2", "GET /deploy", "GET /t2"]
+--- response_body eval
+["inc 1\n", "deployed\n", "inc 2\n"]
+--- no_error_log
+[error]
+
+
+
+=== TEST 3: php_file_watch include out of the watched directories
+the directory of a compiled include is watched too
+--- user_files
+>>> watch3.php
+<?php
+echo (include __DIR__ . "/other/inc.php"), "\n";
+>>> other/inc.php
+<?php
+return "other 1";
+--- http_config
+php_ini_path $TEST_NGINX_BUILD_DIR/.github/ngx-php/php/php.ini;
+php_file_watch on;
+--- config
+location = /t3 {
+    content_by_php_file $TEST_NGINX_HTML_DIR/watch3.php;
+}
+location = /deploy {
+    content_by_php_block {
+        file_put_contents(ngx_request_document_root() . "/other/inc.php", 
+            "<?php\nreturn \"other 2\";\n");
+        yield ngx_msleep(100);
+        /* without opcache, there is nothing stale to test */
+        echo function_exists("opcache_get_status") && opcache_get_status() 
+            ? "deployed\n" : "no opcache\n";
+    }
+}
+--- pipelined_requests eval
+["GET /t3", "GET /deploy", "GET /t3"]
+--- response_body eval
+["other 1\n", "deployed\n", "other 2\n"]
+--- no_error_log
+[error]
@@ -0,0 +1,50 @@
+#!/bin/bash
+
+# Runs the tests of t/ with php_memcheck for a soak of requests each and 
+# fails when the php heap of a worker keeps growing.
+#
+#   SOAK_REQUESTS=1000000 SOAK_CONCURRENCY=2 utils/soak.sh [t/001-hello.t ...]
+
+SOAK_REQUESTS=${SOAK_REQUESTS:-1000000}
+SOAK_CONCURRENCY=${SOAK_CONCURRENCY:-2}
+SOAK_WINDOW=${SOAK_WINDOW:-10000}
+
+root=$(cd "$(dirname "$0")/.." && pwd)
+dir=$(mktemp -d /tmp/ngx_php_soak.XXXXXX)
+
+if [[ $# -eq 0 ]]; then
+    set -- "$root"/t/*.t
+fi
+
+mkdir -p "$dir/t"
+cp -r "$root/t/lib" "$dir/t/"
+
+failed=0
+
+for test in "$@"
+do
+    name=$(basename "$test" .t)
+    log="$dir/$name.log"
+
+    # the config of each block goes in a server, so does php_memcheck
+    sed -e "s|^--- config\$|&\nphp_memcheck $log window=$SOAK_WINDOW;|" \
+        "$test" > "$dir/t/$name.t"
+
+    echo "$name: $SOAK_REQUESTS requests, concurrency $SOAK_CONCURRENCY"
+
+    (cd "$dir" && TEST_NGINX_BENCHMARK="$SOAK_REQUESTS $SOAK_CONCURRENCY" \
+        prove "t/$name.t") || failed=1
+
+    if grep -q "growing" "$log" 2>/dev/null; then
+        grep "growing" "$log"
+        failed=1
+    fi
+done
+
+if [[ $failed -ne 0 ]]; then
+    echo "soak failed, logs in $dir"
+    exit 1
+fi
+
+rm -rf "$dir"
+echo "soak passed"